@@ -48,11 +48,14 @@
 
 #define STATIC_ASSERT(COND,MSG) typedef char static_assertion_##MSG[(COND)?1:-1]
 
+STATIC_ASSERT(BLACKBOX_DELTA_BUFFER_SIZE <= ULINK_MAX_PAYLOAD_SIZE, blackbox_frame_fits_in_ulink_frame);
+
 void blackbox_init(struct blackbox *self, const struct config * config, const struct system_calls *system){
 	memset(self, 0, sizeof(*self));
 	self->cur_frame = self->buffers[0];
 	self->prev_frame = self->buffers[1];
 	self->state_queue = xQueueCreate(1, sizeof(struct blackbox_frame));
+	ulink_ring_init(&self->out, self->out_buffer, sizeof(self->out_buffer));
 	self->config = config;
 	self->system = system;
 }
@@ -66,23 +69,27 @@ void blackbox_flush(struct blackbox *self){
 
 	int16_t size = delta_encode(self->prev_frame, self->cur_frame, sizeof(struct blackbox_frame), self->delta_buffer, sizeof(self->delta_buffer));
 
-	if(size > 0){
-		struct ulink_frame frame;
-		ulink_frame_init(&frame);
-		ulink_pack_data(self->delta_buffer, size, &frame);
-
-		// write all data until we are done
-		size_t idx = 0;
-		while(idx < ulink_frame_size(&frame)){
-			int ret = sys_logger_write(self->system, (char*)ulink_frame_data(&frame) + idx, ulink_frame_size(&frame) - idx);
-			if(ret <= 0){
-				// we failed. Maybe set an error flag.
-				break;
-			}
-			idx += ret;
-		}
+	bool dropped = false;
+	if(size > 0 && ulink_encode(&self->out, self->delta_buffer, size) < 0){
+		// logger is behind and still has the previous frame pending
+		self->dropped_frames++;
+		dropped = true;
+	}
+
+	// write out as much as the logger takes, the rest is retried on the next flush
+	const void *data;
+	size_t len;
+	while((len = ulink_ring_peek(&self->out, &data)) > 0){
+		int ret = sys_logger_write(self->system, data, len);
+		if(ret <= 0)
+			break;
+		ulink_ring_consume(&self->out, ret);
 	}
 
+	// the next frame has to be a delta against the last frame that made it into the log
+	if(dropped)
+		return;
+
 	// swap buffers
 	uint8_t *tmp = self->cur_frame;
 	self->cur_frame = self->prev_frame;
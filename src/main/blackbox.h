@@ -22,6 +22,7 @@
 #include "common/packer.h"
 #include "common/axis.h"
 #include "common/pt.h"
+#include "common/ulink.h"
 
 struct blackbox_frame_header {
 	uint8_t flags;
@@ -50,10 +51,18 @@ struct blackbox_frame {
 	uint16_t rssi;
 } __attribute__((__packed__));
 
+#define BLACKBOX_DELTA_BUFFER_SIZE (sizeof(struct blackbox_frame) + sizeof(struct blackbox_frame) / 2)
+//! room for one fully escaped frame plus crc and frame byte
+#define BLACKBOX_OUT_BUFFER_SIZE (2 * (BLACKBOX_DELTA_BUFFER_SIZE + 2) + 1)
+
 struct blackbox {
 	uint8_t *cur_frame, *prev_frame;
 	uint8_t buffers[2][sizeof(struct blackbox_frame)];
-	uint8_t delta_buffer[sizeof(struct blackbox_frame) + sizeof(struct blackbox_frame) / 2];
+	uint8_t delta_buffer[BLACKBOX_DELTA_BUFFER_SIZE];
+	//! encoded frames waiting for the logger, holds on to data the logger could not take yet
+	uint8_t out_buffer[BLACKBOX_OUT_BUFFER_SIZE];
+	struct ulink_ring out;
+	uint32_t dropped_frames;
 
 	QueueHandle_t state_queue;
 	const struct config *config;
@@ -496,7 +496,7 @@ void blackboxDeviceFlush(void)
          * devices will progressively write in the background without Blackbox calling anything.
          */
         case BLACKBOX_DEVICE_FLASH:
-            flashfsFlushAsync();
+            flashfsUpdate();
         break;
 #endif
 
@@ -591,6 +591,8 @@ bool blackboxDeviceOpen(void)
 
             blackboxMaxHeaderBytesPerIteration = BLACKBOX_TARGET_HEADER_BUDGET_PER_ITERATION;
 
+            flashfsSetLogging(true);
+
             return true;
         break;
 #endif
@@ -629,6 +631,11 @@ void blackboxDeviceClose(void)
                 mspSerialAllocatePorts();
             }
         break;
+#ifdef USE_FLASHFS
+        case BLACKBOX_DEVICE_FLASH:
+            flashfsSetLogging(false);
+        break;
+#endif
         default:
             ;
     }
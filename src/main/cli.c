@@ -48,6 +48,7 @@
 #include <strings.h>
 #include <math.h>
 #include <ctype.h>
+#include <errno.h>
 
 #include <platform.h>
 #include "version.h"
@@ -59,6 +60,7 @@
 #include "common/maths.h"
 #include "common/color.h"
 #include "common/typeconversion.h"
+#include "common/crc.h"
 
 #include "config/tilt.h"
 #include "config/gimbal.h"
@@ -73,7 +75,12 @@
 #include "drivers/bus_i2c.h"
 #include "drivers/pwm_rx.h"
 #include "drivers/sdcard.h"
+#include "drivers/asyncfatfs/asyncfatfs.h"
 #include "drivers/pwm_output.h"
+#ifdef USE_DSHOT
+#include "drivers/pwm_mapping.h"
+#include "drivers/dshot.h"
+#endif
 #include "common/buf_writer.h"
 
 #include "flight/rate_profile.h"
@@ -123,10 +130,14 @@ static void cliDump(struct cli *self, char *cmdLine);
 static void cliExit(struct cli *self, char *cmdline);
 static void cliFeature(struct cli *self, char *cmdline);
 static void cliMotor(struct cli *self, char *cmdline);
+#ifdef USE_DSHOT
+static void cliDshot(struct cli *self, char *cmdline);
+#endif
 static void cliPlaySound(struct cli *self, char *cmdline);
 static void cliProfile(struct cli *self, char *cmdline);
 static void cliRateProfile(struct cli *self, char *cmdline);
 static void cliReboot(struct cli *self);
+static void cliRestore(struct cli *self, char *cmdline);
 static void cliSave(struct cli *self, char *cmdline);
 static void cliSerial(struct cli *self, char *cmdline);
 
@@ -252,7 +263,11 @@ const clicmd_t cmdTable[] = {
 #endif
     CLI_COMMAND_DEF("defaults", "reset to defaults and reboot", NULL, cliDefaults),
     CLI_COMMAND_DEF("dump", "dump configuration",
-        "[master|profile|rates]", cliDump),
+        "[master|profile|rates|binary]", cliDump),
+#ifdef USE_DSHOT
+    CLI_COMMAND_DEF("dshot", "send a command to dshot escs",
+        "<index|all> <beep1-5|normal|reversed|save|0-47>", cliDshot),
+#endif
     CLI_COMMAND_DEF("exit", NULL, NULL, cliExit),
     CLI_COMMAND_DEF("feature", "configure features",
         "list\r\n"
@@ -295,6 +310,8 @@ const clicmd_t cmdTable[] = {
         "[<index>]", cliProfile),
     CLI_COMMAND_DEF("rateprofile", "change rate profile",
         "[<index>]", cliRateProfile),
+    CLI_COMMAND_DEF("restore", "restore binary config dump",
+        "<size> <crc32>", cliRestore),
     CLI_COMMAND_DEF("rxrange", "configure rx channel ranges", NULL, cliRxRange),
     CLI_COMMAND_DEF("rxfail", "show/set rx failsafe settings", NULL, cliRxFail),
     CLI_COMMAND_DEF("save", "save and reboot", NULL, cliSave),
@@ -377,6 +394,16 @@ static const char * const lookupTableSerialRX[] = {
     "IBUS"
 };
 
+static const char * const lookupTableMixerDesat[] = {
+    "AIRMODE", "THROTTLE", "ATTITUDE"
+};
+
+#ifdef USE_DSHOT
+static const char * const lookupTableMotorProtocol[] = {
+    "PWM", "DSHOT150", "DSHOT300", "DSHOT600"
+};
+#endif
+
 static const char * const lookupTableGyroFilter[] = {
     "OFF", "LOW", "MEDIUM", "HIGH"
 };
@@ -408,6 +435,10 @@ typedef enum {
     TABLE_SERIAL_RX,
     TABLE_GYRO_FILTER,
     TABLE_GYRO_LPF,
+    TABLE_MIXER_DESAT,
+#ifdef USE_DSHOT
+    TABLE_MOTOR_PROTOCOL,
+#endif
 } lookupTableIndex_e;
 
 static const lookupTableEntry_t lookupTables[] = {
@@ -423,6 +454,10 @@ static const lookupTableEntry_t lookupTables[] = {
     { lookupTableSerialRX, sizeof(lookupTableSerialRX) / sizeof(char *) },
     { lookupTableGyroFilter, sizeof(lookupTableGyroFilter) / sizeof(char *) },
     { lookupTableGyroLpf, sizeof(lookupTableGyroLpf) / sizeof(char *) },
+    { lookupTableMixerDesat, sizeof(lookupTableMixerDesat) / sizeof(char *) },
+#ifdef USE_DSHOT
+    { lookupTableMotorProtocol, sizeof(lookupTableMotorProtocol) / sizeof(char *) },
+#endif
 };
 
 #define VALUE_TYPE_OFFSET 0
@@ -511,6 +546,10 @@ const clivalue_t valueTable[] = {
     { "servo_center_pulse",         VAR_UINT16 | MASTER_VALUE, .config.minmax = { PWM_RANGE_ZERO,  PWM_RANGE_MAX } ,	CPATH(pwm_out.servoCenterPulse)},
     { "motor_pwm_rate",             VAR_UINT16 | MASTER_VALUE, .config.minmax = { 50,  32000 } ,						CPATH(pwm_out.motor_pwm_rate)},
     { "servo_pwm_rate",             VAR_UINT16 | MASTER_VALUE, .config.minmax = { 50,  498 } ,							CPATH(pwm_out.servo_pwm_rate)},
+#ifdef USE_DSHOT
+    { "motor_protocol",             VAR_UINT8  | MASTER_VALUE | MODE_LOOKUP, .config.lookup = { TABLE_MOTOR_PROTOCOL } ,	CPATH(pwm_out.motor_protocol)},
+#endif
+    { "motor_poles",                VAR_UINT8  | MASTER_VALUE, .config.minmax = { 2,  40 } ,							CPATH(pwm_out.motor_poles)},
 
 
     { "3d_deadband_low",            VAR_UINT16 | MASTER_VALUE, .config.minmax = { PWM_RANGE_ZERO,  PWM_RANGE_MAX } ,	CPATH(motor_3d.deadband3d_low)}, // FIXME upper limit should match code in the mixer, 1500 currently
@@ -552,6 +591,11 @@ const clivalue_t valueTable[] = {
 
     { "telemetry_switch",           VAR_UINT8  | MASTER_VALUE | MODE_LOOKUP, .config.lookup = { TABLE_OFF_ON } ,		CPATH(telemetry.telemetry_switch)},
     { "telemetry_inversion",        VAR_UINT8  | MASTER_VALUE | MODE_LOOKUP, .config.lookup = { TABLE_OFF_ON } ,		CPATH(telemetry.telemetry_inversion)},
+    { "mavlink_sysid",              VAR_UINT8  | MASTER_VALUE, .config.minmax = { 1,  255 } ,							CPATH(telemetry.mavlink_sysid)},
+    { "mavlink_rate_att",           VAR_UINT8  | MASTER_VALUE, .config.minmax = { 0,  50 } ,							CPATH(telemetry.mavlink_rate_att)},
+    { "mavlink_rate_imu",           VAR_UINT8  | MASTER_VALUE, .config.minmax = { 0,  50 } ,							CPATH(telemetry.mavlink_rate_imu)},
+    { "mavlink_rate_srv",           VAR_UINT8  | MASTER_VALUE, .config.minmax = { 0,  50 } ,							CPATH(telemetry.mavlink_rate_servo)},
+    { "mavlink_rate_pos",           VAR_UINT8  | MASTER_VALUE, .config.minmax = { 0,  50 } ,							CPATH(telemetry.mavlink_rate_pos)},
 
     { "frsky_default_lattitude",    VAR_FLOAT  | MASTER_VALUE, .config.minmax = { -90.0,  90.0 } ,						CPATH(frsky.gpsNoFixLatitude)},
     { "frsky_default_longitude",    VAR_FLOAT  | MASTER_VALUE, .config.minmax = { -180.0,  180.0 } ,					CPATH(frsky.gpsNoFixLongitude)},
@@ -582,6 +626,9 @@ const clivalue_t valueTable[] = {
     { "gyro_lpf",                   VAR_UINT8  | MASTER_VALUE | MODE_LOOKUP, .config.lookup = { TABLE_GYRO_LPF } ,		CPATH(gyro.gyro_lpf)},
     { "gyro_soft_lpf",              VAR_UINT16 | MASTER_VALUE, .config.minmax = { 0,  500 } ,							CPATH(gyro.soft_gyro_lpf_hz)},
     { "move_threshold",             VAR_UINT8  | MASTER_VALUE, .config.minmax = { 0,  128 } ,							CPATH(gyro.move_threshold)},
+    { "gyro_rpm_notch_harmonics",   VAR_UINT8  | MASTER_VALUE, .config.minmax = { 0,  3 } ,							CPATH(gyro.rpm_notch_harmonics)},
+    { "gyro_rpm_notch_min_hz",      VAR_UINT8  | MASTER_VALUE, .config.minmax = { 50,  200 } ,							CPATH(gyro.rpm_notch_min_hz)},
+    { "gyro_rpm_notch_q",           VAR_UINT16 | MASTER_VALUE, .config.minmax = { 100,  1000 } ,						CPATH(gyro.rpm_notch_q)},
 
     { "alt_hold_deadband",          VAR_UINT8  | PROFILE_VALUE, .config.minmax = { 1,  250 } ,							PPATH(rc.alt_hold_deadband)},
     { "alt_hold_fast_change",       VAR_UINT8  | PROFILE_VALUE | MODE_LOOKUP, .config.lookup = { TABLE_OFF_ON } ,		PPATH(rc.alt_hold_fast_change)},
@@ -601,6 +648,10 @@ const clivalue_t valueTable[] = {
     { "tri_unarmed_servo",          VAR_INT8   | MASTER_VALUE | MODE_LOOKUP, .config.lookup = { TABLE_OFF_ON } ,		CPATH(mixer.tri_unarmed_servo)},
     { "servo_lowpass_freq",         VAR_FLOAT  | MASTER_VALUE, .config.minmax = { 10,  400} ,							CPATH(mixer.servo_lowpass_freq)},
     { "servo_lowpass_enable",       VAR_INT8   | MASTER_VALUE | MODE_LOOKUP, .config.lookup = { TABLE_OFF_ON } ,		CPATH(mixer.servo_lowpass_enable)},
+    { "mixer_desat_mode",           VAR_UINT8  | MASTER_VALUE | MODE_LOOKUP, .config.lookup = { TABLE_MIXER_DESAT } ,	CPATH(mixer.desat_mode)},
+    { "thrust_linear",              VAR_UINT8  | MASTER_VALUE, .config.minmax = { 0,  100 } ,								CPATH(mixer.thrust_linear)},
+
+    { "led_gamma",                  VAR_UINT8  | MASTER_VALUE | MODE_LOOKUP, .config.lookup = { TABLE_OFF_ON } ,		CPATH(ledstrip.gamma)},
 
     { "default_rate_profile",       VAR_UINT8  | PROFILE_VALUE , .config.minmax = { 0,  MAX_CONTROL_RATE_PROFILE_COUNT - 1 } , PPATH(rate.profile_id)},
 
@@ -614,6 +665,26 @@ const clivalue_t valueTable[] = {
     { "yaw_rate",                   VAR_UINT8  | CONTROL_RATE_VALUE, .config.minmax = { 0,  CONTROL_RATE_CONFIG_YAW_RATE_MAX } ,				RPATH(rates[YAW])},
     { "tpa_rate",                   VAR_UINT8  | CONTROL_RATE_VALUE, .config.minmax = { 0,  CONTROL_RATE_CONFIG_TPA_MAX} ,						RPATH(dynThrPID)},
     { "tpa_breakpoint",             VAR_UINT16 | CONTROL_RATE_VALUE, .config.minmax = { PWM_RANGE_MIN,  PWM_RANGE_MAX} ,						RPATH(tpa_breakpoint)},
+    { "tpa_thr_1",                  VAR_UINT16 | CONTROL_RATE_VALUE, .config.minmax = { PWM_RANGE_MIN,  PWM_RANGE_MAX} ,						RPATH(tpa_curve_throttle[0])},
+    { "tpa_thr_2",                  VAR_UINT16 | CONTROL_RATE_VALUE, .config.minmax = { PWM_RANGE_MIN,  PWM_RANGE_MAX} ,						RPATH(tpa_curve_throttle[1])},
+    { "tpa_thr_3",                  VAR_UINT16 | CONTROL_RATE_VALUE, .config.minmax = { PWM_RANGE_MIN,  PWM_RANGE_MAX} ,						RPATH(tpa_curve_throttle[2])},
+    { "tpa_thr_4",                  VAR_UINT16 | CONTROL_RATE_VALUE, .config.minmax = { PWM_RANGE_MIN,  PWM_RANGE_MAX} ,						RPATH(tpa_curve_throttle[3])},
+    { "tpa_thr_5",                  VAR_UINT16 | CONTROL_RATE_VALUE, .config.minmax = { PWM_RANGE_MIN,  PWM_RANGE_MAX} ,						RPATH(tpa_curve_throttle[4])},
+    { "tpa_roll_1",                 VAR_UINT8  | CONTROL_RATE_VALUE, .config.minmax = { 0,  200 } ,						RPATH(tpa_curve[0][0])},
+    { "tpa_roll_2",                 VAR_UINT8  | CONTROL_RATE_VALUE, .config.minmax = { 0,  200 } ,						RPATH(tpa_curve[0][1])},
+    { "tpa_roll_3",                 VAR_UINT8  | CONTROL_RATE_VALUE, .config.minmax = { 0,  200 } ,						RPATH(tpa_curve[0][2])},
+    { "tpa_roll_4",                 VAR_UINT8  | CONTROL_RATE_VALUE, .config.minmax = { 0,  200 } ,						RPATH(tpa_curve[0][3])},
+    { "tpa_roll_5",                 VAR_UINT8  | CONTROL_RATE_VALUE, .config.minmax = { 0,  200 } ,						RPATH(tpa_curve[0][4])},
+    { "tpa_pitch_1",                VAR_UINT8  | CONTROL_RATE_VALUE, .config.minmax = { 0,  200 } ,						RPATH(tpa_curve[1][0])},
+    { "tpa_pitch_2",                VAR_UINT8  | CONTROL_RATE_VALUE, .config.minmax = { 0,  200 } ,						RPATH(tpa_curve[1][1])},
+    { "tpa_pitch_3",                VAR_UINT8  | CONTROL_RATE_VALUE, .config.minmax = { 0,  200 } ,						RPATH(tpa_curve[1][2])},
+    { "tpa_pitch_4",                VAR_UINT8  | CONTROL_RATE_VALUE, .config.minmax = { 0,  200 } ,						RPATH(tpa_curve[1][3])},
+    { "tpa_pitch_5",                VAR_UINT8  | CONTROL_RATE_VALUE, .config.minmax = { 0,  200 } ,						RPATH(tpa_curve[1][4])},
+    { "tpa_yaw_1",                  VAR_UINT8  | CONTROL_RATE_VALUE, .config.minmax = { 0,  200 } ,						RPATH(tpa_curve[2][0])},
+    { "tpa_yaw_2",                  VAR_UINT8  | CONTROL_RATE_VALUE, .config.minmax = { 0,  200 } ,						RPATH(tpa_curve[2][1])},
+    { "tpa_yaw_3",                  VAR_UINT8  | CONTROL_RATE_VALUE, .config.minmax = { 0,  200 } ,						RPATH(tpa_curve[2][2])},
+    { "tpa_yaw_4",                  VAR_UINT8  | CONTROL_RATE_VALUE, .config.minmax = { 0,  200 } ,						RPATH(tpa_curve[2][3])},
+    { "tpa_yaw_5",                  VAR_UINT8  | CONTROL_RATE_VALUE, .config.minmax = { 0,  200 } ,						RPATH(tpa_curve[2][4])},
 
     { "failsafe_delay",             VAR_UINT8  | MASTER_VALUE, .config.minmax = { 0,  200 } ,								CPATH(failsafe.failsafe_delay)},
     { "failsafe_off_delay",         VAR_UINT8  | MASTER_VALUE, .config.minmax = { 0,  200 } ,								CPATH(failsafe.failsafe_off_delay)},
@@ -636,8 +707,9 @@ const clivalue_t valueTable[] = {
 
     { "baro_tab_size",              VAR_UINT8  | PROFILE_VALUE, .config.minmax = { 0,  BARO_SAMPLE_COUNT_MAX } ,			PPATH(baro.baro_sample_count)},
     { "baro_noise_lpf",             VAR_FLOAT  | PROFILE_VALUE, .config.minmax = { 0 , 1 } ,								PPATH(baro.baro_noise_lpf)},
-    { "baro_cf_vel",                VAR_FLOAT  | PROFILE_VALUE, .config.minmax = { 0 , 1 } ,								PPATH(baro.baro_cf_vel)},
-    { "baro_cf_alt",                VAR_FLOAT  | PROFILE_VALUE, .config.minmax = { 0 , 1 } ,								PPATH(baro.baro_cf_alt)},
+    { "alt_acc_noise",              VAR_UINT16 | PROFILE_VALUE, .config.minmax = { 1 , 1000 } ,								PPATH(baro.alt_acc_noise)},
+    { "alt_baro_noise",             VAR_UINT16 | PROFILE_VALUE, .config.minmax = { 1 , 1000 } ,								PPATH(baro.alt_baro_noise)},
+    { "alt_sonar_noise",            VAR_UINT16 | PROFILE_VALUE, .config.minmax = { 1 , 1000 } ,								PPATH(baro.alt_sonar_noise)},
 
     { "baro_hardware",              VAR_UINT8  | MASTER_VALUE, .config.minmax = { 0,  BARO_MAX } ,							CPATH(sensors.selection.baro_hardware)},
 
@@ -668,6 +740,7 @@ const clivalue_t valueTable[] = {
 
     { "yaw_p_limit",                VAR_UINT16 | PROFILE_VALUE, .config.minmax = { YAW_P_LIMIT_MIN, YAW_P_LIMIT_MAX } ,		PPATH(pid.yaw_p_limit)},
     { "dterm_cut_hz",               VAR_UINT16 | PROFILE_VALUE, .config.minmax = {0, 500 } ,								PPATH(pid.dterm_cut_hz)},
+    { "angle_loop_div",             VAR_UINT8  | PROFILE_VALUE, .config.minmax = {1, 16 } ,								PPATH(pid.angle_loop_div)},
 
     { "gtune_loP_rll",              VAR_UINT8  | PROFILE_VALUE, .config.minmax = { 10,  200 } ,								PPATH(gtune.gtune_lolimP[FD_ROLL])},
     { "gtune_loP_ptch",             VAR_UINT8  | PROFILE_VALUE, .config.minmax = { 10,  200 } ,								PPATH(gtune.gtune_lolimP[FD_PITCH])},
@@ -692,6 +765,57 @@ const clivalue_t valueTable[] = {
     { "magzero_z",                  VAR_INT16  | MASTER_VALUE, .config.minmax = { -32768,  32767 } ,						CPATH(sensors.trims.magZero.raw[Z])},
 };
 
+#define VALUE_COUNT ARRAYLEN(valueTable)
+
+// valueTable stays grouped by subsystem so that dumps remain readable. Name
+// lookups go through this index which is sorted by name once at init so that
+// set does a binary search instead of comparing against every entry.
+static uint16_t valueIndex[VALUE_COUNT];
+static bool valueIndexReady = false;
+
+static void cliBuildValueIndex(void)
+{
+	if(valueIndexReady)
+		return;
+	// insertion sort, runs once and the table is small
+	for(uint16_t c = 0; c < VALUE_COUNT; c++){
+		uint16_t j = c;
+		while(j > 0 && strcasecmp(valueTable[valueIndex[j - 1]].name, valueTable[c].name) > 0){
+			valueIndex[j] = valueIndex[j - 1];
+			j--;
+		}
+		valueIndex[j] = c;
+	}
+	valueIndexReady = true;
+}
+
+//! compares first len chars of name against a full table entry name
+static int cliCompareValueName(const char *name, size_t len, const char *entry)
+{
+	int cmp = strncasecmp(name, entry, len);
+	if(cmp == 0 && entry[len] != '\0')
+		return -1; // name is a prefix of entry and thus sorts before it
+	return cmp;
+}
+
+//! finds variable with exact name match (first len chars of name). Returns NULL if not found.
+static const clivalue_t *cliFindValue(const char *name, size_t len)
+{
+	int lo = 0, hi = VALUE_COUNT - 1;
+	while(lo <= hi){
+		int mid = (lo + hi) >> 1;
+		const clivalue_t *val = &valueTable[valueIndex[mid]];
+		int cmp = cliCompareValueName(name, len, val->name);
+		if(cmp == 0)
+			return val;
+		if(cmp < 0)
+			hi = mid - 1;
+		else
+			lo = mid + 1;
+	}
+	return NULL;
+}
+
 typedef union {
     int32_t int_value;
     float float_value;
@@ -1735,10 +1859,10 @@ static void cliServoMix(struct cli *self, char *cmdline)
 
 #ifdef USE_SDCARD
 
-static void cliWriteBytes(const uint8_t *buffer, int count)
+static void cliWriteBytes(struct cli *self, const uint8_t *buffer, int count)
 {
     while (count > 0) {
-        cliWrite(*buffer);
+        cliWrite(self, *buffer);
         buffer++;
         count--;
     }
@@ -1771,13 +1895,23 @@ static void cliSdInfo(struct cli *self, char *cmdline)
         metadata->productRevisionMinor
     );
 
-    cliWriteBytes((uint8_t*)metadata->productName, sizeof(metadata->productName));
+    cliWriteBytes(self, (uint8_t*)metadata->productName, sizeof(metadata->productName));
 
     cliPrint(self, "'\r\n" "Filesystem: ");
 
     switch (afatfs_getFilesystemState()) {
-        case AFATFS_FILESYSTEM_STATE_READY:
-            cliPrint(self, "Ready");
+        case AFATFS_FILESYSTEM_STATE_READY: {
+            afatfsStatistics_t stats;
+
+            afatfs_getStatistics(&stats);
+
+            cliPrint(self, "Ready\r\n");
+            cliPrintf(self, "Cache: hits=%u, misses=%u, readAhead=%u/%u, fullStalls=%u, busyPolls=%u/%u, dirtyMax=%u\r\n",
+                stats.cacheHits, stats.cacheMisses, stats.readAheadHits, stats.readAheads,
+                stats.cacheFullStalls, stats.cardBusyPolls, stats.polls, stats.dirtyHighWater);
+            cliPrintf(self, "Writes: bursts=%u, burstSectors=%u, deferrals=%u\r\n",
+                stats.writeBursts, stats.writeBurstSectors, stats.writeDeferrals);
+        }
         break;
         case AFATFS_FILESYSTEM_STATE_INITIALIZATION:
             cliPrint(self, "Initializing");
@@ -1811,25 +1945,27 @@ static void cliSdInfo(struct cli *self, char *cmdline)
 static void cliFlashInfo(struct cli *self, char *cmdline)
 {
     const flashGeometry_t *layout = flashfsGetGeometry();
+    flashfsWriteStats_t stats;
 
     UNUSED(cmdline);
 
+    flashfsGetWriteStats(&stats);
+
     cliPrintf(self, "Flash sectors=%u, sectorSize=%u, pagesPerSector=%u, pageSize=%u, totalSize=%u, usedSize=%u\r\n",
             layout->sectors, layout->sectorSize, layout->pagesPerSector, layout->pageSize, layout->totalSize, flashfsGetOffset());
+    cliPrintf(self, "Write buffer=%u, written=%u, dropped=%u, throughput=%u bytes/s, sectorsToErase=%u, erasedReserve=%u\r\n",
+            flashfsGetWriteBufferSize(), stats.bytesWritten, stats.bytesDropped, stats.throughput, flashfsGetSectorsPendingErase(),
+            flashfsGetErasedReserve());
 }
 
 static void cliFlashErase(struct cli *self, char *cmdline)
 {
     UNUSED(cmdline);
 
-    cliPrintf(self, "Erasing...\r\n");
     flashfsEraseCompletely();
 
-    while (!flashfsIsReady()) {
-        usleep(100000);
-    }
-
-    cliPrintf(self, "Done.\r\n");
+    // Sectors are erased in the background starting with the ones the next log will be written to
+    cliPrintf(self, "Erasing %u sectors in the background\r\n", flashfsGetSectorsPendingErase());
 }
 
 #ifdef USE_FLASH_TOOLS
@@ -1921,6 +2057,27 @@ static const char* const sectionBreak = "\r\n";
 
 #define printSectionBreak() cliPrintf(self, (char *)sectionBreak)
 
+/**
+ * Binary dump writes a single header line followed by the raw config store.
+ * The header carries the size and crc32 of the payload so that a host can
+ * pass it back unchanged to the restore command.
+ */
+static void cliDumpBinary(struct cli *self)
+{
+    struct config_store *store = self->ninja->config_store;
+    uint32_t size = sizeof(struct config_store);
+
+    // the stored checksum is only updated on save, restore checks it against the data
+    config_store_update_checksum(store);
+
+    cliPrintf(self, "#binary %u %08x\r\n", size, crc32_ieee_buf(0, store, size));
+    const uint8_t *ptr = (const uint8_t*)store;
+    for (uint32_t i = 0; i < size; i++) {
+        cliWrite(self, ptr[i]);
+    }
+    bufWriterFlush(self->cliWriter);
+}
+
 static void cliDump(struct cli *self, char *cmdline)
 {
     unsigned int i;
@@ -1929,6 +2086,11 @@ static void cliDump(struct cli *self, char *cmdline)
 
     //float thr, roll, pitch, yaw;
 
+    if (strcasecmp(cmdline, "binary") == 0) {
+        cliDumpBinary(self);
+        return;
+    }
+
     uint8_t dumpMask = DUMP_ALL;
     if (strcasecmp(cmdline, "master") == 0) {
         dumpMask = DUMP_MASTER; // only
@@ -2346,6 +2508,71 @@ static void cliMotor(struct cli *self, char *cmdline)
     //cliPrintf(self, "motor %d: %d\r\n", motor_index, mixer_get_motor_value(&ninja.mixer, motor_index));
 }
 
+#ifdef USE_DSHOT
+static const struct {
+    const char *name;
+    uint8_t command;
+} dshotCommandNames[] = {
+    { "beep1", DSHOT_CMD_BEEP1 },
+    { "beep2", DSHOT_CMD_BEEP2 },
+    { "beep3", DSHOT_CMD_BEEP3 },
+    { "beep4", DSHOT_CMD_BEEP4 },
+    { "beep5", DSHOT_CMD_BEEP5 },
+    { "normal", DSHOT_CMD_SPIN_DIRECTION_NORMAL },
+    { "reversed", DSHOT_CMD_SPIN_DIRECTION_REVERSED },
+    { "save", DSHOT_CMD_SAVE_SETTINGS },
+};
+
+static void cliDshot(struct cli *self, char *cmdline)
+{
+    char *saveptr;
+    char *motor = strtok_r(cmdline, " ", &saveptr);
+    char *cmd = strtok_r(NULL, " ", &saveptr);
+
+    if (!motor || !cmd) {
+        cliShowParseError(self);
+        return;
+    }
+
+    // commands replace throttle so they are only sent while the motors are stopped
+    if (ninja_is_armed(self->ninja)) {
+        cliPrint(self, "Not allowed while armed\r\n");
+        return;
+    }
+
+    const pwmIOConfiguration_t *pwm = pwmGetOutputConfiguration();
+    if (pwm->motorProtocol == MOTOR_PROTOCOL_PWM) {
+        cliPrint(self, "Motors are not using dshot\r\n");
+        return;
+    }
+
+    int command = -1;
+    for (unsigned i = 0; i < ARRAYLEN(dshotCommandNames); i++) {
+        if (!strcasecmp(cmd, dshotCommandNames[i].name))
+            command = dshotCommandNames[i].command;
+    }
+    if (command < 0 && isdigit((unsigned char)cmd[0]))
+        command = atoi(cmd);
+    if (command < 0 || command > DSHOT_CMD_MAX) {
+        cliShowArgumentRangeError(self, "command", 0, DSHOT_CMD_MAX);
+        return;
+    }
+
+    if (!strcasecmp(motor, "all")) {
+        for (int i = 0; i < pwm->motorCount; i++)
+            pwmWriteDshotCommand(i, command);
+    } else {
+        int index = atoi(motor);
+        if (index < 0 || index >= pwm->motorCount) {
+            cliShowArgumentRangeError(self, "index", 0, pwm->motorCount - 1);
+            return;
+        }
+        pwmWriteDshotCommand(index, command);
+    }
+    cliPrintf(self, "dshot command %d sent\r\n", command);
+}
+#endif
+
 static void cliPlaySound(struct cli *self, char *cmdline)
 {
 	(void)self; (void)cmdline;
@@ -2434,6 +2661,94 @@ static void cliSave(struct cli *self, char *cmdline)
 
     cliPrint(self, "Saving");
 	ninja_config_save(self->ninja);
+	ninja_config_flush(self->ninja);
+    cliReboot(self);
+}
+
+#define CLI_RESTORE_TIMEOUT_MS 1000
+
+/**
+ * Starts receiving a binary config dump. The data is staged in the buffer used
+ * by background saves so the active config is not touched until the whole
+ * dump has been received and validated.
+ */
+static void cliRestore(struct cli *self, char *cmdline)
+{
+    char *ptr = cmdline;
+    uint32_t size = strtoul(ptr, &ptr, 10);
+    uint32_t crc = strtoul(ptr, &ptr, 16);
+
+    if (ninja_is_armed(self->ninja)) {
+        cliPrint(self, "Not allowed while armed\r\n");
+        return;
+    }
+
+    if (size != sizeof(struct config_store)) {
+        cliPrintf(self, "Size mismatch, expected %u\r\n", (uint32_t)sizeof(struct config_store));
+        return;
+    }
+
+    // the staging buffer is shared with background saves so let a running save complete first
+    ninja_config_flush(self->ninja);
+
+    self->restoreRemaining = size;
+    self->restoreOffset = 0;
+    self->restoreCrc = 0;
+    self->restoreExpectedCrc = crc;
+    self->restoreLastByteAt = sys_millis(self->system);
+
+    cliPrint(self, "Ready\r\n");
+    bufWriterFlush(self->cliWriter);
+}
+
+static void cliRestoreAbort(struct cli *self, const char *reason)
+{
+    self->restoreRemaining = 0;
+    cliPrintf(self, "Restore failed: %s\r\n", reason);
+    cliPrompt(self);
+}
+
+static void cliRestoreUpdate(struct cli *self)
+{
+    sys_millis_t now = sys_millis(self->system);
+    struct config_store *staged = &self->ninja->config_save_buffer;
+    uint8_t *store = (uint8_t*)staged;
+
+    while (self->restoreRemaining && serialRxBytesWaiting(self->cliPort)) {
+        uint8_t c = serialRead(self->cliPort);
+        store[self->restoreOffset++] = c;
+        self->restoreCrc = crc32_ieee_buf(self->restoreCrc, &c, 1);
+        self->restoreRemaining--;
+        self->restoreLastByteAt = now;
+    }
+
+    if (self->restoreRemaining) {
+        if ((now - self->restoreLastByteAt) > CLI_RESTORE_TIMEOUT_MS)
+            cliRestoreAbort(self, "timeout");
+        return;
+    }
+
+    if (self->restoreCrc != self->restoreExpectedCrc) {
+        cliRestoreAbort(self, "crc mismatch");
+        return;
+    }
+
+    // catches dumps from a different firmware build where the layout does not match
+    if (!config_store_valid(staged)) {
+        cliRestoreAbort(self, "invalid config");
+        return;
+    }
+
+    if (ninja_is_armed(self->ninja)) {
+        cliRestoreAbort(self, "armed");
+        return;
+    }
+
+    memcpy(self->ninja->config_store, staged, sizeof(struct config_store));
+
+    cliPrint(self, "Restored, saving");
+    ninja_config_save(self->ninja);
+    ninja_config_flush(self->ninja);
     cliReboot(self);
 }
 
@@ -2470,22 +2785,25 @@ static void cliWrite(struct cli *self, uint8_t ch)
     bufWriterAppend(self->cliWriter, ch);
 }
 
-static void* cliVarPtr(struct cli *self, const clivalue_t *var)
+static void* cliConfigVarPtr(const struct config *config, const clivalue_t *var)
 {
-	(void)self;
-
     switch (var->type & VALUE_SECTION_MASK) {
         case MASTER_VALUE:
-            return ((uint8_t*)self->config) + var->offset;
+            return ((uint8_t*)config) + var->offset;
         case CONTROL_RATE_VALUE:
-            return ((uint8_t*)config_get_rate_profile(self->config)) + var->offset;
+            return ((uint8_t*)config_get_rate_profile(config)) + var->offset;
         case PROFILE_VALUE:
-            return ((uint8_t*)config_get_profile(self->config)) + var->offset;
+            return ((uint8_t*)config_get_profile(config)) + var->offset;
 		default:break;
     }
     return NULL;
 }
 
+static void* cliVarPtr(struct cli *self, const clivalue_t *var)
+{
+	return cliConfigVarPtr(self->config, var);
+}
+
 static void cliPrintVar(struct cli *self, const clivalue_t *var, uint32_t full)
 {
     int32_t value = 0;
@@ -2604,62 +2922,59 @@ static void cliSet(struct cli *self, char *cmdline)
             eqptr++;
         }
 
-        for (i = 0; i < ARRAYLEN(valueTable); i++) {
-            val = &valueTable[i];
-            // ensure exact match when setting to prevent setting variables with shorter names
-            if (strncasecmp(cmdline, valueTable[i].name, strlen(valueTable[i].name)) == 0 && variableNameLength == strlen(valueTable[i].name)) {
+        // exact match when setting to prevent setting variables with shorter names
+        val = cliFindValue(cmdline, variableNameLength);
+        if (!val) {
+            cliPrint(self, "Invalid name\r\n");
+            return;
+        }
 
-                bool changeValue = false;
-                int_float_value_t tmp;
-				tmp.int_value = 0; 
-                switch (valueTable[i].type & VALUE_MODE_MASK) {
-                    case MODE_DIRECT: {
-                            int32_t value = 0;
-                            float valuef = 0;
+        bool changeValue = false;
+        int_float_value_t tmp;
+        tmp.int_value = 0; 
+        switch (val->type & VALUE_MODE_MASK) {
+            case MODE_DIRECT: {
+                    int32_t value = 0;
+                    float valuef = 0;
 
-                            value = atoi(eqptr);
-                            valuef = fastA2F(eqptr);
+                    value = atoi(eqptr);
+                    valuef = fastA2F(eqptr);
 
-                            if (valuef >= valueTable[i].config.minmax.min && valuef <= valueTable[i].config.minmax.max) { // note: compare float value
+                    if (valuef >= val->config.minmax.min && valuef <= val->config.minmax.max) { // note: compare float value
 
-                                if ((valueTable[i].type & VALUE_TYPE_MASK) == VAR_FLOAT)
-                                    tmp.float_value = valuef;
-                                else
-                                    tmp.int_value = value;
+                        if ((val->type & VALUE_TYPE_MASK) == VAR_FLOAT)
+                            tmp.float_value = valuef;
+                        else
+                            tmp.int_value = value;
 
-                                changeValue = true;
-                            }
-                        }
-                        break;
-                    case MODE_LOOKUP: {
-                            const lookupTableEntry_t *tableEntry = &lookupTables[valueTable[i].config.lookup.tableIndex];
-                            bool matched = false;
-                            for (uint8_t tableValueIndex = 0; tableValueIndex < tableEntry->valueCount && !matched; tableValueIndex++) {
-                                matched = strcasecmp(tableEntry->values[tableValueIndex], eqptr) == 0;
-
-                                if (matched) {
-                                    tmp.int_value = tableValueIndex;
-                                    changeValue = true;
-                                }
-                            }
+                        changeValue = true;
+                    }
+                }
+                break;
+            case MODE_LOOKUP: {
+                    const lookupTableEntry_t *tableEntry = &lookupTables[val->config.lookup.tableIndex];
+                    bool matched = false;
+                    for (uint8_t tableValueIndex = 0; tableValueIndex < tableEntry->valueCount && !matched; tableValueIndex++) {
+                        matched = strcasecmp(tableEntry->values[tableValueIndex], eqptr) == 0;
+
+                        if (matched) {
+                            tmp.int_value = tableValueIndex;
+                            changeValue = true;
                         }
-                        break;
-					default:break;
+                    }
                 }
+                break;
+            default:break;
+        }
 
-                if (changeValue) {
-                    cliSetVar(self, val, tmp);
-
-                    cliPrintf(self, "%s set to ", valueTable[i].name);
-                    cliPrintVar(self, val, 0);
-                } else {
-                    cliPrint(self, "Invalid value\r\n");
-                }
+        if (changeValue) {
+            cliSetVar(self, val, tmp);
 
-                return;
-            }
+            cliPrintf(self, "%s set to ", val->name);
+            cliPrintVar(self, val, 0);
+        } else {
+            cliPrint(self, "Invalid value\r\n");
         }
-        cliPrint(self, "Invalid name\r\n");
     } else {
         // no equals, check for matching variables.
         cliGet(self, cmdline);
@@ -2744,6 +3059,14 @@ static void cliStatus(struct cli *self, char *cmdline)
 
     //cliPrintf(self, "Cycle Time: %d, I2C Errors: %d, registry size: %d\r\n", cycleTime, i2cErrorCounter, PG_REGISTRY_SIZE);
     cliPrintf(self, "I2C Errors: %d, registry size: %d\r\n", i2cErrorCounter, sizeof(struct config));
+
+#ifdef USE_DSHOT
+    uint8_t protocol = pwmGetOutputConfiguration()->motorProtocol;
+    if (protocol != self->config->pwm_out.motor_protocol) {
+        cliPrintf(self, "Motor protocol %s not available, motors must all be on the dshot timer. Using %s\r\n",
+            lookupTableMotorProtocol[self->config->pwm_out.motor_protocol], lookupTableMotorProtocol[protocol]);
+    }
+#endif
 }
 
 #ifndef SKIP_TASK_STATISTICS
@@ -2824,6 +3147,11 @@ void cli_update(struct cli *self)
 
     // Be a little bit tricky.  Flush the last inputs buffer, if any.
     bufWriterFlush(self->cliWriter);
+
+    if (self->restoreRemaining) {
+        cliRestoreUpdate(self);
+        return;
+    }
     
     while (serialRxBytesWaiting(self->cliPort)) {
         uint8_t c = serialRead(self->cliPort);
@@ -2896,9 +3224,11 @@ void cli_update(struct cli *self)
                        && !isalnum((unsigned)self->cliBuffer[strlen(cmd->name)]))    // next characted in bufffer is not alphanumeric (command is correctly terminated)
                         break;
                 }
-                if(cmd < cmdTable + CMD_COUNT)
+                if(cmd < cmdTable + CMD_COUNT) {
                     cmd->func(self, self->cliBuffer + strlen(cmd->name) + 1);
-                else
+                    // most commands write the config directly
+                    config_notify_changed();
+                } else
                     cliPrint(self, "Unknown command, try 'help'");
                 self->bufferIndex = 0;
             }
@@ -2929,11 +3259,86 @@ bool cli_is_active(struct cli *self){
 	return self->cliMode;
 }
 
+uint16_t cli_var_count(void){
+	return VALUE_COUNT;
+}
+
+const char *cli_var_name(uint16_t index){
+	if(index >= VALUE_COUNT)
+		return NULL;
+	return valueTable[index].name;
+}
+
+cli_var_type_t cli_var_type(uint16_t index){
+	if(index >= VALUE_COUNT)
+		return CLI_VAR_UINT8;
+	return (cli_var_type_t)(valueTable[index].type & VALUE_TYPE_MASK);
+}
+
+int cli_var_find(const char *name, size_t len){
+	cliBuildValueIndex();
+	const clivalue_t *var = cliFindValue(name, len);
+	if(!var)
+		return -ENOENT;
+	return var - valueTable;
+}
+
+int cli_var_get(const struct config *config, uint16_t index, float *value){
+	if(index >= VALUE_COUNT)
+		return -ENOENT;
+	const clivalue_t *var = &valueTable[index];
+	const void *ptr = cliConfigVarPtr(config, var);
+	if(!ptr)
+		return -ENOENT;
+	switch(var->type & VALUE_TYPE_MASK) {
+		case VAR_UINT8: *value = *(const uint8_t*)ptr; break;
+		case VAR_INT8: *value = *(const int8_t*)ptr; break;
+		case VAR_UINT16: *value = *(const uint16_t*)ptr; break;
+		case VAR_INT16: *value = *(const int16_t*)ptr; break;
+		case VAR_UINT32: *value = (float)*(const uint32_t*)ptr; break;
+		case VAR_FLOAT: *value = *(const float*)ptr; break;
+		default: return -EINVAL;
+	}
+	return 0;
+}
+
+int cli_var_set(struct config *config, uint16_t index, float value){
+	if(index >= VALUE_COUNT)
+		return -ENOENT;
+	const clivalue_t *var = &valueTable[index];
+	void *ptr = cliConfigVarPtr(config, var);
+	if(!ptr)
+		return -ENOENT;
+
+	// same limits as the set command
+	if((var->type & VALUE_MODE_MASK) == MODE_LOOKUP){
+		if(value < 0 || value >= lookupTables[var->config.lookup.tableIndex].valueCount)
+			return -ERANGE;
+	} else if(value < var->config.minmax.min || value > var->config.minmax.max){
+		return -ERANGE;
+	}
+
+	int32_t ivalue = lrintf(value);
+	switch(var->type & VALUE_TYPE_MASK) {
+		case VAR_UINT8: *(uint8_t*)ptr = ivalue; break;
+		case VAR_INT8: *(int8_t*)ptr = ivalue; break;
+		case VAR_UINT16: *(uint16_t*)ptr = ivalue; break;
+		case VAR_INT16: *(int16_t*)ptr = ivalue; break;
+		// values above INT32_MAX do not fit the signed conversion, the range check above keeps this positive
+		case VAR_UINT32: *(uint32_t*)ptr = (uint32_t)(value + 0.5f); break;
+		case VAR_FLOAT: *(float*)ptr = value; break;
+		default: return -EINVAL;
+	}
+	config_notify_changed();
+	return 0;
+}
+
 void cli_init(struct cli *self, struct ninja *ninja, struct config *cfg, const struct system_calls *system){
 	memset(self, 0, sizeof(struct cli));
 	self->ninja = ninja;
 	self->config = cfg;
 	self->system = system;
+	cliBuildValueIndex();
 }
 
 /** @} */
@@ -19,8 +19,21 @@
 
 #include "drivers/serial.h"
 #include "common/buf_writer.h"
+#include "system_calls.h"
 
 struct ninja;
+struct config;
+
+//! storage type of a variable in the settings table
+typedef enum {
+	CLI_VAR_UINT8 = 0,
+	CLI_VAR_INT8,
+	CLI_VAR_UINT16,
+	CLI_VAR_INT16,
+	CLI_VAR_UINT32,
+	CLI_VAR_FLOAT
+} cli_var_type_t;
+
 struct cli {
 	uint8_t cliMode;
 
@@ -33,6 +46,13 @@ struct cli {
 	uint8_t cliWriteBuffer[48];
 	//uint8_t cliWriteBuffer[sizeof(bufWriter_t) + 16];
 
+	// binary restore, active while restoreRemaining is non zero
+	uint32_t restoreRemaining;
+	uint32_t restoreOffset;
+	uint32_t restoreCrc;
+	uint32_t restoreExpectedCrc;
+	sys_millis_t restoreLastByteAt;
+
 	struct ninja *ninja;
 	struct config *config;
 	const struct system_calls *system;
@@ -43,3 +63,19 @@ void cli_start(struct cli *self, serialPort_t *serialPort);
 void cli_update(struct cli *self);
 bool cli_is_active(struct cli *self);
 bool cli_uses_port(struct cli *self, serialPort_t *serialPort);
+
+/**
+ * Access to the settings table for other configuration protocols. Variables
+ * are addressed by their position in the table which stays the same for the
+ * lifetime of a firmware build.
+ */
+uint16_t cli_var_count(void);
+//! returns name of variable at index or NULL if index is out of range
+const char *cli_var_name(uint16_t index);
+cli_var_type_t cli_var_type(uint16_t index);
+//! returns index of the variable named by the first len chars of name or -ENOENT
+int cli_var_find(const char *name, size_t len);
+//! reads variable at index from config as a float
+int cli_var_get(const struct config *config, uint16_t index, float *value);
+//! writes variable at index if value is within the limits of the variable, otherwise returns -ERANGE
+int cli_var_set(struct config *config, uint16_t index, float value);
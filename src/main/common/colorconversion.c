@@ -90,3 +90,83 @@ rgbColor24bpp_t hsvToRgb24(const hsvColor_t* c)
     return r;
 }
 
+
+/*
+ * Table driven conversion.
+ *
+ * For a given hue every channel is either at the value, at the base or on the ramp
+ * between them, so the fully saturated colour at full value gives a per channel
+ * weight that only has to be scaled into [base, val]. The weights are generated by
+ * the preprocessor from the same sector rules as hsvToRgb24() above.
+ */
+
+#define HUE_SECTOR(h) ((h) / 60)
+#define HUE_RAMP(h) ((255 * ((HUE_SECTOR(h) & 1) ? 60 - (h) % 60 : (h) % 60) + 30) / 60)
+// weight of a channel that sits at the value in sectors fa/fb and on the ramp in sectors ra/rb
+#define HUE_WEIGHT(h, fa, fb, ra, rb) \
+    ((HUE_SECTOR(h) == (fa) || HUE_SECTOR(h) == (fb)) ? 255 : \
+     (HUE_SECTOR(h) == (ra) || HUE_SECTOR(h) == (rb)) ? HUE_RAMP(h) : 0)
+#define HUE_ENTRY(h) { .rgb = { \
+    .r = HUE_WEIGHT(h, 0, 5, 1, 4), \
+    .g = HUE_WEIGHT(h, 1, 2, 0, 3), \
+    .b = HUE_WEIGHT(h, 3, 4, 2, 5) } }
+#define HUE_ENTRY10(h) HUE_ENTRY(h), HUE_ENTRY(h + 1), HUE_ENTRY(h + 2), HUE_ENTRY(h + 3), HUE_ENTRY(h + 4), \
+    HUE_ENTRY(h + 5), HUE_ENTRY(h + 6), HUE_ENTRY(h + 7), HUE_ENTRY(h + 8), HUE_ENTRY(h + 9)
+#define HUE_ENTRY60(h) HUE_ENTRY10(h), HUE_ENTRY10(h + 10), HUE_ENTRY10(h + 20), \
+    HUE_ENTRY10(h + 30), HUE_ENTRY10(h + 40), HUE_ENTRY10(h + 50)
+
+static const rgbColor24bpp_t hueTable[HSV_HUE_MAX + 1] = {
+    HUE_ENTRY60(0), HUE_ENTRY60(60), HUE_ENTRY60(120),
+    HUE_ENTRY60(180), HUE_ENTRY60(240), HUE_ENTRY60(300)
+};
+
+// round(255 * (i / 255) ^ 2.2)
+const uint8_t gammaTable[256] = {
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,
+      1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+      3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+      6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+     12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+     20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+     30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+     42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+     56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+     73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+     91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+    113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+    137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+    163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+    192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+    223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255,
+};
+
+static inline uint8_t hueScale(uint8_t weight, int base, int range)
+{
+    // base + (range * weight) / 255 without the division, exact at both ends
+    return base + ((range * (weight + 1)) >> 8);
+}
+
+rgbColor24bpp_t hsvToRgb24Lut(const hsvColor_t *c)
+{
+    rgbColor24bpp_t r;
+    const rgbColor24bpp_t *w = &hueTable[c->h <= HSV_HUE_MAX ? c->h : c->h % (HSV_HUE_MAX + 1)];
+
+    // (s * v) / 255, so that s = 255 gives an exact grey like the reference does
+    int base = (c->v * (c->s + 1)) >> 8;
+    int range = c->v - base;
+
+    r.rgb.r = hueScale(w->rgb.r, base, range);
+    r.rgb.g = hueScale(w->rgb.g, base, range);
+    r.rgb.b = hueScale(w->rgb.b, base, range);
+    return r;
+}
+
+rgbColor24bpp_t hsvToRgb24Gamma(const hsvColor_t *c)
+{
+    rgbColor24bpp_t r = hsvToRgb24Lut(c);
+
+    r.rgb.r = gammaTable[r.rgb.r];
+    r.rgb.g = gammaTable[r.rgb.g];
+    r.rgb.b = gammaTable[r.rgb.b];
+    return r;
+}
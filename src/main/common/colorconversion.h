@@ -17,3 +17,11 @@
 #pragma once
 
 rgbColor24bpp_t hsvToRgb24(const hsvColor_t *c);
+
+//! gamma 2.2 correction table for led output, indexed by linear channel value
+extern const uint8_t gammaTable[256];
+
+//! same result as hsvToRgb24() to within a few steps, using a precomputed hue table
+rgbColor24bpp_t hsvToRgb24Lut(const hsvColor_t *c);
+//! table driven conversion followed by gamma correction, for driving leds
+rgbColor24bpp_t hsvToRgb24Gamma(const hsvColor_t *c);
@@ -0,0 +1,76 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "crc.h"
+
+uint8_t crc8_dvb_s2(uint8_t crc, uint8_t byte){
+	crc ^= byte;
+	for(int c = 0; c < 8; c++){
+		if(crc & 0x80)
+			crc = (uint8_t)((crc << 1) ^ 0xD5);
+		else
+			crc = (uint8_t)(crc << 1);
+	}
+	return crc;
+}
+
+uint8_t crc8_dvb_s2_buf(uint8_t crc, const void *data, size_t size){
+	const uint8_t *p = (const uint8_t*)data;
+	while(size--)
+		crc = crc8_dvb_s2(crc, *p++);
+	return crc;
+}
+
+uint8_t crc8_smbus(uint8_t crc, uint8_t byte){
+	crc ^= byte;
+	for(int c = 0; c < 8; c++){
+		if(crc & 0x80)
+			crc = (uint8_t)((crc << 1) ^ 0x07);
+		else
+			crc = (uint8_t)(crc << 1);
+	}
+	return crc;
+}
+
+uint8_t crc8_smbus_buf(uint8_t crc, const void *data, size_t size){
+	const uint8_t *p = (const uint8_t*)data;
+	while(size--)
+		crc = crc8_smbus(crc, *p++);
+	return crc;
+}
+
+// nibble table keeps flash use at 64 bytes while still avoiding the 8 step bit loop
+static const uint32_t crc32_nibble_table[16] = {
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+	0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+	0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t crc32_ieee_buf(uint32_t crc, const void *data, size_t size){
+	const uint8_t *p = (const uint8_t*)data;
+	crc = ~crc;
+	while(size--){
+		crc ^= *p++;
+		crc = (crc >> 4) ^ crc32_nibble_table[crc & 0x0f];
+		crc = (crc >> 4) ^ crc32_nibble_table[crc & 0x0f];
+	}
+	return ~crc;
+}
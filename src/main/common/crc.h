@@ -0,0 +1,32 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+//! update a CRC8 (DVB-S2, poly 0xD5) with a single byte. Initial value is 0.
+uint8_t crc8_dvb_s2(uint8_t crc, uint8_t byte);
+//! update a CRC8 (DVB-S2) with a buffer of bytes
+uint8_t crc8_dvb_s2_buf(uint8_t crc, const void *data, size_t size);
+//! update a CRC8 (SMBus, poly 0x07) with a single byte. Initial value is 0. Used by KISS/BLHeli32 esc telemetry.
+uint8_t crc8_smbus(uint8_t crc, uint8_t byte);
+//! update a CRC8 (SMBus) with a buffer of bytes
+uint8_t crc8_smbus_buf(uint8_t crc, const void *data, size_t size);
+//! update a CRC32 (IEEE 802.3, reflected poly 0xEDB88320) with a buffer. Start with 0, result is already inverted.
+uint32_t crc32_ieee_buf(uint32_t crc, const void *data, size_t size);
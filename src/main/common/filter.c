@@ -78,6 +78,34 @@ void BiQuadNewLpf(float filterCutFreq, biquad_t *newState, uint32_t refreshRate)
     newState->y1 = newState->y2 = 0;
 }
 
+/* sets notch coefficients without touching the filter history so that the center can be moved while filtering */
+void BiQuadSetNotch(float centerFreq, float q, biquad_t *state, uint32_t refreshRate)
+{
+    float sampleRate = 1 / ((float)refreshRate * 0.000001f);
+
+    float omega = 2 * M_PI_FLOAT * centerFreq / sampleRate;
+    float sn = sinf(omega);
+    float cs = cosf(omega);
+    float alpha = sn / (2 * q);
+
+    float a0 = 1 + alpha;
+
+    state->b0 = 1 / a0;
+    state->b1 = -2 * cs / a0;
+    state->b2 = 1 / a0;
+    state->a1 = -2 * cs / a0;
+    state->a2 = (1 - alpha) / a0;
+}
+
+/* sets up a biquad notch filter */
+void BiQuadNewNotch(float centerFreq, float q, biquad_t *newState, uint32_t refreshRate)
+{
+    BiQuadSetNotch(centerFreq, q, newState, refreshRate);
+
+    newState->x1 = newState->x2 = 0;
+    newState->y1 = newState->y2 = 0;
+}
+
 /* Computes a biquad_t filter on a sample */
 float applyBiQuadFilter(float sample, biquad_t *state)
 {
@@ -0,0 +1,103 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define LZ_HASH_BITS 7
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+
+static inline uint8_t _lz_hash(const uint8_t *p){
+	return (uint8_t)(((p[0] << 4) ^ (p[1] << 2) ^ p[2]) * 157) >> (8 - LZ_HASH_BITS);
+}
+
+static int _lz_write_literals(const uint8_t *src, int len, uint8_t *dst, int pos, int dst_size){
+	while(len > 0){
+		int count = len > LZ_MAX_LITERALS ? LZ_MAX_LITERALS : len;
+		if(pos + 1 + count > dst_size)
+			return -1;
+		dst[pos++] = (uint8_t)(count - 1);
+		memcpy(dst + pos, src, count);
+		pos += count;
+		src += count;
+		len -= count;
+	}
+	return pos;
+}
+
+int lz_compress(const uint8_t *src, int len, uint8_t *dst, int dst_size){
+	// last position at which each hashed 3 byte sequence was seen. Only one candidate is tried per position which
+	// keeps this fast enough to run on every block sent.
+	int16_t table[LZ_HASH_SIZE];
+	int pos = 0;
+	int literals = 0;
+	int i = 0;
+
+	for(int c = 0; c < LZ_HASH_SIZE; c++)
+		table[c] = -1;
+
+	while(i + LZ_MIN_MATCH <= len){
+		uint8_t h = _lz_hash(src + i);
+		int candidate = table[h];
+		int match = 0;
+		table[h] = (int16_t)i;
+		if(candidate >= 0 && (i - candidate) <= LZ_MAX_DISTANCE){
+			while(i + match < len && match < LZ_MAX_MATCH && src[candidate + match] == src[i + match])
+				match++;
+		}
+		if(match < LZ_MIN_MATCH){
+			i++;
+			continue;
+		}
+		pos = _lz_write_literals(src + literals, i - literals, dst, pos, dst_size);
+		if(pos < 0 || pos + 2 > dst_size)
+			return -1;
+		dst[pos++] = (uint8_t)(0x80 | (match - LZ_MIN_MATCH));
+		dst[pos++] = (uint8_t)(i - candidate - 1);
+		i += match;
+		literals = i;
+	}
+	return _lz_write_literals(src + literals, len - literals, dst, pos, dst_size);
+}
+
+int lz_decompress(const uint8_t *src, int len, uint8_t *dst, int dst_size){
+	int in = 0, out = 0;
+	while(in < len){
+		uint8_t token = src[in++];
+		if(token & 0x80){
+			int count = (token & 0x7F) + LZ_MIN_MATCH;
+			if(in >= len)
+				return -1;
+			int distance = src[in++] + 1;
+			if(distance > out || out + count > dst_size)
+				return -1;
+			// byte by byte since the source may overlap the destination
+			for(int c = 0; c < count; c++, out++)
+				dst[out] = dst[out - distance];
+		} else {
+			int count = token + 1;
+			if(in + count > len || out + count > dst_size)
+				return -1;
+			memcpy(dst + out, src + in, count);
+			in += count;
+			out += count;
+		}
+	}
+	return out;
+}
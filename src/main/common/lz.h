@@ -0,0 +1,39 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Small LZ77 style compressor for blocks of a few hundred bytes. Each block is compressed on its own so it can be
+ * decoded without any other block. The compressed stream is a sequence of tokens:
+ *
+ * - token 0x00..0x7F: (token + 1) literal bytes follow.
+ * - token 0x80..0xFF: copy (token & 0x7F) + 3 bytes starting (next byte + 1) bytes back in the output. The copy may
+ *   overlap the bytes it produces, which is how runs (like erased flash) are encoded.
+ */
+
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (0x7F + LZ_MIN_MATCH)
+#define LZ_MAX_DISTANCE 256
+#define LZ_MAX_LITERALS 128
+
+//! compress len bytes of src into dst. Returns compressed size or -1 if it does not fit into dst_size bytes.
+int lz_compress(const uint8_t *src, int len, uint8_t *dst, int dst_size);
+//! decompress a block produced by lz_compress. Returns decompressed size or -1 if the block is corrupt or too large.
+int lz_decompress(const uint8_t *src, int len, uint8_t *dst, int dst_size);
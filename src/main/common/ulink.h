@@ -19,8 +19,11 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #define ULINK_MAX_FRAME_SIZE 512
+//! largest payload a receiver can take, the frame buffer also holds the two crc bytes
+#define ULINK_MAX_PAYLOAD_SIZE (ULINK_MAX_FRAME_SIZE - 3)
 
 struct ulink_frame {
 	char buf[ULINK_MAX_FRAME_SIZE]; 
@@ -28,6 +31,36 @@ struct ulink_frame {
 	uint8_t state; 
 }; 
 
+/**
+ * Output ring that frames are encoded into. Data is taken out with
+ * ulink_ring_peek() and ulink_ring_consume() so that it can be handed to a
+ * device without another copy. Size does not need to be a power of two.
+ */
+struct ulink_ring {
+	uint8_t *buf;
+	size_t size;
+	size_t head;
+	size_t tail;
+	size_t used;
+};
+
+void ulink_ring_init(struct ulink_ring *self, void *buf, size_t size);
+size_t ulink_ring_used(const struct ulink_ring *self);
+size_t ulink_ring_free(const struct ulink_ring *self);
+//! returns the size of the contiguous block of data at the read end of the ring
+size_t ulink_ring_peek(const struct ulink_ring *self, const void **data);
+void ulink_ring_consume(struct ulink_ring *self, size_t size);
+
+/**
+ * Escapes data, appends the crc and the frame byte directly into the ring.
+ * Either the whole frame is written or nothing is.
+ * @return number of bytes written, -ENOSPC if the frame does not fit or
+ * -EMSGSIZE if the payload is larger than a receiver can take.
+ */
+int ulink_encode(struct ulink_ring *out, const void *data, size_t size);
+//! CRC-16/ARC used by ulink frames
+uint16_t ulink_crc16(uint16_t crc, const void *buf, size_t size);
+
 size_t ulink_pack_data(const void *data, size_t size, struct ulink_frame *frame); 
 size_t ulink_parse_frame(const void *data, size_t size, struct ulink_frame *frame); 
 
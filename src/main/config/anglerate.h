@@ -62,6 +62,7 @@ struct pid_config {
     uint8_t D8[PID_ITEM_COUNT]; //!< D gains
     uint16_t yaw_p_limit;                   //!< set P term limit (fixed value was 300)
     uint16_t dterm_cut_hz;                  //!< dterm filtering
+    uint8_t angle_loop_div;                 //!< angle loop runs once every this many rate loop updates
 } __attribute__((packed));
 
 /** @} */
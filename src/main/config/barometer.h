@@ -24,7 +24,8 @@
 struct barometer_config {
     uint8_t baro_sample_count;              // size of baro filter array
     float baro_noise_lpf;                   // additional LPF to reduce baro noise
-    float baro_cf_vel;                      // apply Complimentary Filter to keep the calculated velocity based on baro velocity (i.e. near real velocity)
-    float baro_cf_alt;                      // apply CF to use ACC for height estimation
+    uint16_t alt_acc_noise;                 // vertical acceleration noise of the altitude estimator in cm/s/s
+    uint16_t alt_baro_noise;                // baro altitude noise (standard deviation) in cm
+    uint16_t alt_sonar_noise;               // sonar altitude noise (standard deviation) in cm
 } __attribute__((packed)) ;
 
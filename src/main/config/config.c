@@ -90,6 +90,7 @@
 #define DEFAULT_TELEMETRY_INVERSION 0
 #endif
 
+//! record in the config journal. addr is a byte offset into the config store with bit 15 set.
 struct eeprom_delta {
 	uint16_t addr;
 	uint16_t data;
@@ -101,6 +102,13 @@ static void _reset_rate_profile(struct rate_profile *self){
 		.rcExpo8 = 65,
 		.thrMid8 = 50,
 		.tpa_breakpoint = 1500,
+		// roll and pitch have always flown at half P and D, keep that so existing tunes do not change
+		.tpa_curve_throttle = { 1000, 1250, 1500, 1750, 2000 },
+		.tpa_curve = {
+			{ 50, 50, 50, 50, 50 },
+			{ 50, 50, 50, 50, 50 },
+			{ 100, 100, 100, 100, 100 }
+		},
 	};
 }
 
@@ -238,6 +246,7 @@ static void _reset_ledstrip_config(struct ledstrip_config *self){
 	_reset_led_colors(self);
 	_reset_led_mode_colors(self);
 	_reset_led_spc_colors(self);
+	self->gamma = 0;
 }
 
 static void _reset_rx_output_config(struct rx_output_config *self, const struct rx_config *rx){
@@ -336,6 +345,7 @@ static const struct config_profile _default_profile = {
 
 		.yaw_p_limit = YAW_P_LIMIT_MAX,
 		.dterm_cut_hz = 0,
+		.angle_loop_div = 2,
 	},
 	.acc = {
 		.acc_cut_hz = 15,
@@ -379,8 +389,9 @@ static const struct config_profile _default_profile = {
 	.baro = {
 		.baro_sample_count = 21,
 		.baro_noise_lpf = 0.6f,
-		.baro_cf_vel = 0.985f,
-		.baro_cf_alt = 0.965f,
+		.alt_acc_noise = 50,
+		.alt_baro_noise = 60,
+		.alt_sonar_noise = 3,
 	},
 	.mag = {
 		.mag_declination = 0,
@@ -399,6 +410,9 @@ static const struct config _default_config = {
 		.gyro_lpf = 0,                 // supported by all gyro drivers now. In case of ST gyro, will default to 32Hz instead
 		.soft_gyro_lpf_hz = 60,        // Software based lpf filter for gyro
 		.move_threshold = 32,
+		.rpm_notch_harmonics = 0,
+		.rpm_notch_min_hz = 100,
+		.rpm_notch_q = 500,
 	},
 	//.profiles = { 0 },
 	.airplane_althold = {
@@ -475,6 +489,8 @@ static const struct config _default_config = {
 		.tri_unarmed_servo = 1,
 		.servo_lowpass_freq = 400.0f,
 		.servo_lowpass_enable = 0,
+		.desat_mode = MIXER_DESAT_AIRMODE,
+		.thrust_linear = 0,
 		//.custom_rules = {0}
 	},
 	.motor_3d = {
@@ -489,6 +505,8 @@ static const struct config _default_config = {
 		.servoCenterPulse = 1500,
 		.motor_pwm_rate = DEFAULT_PWM_RATE,
 		.servo_pwm_rate = 50,
+		.motor_protocol = MOTOR_PROTOCOL_PWM,
+		.motor_poles = 14,
 	},
 	.pwm_in = {
 		.inputFilteringMode = 0
@@ -562,6 +580,11 @@ static const struct config _default_config = {
 	.telemetry = {
 		.telemetry_switch = 0,
 		.telemetry_inversion = DEFAULT_TELEMETRY_INVERSION,
+		.mavlink_sysid = 1,
+		.mavlink_rate_att = 10,
+		.mavlink_rate_imu = 10,
+		.mavlink_rate_servo = 5,
+		.mavlink_rate_pos = 2,
 	},
 	.tilt = {
 		.mode = MIXER_TILT_MODE_DYNAMIC,
@@ -595,6 +618,7 @@ void config_reset(struct config_store *store){
 	rx_config_set_mapping(&self->rx, "AERT1234");
 	_reset_rx_output_config(&self->rx_output, &self->rx);
 	_reset_serial_config(&self->serial);
+	config_notify_changed();
 }
 
 static int gcd(int num, int denom)
@@ -665,14 +689,130 @@ static uint16_t crc16(const void *ptr, size_t length){
 	return (crc);
 }
 
-static void config_store_update_checksum(struct config_store *self){
+//! updates the checksum of the store after its data has been changed
+void config_store_update_checksum(struct config_store *self){
 	self->crc = crc16((char*)&self->data, sizeof(self->data));
 }
 
-static bool config_store_valid(const struct config_store *self){
+//! checks that the data of the store matches its checksum
+bool config_store_valid(const struct config_store *self){
 	return self->crc == crc16((char*)&self->data, sizeof(self->data));
 }
 
+/**
+ * @addtogroup config
+ * @section config-journal Config journal
+ *
+ * The config eeprom area is used as a ring of pages. Each page starts with a
+ * header carrying a magic and a sequence number. A generation of pages starts
+ * with a snapshot page which holds a raw image of the whole config store,
+ * continues with log pages that have consecutive sequence numbers, and holds
+ * delta records appended by each save. Every save ends with a commit record so
+ * a save that was interrupted by power loss is ignored when loading.
+ *
+ * Loading only reads the page headers to find the newest complete snapshot
+ * (the active page) and then replays the records of that generation. Saving
+ * diffs the store against the journal a few words at a time so stack usage
+ * does not depend on the size of the config. The log only grows while the
+ * remaining pages can still hold a snapshot. When it can not grow any more
+ * the store is compacted into a new snapshot written into those free pages,
+ * which rotates erases over all pages and keeps the previous generation
+ * intact until the new one has been committed. The config area therefore has
+ * to hold at least two snapshots.
+ *
+ * Older firmware stored a plain list of delta records over the defaults
+ * starting at the beginning of the config area. Such a config is still loaded
+ * when no snapshot is found and is then rewritten in the journal format. The
+ * first snapshot is placed after the old records when there is room so that
+ * the old config survives until the new one has been committed.
+ */
+
+//! magic of the first page of a generation (the one holding the snapshot)
+#define CONFIG_PAGE_SNAPSHOT 0xC5A1
+//! magic of all following pages of a generation
+#define CONFIG_PAGE_LOG 0xC5A2
+//! all valid record addresses have this bit set
+#define CONFIG_RECORD_VALID 0x8000
+//! record written at the end of each save. Data is the checksum of the store.
+#define CONFIG_RECORD_COMMIT 0xFFFE
+//! size of the raw store image rounded up to whole records
+#define CONFIG_IMAGE_SIZE ((sizeof(struct config_store) + sizeof(struct eeprom_delta) - 1) & ~(sizeof(struct eeprom_delta) - 1))
+//! offset of the first delta record in a generation (right after the snapshot commit record)
+#define CONFIG_LOG_START (CONFIG_IMAGE_SIZE + sizeof(struct eeprom_delta))
+//! number of words that are compared at a time when saving
+#define CONFIG_DIFF_CHUNK 16
+
+struct config_page_header {
+	uint16_t magic;
+	uint16_t seq;
+} __attribute__((packed));
+
+static bool _seq_newer(uint16_t a, uint16_t b){
+	return (int16_t)(a - b) > 0;
+}
+
+static uint16_t _journal_payload(const struct config_journal *self){
+	return self->page_size - sizeof(struct config_page_header);
+}
+
+static uint16_t _journal_page_addr(const struct config_journal *self, uint16_t page){
+	return CONFIG_EEPROM_START + (page % self->num_pages) * self->page_size;
+}
+
+static uint16_t _journal_addr(const struct config_journal *self, uint16_t start, uint32_t offs){
+	uint16_t payload = _journal_payload(self);
+	return _journal_page_addr(self, start + offs / payload) + sizeof(struct config_page_header) + offs % payload;
+}
+
+//! number of pages needed for the snapshot image and its commit record
+static uint16_t _journal_image_pages(const struct config_journal *self){
+	uint16_t payload = _journal_payload(self);
+	return (CONFIG_LOG_START + payload - 1) / payload;
+}
+
+static int _journal_read(const struct config_journal *self, uint16_t addr, void *dst, size_t size){
+	if(sys_eeprom_read(self->system, dst, addr, size) != (int)size)
+		return -EIO;
+	return 0;
+}
+
+static int _journal_write(const struct config_journal *self, uint16_t addr, const void *src, size_t size){
+	int ret = sys_eeprom_write(self->system, addr, src, size);
+	if(ret < 0) return ret;
+	if(ret != (int)size) return -EIO;
+	return 0;
+}
+
+static int _journal_read_header(const struct config_journal *self, uint16_t page, struct config_page_header *hdr){
+	return _journal_read(self, _journal_page_addr(self, page), hdr, sizeof(*hdr));
+}
+
+static int _journal_start_page(const struct config_journal *self, uint16_t page, uint16_t magic, uint16_t seq){
+	struct config_page_header hdr = { .magic = magic, .seq = seq };
+	if(sys_eeprom_erase_page(self->system, _journal_page_addr(self, page)) < 0)
+		return -EIO;
+	return _journal_write(self, _journal_page_addr(self, page), &hdr, sizeof(hdr));
+}
+
+//! reads a range of bytes of the snapshot image which may span several pages
+static int _journal_read_image(const struct config_journal *self, void *dst, uint32_t offs, size_t size){
+	uint8_t *ptr = (uint8_t*)dst;
+	uint16_t payload = _journal_payload(self);
+	while(size){
+		size_t len = MIN(size, (size_t)(payload - offs % payload));
+		int ret = _journal_read(self, _journal_addr(self, self->start, offs), ptr, len);
+		if(ret < 0) return ret;
+		ptr += len; offs += len; size -= len;
+	}
+	return 0;
+}
+
+/**
+ * Loads a config written by firmware that stored deltas without a journal.
+ * Records start at the beginning of the config area and never cross a page.
+ * @param store store to apply the records to, can be NULL to only find the end
+ * @return number of bytes used by the records or negative error code
+ */
 static int _load_deltas(struct config_store *store, const struct system_calls *system){
 	uint16_t *ptr = (uint16_t*)store;
 
@@ -681,102 +821,380 @@ static int _load_deltas(struct config_store *store, const struct system_calls *s
 
 	uint32_t eeprom_size = MIN(info.page_size * info.num_pages, CONFIG_EEPROM_SIZE);
 
-	// first load existing config and validate it
-	size_t c = 0;
-	for(c = 0; c < (eeprom_size / sizeof(struct eeprom_delta)); c++){
+	uint32_t pos = 0;
+	while(pos + sizeof(struct eeprom_delta) <= eeprom_size){
+		// records that do not fit at the end of a page continue on the next page
+		uint16_t page_pos = pos % info.page_size;
+		if((page_pos + sizeof(struct eeprom_delta)) > info.page_size){
+			pos += info.page_size - page_pos;
+			continue;
+		}
+
 		struct eeprom_delta delta;
-		memset(&delta, 0, sizeof(delta));
-		// read one delta at a time until we reach the end and load each into the store
-		uint16_t start = CONFIG_EEPROM_START + sizeof(struct eeprom_delta) * c;
-		uint16_t page_pos = start % info.page_size;
+		if(sys_eeprom_read(system, &delta, CONFIG_EEPROM_START + pos, sizeof(delta)) != sizeof(delta))
+			return -EIO;
 
-		// make sure we continue reading on next page since last bytes do not contain valid record
-		if((page_pos + sizeof(struct eeprom_delta)) > info.page_size) start += info.page_size - page_pos;
+		// all addresses have the top bit set so that erased flash (0xffff, out of range) and erased eeprom (0x0000) both end the list
+		if(!(delta.addr & CONFIG_RECORD_VALID) || (delta.addr & ~CONFIG_RECORD_VALID) >= sizeof(struct config_store))
+			break;
 
-		if(sys_eeprom_read(system, &delta, start, sizeof(struct eeprom_delta)) != sizeof(struct eeprom_delta))
-			return -EIO;
+		if(ptr)
+			ptr[(delta.addr & ~CONFIG_RECORD_VALID) >> 1] = delta.data;
+		pos += sizeof(struct eeprom_delta);
+	}
+	return pos;
+}
+
+static bool _record_is_data(const struct eeprom_delta *rec){
+	return (rec->addr & CONFIG_RECORD_VALID) && rec->addr != CONFIG_RECORD_COMMIT &&
+		(rec->addr & ~CONFIG_RECORD_VALID) < sizeof(struct config_store);
+}
 
-		// all addresses will have first bit explicitly set
-		// on a flash eeprom this will be done by design of the flash, on a normal eeprom this will ensure that we stop when we reach erased area with only zeros
-		if(!(delta.addr & 0x8000)) // is an invalid address?
+//! validates generation starting at given snapshot page and finds the end of its log
+static int _journal_scan(struct config_journal *self, uint16_t start, uint16_t seq){
+	self->start = start;
+	self->seq = seq;
+	self->pages = 1;
+	self->dirty = false;
+
+	// follow pages with consecutive sequence numbers
+	while(self->pages < self->num_pages){
+		struct config_page_header hdr;
+		if(_journal_read_header(self, start + self->pages, &hdr) < 0)
+			return -EIO;
+		if(hdr.magic != CONFIG_PAGE_LOG || hdr.seq != (uint16_t)(seq + self->pages))
 			break;
+		self->pages++;
+	}
 
-		// remove the magic bit
-		delta.addr &= ~0x8000;
+	uint32_t capacity = (uint32_t)self->pages * _journal_payload(self);
+	if(capacity < CONFIG_LOG_START)
+		return -EINVAL;
+
+	// a snapshot is only complete once its commit record has been written
+	struct eeprom_delta rec;
+	if(_journal_read(self, _journal_addr(self, start, CONFIG_IMAGE_SIZE), &rec, sizeof(rec)) < 0)
+		return -EIO;
+	if(rec.addr != CONFIG_RECORD_COMMIT)
+		return -EINVAL;
 
-		// this test will ensure we stop on a flash eeprom when we reach an area with just 0xffff (erased flash data)
-		if(delta.addr >= sizeof(struct config_store))
+	self->end = self->tail = CONFIG_LOG_START;
+	while(self->tail < capacity){
+		if(_journal_read(self, _journal_addr(self, start, self->tail), &rec, sizeof(rec)) < 0)
+			return -EIO;
+		if(rec.addr == CONFIG_RECORD_COMMIT){
+			self->end = self->tail + sizeof(rec);
+		} else if(!_record_is_data(&rec)){
+			// anything other than fully erased space means a write was interrupted
+			bool erased = (rec.addr == 0xffff && rec.data == 0xffff) || (rec.addr == 0 && rec.data == 0);
+			self->dirty = !erased;
 			break;
+		}
+		self->tail += sizeof(rec);
+	}
+	return 0;
+}
 
-		// address is actual eeprom address which we need to divide by 2 in order to get word address
-		ptr[delta.addr >> 1] = delta.data;
+//! finds the newest complete generation in the eeprom
+static int _journal_open(struct config_journal *self, const struct system_calls *system){
+	struct system_bdev_info info;
+	sys_eeprom_get_info(system, &info);
+
+	memset(self, 0, sizeof(*self));
+	self->system = system;
+	self->page_size = info.page_size;
+	self->num_pages = MIN(info.page_size * info.num_pages, CONFIG_EEPROM_SIZE) / info.page_size;
+
+	// try snapshots from newest to oldest until we find one that is complete
+	bool have_limit = false;
+	uint16_t limit = 0;
+	for(uint16_t tries = 0; tries < self->num_pages; tries++){
+		int best = -1;
+		uint16_t best_seq = 0;
+		for(uint16_t page = 0; page < self->num_pages; page++){
+			struct config_page_header hdr;
+			if(_journal_read_header(self, page, &hdr) < 0)
+				return -EIO;
+			if(hdr.magic != CONFIG_PAGE_SNAPSHOT)
+				continue;
+			if(have_limit && !_seq_newer(limit, hdr.seq))
+				continue;
+			if(best < 0 || _seq_newer(hdr.seq, best_seq)){
+				best = page;
+				best_seq = hdr.seq;
+			}
+		}
+		if(best < 0)
+			break;
+		int ret = _journal_scan(self, best, best_seq);
+		if(ret == 0 || ret == -EIO)
+			return ret;
+		have_limit = true;
+		limit = best_seq;
 	}
-	// return next position where to write next record (presumably an empty area)
-	return c * sizeof(struct eeprom_delta);
+	self->pages = 0;
+	return -ENOENT;
 }
 
-/**
- * NOTE: this function makes heavy use of the stack to store 2 * sizeof(config)
- * which can be up to 4k. It may therefore cause stack overflow if ram if
- * almost used up when it is called
- * @param self config which is to be saved to eeprom
- */
-int config_save(struct config_store *self, const struct system_calls *system){
-	struct config_store eeprom_store;
+//! loads snapshot and all committed records into the store
+static int _journal_replay(const struct config_journal *self, struct config_store *store){
+	uint16_t *ptr = (uint16_t*)store;
+	if(_journal_read_image(self, store, 0, sizeof(struct config_store)) < 0)
+		return -EIO;
+	for(uint32_t offs = CONFIG_LOG_START; offs < self->end; offs += sizeof(struct eeprom_delta)){
+		struct eeprom_delta rec;
+		if(_journal_read(self, _journal_addr(self, self->start, offs), &rec, sizeof(rec)) < 0)
+			return -EIO;
+		if(!_record_is_data(&rec))
+			continue;
+		ptr[(rec.addr & ~CONFIG_RECORD_VALID) >> 1] = rec.data;
+	}
+	return 0;
+}
 
-	memset(&eeprom_store, 0, sizeof(eeprom_store));
+//! appends a record to the log, starting a new page if needed
+static int _journal_append(struct config_journal *self, uint16_t addr, uint16_t data){
+	struct eeprom_delta rec = { .addr = addr, .data = data };
+	if(self->tail >= (uint32_t)self->pages * _journal_payload(self)){
+		// the ring is full when the pages that are left could not hold the next snapshot
+		if(self->pages + 1 + _journal_image_pages(self) > self->num_pages)
+			return -ENOSPC;
+		int ret = _journal_start_page(self, self->start + self->pages, CONFIG_PAGE_LOG, self->seq + self->pages);
+		if(ret < 0) return ret;
+		self->pages++;
+	}
+	int ret = _journal_write(self, _journal_addr(self, self->start, self->tail), &rec, sizeof(rec));
+	if(ret < 0) return ret;
+	self->tail += sizeof(rec);
+	if(addr == CONFIG_RECORD_COMMIT)
+		self->end = self->tail;
+	return 0;
+}
 
-	// start with a default config and load current deltas over it
-	config_reset(&eeprom_store);
-	int start = _load_deltas(&eeprom_store, system);
-	if(start < 0){
+//! diffs one chunk of words against the committed state and appends records for the ones that changed
+static int _save_diff_chunk(struct config_save *self){
+	struct config_journal *journal = &self->journal;
+	const uint16_t *cur = (const uint16_t*)self->store;
+	const uint32_t words = sizeof(struct config_store) / sizeof(uint16_t);
+	uint16_t stored[CONFIG_DIFF_CHUNK];
+	uint32_t base = self->pos;
+	uint32_t count = MIN(CONFIG_DIFF_CHUNK, words - base);
+
+	// rebuild the committed value of this chunk from the snapshot and the log
+	if(_journal_read_image(journal, stored, base * sizeof(uint16_t), count * sizeof(uint16_t)) < 0)
 		return -EIO;
+	for(uint32_t offs = CONFIG_LOG_START; offs < journal->end; offs += sizeof(struct eeprom_delta)){
+		struct eeprom_delta rec;
+		if(_journal_read(journal, _journal_addr(journal, journal->start, offs), &rec, sizeof(rec)) < 0)
+			return -EIO;
+		if(!_record_is_data(&rec))
+			continue;
+		uint32_t word = (rec.addr & ~CONFIG_RECORD_VALID) >> 1;
+		if(word >= base && word < base + count)
+			stored[word - base] = rec.data;
 	}
 
-	config_store_update_checksum(self);
+	for(uint32_t c = 0; c < count; c++){
+		if(cur[base + c] == stored[c])
+			continue;
+		int ret = _journal_append(journal, ((base + c) << 1) | CONFIG_RECORD_VALID, cur[base + c]);
+		if(ret < 0) return ret;
+		self->changed = true;
+	}
+	self->pos += count;
+	return 0;
+}
 
-	// get the eeprom layout
-	struct system_bdev_info info;
-	sys_eeprom_get_info(system, &info);
+//! picks location of the new snapshot. It goes into the free pages after the current generation so that the current one survives if we lose power.
+static int _save_start_compact(struct config_save *self){
+	struct config_journal *journal = &self->journal;
+	uint16_t image_pages = _journal_image_pages(journal);
+	if(image_pages > journal->num_pages)
+		return -ENOSPC;
+
+	uint16_t start = 0;
+	uint16_t seq = 0;
+	if(journal->pages){
+		// the current generation is the only complete copy of the config so it must not be overwritten
+		if(journal->num_pages < image_pages * 2)
+			return -ENOSPC;
+		seq = journal->seq + journal->pages;
+		start = (journal->start + MIN(journal->pages, journal->num_pages - image_pages)) % journal->num_pages;
+	} else {
+		// keep a config written by older firmware intact until the first snapshot has been committed
+		int legacy = _load_deltas(NULL, journal->system);
+		if(legacy < 0)
+			return legacy;
+		uint16_t used = (legacy + journal->page_size - 1) / journal->page_size;
+		if(used + image_pages <= journal->num_pages)
+			start = used;
+	}
+	journal->start = start;
+	journal->seq = seq;
+	journal->pages = 0;
+	journal->end = journal->tail = 0;
 
-	// store the new delta
-	int retry_count = 0;
-	bool fail = false;
-	do {
-		uint16_t *stored = (uint16_t*)&eeprom_store;
-		uint16_t *cur = (uint16_t*)self;
-		fail = false;
-		for(unsigned c = 0; c < (sizeof(struct config_store) / sizeof(uint16_t)); c++){
-			if(cur[c] != stored[c]) {
-				struct eeprom_delta delta = {
-					.addr = (c << 1) | 0x8000,
-					.data = cur[c]
-				};
-				// if our record will not fit into current page then jump to the next page
-				uint16_t page_pos = start % info.page_size;
-				if((uint16_t)(info.page_size - page_pos) < sizeof(struct eeprom_delta)) start += info.page_size - page_pos;
-				// erase pages as we go
-				if(page_pos == 0) sys_eeprom_erase_page(system, start);
-				int ret = sys_eeprom_write(system, start, &delta, sizeof(delta));
-				if(ret < 0) return ret;
-				if(ret != sizeof(struct eeprom_delta)){
-					// this is used to catch a write past end of eeprom etc
-					// in this case a crude solution is to just restart from the beginning a few times before giving up
-					retry_count++;
-					fail = true;
-					// restart at the beginning of the config area
-					start = CONFIG_EEPROM_START;
-					break;
-				}
-				start += sizeof(struct eeprom_delta);
-			}
+	self->state = CONFIG_SAVE_COMPACT_PAGES;
+	self->pos = 0;
+	return 0;
+}
+
+//! writes one page worth of the snapshot image through a small buffer so that writes are whole records
+static int _save_write_image(struct config_save *self){
+	struct config_journal *journal = &self->journal;
+	const uint8_t *src = (const uint8_t*)self->store;
+	uint16_t payload = _journal_payload(journal);
+	uint32_t page_end = MIN((self->pos / payload + 1) * payload, (uint32_t)CONFIG_IMAGE_SIZE);
+	while(self->pos < page_end){
+		uint8_t buf[32];
+		size_t len = MIN(sizeof(buf), (size_t)(page_end - self->pos));
+		for(size_t c = 0; c < len; c++)
+			buf[c] = ((self->pos + c) < sizeof(struct config_store))?src[self->pos + c]:0;
+		int ret = _journal_write(journal, _journal_addr(journal, journal->start, self->pos), buf, len);
+		if(ret < 0) return ret;
+		self->pos += len;
+	}
+	return 0;
+}
+
+static int _save_commit_snapshot(struct config_save *self){
+	struct config_journal *journal = &self->journal;
+	uint16_t image_pages = journal->pages;
+
+	journal->end = journal->tail = CONFIG_IMAGE_SIZE;
+	int ret = _journal_append(journal, CONFIG_RECORD_COMMIT, self->store->crc);
+	if(ret < 0) return ret;
+
+	// a stale log page right after us would otherwise be taken as part of this generation
+	if(image_pages < journal->num_pages){
+		struct config_page_header hdr;
+		uint16_t page = journal->start + image_pages;
+		if(_journal_read_header(journal, page, &hdr) < 0)
+			return -EIO;
+		if(hdr.magic == CONFIG_PAGE_LOG && hdr.seq == (uint16_t)(journal->seq + image_pages)){
+			if(sys_eeprom_erase_page(journal->system, _journal_page_addr(journal, page)) < 0)
+				return -EIO;
 		}
-	} while(fail && retry_count < 2); // we try twice since the only possibility is that we start from the beginning and all deltas will fit
-	if(fail)
-		return -1;
+	}
 	return 0;
 }
 
+/**
+ * Prepares saving of the store into the journal. The work is then done by
+ * calling config_save_step until it returns zero or an error. Each step does
+ * a bounded amount of work: diffing a few words, erasing one page or writing
+ * one page of a snapshot. The store must not be modified until the save is
+ * done so the caller should pass a copy when saving in the background.
+ */
+void config_save_begin(struct config_save *self, struct config_store *store, const struct system_calls *system){
+	memset(self, 0, sizeof(*self));
+	config_store_update_checksum(store);
+	self->store = store;
+	self->journal.system = system;
+	self->state = CONFIG_SAVE_OPEN;
+}
+
+/**
+ * Does the next step of a save.
+ * @return 1 while there is more work to do, 0 when save is done and negative error code on failure.
+ */
+int config_save_step(struct config_save *self){
+	struct config_journal *journal = &self->journal;
+	const uint32_t words = sizeof(struct config_store) / sizeof(uint16_t);
+	int ret = 0;
+
+	switch(self->state){
+		case CONFIG_SAVE_IDLE:
+			return 0;
+		case CONFIG_SAVE_OPEN:
+			ret = _journal_open(journal, journal->system);
+			if(ret == -EIO)
+				break;
+			// uncommitted records from an interrupted save can not be appended to
+			if(ret == 0 && !journal->dirty && journal->tail == journal->end){
+				self->state = CONFIG_SAVE_DIFF;
+				self->pos = 0;
+				self->changed = false;
+			} else {
+				ret = _save_start_compact(self);
+			}
+			break;
+		case CONFIG_SAVE_DIFF:
+			if(self->pos < words){
+				ret = _save_diff_chunk(self);
+			} else {
+				if(self->changed)
+					ret = _journal_append(journal, CONFIG_RECORD_COMMIT, self->store->crc);
+				if(ret == 0)
+					self->state = CONFIG_SAVE_IDLE;
+			}
+			if(ret == -ENOSPC)
+				ret = _save_start_compact(self);
+			break;
+		case CONFIG_SAVE_COMPACT_PAGES:
+			ret = _journal_start_page(journal, journal->start + self->pos, (self->pos == 0)?CONFIG_PAGE_SNAPSHOT:CONFIG_PAGE_LOG, journal->seq + self->pos);
+			if(ret < 0) break;
+			journal->pages++;
+			if(++self->pos == _journal_image_pages(journal)){
+				self->state = CONFIG_SAVE_COMPACT_IMAGE;
+				self->pos = 0;
+			}
+			break;
+		case CONFIG_SAVE_COMPACT_IMAGE:
+			ret = _save_write_image(self);
+			if(ret == 0 && self->pos >= CONFIG_IMAGE_SIZE)
+				self->state = CONFIG_SAVE_COMPACT_COMMIT;
+			break;
+		case CONFIG_SAVE_COMPACT_COMMIT:
+			ret = _save_commit_snapshot(self);
+			if(ret == 0)
+				self->state = CONFIG_SAVE_IDLE;
+			break;
+		default:
+			ret = -EINVAL;
+			break;
+	}
+	if(ret < 0){
+		self->state = CONFIG_SAVE_IDLE;
+		return ret;
+	}
+	return (self->state == CONFIG_SAVE_IDLE)?0:1;
+}
+
+bool config_save_busy(const struct config_save *self){
+	return self->state != CONFIG_SAVE_IDLE;
+}
+
+//! returns rough progress of current save in percent
+uint8_t config_save_progress(const struct config_save *self){
+	const uint32_t words = sizeof(struct config_store) / sizeof(uint16_t);
+	switch(self->state){
+		case CONFIG_SAVE_IDLE:
+		case CONFIG_SAVE_COMPACT_COMMIT:
+			return 100;
+		case CONFIG_SAVE_DIFF:
+			return (uint8_t)(self->pos * 99 / words);
+		case CONFIG_SAVE_COMPACT_IMAGE:
+			return (uint8_t)(self->pos * 99 / CONFIG_IMAGE_SIZE);
+		default:
+			return 0;
+	}
+}
+
+/**
+ * Saves the config store into the journal and waits until done. Only words
+ * that differ from what is already stored are written, unless the journal
+ * needs to be compacted.
+ * @param self config which is to be saved to eeprom
+ */
+int config_save(struct config_store *self, const struct system_calls *system){
+	struct config_save save;
+	int ret;
+	config_save_begin(&save, self, system);
+	while((ret = config_save_step(&save)) > 0);
+	return ret;
+}
+
 bool config_fixup(struct config_store *config){
 	uint32_t checksum = crc16(&config->data, sizeof(struct config));
 	_fixup_blackbox_config(&config->data);
@@ -787,30 +1205,39 @@ bool config_fixup(struct config_store *config){
  * @addtogroup config
  * @section config-load Loading of config
  *
- * Config module typically only stores deltas in the eeprom. Before loading a
- * config, the data area is filled with available defaults. Then deltas are
- * loaded from the eeprom which overwrite some values that have been modified
- * by the user from defaults. Finally the new checksum is loaded from the
- * eeprom as well. If checksum of the loaded data matches the checksum loaded
- * from the eeprom then all config data is copied to the config struct supplied
- * to config_load. If data can not be loaded then config_load will return an
- * error.
+ * Loading finds the newest complete snapshot in the journal, reads it into
+ * the store and applies all committed records that follow it. The checksum
+ * of the result is then compared against the checksum stored in the config.
+ * If there is no snapshot then a config in the format of older firmware is
+ * loaded and saved as a journal. If no valid config can be loaded then the
+ * store is reset to defaults and config_load returns an error.
  */
 int config_load(struct config_store *self, const struct system_calls *system){
-	(void)system;
-	(void)self;
-	memset(self, 0, sizeof(struct config_store));
+	struct config_journal journal;
 
-	config_reset(self);
+	memset(self, 0, sizeof(struct config_store));
 
-	if(_load_deltas(self, system) < 0){
+	int ret = _journal_open(&journal, system);
+	if(ret == -ENOENT){
+		// config saved by older firmware. It is rewritten in the journal format once, if that fails it is retried on next load.
 		config_reset(self);
-		return -EIO;
+		if(_load_deltas(self, system) > 0 && config_store_valid(self)){
+			config_save(self, system);
+			config_notify_changed();
+			return 0;
+		}
+	}
+	if(ret == 0)
+		ret = _journal_replay(&journal, self);
+	if(ret < 0){
+		config_reset(self);
+		return (ret == -EIO)?-EIO:-EINVAL;
 	}
 	if(!config_store_valid(self)){
 		config_reset(self);
 		return -EINVAL;
 	}
+	config_notify_changed();
 	return 0;
 }
 
@@ -823,6 +1250,17 @@ void config_erase(struct config_store *self, const struct system_calls *system){
 	}
 }
 
+//! incremented on every config change, read from other threads so it is only ever written as a whole
+static volatile uint16_t _config_generation = 0;
+
+void config_notify_changed(void){
+	_config_generation++;
+}
+
+uint16_t config_get_generation(void){
+	return _config_generation;
+}
+
 #if 0
 void handleOneshotFeatureChangeOnRestart(void)
 {
@@ -117,15 +117,60 @@ struct config_store {
 
 struct system_calls;
 
+//! location of the active generation in the config journal. Offsets are counted in payload bytes from the start of the snapshot.
+struct config_journal {
+	const struct system_calls *system;
+	uint16_t page_size;
+	uint16_t num_pages;
+	uint16_t start;	//!< page index of the snapshot page
+	uint16_t seq;	//!< sequence number of the snapshot page
+	uint16_t pages;	//!< number of pages in the generation
+	uint32_t end;	//!< offset just past the last commit record
+	uint32_t tail;	//!< offset where the next record will be written
+	bool dirty;		//!< tail contains a partially written record
+};
+
+typedef enum {
+	CONFIG_SAVE_IDLE = 0,
+	CONFIG_SAVE_OPEN,
+	CONFIG_SAVE_DIFF,
+	CONFIG_SAVE_COMPACT_PAGES,
+	CONFIG_SAVE_COMPACT_IMAGE,
+	CONFIG_SAVE_COMPACT_COMMIT
+} config_save_state_t;
+
+//! state of a save that is done in small steps. The store must not change until the save is done.
+struct config_save {
+	struct config_journal journal;
+	struct config_store *store;
+	uint8_t state;
+	uint32_t pos;
+	bool changed;
+};
+
 struct config_profile const * config_get_profile(const struct config * const self);
 struct config_profile *config_get_profile_rw(struct config *self);
 struct rate_profile const * config_get_rate_profile(const struct config * const self);
 struct rate_profile *config_get_rate_profile_rw(struct config *self);
 
 int config_save(struct config_store *self, const struct system_calls *system);
+void config_save_begin(struct config_save *self, struct config_store *store, const struct system_calls *system);
+int config_save_step(struct config_save *self);
+bool config_save_busy(const struct config_save *self);
+uint8_t config_save_progress(const struct config_save *self);
 int config_load(struct config_store *self, const struct system_calls *system);
 void config_reset(struct config_store *self);
 bool config_fixup(struct config_store *config);
+void config_store_update_checksum(struct config_store *self);
+bool config_store_valid(const struct config_store *self);
 void config_erase(struct config_store *self, const struct system_calls *system);
 
+/**
+ * Config is written in place by cli, msp, telemetry and rc adjustments. Each of them calls config_notify_changed()
+ * after a write so that modules which derive state from the config can compare config_get_generation() against the
+ * value they last loaded instead of checking the config itself on every update.
+ */
+void config_notify_changed(void);
+uint16_t config_get_generation(void);
+
 /** @} */
@@ -25,5 +25,8 @@ struct gyro_config {
     uint8_t move_threshold;			//!< people keep forgetting that moving model while init results in wrong gyro offsets. and then they never reset gyro. so this is now on by default.
     uint8_t gyro_lpf;                           //!< gyro LPF setting - values are driver specific, in case of invalid number, a reasonable default ~30-40HZ is chosen.
     uint16_t soft_gyro_lpf_hz;                  //!< Software based gyro filter in hz
+    uint8_t rpm_notch_harmonics;                //!< number of motor speed harmonics to notch out of the gyro signal (0 disables rpm filtering)
+    uint8_t rpm_notch_min_hz;                   //!< motors turning slower than this are not filtered
+    uint16_t rpm_notch_q;                       //!< quality of the rpm notch filters times 100
 } __attribute__((packed)) ;
 
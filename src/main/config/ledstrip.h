@@ -128,6 +128,7 @@ struct ledstrip_config {
 	struct hsvColor_s colors[LED_CONFIGURABLE_COLOR_COUNT];
 	struct led_mode_color_indices modeColors[LED_MODE_COUNT];
 	struct led_spc_color_indices spcColors[1];
+	uint8_t gamma;	//!< apply gamma correction to led output, off keeps the linear colors
 } __attribute__((packed)) ;
 
 bool ledstrip_config_set_color(struct ledstrip_config *self, int index, const char *colorConfig);
@@ -61,6 +61,15 @@ struct motor_3d_config {
     uint16_t neutral3d;                     // center 3d value
 } __attribute__((packed)) ;
 
+//! digital or analog protocol used to drive the escs
+typedef enum {
+	MOTOR_PROTOCOL_PWM = 0,		//!< pwm, oneshot125 or brushed depending on features and motor_pwm_rate
+	MOTOR_PROTOCOL_DSHOT150,
+	MOTOR_PROTOCOL_DSHOT300,
+	MOTOR_PROTOCOL_DSHOT600,
+	MOTOR_PROTOCOL_COUNT
+} motor_protocol_t;
+
 struct pwm_output_config {
     // PWM values, in milliseconds, common range is 1000-2000 (1 to 2ms)
     uint16_t minthrottle;                   // Set the minimum throttle command sent to the ESC (Electronic Speed Controller). This is the minimum value that allow motors to run at a idle speed.
@@ -69,6 +78,8 @@ struct pwm_output_config {
     uint16_t servoCenterPulse;              // This is the value for servos when they should be in the middle. e.g. 1500.
     uint16_t motor_pwm_rate;                // The update rate of motor outputs (50-498Hz)
     uint16_t servo_pwm_rate;                // The update rate of servo outputs (50-498Hz)
+    uint8_t motor_protocol;                 // One of motor_protocol_t values
+    uint8_t motor_poles;                    // Number of magnet poles in the motor bell, used to get rpm from esc telemetry erpm
 } __attribute__((packed)) ;
 
 // the following few structures are cleanflight config for motor and servo mixers which is also currently used for custom mixers
@@ -203,6 +214,14 @@ typedef enum {
 } mixer_mode_t;
 
 
+//! how the mixer resolves motor saturation
+typedef enum {
+	MIXER_DESAT_AIRMODE = 0,	//!< keep full differential thrust, move collective thrust up or down to fit
+	MIXER_DESAT_THROTTLE,		//!< keep collective thrust, reduce differential thrust to fit
+	MIXER_DESAT_ATTITUDE,		//!< like airmode at the top of the range but never raises collective thrust at the bottom
+	MIXER_DESAT_COUNT
+} mixer_desat_mode_t;
+
 //! general mixer settings
 struct mixer_config {
     uint8_t mixerMode;				//!< one of the mixer_mode_t values
@@ -212,6 +231,8 @@ struct mixer_config {
     uint8_t tri_unarmed_servo;		//!< send tail servo correction pulses even when unarmed
     float servo_lowpass_freq;		//!< lowpass servo filter frequency selection; 1/1000ths of loop freq
     int8_t servo_lowpass_enable;	//!< enable/disable lowpass filter for servo output
+	uint8_t desat_mode;				//!< one of mixer_desat_mode_t values
+	uint8_t thrust_linear;			//!< thrust linearization in percent (0 = pwm proportional to command, 100 = pwm proportional to sqrt of command)
 	struct mixer_rule_def custom_rules[MIXER_MAX_RULES];
 } __attribute__((packed)) ;
 
@@ -23,6 +23,9 @@
 
 #define MAX_CONTROL_RATE_PROFILE_COUNT 1
 
+//! number of points in the throttle pid attenuation curves
+#define TPA_CURVE_POINTS 5
+
 struct rate_profile {
     uint8_t rcRate8;
     uint8_t rcExpo8;
@@ -32,6 +35,8 @@ struct rate_profile {
     uint8_t dynThrPID;
     uint8_t rcYawExpo8;
     uint16_t tpa_breakpoint;                // Breakpoint at which TPA is activated
+    uint16_t tpa_curve_throttle[TPA_CURVE_POINTS];  // Throttle (1000-2000) of each tpa curve point in ascending order
+    uint8_t tpa_curve[3][TPA_CURVE_POINTS];         // P and D weight in percent at each tpa curve point for roll, pitch and yaw
 } __attribute__((packed)) ;
 
 struct rate_profile_selection {
@@ -24,5 +24,10 @@
 struct telemetry_config {
     uint8_t telemetry_switch;               // Use aux channel to change serial output & baudrate( MSP / Telemetry ). It disables automatic switching to Telemetry when armed.
     uint8_t telemetry_inversion;            // also shared with smartport inversion
+    uint8_t mavlink_sysid;                  // system id used in mavlink frames
+    uint8_t mavlink_rate_att;               // ATTITUDE_QUATERNION rate in Hz, 0 disables the stream
+    uint8_t mavlink_rate_imu;               // HIGHRES_IMU rate in Hz
+    uint8_t mavlink_rate_servo;             // SERVO_OUTPUT_RAW rate in Hz
+    uint8_t mavlink_rate_pos;               // GLOBAL_POSITION_INT rate in Hz
 } __attribute__((packed)) ;
 
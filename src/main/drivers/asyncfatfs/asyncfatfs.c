@@ -35,13 +35,21 @@
     #define ONLY_EXPOSE_FOR_TESTING static
 #endif
 
+/*
+ * Number of 512-byte sectors held in the cache. Targets with RAM to spare can raise this in target.h to give the
+ * write-behind more room to build up multi-block bursts and the read-ahead more room to prefetch into.
+ */
+#ifndef AFATFS_NUM_CACHE_SECTORS
 #define AFATFS_NUM_CACHE_SECTORS 8
+#endif
 
 // FAT filesystems are allowed to differ from these parameters, but we choose not to support those weird filesystems:
 #define AFATFS_SECTOR_SIZE  512
 #define AFATFS_NUM_FATS     2
 
+#ifndef AFATFS_MAX_OPEN_FILES
 #define AFATFS_MAX_OPEN_FILES 3
+#endif
 
 #define AFATFS_DEFAULT_FILE_DATE FAT_MAKE_DATE(2015, 12, 01)
 #define AFATFS_DEFAULT_FILE_TIME FAT_MAKE_TIME(00, 00, 00)
@@ -52,6 +60,25 @@
  */
 #define AFATFS_MIN_MULTIPLE_BLOCK_WRITE_COUNT 4
 
+/*
+ * Write-behind: while a file is still filling the sector that would extend a run of dirty sectors (or continue the
+ * multi-block write that is in progress), hold back flushes of other sectors so that the run goes out in one burst
+ * instead of being broken up by a FAT or directory update. We give up waiting once this many sectors are dirty or
+ * we have deferred this many flush attempts in a row.
+ */
+#ifndef AFATFS_WRITE_BEHIND_DIRTY_LIMIT
+#define AFATFS_WRITE_BEHIND_DIRTY_LIMIT (AFATFS_NUM_CACHE_SECTORS / 2)
+#endif
+#define AFATFS_WRITE_BEHIND_MAX_DEFERRALS 32
+
+/*
+ * How many sectors beyond the cursor of a file opened read-only we'll fetch while the card is otherwise idle. Set to
+ * zero to disable read-ahead.
+ */
+#ifndef AFATFS_READ_AHEAD_SECTORS
+#define AFATFS_READ_AHEAD_SECTORS (AFATFS_NUM_CACHE_SECTORS / 4)
+#endif
+
 #define AFATFS_FILES_PER_DIRECTORY_SECTOR (AFATFS_SECTOR_SIZE / sizeof(fatDirectoryEntry_t))
 
 #define AFATFS_FAT32_FAT_ENTRIES_PER_SECTOR  (AFATFS_SECTOR_SIZE / sizeof(uint32_t))
@@ -191,6 +218,9 @@ typedef struct afatfsCacheBlockDescriptor_t {
      * is overridden by the locked and retainCount flags.
      */
     unsigned discardable:1;
+
+    // This sector was fetched by read-ahead and nobody has asked for it yet
+    unsigned prefetched:1;
 } afatfsCacheBlockDescriptor_t;
 
 typedef enum {
@@ -444,6 +474,13 @@ typedef struct afatfs_t {
     int cacheDirtyEntries; // The number of cache entries in the AFATFS_CACHE_STATE_DIRTY state
     bool cacheFlushInProgress;
 
+    // The multi-block write we believe the card is in the middle of (no burst in progress if writeBurstRemaining is 0)
+    uint32_t writeBurstNextSector;
+    uint32_t writeBurstRemaining;
+    uint8_t writeBehindDeferrals; // Number of afatfs_flush() calls in a row that held back a flush
+
+    afatfsStatistics_t stats;
+
     afatfsFile_t openFiles[AFATFS_MAX_OPEN_FILES];
 
 #ifdef AFATFS_USE_FREEFILE
@@ -615,6 +652,7 @@ static void afatfs_cacheSectorInit(afatfsCacheBlockDescriptor_t *descriptor, uin
     descriptor->locked = locked;
     descriptor->retainCount = 0;
     descriptor->discardable = 0;
+    descriptor->prefetched = 0;
 }
 
 /**
@@ -664,6 +702,9 @@ static void afatfs_sdcardWriteComplete(sdcardBlockOperation_e operation, uint32_
                 // Write failed, remark the sector as dirty
                 afatfs.cacheDescriptor[i].state = AFATFS_CACHE_STATE_DIRTY;
                 afatfs.cacheDirtyEntries++;
+
+                // The card abandons any multi-block write when a write fails
+                afatfs.writeBurstRemaining = 0;
             } else {
                 afatfs_assert(afatfs_cacheSectorGetMemory(i) == buffer);
 
@@ -676,15 +717,26 @@ static void afatfs_sdcardWriteComplete(sdcardBlockOperation_e operation, uint32_
 
 /**
  * Attempt to flush the dirty cache entry with the given index to the SDcard.
+ *
+ * burstLength - The number of consecutive dirty sectors (including this one) which are ready to be written along with
+ *               this one. If this is long enough, we'll start a multi-block write to cover them.
  */
-static void afatfs_cacheFlushSector(int cacheIndex)
+static void afatfs_cacheFlushSector(int cacheIndex, uint32_t burstLength)
 {
     afatfsCacheBlockDescriptor_t *cacheDescriptor = &afatfs.cacheDescriptor[cacheIndex];
+    bool continuingBurst = afatfs.writeBurstRemaining > 0 && cacheDescriptor->sectorIndex == afatfs.writeBurstNextSector;
+    bool startingBurst = false;
 
 #ifdef AFATFS_MIN_MULTIPLE_BLOCK_WRITE_COUNT
-    if (cacheDescriptor->consecutiveEraseBlockCount) {
-        sdcard_beginWriteBlocks(cacheDescriptor->sectorIndex, cacheDescriptor->consecutiveEraseBlockCount);
+    burstLength = MAX(burstLength, cacheDescriptor->consecutiveEraseBlockCount);
+
+    // If we're continuing a burst, the card will recognise that and carry on with the multi-block write it's already in
+    if (cacheDescriptor->consecutiveEraseBlockCount || (!continuingBurst && burstLength >= AFATFS_MIN_MULTIPLE_BLOCK_WRITE_COUNT)) {
+        startingBurst = sdcard_beginWriteBlocks(cacheDescriptor->sectorIndex, burstLength) == SDCARD_OPERATION_SUCCESS
+            && !continuingBurst;
     }
+#else
+    (void) burstLength;
 #endif
 
     switch (sdcard_writeBlock(cacheDescriptor->sectorIndex, afatfs_cacheSectorGetMemory(cacheIndex), afatfs_sdcardWriteComplete, 0)) {
@@ -704,7 +756,23 @@ static void afatfs_cacheFlushSector(int cacheIndex)
         case SDCARD_OPERATION_BUSY:
         case SDCARD_OPERATION_FAILURE:
         default:
-            ;
+            return;
+    }
+
+    afatfs.writeBehindDeferrals = 0;
+
+    if (continuingBurst) {
+        afatfs.writeBurstNextSector++;
+        afatfs.writeBurstRemaining--;
+        afatfs.stats.writeBurstSectors++;
+    } else if (startingBurst) {
+        afatfs.writeBurstNextSector = cacheDescriptor->sectorIndex + 1;
+        afatfs.writeBurstRemaining = burstLength - 1;
+        afatfs.stats.writeBursts++;
+        afatfs.stats.writeBurstSectors++;
+    } else {
+        // A single block write to anywhere else ends any multi-block write the card was doing
+        afatfs.writeBurstRemaining = 0;
     }
 }
 
@@ -805,6 +873,34 @@ static int afatfs_allocateCacheSector(uint32_t sectorIndex)
     return allocateIndex;
 }
 
+/**
+ * Count the dirty, unlocked sectors in the cache which are physically consecutive, starting from the given sector.
+ */
+static uint32_t afatfs_cacheCountDirtyRun(uint32_t sectorIndex)
+{
+    uint32_t count = 0;
+    afatfsCacheBlockDescriptor_t *descriptor;
+
+    while (count < AFATFS_NUM_CACHE_SECTORS
+        && (descriptor = afatfs_findCacheSector(sectorIndex + count)) != NULL
+        && descriptor->state == AFATFS_CACHE_STATE_DIRTY && !descriptor->locked
+    ) {
+        count++;
+    }
+
+    return count;
+}
+
+/**
+ * Returns true if the given sector is in the cache and locked, i.e. a file is in the middle of writing to it.
+ */
+static bool afatfs_cacheSectorIsBeingWritten(uint32_t sectorIndex)
+{
+    afatfsCacheBlockDescriptor_t *descriptor = afatfs_findCacheSector(sectorIndex);
+
+    return descriptor != NULL && descriptor->state != AFATFS_CACHE_STATE_EMPTY && descriptor->locked;
+}
+
 /**
  * Attempt to flush dirty cache pages out to the sdcard, returning true if all flushable data has been flushed.
  */
@@ -815,17 +911,62 @@ bool afatfs_flush(void)
         uint32_t earliestSectorTime = 0xFFFFFFFF;
         int earliestSectorIndex = -1;
 
+        // Or in preference, the sector which continues the multi-block write that's in progress
+        int burstSectorIndex = -1;
+        bool burstSectorBeingWritten = false;
+
         for (int i = 0; i < AFATFS_NUM_CACHE_SECTORS; i++) {
-            if (afatfs.cacheDescriptor[i].state == AFATFS_CACHE_STATE_DIRTY && !afatfs.cacheDescriptor[i].locked
-                && (earliestSectorIndex == -1 || afatfs.cacheDescriptor[i].writeTimestamp < earliestSectorTime)
+            afatfsCacheBlockDescriptor_t *descriptor = &afatfs.cacheDescriptor[i];
+
+            if (afatfs.writeBurstRemaining > 0 && descriptor->sectorIndex == afatfs.writeBurstNextSector
+                && descriptor->state != AFATFS_CACHE_STATE_EMPTY
+            ) {
+                if (descriptor->locked) {
+                    burstSectorBeingWritten = true;
+                } else if (descriptor->state == AFATFS_CACHE_STATE_DIRTY) {
+                    burstSectorIndex = i;
+                }
+            }
+
+            if (descriptor->state == AFATFS_CACHE_STATE_DIRTY && !descriptor->locked
+                && (earliestSectorIndex == -1 || descriptor->writeTimestamp < earliestSectorTime)
             ) {
                 earliestSectorIndex = i;
-                earliestSectorTime = afatfs.cacheDescriptor[i].writeTimestamp;
+                earliestSectorTime = descriptor->writeTimestamp;
             }
         }
 
+        if (burstSectorIndex > -1) {
+            afatfs_cacheFlushSector(burstSectorIndex, 0);
+
+            return false;
+        }
+
         if (earliestSectorIndex > -1) {
-            afatfs_cacheFlushSector(earliestSectorIndex);
+            uint32_t sectorIndex = afatfs.cacheDescriptor[earliestSectorIndex].sectorIndex;
+            uint32_t runLength = afatfs_cacheCountDirtyRun(sectorIndex);
+
+#ifdef AFATFS_MIN_MULTIPLE_BLOCK_WRITE_COUNT
+            /*
+             * If a file is still filling the sector which would carry on the current burst (or lengthen this run into
+             * one), writing this sector now would break that up. Wait a little while for the file to move on, as long
+             * as we aren't running short of cache.
+             */
+            if ((burstSectorBeingWritten
+                    || (runLength < AFATFS_MIN_MULTIPLE_BLOCK_WRITE_COUNT && afatfs_cacheSectorIsBeingWritten(sectorIndex + runLength)))
+                && afatfs.cacheDirtyEntries <= AFATFS_WRITE_BEHIND_DIRTY_LIMIT
+                && afatfs.writeBehindDeferrals < AFATFS_WRITE_BEHIND_MAX_DEFERRALS
+            ) {
+                afatfs.writeBehindDeferrals++;
+                afatfs.stats.writeDeferrals++;
+
+                return false;
+            }
+#else
+            (void) burstSectorBeingWritten;
+#endif
+
+            afatfs_cacheFlushSector(earliestSectorIndex, runLength);
 
             // That flush will take time to complete so we may as well tell caller to come back later
             return false;
@@ -906,9 +1047,23 @@ static afatfsOperationStatus_e afatfs_cacheSector(uint32_t physicalSectorIndex,
 
     if (cacheSectorIndex == -1) {
         // We don't have enough free cache to service this request right now, try again later
+        afatfs.stats.cacheFullStalls++;
         return AFATFS_OPERATION_IN_PROGRESS;
     }
 
+    afatfsCacheBlockDescriptor_t *descriptor = &afatfs.cacheDescriptor[cacheSectorIndex];
+
+    if ((sectorFlags & AFATFS_CACHE_READ) != 0
+        && descriptor->state != AFATFS_CACHE_STATE_EMPTY && descriptor->state != AFATFS_CACHE_STATE_READING
+    ) {
+        afatfs.stats.cacheHits++;
+
+        if (descriptor->prefetched) {
+            afatfs.stats.readAheadHits++;
+            descriptor->prefetched = 0;
+        }
+    }
+
     switch (afatfs.cacheDescriptor[cacheSectorIndex].state) {
         case AFATFS_CACHE_STATE_READING:
             return AFATFS_OPERATION_IN_PROGRESS;
@@ -918,6 +1073,10 @@ static afatfsOperationStatus_e afatfs_cacheSector(uint32_t physicalSectorIndex,
             if ((sectorFlags & AFATFS_CACHE_READ) != 0) {
                 if (sdcard_readBlock(physicalSectorIndex, afatfs_cacheSectorGetMemory(cacheSectorIndex), afatfs_sdcardReadComplete, 0)) {
                     afatfs.cacheDescriptor[cacheSectorIndex].state = AFATFS_CACHE_STATE_READING;
+                    afatfs.stats.cacheMisses++;
+
+                    // The card has to end any multi-block write in progress to service the read
+                    afatfs.writeBurstRemaining = 0;
                 }
                 return AFATFS_OPERATION_IN_PROGRESS;
             }
@@ -1830,6 +1989,74 @@ static uint8_t* afatfs_fileRetainCursorSectorForRead(afatfsFilePtr_t file)
     return result;
 }
 
+/**
+ * Begin reading the given sector into the cache in anticipation of it being asked for soon. Only does anything if the
+ * card is idle and the sector isn't cached already.
+ */
+static void afatfs_cacheReadAhead(uint32_t physicalSectorIndex)
+{
+    afatfsCacheBlockDescriptor_t *descriptor = afatfs_findCacheSector(physicalSectorIndex);
+
+    if (descriptor != NULL && descriptor->state != AFATFS_CACHE_STATE_EMPTY) {
+        return;
+    }
+
+    // Flushing dirty sectors takes priority, and reading now would end any multi-block write the card is in
+    if (afatfs.cacheDirtyEntries > 0 || afatfs.cacheFlushInProgress || afatfs.writeBurstRemaining > 0) {
+        return;
+    }
+
+    int cacheSectorIndex = afatfs_allocateCacheSector(physicalSectorIndex);
+
+    if (cacheSectorIndex == -1) {
+        return;
+    }
+
+    if (sdcard_readBlock(physicalSectorIndex, afatfs_cacheSectorGetMemory(cacheSectorIndex), afatfs_sdcardReadComplete, 0)) {
+        afatfs.cacheDescriptor[cacheSectorIndex].state = AFATFS_CACHE_STATE_READING;
+        afatfs.cacheDescriptor[cacheSectorIndex].prefetched = 1;
+        afatfs.stats.readAheads++;
+    }
+}
+
+/**
+ * Prefetch the sectors following the cursor of a file that is being read sequentially. We don't look beyond the end
+ * of the cursor's cluster, since finding the next cluster would need a FAT lookup.
+ */
+static void afatfs_fileReadAhead(afatfsFilePtr_t file)
+{
+#if AFATFS_READ_AHEAD_SECTORS > 0
+    if (file->type != AFATFS_FILE_TYPE_NORMAL
+        || (file->mode & (AFATFS_FILE_MODE_WRITE | AFATFS_FILE_MODE_APPEND)) != 0
+        || afatfs_isEndOfAllocatedFile(file)
+    ) {
+        return;
+    }
+
+    uint32_t physicalSector = afatfs_fileGetCursorPhysicalSector(file);
+    uint32_t sectorIndexInCluster = afatfs_sectorIndexInCluster(file->cursorOffset);
+    uint32_t offsetOfStartOfSector = file->cursorOffset & ~((uint32_t) AFATFS_SECTOR_SIZE - 1);
+
+    for (uint32_t i = 1; i <= AFATFS_READ_AHEAD_SECTORS; i++) {
+        if (sectorIndexInCluster + i >= afatfs.sectorsPerCluster
+            || offsetOfStartOfSector + i * AFATFS_SECTOR_SIZE >= file->logicalSize
+        ) {
+            break;
+        }
+
+        afatfsCacheBlockDescriptor_t *descriptor = afatfs_findCacheSector(physicalSector + i);
+
+        if (descriptor == NULL || descriptor->state == AFATFS_CACHE_STATE_EMPTY) {
+            // The card can only do one read at a time, so the rest will have to wait for a later call
+            afatfs_cacheReadAhead(physicalSector + i);
+            break;
+        }
+    }
+#else
+    (void) file;
+#endif
+}
+
 /**
  * Lock the sector at the file's cursor position for write, and return a reference to the memory for that sector.
  *
@@ -3138,6 +3365,14 @@ uint32_t afatfs_fread(afatfsFilePtr_t file, uint8_t *buffer, uint32_t len)
 
         readBytes += bytesToReadThisSector;
 
+        /*
+         * We don't expect a sequential reader to come back for a sector it has finished with, so let it be evicted
+         * ahead of sectors that have been read ahead for it.
+         */
+        if (cursorOffsetInSector + bytesToReadThisSector == AFATFS_SECTOR_SIZE && (file->mode & AFATFS_FILE_MODE_WRITE) == 0) {
+            afatfs.cacheDescriptor[file->readRetainCacheIndex].discardable = 1;
+        }
+
         /*
          * If the seek doesn't complete immediately then we'll break and wait for that seek to complete by waiting for
          * the file to be non-busy on entry again.
@@ -3154,6 +3389,8 @@ uint32_t afatfs_fread(afatfsFilePtr_t file, uint8_t *buffer, uint32_t len)
         cursorOffsetInSector = 0;
     }
 
+    afatfs_fileReadAhead(file);
+
     return readBytes;
 }
 
@@ -3495,6 +3732,9 @@ static void afatfs_initContinue(void)
  */
 void afatfs_poll(void)
 {
+    afatfs.stats.polls++;
+    afatfs.stats.dirtyHighWater = MAX(afatfs.stats.dirtyHighWater, afatfs.cacheDirtyEntries);
+
     // Only attempt to continue FS operations if the card is present & ready, otherwise we would just be wasting time
     if (sdcard_poll()) {
         afatfs_flush();
@@ -3509,9 +3749,19 @@ void afatfs_poll(void)
             default:
                 ;
         }
+    } else if (afatfs.filesystemState == AFATFS_FILESYSTEM_STATE_READY) {
+        afatfs.stats.cardBusyPolls++;
     }
 }
 
+/**
+ * Get the cache and write scheduling counters accumulated by afatfs_poll() and the file operations it drives.
+ */
+void afatfs_getStatistics(afatfsStatistics_t *stats)
+{
+    *stats = afatfs.stats;
+}
+
 #ifdef AFATFS_USE_INTROSPECTIVE_LOGGING
 
 void afatfs_sdcardProfilerCallback(sdcardBlockOperation_e operation, uint32_t blockIndex, uint32_t duration)
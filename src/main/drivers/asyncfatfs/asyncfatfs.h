@@ -57,6 +57,20 @@ typedef enum {
     AFATFS_SEEK_END,
 } afatfsSeek_e;
 
+typedef struct afatfsStatistics_t {
+    uint32_t polls;             // Calls to afatfs_poll()
+    uint32_t cardBusyPolls;     // Polls that found the card still busy with a previous operation
+    uint32_t cacheHits;         // Sector reads served from the cache
+    uint32_t cacheMisses;       // Sector reads that had to go to the card
+    uint32_t readAheads;        // Sectors fetched by read-ahead
+    uint32_t readAheadHits;     // Sectors fetched by read-ahead which were then asked for
+    uint32_t cacheFullStalls;   // Requests turned away because no cache sector could be evicted
+    uint32_t writeBursts;       // Multi-block writes started
+    uint32_t writeBurstSectors; // Sectors written as part of a multi-block write
+    uint32_t writeDeferrals;    // Flushes held back to avoid breaking up a burst
+    uint16_t dirtyHighWater;    // Largest number of dirty cache sectors seen by afatfs_poll()
+} afatfsStatistics_t;
+
 typedef void (*afatfsFileCallback_t)(afatfsFilePtr_t file);
 typedef void (*afatfsCallback_t)(void);
 
@@ -83,6 +97,7 @@ bool afatfs_flush(void);
 void afatfs_init(void);
 bool afatfs_destroy(bool dirty);
 void afatfs_poll(void);
+void afatfs_getStatistics(afatfsStatistics_t *stats);
 
 uint32_t afatfs_getFreeBufferSpace(void);
 uint32_t afatfs_getContiguousFreeSpace(void);
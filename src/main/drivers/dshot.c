@@ -0,0 +1,90 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * DShot frame encoding. This part does not touch any hardware so that it can
+ * be shared between targets and tested on the host. Timer and dma setup lives
+ * in pwm_output.c.
+ *
+ * A frame is sent msb first. Each bit has the same period and is told apart by
+ * its high time which is 3/4 of the period for a one and 3/8 for a zero.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "common/maths.h"
+
+#include "dshot.h"
+
+void dshot_timing_init(struct dshot_timing *self, uint16_t rate_khz, uint32_t timer_hz){
+	self->period = timer_hz / ((uint32_t)rate_khz * 1000);
+	self->bit1 = (self->period * 3) / 4;
+	self->bit0 = (self->period * 3) / 8;
+}
+
+uint16_t dshot_frame(uint16_t value, bool telemetry){
+	uint16_t packet = ((value & 0x7ff) << 1) | (telemetry?1:0);
+	uint16_t csum = (packet ^ (packet >> 4) ^ (packet >> 8)) & 0xf;
+	return (packet << 4) | csum;
+}
+
+uint16_t dshot_throttle_from_pwm(uint16_t pwm){
+	if(pwm <= 1000) return DSHOT_CMD_MOTOR_STOP;
+	uint32_t value = DSHOT_MIN_THROTTLE + ((uint32_t)(pwm - 1000) * (DSHOT_MAX_THROTTLE - DSHOT_MIN_THROTTLE)) / 1000;
+	return MIN(value, DSHOT_MAX_THROTTLE);
+}
+
+uint8_t dshot_command_repeats(dshot_command_t cmd){
+	switch(cmd){
+		case DSHOT_CMD_SPIN_DIRECTION_1:
+		case DSHOT_CMD_SPIN_DIRECTION_2:
+		case DSHOT_CMD_3D_MODE_OFF:
+		case DSHOT_CMD_3D_MODE_ON:
+		case DSHOT_CMD_SAVE_SETTINGS:
+		case DSHOT_CMD_SPIN_DIRECTION_NORMAL:
+		case DSHOT_CMD_SPIN_DIRECTION_REVERSED:
+			return 6;
+		case DSHOT_CMD_MOTOR_STOP:
+		case DSHOT_CMD_BEEP1:
+		case DSHOT_CMD_BEEP2:
+		case DSHOT_CMD_BEEP3:
+		case DSHOT_CMD_BEEP4:
+		case DSHOT_CMD_BEEP5:
+		case DSHOT_CMD_ESC_INFO:
+		case DSHOT_CMD_SETTINGS_REQUEST:
+		case DSHOT_CMD_MAX:
+			break;
+	}
+	return 1;
+}
+
+void dshot_encode(uint16_t *buf, const uint16_t *frames, uint8_t count, const struct dshot_timing *timing){
+	for(uint8_t ch = 0; ch < count; ch++){
+		uint16_t frame = frames[ch];
+		uint16_t *out = buf + ch;
+		for(int bit = 0; bit < DSHOT_FRAME_BITS; bit++){
+			*out = (frame & 0x8000)?timing->bit1:timing->bit0;
+			frame <<= 1;
+			out += count;
+		}
+		for(int c = 0; c < DSHOT_FRAME_PAD; c++){
+			*out = 0;
+			out += count;
+		}
+	}
+}
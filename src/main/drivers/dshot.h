@@ -0,0 +1,81 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//! bits in one dshot frame (11 bit value, telemetry request bit and 4 bit checksum)
+#define DSHOT_FRAME_BITS 16
+//! zero duty slots appended after each frame so that the line stays low until the next update
+#define DSHOT_FRAME_PAD 2
+//! number of timer compare values needed to send one frame on each of count channels
+#define DSHOT_DMA_BUFFER_SIZE(count) ((DSHOT_FRAME_BITS + DSHOT_FRAME_PAD) * (count))
+
+//! lowest and highest value that is interpreted as throttle by the esc. Values below are commands.
+#define DSHOT_MIN_THROTTLE 48
+#define DSHOT_MAX_THROTTLE 2047
+
+//! special values that are sent in place of throttle while motors are stopped
+typedef enum {
+	DSHOT_CMD_MOTOR_STOP = 0,
+	DSHOT_CMD_BEEP1,
+	DSHOT_CMD_BEEP2,
+	DSHOT_CMD_BEEP3,
+	DSHOT_CMD_BEEP4,
+	DSHOT_CMD_BEEP5,
+	DSHOT_CMD_ESC_INFO,
+	DSHOT_CMD_SPIN_DIRECTION_1,
+	DSHOT_CMD_SPIN_DIRECTION_2,
+	DSHOT_CMD_3D_MODE_OFF,
+	DSHOT_CMD_3D_MODE_ON,
+	DSHOT_CMD_SETTINGS_REQUEST,
+	DSHOT_CMD_SAVE_SETTINGS,
+	DSHOT_CMD_SPIN_DIRECTION_NORMAL = 20,
+	DSHOT_CMD_SPIN_DIRECTION_REVERSED = 21,
+	DSHOT_CMD_MAX = 47
+} dshot_command_t;
+
+//! timer compare values for one dshot bit at a given bit rate and timer clock
+struct dshot_timing {
+	uint16_t period;	//!< timer ticks per bit
+	uint16_t bit0;		//!< high time of a zero bit
+	uint16_t bit1;		//!< high time of a one bit
+};
+
+//! calculates bit timing for dshot rate in kbit/s (150, 300 or 600) from timer clock in hz
+void dshot_timing_init(struct dshot_timing *self, uint16_t rate_khz, uint32_t timer_hz);
+
+//! builds a 16 bit dshot frame from an 11 bit value and the telemetry request flag
+uint16_t dshot_frame(uint16_t value, bool telemetry);
+
+//! converts a pwm motor value (1000-2000) into dshot throttle. Values at or below 1000 stop the motor.
+uint16_t dshot_throttle_from_pwm(uint16_t pwm);
+
+//! returns how many consecutive frames the esc expects to receive for a command before acting on it
+uint8_t dshot_command_repeats(dshot_command_t cmd);
+
+/**
+ * Fills a dma buffer with timer compare values for count frames. Values are
+ * interleaved so that each group of count values updates all channels for one
+ * bit, which is the order a timer dma burst writes them in.
+ *
+ * @param buf buffer of at least DSHOT_DMA_BUFFER_SIZE(count) entries
+ * @param frames count frames, one per timer channel
+ */
+void dshot_encode(uint16_t *buf, const uint16_t *frames, uint8_t count, const struct dshot_timing *timing);
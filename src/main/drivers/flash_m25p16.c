@@ -66,6 +66,14 @@ static flashGeometry_t geometry = {.pageSize = M25P16_PAGESIZE};
  */
 static bool couldBeBusy = false;
 
+#ifdef M25P16_DMA_CHANNEL_TX
+/*
+ * True while a page program started by m25p16_pageProgramAsync() is still clocking its payload out over DMA. Chip
+ * select is held low (and the caller's buffer must stay untouched) until m25p16_isTransferring() reports completion.
+ */
+static bool dmaInProgress = false;
+#endif
+
 /**
  * Send the given command byte to the device.
  */
@@ -104,8 +112,52 @@ static uint8_t m25p16_readStatus(void)
     return in[1];
 }
 
+/**
+ * Returns true while the payload of an asynchronous page program is still being sent to the chip, in which case the
+ * buffer that was passed to m25p16_pageProgramAsync() must not be modified yet.
+ *
+ * Once the DMA transfer completes this finishes off the program command so that the chip starts its internal
+ * programming cycle.
+ */
+bool m25p16_isTransferring(void)
+{
+#ifdef M25P16_DMA_CHANNEL_TX
+    if (!dmaInProgress) {
+        return false;
+    }
+
+    if (DMA_GetFlagStatus(M25P16_DMA_CHANNEL_TX_COMPLETE_FLAG) != SET) {
+        return true;
+    }
+
+    DMA_ClearFlag(M25P16_DMA_CHANNEL_TX_COMPLETE_FLAG);
+
+    DMA_Cmd(M25P16_DMA_CHANNEL_TX, DISABLE);
+
+    // Drain anything left in the Rx FIFO (we didn't read it during the write)
+    while (SPI_I2S_GetFlagStatus(M25P16_SPI_INSTANCE, SPI_I2S_FLAG_RXNE) == SET) {
+        M25P16_SPI_INSTANCE->DR;
+    }
+
+    // Wait for the final bit to be transmitted before releasing chip select
+    while (spiIsBusBusy(M25P16_SPI_INSTANCE)) {
+    }
+
+    SPI_I2S_DMACmd(M25P16_SPI_INSTANCE, SPI_I2S_DMAReq_Tx, DISABLE);
+
+    DISABLE_M25P16;
+
+    dmaInProgress = false;
+#endif
+    return false;
+}
+
 bool m25p16_isReady(void)
 {
+    if (m25p16_isTransferring()) {
+        return false;
+    }
+
     // If couldBeBusy is false, don't bother to poll the flash chip for its status
     couldBeBusy = couldBeBusy && ((m25p16_readStatus() & M25P16_STATUS_FLAG_WRITE_IN_PROGRESS) != 0);
 
@@ -195,6 +247,9 @@ static bool m25p16_readIdentification(void)
  */
 bool m25p16_init(void)
 {
+#ifdef M25P16_DMA_CHANNEL_TX
+    RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+#endif
     //Maximum speed for standard READ command is 20mHz, other commands tolerate 25mHz
     spiSetDivisor(M25P16_SPI_INSTANCE, SPI_18MHZ_CLOCK_DIVIDER);
 
@@ -275,6 +330,56 @@ void m25p16_pageProgram(uint32_t address, const uint8_t *data, int length)
     m25p16_pageProgramFinish();
 }
 
+/**
+ * Begin programming a flash page without waiting for the payload to be sent, if the target has a DMA channel for the
+ * flash SPI bus. Address must not cross a page boundary.
+ *
+ * The device must already be ready (see m25p16_isReady()), this routine doesn't wait for it. The `data` buffer must
+ * stay valid until m25p16_isTransferring() returns false, which lets the caller refill the rest of its buffers while
+ * the payload is clocked out and the chip is programming.
+ *
+ * Without DMA support this falls back to a blocking m25p16_pageProgram().
+ */
+void m25p16_pageProgramAsync(uint32_t address, const uint8_t *data, int length)
+{
+#ifdef M25P16_DMA_CHANNEL_TX
+    uint8_t command[] = { M25P16_INSTRUCTION_PAGE_PROGRAM, (address >> 16) & 0xFF, (address >> 8) & 0xFF, address & 0xFF};
+    DMA_InitTypeDef DMA_InitStructure;
+
+    m25p16_writeEnable();
+
+    ENABLE_M25P16;
+
+    spiTransfer(M25P16_SPI_INSTANCE, NULL, command, sizeof(command));
+
+    DMA_StructInit(&DMA_InitStructure);
+    DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t) &M25P16_SPI_INSTANCE->DR;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_Low;
+    DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+    DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+    DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t) data;
+    DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+
+    DMA_InitStructure.DMA_BufferSize = length;
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralDST;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+
+    DMA_DeInit(M25P16_DMA_CHANNEL_TX);
+    DMA_Init(M25P16_DMA_CHANNEL_TX, &DMA_InitStructure);
+
+    dmaInProgress = true;
+
+    DMA_Cmd(M25P16_DMA_CHANNEL_TX, ENABLE);
+
+    SPI_I2S_DMACmd(M25P16_SPI_INSTANCE, SPI_I2S_DMAReq_Tx, ENABLE);
+#else
+    m25p16_pageProgram(address, data, length);
+#endif
+}
+
 /**
  * Read `length` bytes into the provided `buffer` from the flash starting from the given `address` (which need not lie
  * on a page boundary).
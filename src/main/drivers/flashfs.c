@@ -34,6 +34,7 @@
 #include <string.h>
 
 #include "drivers/flash_m25p16.h"
+#include "drivers/system.h"
 #include "flashfs.h"
 
 static uint8_t flashWriteBuffer[FLASHFS_WRITE_BUFFER_SIZE];
@@ -41,18 +42,47 @@ static uint8_t flashWriteBuffer[FLASHFS_WRITE_BUFFER_SIZE];
 /* The position of our head and tail in the circular flash write buffer.
  *
  * The head is the index that a byte would be inserted into on writing, while the tail is the index of the
- * oldest byte that has yet to be written to flash.
+ * oldest byte that has yet to be written to flash. Bytes between bufferInFlight and the tail have been handed to the
+ * flash chip but may still be being clocked out of the buffer by DMA, so they can't be overwritten yet.
+ *
+ * The buffer is a whole number of flash pages long and the tail always sits at the same offset within a page as
+ * tailAddress does in the flash, so the data for one page program never wraps around the end of the buffer and can
+ * be sent to the chip straight out of the buffer.
  *
  * When the circular buffer is empty, head == tail
  */
-static uint8_t bufferHead = 0, bufferTail = 0;
+static uint16_t bufferHead = 0, bufferTail = 0, bufferInFlight = 0;
 
 // The position of the buffer's tail in the overall flash address space:
 static uint32_t tailAddress = 0;
 
+// How long synchronous writes wait for the flash to finish its previous operation (page program max is 5ms)
+#define FLASHFS_SYNC_TIMEOUT_MILLIS 10
+// Same for when that operation is a sector erase
+#define FLASHFS_ERASE_TIMEOUT_MILLIS 5000
+
+/*
+ * Sectors that still hold old data and must be erased before we can program them. These are erased in the background
+ * by flashfsEraseUpdate() ahead of the write pointer, or on demand when the write pointer reaches one first.
+ */
+static uint8_t sectorPendingErase[FLASHFS_MAX_SECTORS / 8];
+static uint16_t sectorsPendingErase = 0;
+
+// Whether the last operation we started on the flash was a sector erase, which takes much longer than a program
+static bool sectorEraseInProgress = false;
+
+// While a log is being written the chip is kept free for page programs, see flashfsSetLogging()
+static bool logging = false;
+
+static flashfsWriteStats_t writeStats;
+
+// Start of the current throughput measurement window
+static uint32_t statsWindowStartTime;
+static uint32_t statsWindowStartBytes;
+
 static void flashfsClearBuffer(void)
 {
-    bufferTail = bufferHead = 0;
+    bufferTail = bufferHead = bufferInFlight = tailAddress % M25P16_PAGESIZE;
 }
 
 static bool flashfsBufferIsEmpty(void)
@@ -63,13 +93,54 @@ static bool flashfsBufferIsEmpty(void)
 static void flashfsSetTailAddress(uint32_t address)
 {
     tailAddress = address;
+
+    // Keep the buffer aligned with flash pages (the buffer is always empty when we seek)
+    flashfsClearBuffer();
+}
+
+static bool flashfsSectorIsPendingErase(uint16_t sector)
+{
+    return (sectorPendingErase[sector / 8] & (1 << (sector % 8))) != 0;
+}
+
+static void flashfsSetSectorPendingErase(uint16_t sector, bool pending)
+{
+    if (sector >= FLASHFS_MAX_SECTORS || flashfsSectorIsPendingErase(sector) == pending) {
+        return;
+    }
+
+    if (pending) {
+        sectorPendingErase[sector / 8] |= 1 << (sector % 8);
+        sectorsPendingErase++;
+    } else {
+        sectorPendingErase[sector / 8] &= ~(1 << (sector % 8));
+        sectorsPendingErase--;
+    }
+}
+
+/**
+ * Start erasing the given sector, the flash must be ready.
+ */
+static void flashfsEraseSector(uint16_t sector)
+{
+    m25p16_eraseSector(sector * m25p16_getGeometry()->sectorSize);
+
+    flashfsSetSectorPendingErase(sector, false);
+
+    sectorEraseInProgress = true;
 }
 
+/**
+ * Erase the volume and rewind the file pointer to the beginning so that logging can start again right away.
+ *
+ * This doesn't wait for the erase: only the sectors that have been written to are scheduled to be erased, which
+ * happens in the background (see flashfsEraseUpdate()) ahead of new writes.
+ */
 void flashfsEraseCompletely(void)
 {
-    m25p16_eraseCompletely();
+    flashfsFlushSync();
 
-    flashfsClearBuffer();
+    flashfsEraseRange(0, flashfsGetOffset());
 
     flashfsSetTailAddress(0);
 }
@@ -77,6 +148,8 @@ void flashfsEraseCompletely(void)
 /**
  * Start and end must lie on sector boundaries, or they will be rounded out to sector boundaries such that
  * all the bytes in the range [start...end) are erased.
+ *
+ * The sectors are erased in the background by flashfsEraseUpdate(), or just before the file pointer reaches them.
  */
 void flashfsEraseRange(uint32_t start, uint32_t end)
 {
@@ -97,10 +170,78 @@ void flashfsEraseRange(uint32_t start, uint32_t end)
     }
 
     for (int i = startSector; i < endSector; i++) {
-        m25p16_eraseSector(i * geometry->sectorSize);
+        flashfsSetSectorPendingErase(i, true);
+    }
+}
+
+/**
+ * Erase the next sector that is waiting to be erased, starting with the one closest ahead of the file pointer so that
+ * the erased space in front of the next log grows first.
+ *
+ * Intended to be called from an idle priority task. Never waits for the flash: if it is busy with a program or an
+ * earlier erase then this returns without doing anything. Nothing is erased while logging, the chip can't program
+ * pages during the whole time a sector erase takes and the write buffer would overflow.
+ */
+void flashfsEraseUpdate(void)
+{
+    if (logging || sectorsPendingErase == 0 || !m25p16_isReady()) {
+        return;
+    }
+
+    const flashGeometry_t *geometry = m25p16_getGeometry();
+
+    if (geometry->sectorSize <= 0 || geometry->sectors <= 0)
+        return;
+
+    uint16_t headSector = tailAddress / geometry->sectorSize;
+
+    for (uint16_t i = 0; i < geometry->sectors; i++) {
+        uint16_t sector = (headSector + i) % geometry->sectors;
+
+        if (flashfsSectorIsPendingErase(sector)) {
+            flashfsEraseSector(sector);
+            break;
+        }
     }
 }
 
+/**
+ * Get the number of sectors that are still waiting to be erased in the background.
+ */
+uint16_t flashfsGetSectorsPendingErase(void)
+{
+    return sectorsPendingErase;
+}
+
+/**
+ * Get the number of bytes ahead of the file pointer that are erased and can be logged to without stalling on an erase.
+ */
+uint32_t flashfsGetErasedReserve(void)
+{
+    const flashGeometry_t *geometry = m25p16_getGeometry();
+    uint32_t offset = flashfsGetOffset();
+
+    if (geometry->sectorSize <= 0 || offset >= geometry->totalSize)
+        return 0;
+
+    uint16_t sector = offset / geometry->sectorSize;
+
+    while (sector < geometry->sectors && !flashfsSectorIsPendingErase(sector)) {
+        sector++;
+    }
+
+    return sector * geometry->sectorSize - offset;
+}
+
+/**
+ * Tell flashfs whether a log is being written. Background erase is suspended while logging, so a log only runs
+ * without interruption for as long as the erased reserve ahead of it lasts (see flashfsGetErasedReserve()).
+ */
+void flashfsSetLogging(bool active)
+{
+    logging = active;
+}
+
 /**
  * Return true if the flash is not currently occupied with an operation.
  */
@@ -114,12 +255,30 @@ uint32_t flashfsGetSize(void)
     return m25p16_getGeometry()->totalSize;
 }
 
+static uint32_t flashfsBufferDistance(uint16_t from, uint16_t to)
+{
+    if (to >= from)
+        return to - from;
+
+    return FLASHFS_WRITE_BUFFER_SIZE - from + to;
+}
+
+/**
+ * Bytes that occupy the buffer, including those that are still being transferred to the flash.
+ */
 static uint32_t flashfsTransmitBufferUsed(void)
 {
-    if (bufferHead >= bufferTail)
-        return bufferHead - bufferTail;
+    return flashfsBufferDistance(bufferInFlight, bufferHead);
+}
 
-    return FLASHFS_WRITE_BUFFER_SIZE - bufferTail + bufferHead;
+/**
+ * Release the buffer space of a page program once the flash chip no longer needs to read it.
+ */
+static void flashfsUpdateInFlight(void)
+{
+    if (bufferInFlight != bufferTail && !m25p16_isTransferring()) {
+        bufferInFlight = bufferTail;
+    }
 }
 
 /**
@@ -143,202 +302,154 @@ const flashGeometry_t* flashfsGetGeometry(void)
     return m25p16_getGeometry();
 }
 
-/**
- * Write the given buffers to flash sequentially at the current tail address, advancing the tail address after
- * each write.
- *
- * In synchronous mode, waits for the flash to become ready before writing so that every byte requested can be written.
- *
- * In asynchronous mode, if the flash is busy, then the write is aborted and the routine returns immediately.
- * In this case the returned number of bytes written will be less than the total amount requested.
- *
- * Modifies the supplied buffer pointers and sizes to reflect how many bytes remain in each of them.
- *
- * bufferCount: the number of buffers provided
- * buffers: an array of pointers to the beginning of buffers
- * bufferSizes: an array of the sizes of those buffers
- * sync: true if we should wait for the device to be idle before writes, otherwise if the device is busy the
- *       write will be aborted and this routine will return immediately.
- *
- * Returns the number of bytes written
- */
-static uint32_t flashfsWriteBuffers(uint8_t const **buffers, uint32_t *bufferSizes, int bufferCount, bool sync)
+static void flashfsUpdateWriteStats(uint32_t bytesWritten)
 {
-    uint32_t bytesTotal = 0;
+    uint32_t now = millis();
+    uint32_t elapsed = now - statsWindowStartTime;
 
-    int i;
+    writeStats.bytesWritten += bytesWritten;
 
-    for (i = 0; i < bufferCount; i++) {
-        bytesTotal += bufferSizes[i];
-    }
+    if (elapsed >= FLASHFS_THROUGHPUT_WINDOW_MS) {
+        writeStats.throughput = (uint64_t) (writeStats.bytesWritten - statsWindowStartBytes) * 1000 / elapsed;
 
-    if (!sync && !m25p16_isReady()) {
-        return 0;
+        statsWindowStartTime = now;
+        statsWindowStartBytes = writeStats.bytesWritten;
     }
+}
 
-    uint32_t bytesTotalRemaining = bytesTotal;
-
-    while (bytesTotalRemaining > 0) {
-        uint32_t bytesTotalThisIteration;
-        uint32_t bytesRemainThisIteration;
-
-        /*
-         * Each page needs to be saved in a separate program operation, so
-         * if we would cross a page boundary, only write up to the boundary in this iteration:
-         */
-        if (tailAddress % M25P16_PAGESIZE + bytesTotalRemaining > M25P16_PAGESIZE) {
-            bytesTotalThisIteration = M25P16_PAGESIZE - tailAddress % M25P16_PAGESIZE;
-        } else {
-            bytesTotalThisIteration = bytesTotalRemaining;
-        }
+/**
+ * Start programming the oldest buffered bytes to the flash, up to the end of the flash page that they belong to.
+ *
+ * If `partial` is false then a program is only started once the buffer holds the data all the way up to the page
+ * boundary, so that the flash is programmed in whole pages instead of a series of short writes.
+ *
+ * Returns false if the flash is still busy with the previous operation, in which case nothing was done.
+ */
+static bool flashfsProgramPage(bool partial)
+{
+    flashfsUpdateInFlight();
 
-        // Are we at EOF already? Abort.
-        if (flashfsIsEOF()) {
-            // May as well throw away any buffered data
-            flashfsClearBuffer();
+    if (flashfsBufferIsEmpty()) {
+        return true;
+    }
 
-            break;
-        }
+    // Are we at EOF already? May as well throw away any buffered data
+    if (flashfsIsEOF()) {
+        writeStats.bytesDropped += flashfsBufferDistance(bufferTail, bufferHead);
 
-        m25p16_pageProgramBegin(tailAddress);
+        flashfsClearBuffer();
 
-        bytesRemainThisIteration = bytesTotalThisIteration;
+        return true;
+    }
 
-        for (i = 0; i < bufferCount; i++) {
-            if (bufferSizes[i] > 0) {
-                // Is buffer larger than our write limit? Write our limit out of it
-                if (bufferSizes[i] >= bytesRemainThisIteration) {
-                    m25p16_pageProgramContinue(buffers[i], bytesRemainThisIteration);
+    // Each page needs to be saved in a separate program operation, which never wraps around the end of the buffer
+    uint32_t bytesToPageEnd = M25P16_PAGESIZE - tailAddress % M25P16_PAGESIZE;
+    uint32_t bytesBuffered = flashfsBufferDistance(bufferTail, bufferHead);
+    uint32_t bytesThisPage = bytesBuffered < bytesToPageEnd ? bytesBuffered : bytesToPageEnd;
 
-                    buffers[i] += bytesRemainThisIteration;
-                    bufferSizes[i] -= bytesRemainThisIteration;
+    if (!partial && bytesThisPage < bytesToPageEnd) {
+        return true;
+    }
 
-                    bytesRemainThisIteration = 0;
-                    break;
-                } else {
-                    // We'll still have more to write after finishing this buffer off
-                    m25p16_pageProgramContinue(buffers[i], bufferSizes[i]);
+    if (!m25p16_isReady()) {
+        return false;
+    }
 
-                    bytesRemainThisIteration -= bufferSizes[i];
+    sectorEraseInProgress = false;
 
-                    buffers[i] += bufferSizes[i];
-                    bufferSizes[i] = 0;
-                }
-            }
-        }
+    // We ran out of erased reserve, this sector has to be erased before we can write to it which stalls the writer
+    uint16_t sector = tailAddress / m25p16_getGeometry()->sectorSize;
 
-        m25p16_pageProgramFinish();
+    if (flashfsSectorIsPendingErase(sector)) {
+        flashfsEraseSector(sector);
+        return false;
+    }
 
-        bytesTotalRemaining -= bytesTotalThisIteration;
+    m25p16_pageProgramAsync(tailAddress, flashWriteBuffer + bufferTail, bytesThisPage);
 
-        // Advance the cursor in the file system to match the bytes we wrote
-        flashfsSetTailAddress(tailAddress + bytesTotalThisIteration);
+    tailAddress += bytesThisPage;
 
-        /*
-         * We'll have to wait for that write to complete before we can issue the next one, so if
-         * the user requested asynchronous writes, break now.
-         */
-        if (!sync)
-            break;
+    bufferTail += bytesThisPage;
+    if (bufferTail >= FLASHFS_WRITE_BUFFER_SIZE) {
+        bufferTail -= FLASHFS_WRITE_BUFFER_SIZE;
     }
 
-    return bytesTotal - bytesTotalRemaining;
-}
-
-/*
- * Since the buffered data might wrap around the end of the circular buffer, we can have two segments of data to write,
- * an initial portion and a possible wrapped portion.
- *
- * This routine will fill the details of those buffers into the provided arrays, which must be at least 2 elements long.
- */
-static void flashfsGetDirtyDataBuffers(uint8_t const *buffers[], uint32_t bufferSizes[])
-{
-    buffers[0] = flashWriteBuffer + bufferTail;
-    buffers[1] = flashWriteBuffer + 0;
+    flashfsUpdateWriteStats(bytesThisPage);
 
-    if (bufferHead >= bufferTail) {
-        bufferSizes[0] = bufferHead - bufferTail;
-        bufferSizes[1] = 0;
-    } else {
-        bufferSizes[0] = FLASHFS_WRITE_BUFFER_SIZE - bufferTail;
-        bufferSizes[1] = bufferHead;
-    }
+    return true;
 }
 
 /**
- * Get the current offset of the file pointer within the volume.
+ * Like flashfsProgramPage(true) but waits for the flash to become ready first. If the flash doesn't become ready in
+ * time the buffered data is discarded rather than blocking forever.
  */
-uint32_t flashfsGetOffset(void)
+static void flashfsProgramPageSync(void)
 {
-    uint8_t const * buffers[2];
-    uint32_t bufferSizes[2];
+    if (flashfsProgramPage(true)) {
+        return;
+    }
 
-    // Dirty data in the buffers contributes to the offset
+    if (m25p16_waitForReady(sectorEraseInProgress ? FLASHFS_ERASE_TIMEOUT_MILLIS : FLASHFS_SYNC_TIMEOUT_MILLIS)
+            && flashfsProgramPage(true)) {
+        return;
+    }
 
-    flashfsGetDirtyDataBuffers(buffers, bufferSizes);
+    // We might have only just started an erase of the sector we're writing to
+    if (sectorEraseInProgress && m25p16_waitForReady(FLASHFS_ERASE_TIMEOUT_MILLIS) && flashfsProgramPage(true)) {
+        return;
+    }
 
-    return tailAddress + bufferSizes[0] + bufferSizes[1];
+    writeStats.bytesDropped += flashfsBufferDistance(bufferTail, bufferHead);
+
+    flashfsClearBuffer();
 }
 
 /**
- * Called after bytes have been written from the buffer to advance the position of the tail by the given amount.
+ * Get the current offset of the file pointer within the volume.
  */
-static void flashfsAdvanceTailInBuffer(uint32_t delta)
+uint32_t flashfsGetOffset(void)
 {
-    bufferTail += delta;
-
-    // Wrap tail around the end of the buffer
-    if (bufferTail >= FLASHFS_WRITE_BUFFER_SIZE) {
-        bufferTail -= FLASHFS_WRITE_BUFFER_SIZE;
-    }
-
-    if (flashfsBufferIsEmpty()) {
-        flashfsClearBuffer(); // Bring buffer pointers back to the start to be tidier
-    }
+    // Dirty data in the buffer contributes to the offset
+    return tailAddress + flashfsBufferDistance(bufferTail, bufferHead);
 }
 
 /**
- * If the flash is ready to accept writes, flush the buffer to it.
+ * If the flash is ready to accept writes, start flushing the buffer to it.
  *
  * Returns true if all data in the buffer has been flushed to the device, or false if
  * there is still data to be written (call flush again later).
  */
 bool flashfsFlushAsync(void)
 {
-    if (flashfsBufferIsEmpty()) {
-        return true; // Nothing to flush
-    }
-
-    uint8_t const * buffers[2];
-    uint32_t bufferSizes[2];
-    uint32_t bytesWritten;
-
-    flashfsGetDirtyDataBuffers(buffers, bufferSizes);
-    bytesWritten = flashfsWriteBuffers(buffers, bufferSizes, 2, false);
-    flashfsAdvanceTailInBuffer(bytesWritten);
+    flashfsProgramPage(true);
 
     return flashfsBufferIsEmpty();
 }
 
 /**
- * Wait for the flash to become ready and begin flushing any buffered data to flash.
+ * Housekeeping to be called regularly while writing, programs any completely buffered page that couldn't be written
+ * at the time it was filled because the flash was busy. Partial pages are left to accumulate more data.
+ */
+void flashfsUpdate(void)
+{
+    flashfsProgramPage(false);
+}
+
+/**
+ * Wait for the flash to become ready and flush any buffered data to flash.
  *
- * The flash will still be busy some time after this sync completes, but space will
- * be freed up to accept more writes in the write buffer.
+ * The flash will still be busy some time after this sync completes programming the last page, but the whole write
+ * buffer is free to accept more writes.
  */
 void flashfsFlushSync(void)
 {
-    if (flashfsBufferIsEmpty()) {
-        return; // Nothing to flush
+    while (!flashfsBufferIsEmpty()) {
+        flashfsProgramPageSync();
     }
 
-    uint8_t const * buffers[2];
-    uint32_t bufferSizes[2];
-
-    flashfsGetDirtyDataBuffers(buffers, bufferSizes);
-    flashfsWriteBuffers(buffers, bufferSizes, 2, true);
+    while (m25p16_isTransferring()) {
+    }
 
-    // We've written our entire buffer now:
     flashfsClearBuffer();
 }
 
@@ -361,15 +472,21 @@ void flashfsSeekRel(int32_t offset)
  */
 void flashfsWriteByte(uint8_t byte)
 {
+    flashfsUpdateInFlight();
+
+    if (flashfsTransmitBufferUsed() >= FLASHFS_WRITE_BUFFER_USABLE) {
+        writeStats.bytesDropped++;
+        return;
+    }
+
     flashWriteBuffer[bufferHead++] = byte;
 
     if (bufferHead >= FLASHFS_WRITE_BUFFER_SIZE) {
         bufferHead = 0;
     }
 
-    if (flashfsTransmitBufferUsed() >= FLASHFS_WRITE_BUFFER_AUTO_FLUSH_LEN) {
-        flashfsFlushAsync();
-    }
+    // Program as soon as we have filled up a page
+    flashfsProgramPage(false);
 }
 
 /**
@@ -380,82 +497,62 @@ void flashfsWriteByte(uint8_t byte)
  */
 void flashfsWrite(const uint8_t *data, unsigned int len, bool sync)
 {
-    uint8_t const * buffers[3];
-    uint32_t bufferSizes[3];
-
-    // There could be two dirty buffers to write out already:
-    flashfsGetDirtyDataBuffers(buffers, bufferSizes);
-
-    // Plus the buffer the user supplied:
-    buffers[2] = data;
-    bufferSizes[2] = len;
+    flashfsUpdateInFlight();
 
-    /*
-     * Would writing this data to our buffer cause our buffer to reach the flush threshold? If so try to write through
-     * to the flash now
-     */
-    if (bufferSizes[0] + bufferSizes[1] + bufferSizes[2] >= FLASHFS_WRITE_BUFFER_AUTO_FLUSH_LEN) {
-        uint32_t bytesWritten;
-
-        // Attempt to write all three buffers through to the flash asynchronously
-        bytesWritten = flashfsWriteBuffers(buffers, bufferSizes, 3, false);
-
-        if (bufferSizes[0] == 0 && bufferSizes[1] == 0) {
-            // We wrote all the data that was previously buffered
-            flashfsClearBuffer();
-
-            if (bufferSizes[2] == 0) {
-                // And we wrote all the data the user supplied! Job done!
-                return;
-            }
-        } else {
-            // We only wrote a portion of the old data, so advance the tail to remove the bytes we did write from the buffer
-            flashfsAdvanceTailInBuffer(bytesWritten);
-        }
-
-        // Is the remainder of the data to be written too big to fit in the buffers?
-        if (bufferSizes[0] + bufferSizes[1] + bufferSizes[2] > FLASHFS_WRITE_BUFFER_USABLE) {
-            if (sync) {
-                // Write it through synchronously
-                flashfsWriteBuffers(buffers, bufferSizes, 3, true);
-                flashfsClearBuffer();
-            } else {
-                /*
-                 * Silently drop the data the user asked to write (i.e. no-op) since we can't buffer it and they
-                 * requested async.
-                 */
-            }
+    if (!sync && len > flashfsGetWriteBufferFreeSpace()) {
+        // Make room for it if the flash is ready to take the oldest data
+        flashfsProgramPage(true);
+        flashfsUpdateInFlight();
 
+        if (len > flashfsGetWriteBufferFreeSpace()) {
+            // Silently drop the data the user asked to write since we can't buffer it and they requested async
+            writeStats.bytesDropped += len;
             return;
         }
-
-        // Fall through and add the remainder of the incoming data to our buffer
-        data = buffers[2];
-        len = bufferSizes[2];
     }
 
-    // Buffer up the data the user supplied instead of writing it right away
+    while (len > 0) {
+        unsigned int freeSpace = flashfsGetWriteBufferFreeSpace();
 
-    // First write the portion before we wrap around the end of the circular buffer
-    unsigned int bufferBytesBeforeWrap = FLASHFS_WRITE_BUFFER_SIZE - bufferHead;
+        if (freeSpace == 0) {
+            // Only reachable in sync mode, wait for the oldest data to leave the buffer
+            flashfsProgramPageSync();
+            flashfsUpdateInFlight();
+            continue;
+        }
 
-    unsigned int firstPortion = len < bufferBytesBeforeWrap ? len : bufferBytesBeforeWrap;
+        // Copy up to the wrap point of the circular buffer or as much as fits
+        unsigned int chunk = FLASHFS_WRITE_BUFFER_SIZE - bufferHead;
 
-    memcpy(flashWriteBuffer + bufferHead, data, firstPortion);
+        if (chunk > freeSpace)
+            chunk = freeSpace;
+        if (chunk > len)
+            chunk = len;
 
-    bufferHead += firstPortion;
+        memcpy(flashWriteBuffer + bufferHead, data, chunk);
 
-    data += firstPortion;
-    len -= firstPortion;
+        bufferHead += chunk;
+        if (bufferHead >= FLASHFS_WRITE_BUFFER_SIZE) {
+            bufferHead = 0;
+        }
 
-    // If we wrap the head around, write the remainder to the start of the buffer (if any)
-    if (bufferHead == FLASHFS_WRITE_BUFFER_SIZE) {
-        memcpy(flashWriteBuffer + 0, data, len);
+        data += chunk;
+        len -= chunk;
 
-        bufferHead = len;
+        // Keep the flash busy with every page that we have completed
+        flashfsProgramPage(false);
     }
 }
 
+/**
+ * Get counters describing the write performance of the flash, the throughput is averaged over the last
+ * FLASHFS_THROUGHPUT_WINDOW_MS of writing.
+ */
+void flashfsGetWriteStats(flashfsWriteStats_t *stats)
+{
+    *stats = writeStats;
+}
+
 /**
  * Read `len` bytes from the given address into the supplied buffer.
  *
@@ -484,9 +581,14 @@ int flashfsReadAbs(uint32_t address, uint8_t *buffer, unsigned int len)
  */
 int flashfsIdentifyStartOfFreeSpace(void)
 {
-    /* Find the start of the free space on the device by examining the beginning of blocks with a binary search,
-     * looking for ones that appear to be erased. We can achieve this with good accuracy because an erased block
-     * is all bits set to 1, which pretty much never appears in reasonable size substrings of blackbox logs.
+    /* Find the start of the free space on the device by examining the beginning of blocks, looking for the first one
+     * that appears to be erased. We can achieve this with good accuracy because an erased block is all bits set to 1,
+     * which pretty much never appears in reasonable size substrings of blackbox logs.
+     *
+     * The blocks are scanned in order rather than with a binary search because the device isn't always written
+     * followed by erased: a log may have been written into the erased start of the device while the background erase
+     * of older logs further on was still going, or power may have been lost part way through a sector erase. The
+     * data after the free space is found by flashfsFindSectorsPendingErase().
      *
      * To do better we might write a volume header instead, which would mark how much free space remains. But keeping
      * a header up to date while logging would incur more writes to the flash, which would consume precious write
@@ -495,7 +597,7 @@ int flashfsIdentifyStartOfFreeSpace(void)
 
     enum {
         /* We can choose whatever power of 2 size we like, which determines how much wastage of free space we'll have
-         * at the end of the last written data. But smaller blocksizes will require more searching.
+         * at the end of the last written data. But smaller blocksizes will require more reads.
          */
         FREE_BLOCK_SIZE = 2048,
 
@@ -509,24 +611,16 @@ int flashfsIdentifyStartOfFreeSpace(void)
         uint32_t ints[FREE_BLOCK_TEST_SIZE_INTS];
     } testBuffer;
 
-    int left = 0; // Smallest block index in the search region
-    int right = flashfsGetSize() / FREE_BLOCK_SIZE; // One past the largest block index in the search region
-    int mid;
-    int result = right;
-    int i;
-    bool blockErased;
+    int blocks = flashfsGetSize() / FREE_BLOCK_SIZE;
 
-    while (left < right) {
-        mid = (left + right) / 2;
-
-        if (m25p16_readBytes(mid * FREE_BLOCK_SIZE, testBuffer.bytes, FREE_BLOCK_TEST_SIZE_BYTES) < FREE_BLOCK_TEST_SIZE_BYTES) {
+    for (int block = 0; block < blocks; block++) {
+        if (m25p16_readBytes(block * FREE_BLOCK_SIZE, testBuffer.bytes, FREE_BLOCK_TEST_SIZE_BYTES) < FREE_BLOCK_TEST_SIZE_BYTES) {
             // Unexpected timeout from flash, so bail early (reporting the device fuller than it really is)
             break;
         }
 
-        // Checking the buffer 4 bytes at a time like this is probably faster than byte-by-byte, but I didn't benchmark it :)
-        blockErased = true;
-        for (i = 0; i < FREE_BLOCK_TEST_SIZE_INTS; i++) {
+        bool blockErased = true;
+        for (int i = 0; i < FREE_BLOCK_TEST_SIZE_INTS; i++) {
             if (testBuffer.ints[i] != 0xFFFFFFFF) {
                 blockErased = false;
                 break;
@@ -534,18 +628,11 @@ int flashfsIdentifyStartOfFreeSpace(void)
         }
 
         if (blockErased) {
-            /* This erased block might be the leftmost erased block in the volume, but we'll need to continue the
-             * search leftwards to find out:
-             */
-            result = mid;
-
-            right = mid;
-        } else {
-            left = mid + 1;
+            return block * FREE_BLOCK_SIZE;
         }
     }
 
-    return result * FREE_BLOCK_SIZE;
+    return blocks * FREE_BLOCK_SIZE;
 }
 
 /**
@@ -556,6 +643,65 @@ bool flashfsIsEOF(void)
     return tailAddress >= flashfsGetSize();
 }
 
+/**
+ * Return true if the page at the given address looks erased. Old data always runs up to the end of a page or starts at
+ * its beginning, so checking both ends also finds a sector whose erase was cut short, leaving an erased start followed
+ * by old data.
+ */
+static bool flashfsPageIsErased(uint32_t address)
+{
+    uint32_t testBuffer[4];
+    const uint32_t ends[2] = {address, address + M25P16_PAGESIZE - sizeof(testBuffer)};
+
+    for (int end = 0; end < 2; end++) {
+        if (m25p16_readBytes(ends[end], (uint8_t*) testBuffer, sizeof(testBuffer)) < (int) sizeof(testBuffer)) {
+            return false;
+        }
+
+        for (unsigned i = 0; i < sizeof(testBuffer) / sizeof(testBuffer[0]); i++) {
+            if (testBuffer[i] != 0xFFFFFFFF) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Check the sectors from the file pointer onward for old data. We might have been powered down part way through a
+ * background erase, in which case those sectors have to be erased before we write to them.
+ */
+static void flashfsFindSectorsPendingErase(void)
+{
+    const flashGeometry_t *geometry = m25p16_getGeometry();
+
+    if (geometry->sectorSize <= 0)
+        return;
+
+    for (uint16_t sector = tailAddress / geometry->sectorSize; sector < geometry->sectors; sector++) {
+        uint32_t sectorStart = sector * geometry->sectorSize;
+        uint32_t address = tailAddress > sectorStart ? tailAddress - tailAddress % M25P16_PAGESIZE : sectorStart;
+
+        for (; address < sectorStart + geometry->sectorSize; address += M25P16_PAGESIZE) {
+            if (!flashfsPageIsErased(address)) {
+                break;
+            }
+        }
+
+        if (address >= sectorStart + geometry->sectorSize) {
+            continue;
+        }
+
+        if (tailAddress > sectorStart) {
+            // The start of the sector holds the last log, so leave it alone and continue logging in the next sector
+            flashfsSetTailAddress(sectorStart + geometry->sectorSize);
+        } else {
+            flashfsSetSectorPendingErase(sector, true);
+        }
+    }
+}
+
 /**
  * Call after initializing the flash chip in order to set up the filesystem.
  */
@@ -563,7 +709,12 @@ void flashfsInit(void)
 {
     // If we have a flash chip present at all
     if (flashfsGetSize() > 0) {
+        memset(sectorPendingErase, 0, sizeof(sectorPendingErase));
+        sectorsPendingErase = 0;
+
         // Start the file pointer off at the beginning of free space so caller can start writing immediately
         flashfsSeekAbs(flashfsIdentifyStartOfFreeSpace());
+
+        flashfsFindSectorsPendingErase();
     }
 }
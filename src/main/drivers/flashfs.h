@@ -21,14 +21,34 @@
 
 #include "drivers/flash.h"
 
-#define FLASHFS_WRITE_BUFFER_SIZE 128
+#include "drivers/flash_m25p16.h"
+
+// Number of flash pages of data that we can buffer while the flash is busy programming, targets can override this
+#ifndef FLASHFS_WRITE_BUFFER_PAGES
+#define FLASHFS_WRITE_BUFFER_PAGES 4
+#endif
+
+#define FLASHFS_WRITE_BUFFER_SIZE (FLASHFS_WRITE_BUFFER_PAGES * M25P16_PAGESIZE)
 #define FLASHFS_WRITE_BUFFER_USABLE (FLASHFS_WRITE_BUFFER_SIZE - 1)
 
-// Automatically trigger a flush when this much data is in the buffer
-#define FLASHFS_WRITE_BUFFER_AUTO_FLUSH_LEN 64
+// Largest number of sectors of any supported flash chip (128Mbit with 64KB sectors)
+#define FLASHFS_MAX_SECTORS 256
+
+// Period over which the sustained write throughput is averaged
+#define FLASHFS_THROUGHPUT_WINDOW_MS 1000
+
+typedef struct flashfsWriteStats_s {
+    uint32_t bytesWritten; // Bytes handed to the flash since boot
+    uint32_t bytesDropped; // Bytes discarded because the write buffer was full or the flash was full
+    uint32_t throughput;   // Bytes per second written to the flash over the last measurement window
+} flashfsWriteStats_t;
 
 void flashfsEraseCompletely(void);
 void flashfsEraseRange(uint32_t start, uint32_t end);
+void flashfsEraseUpdate(void);
+uint16_t flashfsGetSectorsPendingErase(void);
+uint32_t flashfsGetErasedReserve(void);
+void flashfsSetLogging(bool active);
 
 uint32_t flashfsGetSize(void);
 uint32_t flashfsGetOffset(void);
@@ -46,8 +66,11 @@ void flashfsWrite(const uint8_t *data, unsigned int len, bool sync);
 int flashfsReadAbs(uint32_t offset, uint8_t *data, unsigned int len);
 
 bool flashfsFlushAsync(void);
+void flashfsUpdate(void);
 void flashfsFlushSync(void);
 
+void flashfsGetWriteStats(flashfsWriteStats_t *stats);
+
 void flashfsInit(void);
 
 bool flashfsIsReady(void);
@@ -39,11 +39,33 @@
 uint8_t ledStripDMABuffer[WS2811_DMA_BUFFER_SIZE];
 volatile uint8_t ws2811LedDataTransferInProgress = 0;
 
+#if WS2811_LED_STRIP_LENGTH > 32
+#error "ws2811 dirty led tracking uses a 32 bit mask"
+#endif
+
 static hsvColor_t ledColorBuffer[WS2811_LED_STRIP_LENGTH];
+// leds whose color changed since they were last encoded into the dma buffer
+static uint32_t ledDirtyMask;
+static bool ledGamma = false;
+
+// leds mostly show a handful of configured colors so converted colors are kept in a small direct mapped cache
+#define WS2811_RGB_CACHE_SIZE 16
+static struct {
+    uint32_t key;
+    rgbColor24bpp_t rgb;
+} rgbCache[WS2811_RGB_CACHE_SIZE];
+
+static inline bool hsvEqual(const hsvColor_t *a, const hsvColor_t *b)
+{
+    return a->h == b->h && a->s == b->s && a->v == b->v;
+}
 
 void setLedHsv(int index, const hsvColor_t *color)
 {
+    if (hsvEqual(&ledColorBuffer[index], color))
+        return;
     ledColorBuffer[index] = *color;
+    ledDirtyMask |= 1UL << index;
 }
 
 void getLedHsv(int index, hsvColor_t *color)
@@ -53,12 +75,16 @@ void getLedHsv(int index, hsvColor_t *color)
 
 void setLedValue(int index, const uint8_t value)
 {
-    ledColorBuffer[index].v = value;
+    hsvColor_t color = ledColorBuffer[index];
+    color.v = value;
+    setLedHsv(index, &color);
 }
 
 void scaleLedValue(int index, const uint8_t scalePercent)
 {
-    ledColorBuffer[index].v = (uint8_t)(ledColorBuffer[index].v * scalePercent / 100);
+    hsvColor_t color = ledColorBuffer[index];
+    color.v = (uint8_t)(color.v * scalePercent / 100);
+    setLedHsv(index, &color);
 }
 
 void setStripColor(const hsvColor_t *color)
@@ -87,11 +113,24 @@ static void ws2811DMAHandler(DMA_Channel_TypeDef *channel)
 void ws2811LedStripInit(void)
 {
     memset(&ledStripDMABuffer, 0, WS2811_DMA_BUFFER_SIZE);
+    memset(rgbCache, 0, sizeof(rgbCache));
+    // the dma buffer no longer matches any led
+    ledDirtyMask = 0xFFFFFFFF;
     dmaSetHandler(WS2811_DMA_HANDLER_IDENTIFER, ws2811DMAHandler);
     ws2811LedStripHardwareInit();
     ws2811UpdateStrip();
 }
 
+void ws2811SetGamma(bool enabled)
+{
+    if (enabled == ledGamma)
+        return;
+    ledGamma = enabled;
+    // cached colors and the whole dma buffer were converted with the old setting
+    memset(rgbCache, 0, sizeof(rgbCache));
+    ledDirtyMask = 0xFFFFFFFF;
+}
+
 bool isWS2811LedStripReady(void)
 {
     return !ws2811LedDataTransferInProgress;
@@ -109,24 +148,44 @@ void fastUpdateLEDDMABuffer(uint8_t **buffer, rgbColor24bpp_t color)
     }
 }
 
+// a miss costs one hue table lookup, plus the gamma lookups when gamma is enabled, see hsvToRgb24Gamma()
+static rgbColor24bpp_t ws2811ColorToRgb(const hsvColor_t *color)
+{
+    // bit 31 marks the entry as valid
+    uint32_t key = (1UL << 31) | ((uint32_t)color->h << 16) | ((uint32_t)color->s << 8) | color->v;
+    unsigned slot = (color->h ^ color->s ^ (color->v >> 2)) % WS2811_RGB_CACHE_SIZE;
+
+    if (rgbCache[slot].key != key) {
+        rgbCache[slot].key = key;
+        rgbCache[slot].rgb = ledGamma ? hsvToRgb24Gamma(color) : hsvToRgb24Lut(color);
+    }
+    return rgbCache[slot].rgb;
+}
+
 /*
  * This method is non-blocking unless an existing LED update is in progress.
  * it does not wait until all the LEDs have been updated, that happens in the background.
+ * Only leds that changed since the last update are re-encoded, the rest of the dma buffer is still valid.
+ * Nothing is sent if no led changed.
  */
 void ws2811UpdateStrip(void)
 {
+    if (!ledDirtyMask)
+        return;
+
     // wait until previous transfer completes
     while(ws2811LedDataTransferInProgress);
 
-    uint8_t *dst = ledStripDMABuffer;               // reset buffer memory index
-
     // fill transmit buffer with correct compare values to achieve
     // correct pulse widths according to color values
     for (int ledIndex = 0; ledIndex < WS2811_LED_STRIP_LENGTH; ledIndex++) {
-        rgbColor24bpp_t rgb24 = hsvToRgb24(&ledColorBuffer[ledIndex]);
+        if (!(ledDirtyMask & (1UL << ledIndex)))
+            continue;
 
-        fastUpdateLEDDMABuffer(&dst, rgb24);
+        uint8_t *dst = &ledStripDMABuffer[ledIndex * WS2811_BITS_PER_LED];
+        fastUpdateLEDDMABuffer(&dst, ws2811ColorToRgb(&ledColorBuffer[ledIndex]));
     }
+    ledDirtyMask = 0;
 
     ws2811LedDataTransferInProgress = 1;
     ws2811LedStripDMAEnable();
@@ -26,6 +26,8 @@
 #include "timer.h"
 #include "drivers/bus_i2c.h"
 
+#include "config/mixer.h"
+
 #include "pwm_output.h"
 #include "pwm_rx.h"
 #include "pwm_mapping.h"
@@ -36,6 +38,7 @@
 void pwmBrushedMotorConfig(const timerHardware_t *timerHardware, uint8_t motorIndex, uint16_t motorPwmRate, uint16_t idlePulse);
 void pwmBrushlessMotorConfig(const timerHardware_t *timerHardware, uint8_t motorIndex, uint16_t motorPwmRate, uint16_t idlePulse);
 void pwmOneshotMotorConfig(const timerHardware_t *timerHardware, uint8_t motorIndex);
+void pwmDshotMotorConfig(const timerHardware_t *timerHardware, uint8_t motorIndex, uint8_t protocol);
 void pwmServoConfig(const timerHardware_t *timerHardware, uint8_t servoIndex, uint16_t servoPwmRate, uint16_t servoCenterPulse);
 
 
@@ -641,6 +644,53 @@ pwmIOConfiguration_t *pwmGetOutputConfiguration(void){
 // TODO: this is an odd dependency from pwm_rx.c
 void ppmAvoidPWMTimerClash(const timerHardware_t *timerHardwarePtr, TIM_TypeDef *sharedPwmTimer); 
 
+// configures a standard, oneshot or brushed motor output and returns its port flags
+static pwmPortFlags_e pwmMotorConfig(const drv_pwm_config_t *init, const timerHardware_t *timerHardwarePtr, uint8_t motorIndex)
+{
+    if (init->useOneshot) {
+        pwmOneshotMotorConfig(timerHardwarePtr, motorIndex);
+        return PWM_PF_MOTOR | PWM_PF_OUTPUT_PROTOCOL_ONESHOT | PWM_PF_OUTPUT_PROTOCOL_PWM;
+    } else if (isMotorBrushed(init->motorPwmRate)) {
+        pwmBrushedMotorConfig(timerHardwarePtr, motorIndex, init->motorPwmRate, init->idlePulse);
+        return PWM_PF_MOTOR | PWM_PF_MOTOR_MODE_BRUSHED | PWM_PF_OUTPUT_PROTOCOL_PWM;
+    }
+    pwmBrushlessMotorConfig(timerHardwarePtr, motorIndex, init->motorPwmRate, init->idlePulse);
+    return PWM_PF_MOTOR | PWM_PF_OUTPUT_PROTOCOL_PWM;
+}
+
+#ifdef USE_DSHOT
+/*
+ * All dshot motors are sent with one dma burst so they have to share
+ * DSHOT_TIMER. Skipping the motors on other timers would shift the motor
+ * indices, so if any motor is elsewhere the whole set is driven with pwm
+ * instead and motorProtocol tells the rest of the system what was used.
+ */
+static void pwmDshotMotorSetConfig(const drv_pwm_config_t *init)
+{
+    bool dshot = init->motorProtocol < MOTOR_PROTOCOL_COUNT;
+    for (int i = 0; i < pwmIOConfiguration.ioCount; i++) {
+        pwmPortConfiguration_t *port = &pwmIOConfiguration.ioConfigurations[i];
+        if ((port->flags & PWM_PF_MOTOR) && port->timerHardware->tim != DSHOT_TIMER)
+            dshot = false;
+    }
+
+    for (int i = 0; i < pwmIOConfiguration.ioCount; i++) {
+        pwmPortConfiguration_t *port = &pwmIOConfiguration.ioConfigurations[i];
+        if (!(port->flags & PWM_PF_MOTOR))
+            continue;
+        if (dshot) {
+            pwmDshotMotorConfig(port->timerHardware, port->index, init->motorProtocol);
+            port->flags = PWM_PF_MOTOR | PWM_PF_OUTPUT_PROTOCOL_DSHOT;
+        } else {
+            port->flags = pwmMotorConfig(init, port->timerHardware, port->index);
+        }
+    }
+
+    if (dshot)
+        pwmIOConfiguration.motorProtocol = init->motorProtocol;
+}
+#endif
+
 // TODO: do not use static variables
 bool pwmUseInputFiltering = false;
 
@@ -883,21 +933,13 @@ pwmIOConfiguration_t *pwmInit(drv_pwm_config_t *init, const struct pwm_input_con
             		continue;
             }
 #endif
-            if (init->useOneshot) {
-
-                pwmOneshotMotorConfig(timerHardwarePtr, pwmIOConfiguration.motorCount);
-                pwmIOConfiguration.ioConfigurations[pwmIOConfiguration.ioCount].flags = PWM_PF_MOTOR | PWM_PF_OUTPUT_PROTOCOL_ONESHOT|PWM_PF_OUTPUT_PROTOCOL_PWM;
-
-            } else if (isMotorBrushed(init->motorPwmRate)) {
-
-                pwmBrushedMotorConfig(timerHardwarePtr, pwmIOConfiguration.motorCount, init->motorPwmRate, init->idlePulse);
-                pwmIOConfiguration.ioConfigurations[pwmIOConfiguration.ioCount].flags = PWM_PF_MOTOR | PWM_PF_MOTOR_MODE_BRUSHED | PWM_PF_OUTPUT_PROTOCOL_PWM;
-
-            } else {
-
-                pwmBrushlessMotorConfig(timerHardwarePtr, pwmIOConfiguration.motorCount, init->motorPwmRate, init->idlePulse);
-                pwmIOConfiguration.ioConfigurations[pwmIOConfiguration.ioCount].flags = PWM_PF_MOTOR | PWM_PF_OUTPUT_PROTOCOL_PWM ;
-            }
+#ifdef USE_DSHOT
+            if (init->motorProtocol != MOTOR_PROTOCOL_PWM) {
+                // the protocol is chosen for the whole set once all motors are known, see below
+                pwmIOConfiguration.ioConfigurations[pwmIOConfiguration.ioCount].flags = PWM_PF_MOTOR;
+            } else
+#endif
+            pwmIOConfiguration.ioConfigurations[pwmIOConfiguration.ioCount].flags = pwmMotorConfig(init, timerHardwarePtr, pwmIOConfiguration.motorCount);
 
             pwmIOConfiguration.ioConfigurations[pwmIOConfiguration.ioCount].index = pwmIOConfiguration.motorCount;
             pwmIOConfiguration.ioConfigurations[pwmIOConfiguration.ioCount].timerHardware = timerHardwarePtr;
@@ -921,5 +963,11 @@ pwmIOConfiguration_t *pwmInit(drv_pwm_config_t *init, const struct pwm_input_con
         pwmIOConfiguration.ioCount++;
     }
 
+    pwmIOConfiguration.motorProtocol = MOTOR_PROTOCOL_PWM;
+#ifdef USE_DSHOT
+    if (init->motorProtocol != MOTOR_PROTOCOL_PWM)
+        pwmDshotMotorSetConfig(init);
+#endif
+
     return &pwmIOConfiguration;
 }
@@ -46,6 +46,7 @@
 #define PWM_TIMER_MHZ 1
 #define ONESHOT125_TIMER_MHZ 8
 #define PWM_BRUSHED_TIMER_MHZ 8
+#define DSHOT_TIMER_MHZ 24
 
 
 typedef struct sonarGPIOConfig_s {
@@ -74,6 +75,7 @@ typedef struct drv_pwm_config_s {
 #endif
     bool useVbat;
     bool useOneshot;
+    uint8_t motorProtocol;  // one of motor_protocol_t, overrides oneshot and brushed when not MOTOR_PROTOCOL_PWM
     bool useSoftSerial;
     bool useLEDStrip;
 #ifdef SONAR
@@ -101,7 +103,8 @@ typedef enum {
     PWM_PF_OUTPUT_PROTOCOL_PWM = (1 << 3),
     PWM_PF_OUTPUT_PROTOCOL_ONESHOT = (1 << 4),
     PWM_PF_PPM = (1 << 5),
-    PWM_PF_PWM = (1 << 6)
+    PWM_PF_PWM = (1 << 6),
+    PWM_PF_OUTPUT_PROTOCOL_DSHOT = (1 << 7)
 } pwmPortFlags_e;
 
 
@@ -117,6 +120,7 @@ typedef struct pwmIOConfiguration_s {
     uint8_t ioCount;
     uint8_t pwmInputCount;
     uint8_t ppmInputCount;
+    uint8_t motorProtocol;  // protocol the motors actually use, MOTOR_PROTOCOL_PWM if the requested one could not be used
     pwmPortConfiguration_t ioConfigurations[USABLE_TIMER_CHANNEL_COUNT];
 } pwmIOConfiguration_t;
 
@@ -29,8 +29,10 @@
 #include "system.h"
 #include "pwm_mapping.h"
 #include "pwm_output.h"
+#include "dshot.h"
 
 #include "common/maths.h"
+#include "config/mixer.h"
 
 #define MAX_PWM_OUTPUT_PORTS MAX(MAX_MOTORS, MAX_SERVOS)
 
@@ -38,6 +40,7 @@
 void pwmBrushedMotorConfig(const timerHardware_t *timerHardware, uint8_t motorIndex, uint16_t motorPwmRate, uint16_t idlePulse);
 void pwmBrushlessMotorConfig(const timerHardware_t *timerHardware, uint8_t motorIndex, uint16_t motorPwmRate, uint16_t idlePulse);
 void pwmOneshotMotorConfig(const timerHardware_t *timerHardware, uint8_t motorIndex);
+void pwmDshotMotorConfig(const timerHardware_t *timerHardware, uint8_t motorIndex, uint8_t protocol);
 void pwmServoConfig(const timerHardware_t *timerHardware, uint8_t servoIndex, uint16_t servoPwmRate, uint16_t servoCenterPulse);
 
 
@@ -241,6 +244,124 @@ void pwmOneshotMotorConfig(const timerHardware_t *hw, uint8_t motorIndex)
     motors[motorIndex]->pwmWritePtr = pwmWriteStandard;
 }
 
+#ifdef USE_DSHOT
+/*
+ * DShot output. All dshot motors live on DSHOT_TIMER. Motor writes only store
+ * a frame and pwmCompleteDshotMotorUpdate() encodes the frames for all four
+ * channels into one buffer which the timer update dma request then writes into
+ * CCR1-CCR4 as a burst, one bit per timer period. The cpu is not involved
+ * while the frames are being sent.
+ */
+#define DSHOT_TIMER_CHANNELS 4
+
+static uint16_t dshotDMABuffer[DSHOT_DMA_BUFFER_SIZE(DSHOT_TIMER_CHANNELS)];
+static uint16_t dshotFrames[DSHOT_TIMER_CHANNELS];
+static uint8_t dshotChannel[MAX_PWM_MOTORS];
+static uint8_t dshotCommand[MAX_PWM_MOTORS];
+static uint8_t dshotCommandRepeat[MAX_PWM_MOTORS];
+static struct dshot_timing dshotTiming;
+static bool dshotEnabled = false;
+static bool dshotDMAStarted = false;
+static int8_t dshotTelemetryMotor = -1;
+
+static void pwmWriteDshot(uint8_t index, uint16_t value)
+{
+    if (dshotCommandRepeat[index]) {
+        // commands are sent with the telemetry bit set and repeated as many times as the esc requires
+        dshotCommandRepeat[index]--;
+        dshotFrames[dshotChannel[index]] = dshot_frame(dshotCommand[index], true);
+        return;
+    }
+    // telemetry is requested for one frame only, the esc answers on the telemetry wire
+    bool telemetry = (dshotTelemetryMotor == index);
+    if (telemetry)
+        dshotTelemetryMotor = -1;
+    dshotFrames[dshotChannel[index]] = dshot_frame(dshot_throttle_from_pwm(value), telemetry);
+}
+
+static void pwmDshotDMAConfig(void)
+{
+    DMA_InitTypeDef DMA_InitStructure;
+
+    RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+
+    DMA_DeInit(DSHOT_DMA_CHANNEL);
+    DMA_StructInit(&DMA_InitStructure);
+    DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t)&DSHOT_TIMER->DMAR;
+    DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t)dshotDMABuffer;
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralDST;
+    DMA_InitStructure.DMA_BufferSize = DSHOT_DMA_BUFFER_SIZE(DSHOT_TIMER_CHANNELS);
+    DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+    DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_VeryHigh;
+    DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+    DMA_Init(DSHOT_DMA_CHANNEL, &DMA_InitStructure);
+
+    // every update event writes CCR1 to CCR4 from the next four buffer entries
+    TIM_DMAConfig(DSHOT_TIMER, TIM_DMABase_CCR1, TIM_DMABurstLength_4Transfers);
+    TIM_DMACmd(DSHOT_TIMER, TIM_DMA_Update, ENABLE);
+}
+
+void pwmDshotMotorConfig(const timerHardware_t *hw, uint8_t motorIndex, uint8_t protocol)
+{
+    static const uint16_t rates[MOTOR_PROTOCOL_COUNT] = {
+        [MOTOR_PROTOCOL_DSHOT150] = 150,
+        [MOTOR_PROTOCOL_DSHOT300] = 300,
+        [MOTOR_PROTOCOL_DSHOT600] = 600,
+    };
+    if (hw->tim != DSHOT_TIMER || protocol >= MOTOR_PROTOCOL_COUNT || !rates[protocol])
+        return;
+
+    dshot_timing_init(&dshotTiming, rates[protocol], DSHOT_TIMER_MHZ * 1000000);
+
+    // line is held low (compare value 0) between frames
+    motors[motorIndex] = pwmOutConfig(hw, DSHOT_TIMER_MHZ, dshotTiming.period, 0);
+    motors[motorIndex]->pwmWritePtr = pwmWriteDshot;
+    dshotChannel[motorIndex] = hw->channel >> 2;
+
+    if (!dshotEnabled) {
+        pwmDshotDMAConfig();
+        dshotEnabled = true;
+    }
+}
+
+void pwmWriteDshotCommand(uint8_t index, uint8_t command)
+{
+    if (index >= MAX_PWM_MOTORS || command > DSHOT_CMD_MAX)
+        return;
+    dshotCommand[index] = command;
+    dshotCommandRepeat[index] = dshot_command_repeats(command);
+}
+
+void pwmRequestDshotTelemetry(uint8_t index)
+{
+    if (index >= MAX_PWM_MOTORS)
+        return;
+    dshotTelemetryMotor = index;
+}
+
+void pwmCompleteDshotMotorUpdate(void)
+{
+    if (!dshotEnabled || !pwmMotorsEnabled)
+        return;
+
+    // the buffer is still being read while the previous burst is running. The
+    // frames are kept and go out with the next update instead.
+    if (dshotDMAStarted && DMA_GetCurrDataCounter(DSHOT_DMA_CHANNEL) != 0)
+        return;
+
+    dshot_encode(dshotDMABuffer, dshotFrames, DSHOT_TIMER_CHANNELS, &dshotTiming);
+
+    DMA_Cmd(DSHOT_DMA_CHANNEL, DISABLE);
+    DMA_SetCurrDataCounter(DSHOT_DMA_CHANNEL, DSHOT_DMA_BUFFER_SIZE(DSHOT_TIMER_CHANNELS));
+    DMA_Cmd(DSHOT_DMA_CHANNEL, ENABLE);
+    dshotDMAStarted = true;
+}
+#endif
+
 #ifdef USE_SERVOS
 void pwmServoConfig(const timerHardware_t *hw, uint8_t servoIndex, uint16_t servoPwmRate, uint16_t servoCenterPulse)
 {
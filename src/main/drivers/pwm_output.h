@@ -21,6 +21,15 @@ void pwmWriteMotor(uint8_t index, uint16_t value);
 void pwmShutdownPulsesForAllMotors(uint8_t motorCount);
 void pwmCompleteOneshotMotorUpdate(uint8_t motorCount);
 
+#ifdef USE_DSHOT
+//! sends the frames stored by pwmWriteMotor() to all dshot motors in one dma burst
+void pwmCompleteDshotMotorUpdate(void);
+//! queues a dshot command (dshot_command_t) for a motor. It replaces throttle for as many updates as the esc requires.
+void pwmWriteDshotCommand(uint8_t index, uint8_t command);
+//! sets the telemetry request bit in the next frame sent to the motor
+void pwmRequestDshotTelemetry(uint8_t index);
+#endif
+
 void pwmStopMotors(bool oneshot);
 void pwmWriteAllMotors(uint8_t motorCount, uint16_t mc, bool oneshot);
 void pwmWriteServo(uint8_t index, uint16_t value);
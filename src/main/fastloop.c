@@ -23,8 +23,10 @@
  * - read the gyro
  * - read acc if it is time
  * - read compass if it is time
+ * - read baro if it is time
  * - update dcm and attitude rate/angle estimate
  * - read control inputs (if user sent some)
+ * - run altitude hold at a fixed rate if enabled
  * - run pid controller
  * - run the mixer and write pwm values back to system
  */
@@ -37,6 +39,8 @@
 #include <queue.h>
 #include <task.h>
 
+#include "config/config.h"
+
 #include "fastloop.h"
 
 #ifdef SITL
@@ -45,6 +49,20 @@
 #define ACC_READ_TIMEOUT 2000
 #endif
 
+// upper bound for baro polling, the driver reports when it has a new sample
+#define BARO_READ_TIMEOUT 10000
+#define ALTHOLD_UPDATE_PERIOD (1000000UL / ALTHOLD_UPDATE_HZ)
+// position is predicted at 100Hz so that the estimator history covers the receiver delay
+#define POSITION_UPDATE_PERIOD 10000
+
+//! rederives controller and mixer constants from the config
+static void _reload_config(struct fastloop *self){
+	self->config_generation = config_get_generation();
+	anglerate_reload_config(&self->ctrl);
+	mixer_reload_config(&self->mixer);
+	mixer_set_throttle_range(&self->mixer, 1500, self->config->pwm_out.minthrottle, self->config->pwm_out.maxthrottle);
+}
+
 static void _task(void *param){
 	struct fastloop *self = (struct fastloop*)param;
 	int16_t _acc[3];
@@ -88,6 +106,29 @@ static void _task(void *param){
 			}
 			self->next_acc_read_time = t + ACC_READ_TIMEOUT;
 
+			if(self->system->imu.read_pressure && t > self->next_baro_read_time){
+				uint32_t pressure;
+				if(sys_read_pressure(self->system, &pressure) == 0){
+					ins_process_pressure(&self->ins, pressure);
+				}
+				self->next_baro_read_time = t + BARO_READ_TIMEOUT;
+			}
+
+			if(t > self->next_pos_time){
+				ins_update_position(&self->ins, t);
+				self->next_pos_time = t + POSITION_UPDATE_PERIOD;
+			}
+			if(self->gps_queue){
+				struct posest_gps_fix fix;
+				if(xQueueReceive(self->gps_queue, &fix, 0))
+					ins_process_gps(&self->ins, &fix);
+			}
+
+			// config can be changed at any time from cli or msp. Controller constants
+			// are refreshed here so that the gyro path never has to derive them.
+			if(self->config_generation != config_get_generation())
+				_reload_config(self);
+
 			// read user command
 			if(self->in_queue){
 				struct fastloop_input in;
@@ -102,16 +143,21 @@ static void _task(void *param){
 					} else {
 						anglerate_set_openloop(&self->ctrl, false);
 					}
-					// soften pids if throttle is near zero
-					if(in.throttle < self->config->rx.mincheck){
-						anglerate_set_pid_axis_weight(&self->ctrl, FD_ROLL, 50);
-						anglerate_set_pid_axis_weight(&self->ctrl, FD_PITCH, 50);
+					// scale P and D according to the tpa curves
+					anglerate_input_throttle(&self->ctrl, in.throttle);
+
+					// with althold enabled throttle goes to the mixer through the althold controller
+					althold_input_throttle(&self->althold, in.throttle);
+					if(in.mode & FL_ALTHOLD){
+						if(!self->althold_on){
+							althold_engage(&self->althold);
+							self->next_althold_time = t;
+							self->althold_on = true;
+						}
 					} else {
-						anglerate_set_pid_axis_weight(&self->ctrl, FD_ROLL, 100);
-						anglerate_set_pid_axis_weight(&self->ctrl, FD_PITCH, 100);
+						self->althold_on = false;
+						mixer_input_command(&self->mixer, MIXER_INPUT_G0_THROTTLE, in.throttle);
 					}
-
-					mixer_input_command(&self->mixer, MIXER_INPUT_G0_THROTTLE, in.throttle);
 					// center the RC input value around the RC middle value
 					// by subtracting the RC middle value from the RC input value, we get:
 					// data - middle = input
@@ -143,12 +189,19 @@ static void _task(void *param){
 				ins_update(&self->ins, dt);
 			}
 
+			// althold runs at a fixed rate on the altitude estimate which is updated above
+			if(self->althold_on && t >= self->next_althold_time){
+				self->next_althold_time += ALTHOLD_UPDATE_PERIOD;
+				// resync instead of catching up if we have fallen behind
+				if(t >= self->next_althold_time) self->next_althold_time = t + ALTHOLD_UPDATE_PERIOD;
+				althold_update(&self->althold, 1.0f / ALTHOLD_UPDATE_HZ);
+				mixer_input_command(&self->mixer, MIXER_INPUT_G0_THROTTLE, althold_get_throttle(&self->althold));
+			}
+
 			anglerate_input_body_rates(&self->ctrl, ins_get_gyro_x(&self->ins), ins_get_gyro_y(&self->ins), ins_get_gyro_z(&self->ins));
 			anglerate_input_body_angles(&self->ctrl, ins_get_roll_dd(&self->ins), ins_get_pitch_dd(&self->ins), ins_get_yaw_dd(&self->ins));
 			anglerate_update(&self->ctrl, dt);
 
-			mixer_set_throttle_range(&self->mixer, 1500, self->config->pwm_out.minthrottle, self->config->pwm_out.maxthrottle);
-
 			// TODO: passthrough mode
 			mixer_input_command(&self->mixer, MIXER_INPUT_G0_ROLL, anglerate_get_roll(&self->ctrl));
 			mixer_input_command(&self->mixer, MIXER_INPUT_G0_PITCH, anglerate_get_pitch(&self->ctrl));
@@ -156,6 +209,11 @@ static void _task(void *param){
 
 			mixer_update(&self->mixer);
 
+			// motor speed moves the gyro rpm notch filters for the next samples
+			for(int c = 0; c < GYRO_RPM_NOTCH_MOTORS; c++){
+				ins_set_motor_rpm(&self->ins, c, mixer_get_motor_rpm(&self->mixer, c));
+			}
+
 			// make data available to other applications
 			if(self->out_queue){
 				struct fastloop_output out;
@@ -193,6 +251,7 @@ void fastloop_init(struct fastloop *self, const struct system_calls *system, con
 
 	self->in_queue = xQueueCreate(1, sizeof(struct fastloop_input));
 	self->out_queue = xQueueCreate(1, sizeof(struct fastloop_output));
+	self->gps_queue = xQueueCreate(1, sizeof(struct posest_gps_fix));
 
 	// TODO: sensor scale and alignment should be completely handled by the driver!
 	ins_set_gyro_alignment(&self->ins, config->sensors.alignment.gyro_align);
@@ -202,6 +261,8 @@ void fastloop_init(struct fastloop *self, const struct system_calls *system, con
 	mixer_init(&self->mixer, self->config, &system->pwm);
 	ins_init(&self->ins, self->config);
 	anglerate_init(&self->ctrl, &self->ins, self->config);
+	althold_init(&self->althold, &self->ins, self->config);
+	_reload_config(self);
 }
 
 void fastloop_write_controls(struct fastloop *self, const struct fastloop_input *in){
@@ -212,6 +273,10 @@ void fastloop_read_outputs(struct fastloop *self, struct fastloop_output *out){
 	if(self->out_queue) xQueuePeek(self->out_queue, out, 5000);
 }
 
+void fastloop_write_gps(struct fastloop *self, const struct posest_gps_fix *fix){
+	if(self->gps_queue) xQueueOverwrite(self->gps_queue, fix);
+}
+
 void fastloop_start(struct fastloop *self){
 	xTaskCreate(_task, "gyro", 1224 / sizeof(StackType_t), self, 4, NULL);
 }
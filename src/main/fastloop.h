@@ -19,6 +19,7 @@
 #pragma once
 
 #include "flight/anglerate.h"
+#include "flight/altitudehold.h"
 #include "flight/mixer.h"
 #include "sensors/instruments.h"
 #include "system_calls.h"
@@ -28,6 +29,7 @@
 
 #define FL_ARMED	(1 << 0)
 #define FL_OPEN		(1 << 1)
+#define FL_ALTHOLD	(1 << 2)
 
 struct fastloop_input {
 	uint8_t mode;
@@ -51,10 +53,17 @@ struct fastloop {
 	struct instruments ins;
 	struct mixer mixer;
 	struct anglerate ctrl;
+	struct althold althold;
 
 	sys_micros_t next_acc_read_time;
+	sys_micros_t next_baro_read_time;
+	sys_micros_t next_althold_time;
+	sys_micros_t next_pos_time;
+	bool althold_on;
+	//! config generation that the controller and mixer were last loaded from
+	uint16_t config_generation;
 
-	QueueHandle_t in_queue, out_queue;
+	QueueHandle_t in_queue, out_queue, gps_queue;
 
 	const struct config *config;
 	const struct system_calls *system;
@@ -62,5 +71,7 @@ struct fastloop {
 
 void fastloop_write_controls(struct fastloop *self, const struct fastloop_input *in);
 void fastloop_read_outputs(struct fastloop *self, struct fastloop_output *out);
+//! passes a new gps solution to the position estimator
+void fastloop_write_gps(struct fastloop *self, const struct posest_gps_fix *fix);
 void fastloop_init(struct fastloop *self, const struct system_calls *system, const struct config *config);
 void fastloop_start(struct fastloop *self);
@@ -18,279 +18,95 @@
 
 #include <stdbool.h>
 #include <stdint.h>
-#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
-
 #include <platform.h>
 
-#include "debug.h"
-
 #include "common/maths.h"
-#include "common/axis.h"
 
 #include "config/config.h"
 
-#include "drivers/sensor.h"
-#include "drivers/accgyro.h"
-#include "drivers/sonar_hcsr04.h"
-
-#include "sensors/acceleration.h"
-#include "sensors/barometer.h"
-#include "sensors/sonar.h"
-
-#include "rx/rx.h"
-
-#include "flight/mixer.h"
-#include "flight/anglerate.h"
+#include "sensors/instruments.h"
 
 #include "flight/altitudehold.h"
 
-#include "ninja.h"
+//! the integer implementation ran at 40hz and its gains were tuned per update
+#define ALTHOLD_LEGACY_HZ 40
 
-#include <string.h>
+#define DEGREES_80_IN_DECIDEGREES 800
 
 void althold_init(struct althold *self, struct instruments *ins, const struct config *config){
 	memset(self, 0, sizeof(struct althold));
 	self->ins = ins;
 	self->config = config;
+	self->changed = true;
 }
 
-void althold_input_throttle(struct althold *self, int32_t throttle){
+void althold_input_throttle(struct althold *self, int16_t throttle){
 	self->throttle = throttle;
 }
 
-void althold_update(struct althold *self){
-	uint32_t alt = ins_get_altitude_cm(self->ins);
-	(void)alt;
-}
-
-int32_t althold_get_throttle(struct althold *self){
-	return self->output;
-}
-
-// TODO: althold
-#if 0
-// 40hz update rate (20hz LPF on acc)
-#define BARO_UPDATE_FREQUENCY_40HZ (1000 * 25)
-
-#define DEGREES_80_IN_DECIDEGREES 800
-
-void althold_init(struct althold *self, struct instruments *ins, struct rx *rx, const struct config const *config){
-	memset(self, 0, sizeof(struct althold));
-	self->rx = rx;
-	self->ins = ins;
-	self->config = config;
-}
-
-static void _apply_multi_althold(struct althold *self){
-	const struct rc_controls_config *rc = &config_get_profile(self->config)->rc;
-	// multirotor alt hold
-	if (rc->alt_hold_fast_change) {
-		// rapid alt changes
-		if (ABS(rx_get_channel(self->rx, THROTTLE) - self->initialRawThrottleHold) > rc->alt_hold_deadband) {
-			self->errorVelocityI = 0;
-			self->isAltHoldChanged = 1;
-			self->throttle = (rx_get_channel(self->rx, THROTTLE) > self->initialRawThrottleHold) ? -rc->alt_hold_deadband : rc->alt_hold_deadband;
-		} else {
-			if (self->isAltHoldChanged) {
-				self->AltHold = self->EstAlt;
-				self->isAltHoldChanged = 0;
-			}
-			self->throttle = constrain(self->initialThrottleHold + self->altHoldThrottleAdjustment, self->config->pwm_out.minthrottle, self->config->pwm_out.maxthrottle);
-		}
-	} else {
-		// slow alt changes, mostly used for aerial photography
-		if (ABS(rx_get_channel(self->rx, THROTTLE) - self->initialRawThrottleHold) > rc->alt_hold_deadband) {
-			// set velocity proportional to stick movement +100 throttle gives ~ +50 cm/s
-			self->setVelocity = (rx_get_channel(self->rx, THROTTLE) - self->initialRawThrottleHold) / 2;
-			self->velocityControl = 1;
-			self->isAltHoldChanged = 1;
-		} else if (self->isAltHoldChanged) {
-			self->AltHold = self->EstAlt;
-			self->velocityControl = 0;
-			self->isAltHoldChanged = 0;
-		}
-		self->throttle = constrain(self->initialThrottleHold + self->altHoldThrottleAdjustment, self->config->pwm_out.minthrottle, self->config->pwm_out.maxthrottle);
-	}
-}
-
-void althold_apply(struct althold *self){
-	// TODO: generic althold that works for both airplane and multi
-	/*
-	if (STATE(FIXED_WING)) {
-		_apply_airplane_althold(self);
-	} else {
-		_apply_multi_althold(self);
-	}
-	*/
-	_apply_multi_althold(self);
-}
-
-void althold_update(struct althold *self){
-	self->AltHold = self->EstAlt;
-	self->initialRawThrottleHold = rx_get_channel(self->rx, THROTTLE);
-	self->initialThrottleHold = 0;
-	self->errorVelocityI = 0;
-	self->altHoldThrottleAdjustment = 0;
-}
-
-static int32_t _calc_althold_throttle_delta(struct althold *self, int32_t vel_tmp, float accZ_tmp, float accZ_old){
-	int32_t result = 0;
-	int32_t error;
-	int32_t setVel;
-
-	const struct pid_config *pid = &config_get_profile(self->config)->pid;
-
-	bool is_thrust_downwards = ABS(ins_get_roll_dd(self->ins)) < DEGREES_80_IN_DECIDEGREES && ABS(ins_get_pitch_dd(self->ins)) < DEGREES_80_IN_DECIDEGREES;
-	if(!is_thrust_downwards){
-		return result;
-	}
-
-	// Altitude P-Controller
-
-	if (!self->velocityControl) {
-		error = constrain(self->AltHold - self->EstAlt, -500, 500);
-		error = applyDeadband(error, 10); // remove small P parameter to reduce noise near zero position
-		setVel = constrain((pid->P8[PIDALT] * error / 128), -300, +300); // limit velocity to +/- 3 m/s
-	} else {
-		setVel = self->setVelocity;
-	}
-	// Velocity PID-Controller
-
-	// P
-	error = setVel - vel_tmp;
-	result = constrain((pid->P8[PIDVEL] * error / 32), -300, +300);
-
-	// I
-	self->errorVelocityI += (pid->I8[PIDVEL] * error);
-	self->errorVelocityI = constrain(self->errorVelocityI, -(8192 * 200), (8192 * 200));
-	result += self->errorVelocityI / 8192;	 // I in range +/-200
-
-	// D
-	result -= constrain(pid->D8[PIDVEL] * (accZ_tmp + accZ_old) / 512, -150, 150);
-
-	return result;
+void althold_engage(struct althold *self){
+	self->setpoint = ins_get_altitude_cmf(self->ins);
+	self->hold_throttle = self->throttle;
+	self->output = self->throttle;
+	self->vel_i = 0;
+	self->changed = !ins_has_altitude(self->ins);
 }
 
-void althold_calculate_altitude(struct althold *self, uint32_t currentTime){
-	static uint32_t previousTime;
-	uint32_t dTime;
-	int32_t baroVel;
-	//float dt;
-	//float vel_acc;
-	int32_t vel_tmp;
-	static float accZ_old = 0.0f;
-	static float vel = 0.0f;
-	static float accAlt = 0.0f;
-	static int32_t lastBaroAlt;
-
-#ifdef SONAR
-	int32_t sonarAlt = SONAR_OUT_OF_RANGE;
-	static int32_t baroAlt_offset = 0;
-	float sonarTransition;
-#endif
-
+void althold_update(struct althold *self, float dt){
 	const struct config_profile *profile = config_get_profile(self->config);
+	const struct pid_config *pid = &profile->pid;
 
-	dTime = currentTime - previousTime;
-	if (dTime < BARO_UPDATE_FREQUENCY_40HZ)
+	if(!ins_has_altitude(self->ins)){
+		self->output = self->throttle;
+		self->changed = true;
 		return;
-
-	previousTime = currentTime;
-
-#ifdef BARO
-	if (!baro_is_calibrated(self->baro)) {
-		performBaroCalibrationCycle();
-		vel = 0;
-		accAlt = 0;
 	}
 
-	BaroAlt = baro_calc_altitude(self->baro);
-#else
-	BaroAlt = 0;
-#endif
-
-#ifdef SONAR
-	sonarAlt = sonar_read(&default_sonar);
-
-	// TODO: make this sonar calculation work after refactoring
-	//sonarAlt = sonar_calc_altitude(&default_sonar, imu_get_cos_tilt_angle(&default_imu));
-
-	if (sonarAlt > 0 && sonarAlt < default_sonar.cf_alt_cm) {
-		// just use the SONAR
-		baroAlt_offset = BaroAlt - sonarAlt;
-		BaroAlt = sonarAlt;
+	const float alt = ins_get_altitude_cmf(self->ins);
+	const int16_t stick = self->throttle - self->hold_throttle;
+	float set_vel;
+
+	if(ABS(stick) > profile->rc.alt_hold_deadband){
+		self->changed = true;
+		if(profile->rc.alt_hold_fast_change){
+			// pilot controls throttle directly while outside of the deadband
+			self->vel_i = 0;
+			self->output = self->throttle - ((stick > 0)?profile->rc.alt_hold_deadband:-profile->rc.alt_hold_deadband);
+			return;
+		}
+		// slow altitude changes for aerial photography, +100 throttle gives ~ +50 cm/s
+		set_vel = stick * 0.5f;
 	} else {
-		BaroAlt -= baroAlt_offset;
-		if (sonarAlt > 0  && sonarAlt <= default_sonar.max_alt_with_tilt_cm) {
-			// SONAR in range, so use complementary filter
-			sonarTransition = (float)(default_sonar.max_alt_with_tilt_cm - sonarAlt) / (default_sonar.max_alt_with_tilt_cm - default_sonar.cf_alt_cm);
-			BaroAlt = sonarAlt * sonarTransition + BaroAlt * (1.0f - sonarTransition);
+		if(self->changed){
+			self->setpoint = alt;
+			self->changed = false;
 		}
+		// altitude P controller, limit velocity to +/- 3 m/s
+		const float error = constrainf(self->setpoint - alt, -500, 500);
+		set_vel = constrainf(pid->P8[PIDALT] * error / 128.0f, -300, 300);
 	}
-#endif
 
-/* TODO: make this kind of thing work without so much interaction with the internals of imu!
- 
-	dt = imu_get_velocity_integration_time(&default_imu); 
-	vel_acc = imu_get_est_vertical_vel_cms(&default_imu); 
-
-	// Integrator - Altitude in cm
-	accAlt += (vel_acc * 0.5f) * dt + vel * dt;																 // integrate velocity to get distance (x= a/2 * t^2)
-	accAlt = accAlt * barometerConfig()->baro_cf_alt + (float)BaroAlt * (1.0f - barometerConfig()->baro_cf_alt);	// complementary filter for altitude estimation (baro & acc)
-	vel += vel_acc;
-
-#ifdef DEBUG_ALT_HOLD
-	debug[1] = accSum[2] / accSumCount; // acceleration
-	debug[2] = vel;					 // velocity
-	debug[3] = accAlt;				  // height
-#endif
-
-	imu_reset_velocity_estimate(&default_imu);
-*/
-#ifdef BARO
-	if (!isBaroCalibrationComplete()) {
+	bool is_thrust_downwards = ABS(ins_get_roll_dd(self->ins)) < DEGREES_80_IN_DECIDEGREES && ABS(ins_get_pitch_dd(self->ins)) < DEGREES_80_IN_DECIDEGREES;
+	if(!is_thrust_downwards){
+		self->output = self->hold_throttle;
 		return;
 	}
-#endif
-
-#ifdef SONAR
-	// TODO: pass sonar object to althold and read altitude from there
-	if (sonarAlt > 0 && sonarAlt < default_sonar.cf_alt_cm) {
-		// the sonar has the best range
-		self->EstAlt = BaroAlt;
-	} else {
-		self->EstAlt = accAlt;
-	}
-#else
-	self->EstAlt = accAlt;
-#endif
 
-	baroVel = (BaroAlt - lastBaroAlt) * 1000000.0f / dTime;
-	lastBaroAlt = BaroAlt;
+	// velocity PID controller
+	const float error = set_vel - ins_get_vertical_speed_cmsf(self->ins);
+	float result = constrainf(pid->P8[PIDVEL] * error / 32.0f, -300, 300);
 
-	baroVel = constrain(baroVel, -1500, 1500);  // constrain baro velocity +/- 1500cm/s
-	baroVel = applyDeadband(baroVel, 10);	   // to reduce noise near zero
+	self->vel_i = constrainf(self->vel_i + pid->I8[PIDVEL] * error * dt * (ALTHOLD_LEGACY_HZ / 8192.0f), -200, 200);
+	result += self->vel_i;
 
-	// apply Complimentary Filter to keep the calculated velocity based on baro velocity (i.e. near real velocity).
-	// By using CF it's possible to correct the drift of integrated accZ (velocity) without loosing the phase, i.e without delay
-	vel = vel * profile->baro.baro_cf_vel + baroVel * (1.0f - profile->baro.baro_cf_vel);
-	vel_tmp = lrintf(vel);
+	result -= constrainf(pid->D8[PIDVEL] * ins_get_vertical_accel_cmss(self->ins) / 256.0f, -150, 150);
 
-	// set vario
-	self->vario = applyDeadband(vel_tmp, 5);
-
-	// TODO: below line gets average vertical acceleration. It is nonsense. We should fix this once done refactoring (when the change can be tested)
-
-	// TODO: make this code work after refactoring
-	float acc_z = 0; //imu_get_avg_vertical_accel_cmss(&default_imu); 
-	self->altHoldThrottleAdjustment = _calc_althold_throttle_delta(self, vel_tmp, acc_z, accZ_old);
-
-	accZ_old = acc_z;
+	self->output = constrain(lrintf(self->hold_throttle + result), -500, 500);
 }
 
-int32_t althold_get_est_alt(struct althold *self){
-	return self->EstAlt;
+int16_t althold_get_throttle(struct althold *self){
+	return self->output;
 }
-#endif
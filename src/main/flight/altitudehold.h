@@ -22,28 +22,33 @@
 #include "../config/altitudehold.h"
 
 struct instruments;
-struct althold {
-	int32_t setVelocity;
-	uint8_t velocityControl;
-	int32_t errorVelocityI;
-	int32_t altHoldThrottleAdjustment;
-	int32_t AltHold;
-	int32_t vario;                      // variometer in cm/s
 
-	int16_t initialRawThrottleHold;
-	int16_t initialThrottleHold;
-	int32_t EstAlt;                // in cm
+//! rate at which althold_update() is expected to be called
+#define ALTHOLD_UPDATE_HZ 100
 
-    uint8_t isAltHoldChanged;
+/**
+ * Altitude hold for multirotors. Cascaded position and velocity controller
+ * that works on the float altitude estimate of the instruments. Runs at a fixed
+ * rate independent of the barometer so that the loop timing does not depend
+ * on sensor sample rate.
+ */
+struct althold {
+	float setpoint;			//!< altitude to hold in cm
+	float vel_i;			//!< integral of the velocity error
+	int16_t hold_throttle;	//!< throttle at the moment hold was engaged
+	bool changed;			//!< pilot is changing altitude, setpoint is taken from the estimate on release
 
 	int16_t throttle; //!< input throttle
-	int16_t output; //!< output throttle difference
+	int16_t output; //!< output throttle
 
 	struct instruments *ins;
 	const struct config *config;
 };
 
 void althold_init(struct althold *self, struct instruments *ins, const struct config *config);
-void althold_input_throttle(struct althold *self, int32_t throttle);
-void althold_update(struct althold *self);
-int32_t althold_get_throttle(struct althold *self);
+//! sets centered throttle stick (-500 to 500)
+void althold_input_throttle(struct althold *self, int16_t throttle);
+//! starts holding current altitude using current throttle as hover throttle
+void althold_engage(struct althold *self);
+void althold_update(struct althold *self, float dt);
+int16_t althold_get_throttle(struct althold *self);
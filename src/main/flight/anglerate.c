@@ -34,6 +34,7 @@
 #include "sensors/gyro.h"
 
 #include "rx/rx.h"
+#include "rx/rc.h"
 
 #include "anglerate.h"
 #include "rate_profile.h"
@@ -56,79 +57,157 @@ static void _anglerate_delta_state_update(struct anglerate *self) {
 	}
 }
 
-// constants to scale pidLuxFloat so output is same as pidMultiWiiRewrite
-static const float luxPTermScale = 1.0f; //1.0f / 64;
-static const float luxITermScale = 1.0f; //1.0f / 16.777216f;
-static const float luxDTermScale = 1.0f; //0.000128f;
+/**
+ * Builds the tpa table from the per axis curves. Points between curve
+ * breakpoints are interpolated linearly and throttle outside of the curve uses
+ * the nearest end point. The legacy single breakpoint tpa (tpa_rate above
+ * tpa_breakpoint) is folded into the roll and pitch weights so that both
+ * settings keep working together. The table is only rebuilt when one of these
+ * settings has changed since the last build.
+ */
+static void _anglerate_build_tpa(struct anglerate *self, const struct rate_profile *rp){
+	struct anglerate_tpa_source src;
+	memset(&src, 0, sizeof(src));
+	memcpy(src.curve_throttle, rp->tpa_curve_throttle, sizeof(src.curve_throttle));
+	memcpy(src.curve, rp->tpa_curve, sizeof(src.curve));
+	src.breakpoint = rp->tpa_breakpoint;
+	src.rate = rp->dynThrPID;
+	src.built = true;
+	if(!memcmp(&src, &self->k.tpa_source, sizeof(src)))
+		return;
+	self->k.tpa_source = src;
+
+	const float tpa_rate = MIN(rp->dynThrPID, CONTROL_RATE_CONFIG_TPA_MAX) * 0.01f;
+	const float tpa_bp = constrain(rp->tpa_breakpoint, PWM_RANGE_MIN, PWM_RANGE_MAX);
+	for(int c = 0; c <= ANGLERATE_TPA_LUT_SIZE; c++){
+		const float thr = PWM_RANGE_MIN + c * (float)(PWM_RANGE_MAX - PWM_RANGE_MIN) / ANGLERATE_TPA_LUT_SIZE;
+		int s = 0;
+		while(s < TPA_CURVE_POINTS - 2 && thr > rp->tpa_curve_throttle[s + 1]) s++;
+		const float x0 = rp->tpa_curve_throttle[s];
+		const float x1 = rp->tpa_curve_throttle[s + 1];
+		const float f = (x1 > x0)?constrainf((thr - x0) / (x1 - x0), 0, 1):((thr < x0)?0:1);
+		float legacy = 1.0f;
+		if(thr > tpa_bp && tpa_bp < PWM_RANGE_MAX)
+			legacy -= tpa_rate * (thr - tpa_bp) / (PWM_RANGE_MAX - tpa_bp);
+		for(int axis = 0; axis < 3; axis++){
+			const float y0 = rp->tpa_curve[axis][s];
+			const float y1 = rp->tpa_curve[axis][s + 1];
+			float w = (y0 + (y1 - y0) * f) * 0.01f;
+			if(axis != YAW) w *= legacy;
+			self->k.tpa[axis][c] = w;
+		}
+	}
+}
 
-static int16_t _anglerate_calc_axis(struct anglerate *self, int axis, const float gyroRate, const float rateError, float dT){
+//! interpolates the tpa table at the current throttle into the weights used by the rate loop
+static void _anglerate_update_tpa(struct anglerate *self){
+	const float pos = (self->throttle + 500) * (ANGLERATE_TPA_LUT_SIZE / 1000.0f);
+	const int idx = MIN((int)pos, ANGLERATE_TPA_LUT_SIZE - 1);
+	const float f = pos - idx;
+	for(int axis = 0; axis < 3; axis++){
+		const float *lut = self->k.tpa[axis];
+		self->pid_weight[axis] = lut[idx] + (lut[idx + 1] - lut[idx]) * f;
+	}
+}
+
+void anglerate_reload_config(struct anglerate *self){
 	const struct config_profile *profile = config_get_profile(self->config);
+	const struct rate_profile *rp = config_get_rate_profile(self->config);
 	const struct pid_config *pid = &profile->pid;
+	struct anglerate_pid *rate = &self->pid;
+	struct anglerate_coeffs *k = &self->k;
+
+	// gains are derived from P8 and I8 as ziegler-nichols ultimate gain and period
+	for(int axis = 0; axis < 3; axis++){
+		float ku = pid->P8[axis] * 0.1f;
+		float tu = pid->I8[axis] * 0.01f;
+		// for rate we use a PD controller
+		rate->kp[axis] = 0.6f * ku;
+		rate->ki[axis] = 0;
+		rate->kd[axis] = (0.6f * ku * tu) / 8;
+		rate->i_limit[axis] = PID_MAX_I;
+		rate->d_limit[axis] = PID_MAX_D;
+	}
+	rate->out_limit = 500;
+
+	// 100dps to 1100dps max yaw rate and 200dps to 1200dps max roll/pitch rate
+	k->stick_rate[ROLL] = (rp->rates[ROLL] + 27) / 16.0f;
+	k->stick_rate[PITCH] = (rp->rates[PITCH] + 27) / 16.0f;
+	k->stick_rate[YAW] = (rp->rates[YAW] + 27) / 32.0f;
+
+	float ku = pid->P8[PIDLEVEL] * 0.1f;
+	float tu = pid->I8[PIDLEVEL] * 0.1f;
+	k->level_kp = 0.6f * ku;
+	k->level_ki = (tu > 0)?((1.2f * ku) / tu):0;
+	k->level_kd = (0.6f * ku * tu) / 8;
+
+	k->max_angle = self->config->imu.max_angle_inclination;
+	k->trim[ROLL] = profile->acc.trims.raw[ROLL];
+	k->trim[PITCH] = profile->acc.trims.raw[PITCH];
+	k->angle_div = constrain(pid->angle_loop_div, 1, 255);
+
+	_anglerate_build_tpa(self, rp);
+	_anglerate_update_tpa(self);
+}
 
-	float ku = pid->P8[axis] * 0.1f;
-	float tu = pid->I8[axis] * 0.01f;
-	float kp = 0.6f * ku;
-	float ki = 0; // for rate we use a PD controller. //(1.2f * ku) / tu;
-	float kd = (0.6f * ku * tu) / 8;
+/**
+ * Inner loop. Runs the rate pid on all three axes at once using the compiled
+ * gains. There is no per axis special casing here: terms with zero gain simply
+ * evaluate to zero and limits are applied with fminf/fmaxf so the loop body
+ * compiles to straight line code.
+ */
+static void _anglerate_update_rate(struct anglerate *self, const float target[3], const float rate[3], float dT){
+	const struct anglerate_pid *k = &self->pid;
+	const float inv_dt = 1.0f / dT;
 
-	// -----calculate P component
-	float PTerm = rateError * kp * self->PIDweight[axis] / 100;
+	for(int axis = 0; axis < 3; axis++){
+		const float error = target[axis] - rate[axis];
+		const float w = self->pid_weight[axis];
 
-	// Constrain YAW by yaw_p_limit value if not servo driven, in that case servolimits apply
-	/*
-	if (axis == YAW && pid->yaw_p_limit && (self->flags & ANGLERATE_FLAG_PLIMIT)) {
-		PTerm = constrainf(PTerm, -pid->yaw_p_limit, pid->yaw_p_limit);
-	}
-	*/
-
-	// -----calculate I component
-	float ITerm = self->lastITermf[axis] + luxITermScale * rateError * dT * ki;
-	// generic antiwindup
-	if(ITerm < -PID_MAX_I || ITerm > PID_MAX_I)
-		ITerm = ITerm - self->output.axis_I[axis];
-	ITerm = constrainf(ITerm, -PID_MAX_I, PID_MAX_I);
-	self->lastITermf[axis] = ITerm;
-	/*
-	// limit maximum integrator value to prevent WindUp - accumulating extreme values when system is saturated.
-	// I coefficient (I8) moved before integration to make limiting independent from PID settings
-	// Anti windup protection
-	if (self->flags & ANGLERATE_FLAG_ANTIWINDUP) {
-		ITerm = constrainf(ITerm, -self->ITermLimitf[axis], self->ITermLimitf[axis]);
-	} else {
-		self->ITermLimitf[axis] = ABS(ITerm);
+		const float p = error * k->kp[axis] * w;
+
+		float i = self->lastITermf[axis] + error * dT * k->ki[axis];
+		i = fminf(fmaxf(i, -k->i_limit[axis]), k->i_limit[axis]);
+		self->lastITermf[axis] = i;
+
+		// delta calculated from measurement to avoid kicks on setpoint changes
+		float d = (self->lastRateForDelta[axis] - rate[axis]) * inv_dt * k->kd[axis] * w;
+		d = fminf(fmaxf(d, -k->d_limit[axis]), k->d_limit[axis]);
+		self->lastRateForDelta[axis] = rate[axis];
+
+		self->output.axis_P[axis] = p;
+		self->output.axis_I[axis] = i;
+		self->output.axis_D[axis] = d;
+		self->output.axis[axis] = lrintf(fminf(fmaxf(p + i + d, -k->out_limit), k->out_limit));
 	}
-	self->lastITermf[axis] = ITerm;
-	*/
-
-	// -----calculate D component
-	float DTerm;
-	if (kd < 1e-6f) {
-		// optimisation for when D8 is zero, often used by YAW axis
-		DTerm = 0;
-	} else {
-		// delta calculated from measurement
-		float delta = -(gyroRate - self->lastRateForDelta[axis]);
-		self->lastRateForDelta[axis] = gyroRate;
-		// Divide delta by dT to get differential (ie dr/dt)
-		delta *= (1.0f / dT);
-		/*
-		if (pid->dterm_cut_hz) {
-			// DTerm delta low pass filter
-			delta = applyBiQuadFilter(delta, &self->deltaFilterState[axis]);
-		} else {
-			// When DTerm low pass filter disabled apply moving average to reduce noise
-			delta = filterApplyAveragef(delta, DTERM_AVERAGE_COUNT, self->deltaStatef[axis]);
+}
+
+/**
+ * Outer loop. Turns the attitude error into a desired rotation rate. It runs
+ * at a fraction of the gyro rate because attitude changes much slower than the
+ * body rates that the inner loop has to follow.
+ */
+static void _anglerate_update_angle(struct anglerate *self, float dT, uint8_t steps){
+	const struct anglerate_coeffs *k = &self->k;
+	for(int axis = 0; axis < 2; axis++){
+		if(self->level_percent[axis] == 0){
+			self->angle_rate[axis] = 0;
+			continue;
 		}
-		*/
-		DTerm = delta * kd * self->PIDweight[axis] / 100;
-		DTerm = constrainf(DTerm, -PID_MAX_D, PID_MAX_D);
-	}
+		// calculate error angle and limit the angle to the max inclination
+		// multiplication of user input corresponds to changing the sticks scaling here
+		const float errorAngle = constrainf(self->user[axis], -k->max_angle, k->max_angle)
+				- self->body_angles[axis] + k->trim[axis];
+
+		self->angle_I[axis] = constrainf(self->angle_I[axis] + errorAngle * dT, -256, 256);
+		float ITerm = self->angle_I[axis];
 
-	self->output.axis_P[axis] = PTerm;
-	self->output.axis_I[axis] = ITerm;
-	self->output.axis_D[axis] = DTerm;
-	// -----calculate total PID output
-	return lrintf(PTerm + ITerm + DTerm);
+		// the derivative is kept in units of one rate loop step so gains do not depend on the divider
+		float DTerm = (self->body_angles[axis] - self->angle_E[axis]) / steps;
+		self->angle_E[axis] = self->body_angles[axis];
+
+		self->angle_rate[axis] = errorAngle * k->level_kp + ITerm * k->level_ki + DTerm * k->level_kd;
+	}
 }
 
 void anglerate_update(struct anglerate *self, float dT){
@@ -141,55 +220,27 @@ void anglerate_update(struct anglerate *self, float dT){
 
 	_anglerate_delta_state_update(self);
 
-	const struct rate_profile *rp = config_get_rate_profile(self->config);
-	const struct config_profile *profile = config_get_profile(self->config);
-	const struct pid_config *pid = &profile->pid;
+	self->angle_dt += dT;
+	if(++self->angle_count >= self->k.angle_div){
+		_anglerate_update_angle(self, self->angle_dt, self->angle_count);
+		self->angle_dt = 0;
+		self->angle_count = 0;
+	}
 
-	// ----------PID controller----------
+	float target[3], rate[3];
 	for (int axis = 0; axis < 3; axis++) {
-		const uint8_t rate = rp->rates[axis];
-
-		// -----Get the desired angle rate depending on flight mode
-		float angleRate;
-		if (axis == FD_YAW) {
-			// YAW is always gyro-controlled (MAG correction is applied to user input) 100dps to 1100dps max yaw rate
-			angleRate = (float)((rate + 27) * self->user[YAW]) / 32.0f;
-		} else {
-			// control is GYRO based for ACRO and HORIZON - direct sticks control is applied to rate PID
-			// also if we use blending then we lower the rate mode percentage depending on how much angle mode percentage we need
-			angleRate = (float)(rate + 27) * self->user[axis] * ((100.0f - self->level_percent[axis]) / 100) / 16.0f; // 200dps to 1200dps max roll/pitch rate
-
-			if(self->level_percent[axis] > 0){
-				// calculate error angle and limit the angle to the max inclination
-				// multiplication of user input corresponds to changing the sticks scaling here
-				const float maxangle = self->config->imu.max_angle_inclination;
-				const float errorAngle = constrain(self->user[axis], -((int)maxangle), maxangle)
-						- self->body_angles[axis] + profile->acc.trims.raw[axis];
-				
-				float ku = pid->P8[PIDLEVEL] * 0.1f;
-				float tu = pid->I8[PIDLEVEL] * 0.1f;
-				float kp = 0.6f * ku;
-				float ki = (1.2f * ku) / tu;
-				float kd = (0.6f * ku * tu) / 8;
-
-				self->angle_I[axis] = constrainf(self->angle_I[axis] + errorAngle * dT, -256, 256);
-				float ITerm = self->angle_I[axis];
-				if(ITerm < -PID_MAX_I || ITerm > PID_MAX_I)
-					ITerm = ITerm - self->angle_I[axis];
-
-				float DTerm = (self->body_angles[axis] - self->angle_E[axis]);
-				self->angle_E[axis] = self->body_angles[axis];
-
-				angleRate = errorAngle * kp + ITerm * ki + DTerm * kd;
-				//angleRate += errorAngle * pid->P8[PIDLEVEL] * ((float)self->level_percent[axis] / 100.0f) / 16.0f + ITerm + DTerm;
-			}
-		}
-
-		// --------low-level gyro-based PID. ----------
+		// control is GYRO based for ACRO and HORIZON - direct sticks control is applied to rate PID
+		target[axis] = self->k.stick_rate[axis] * self->user[axis];
 		// gyro rates converted into deg/s
-		const float gyroRate = self->body_rates[axis] * SYSTEM_GYRO_SCALE;
-		self->output.axis[axis] = constrain(_anglerate_calc_axis(self, axis, gyroRate, angleRate - gyroRate, dT), -500, 500);
+		rate[axis] = self->body_rates[axis] * SYSTEM_GYRO_SCALE;
+	}
+	// YAW is always gyro-controlled (MAG correction is applied to user input)
+	for (int axis = 0; axis < 2; axis++) {
+		if(self->level_percent[axis] > 0)
+			target[axis] = self->angle_rate[axis];
 	}
+
+	_anglerate_update_rate(self, target, rate, dT);
 }
 
 void anglerate_init(struct anglerate *self,
@@ -198,9 +249,10 @@ void anglerate_init(struct anglerate *self,
 	self->ins = ins;
 	for(int c = 0; c < 3; c++) {
 		self->pidScale[c] = 100;
-		self->PIDweight[c] = 100;
+		self->pid_weight[c] = 1.0f;
 	}
 	self->config = config;
+	anglerate_reload_config(self);
 }
 
 void anglerate_reset_angle_i(struct anglerate *self){
@@ -238,7 +290,7 @@ void anglerate_set_pid_axis_scale(struct anglerate *self, uint8_t axis, int32_t
 
 void anglerate_set_pid_axis_weight(struct anglerate *self, uint8_t axis, int32_t weight){
 	if(axis > 2) return;
-	self->PIDweight[axis] = weight;
+	self->pid_weight[axis] = weight * 0.01f;
 }
 
 void anglerate_input_body_rates(struct anglerate *self, int16_t x, int16_t y, int16_t z){
@@ -253,6 +305,11 @@ void anglerate_input_body_angles(struct anglerate *self, int16_t roll, int16_t p
 	self->body_angles[2] = yaw;
 }
 
+void anglerate_input_throttle(struct anglerate *self, int16_t throttle){
+	self->throttle = constrain(throttle, -500, 500);
+	_anglerate_update_tpa(self);
+}
+
 void anglerate_input_user(struct anglerate *self, int16_t roll, int16_t pitch, int16_t yaw){
 	self->user[0] = constrain(roll, -500, 500);
 	self->user[1] = constrain(pitch, -500, 500);
@@ -313,6 +370,13 @@ void anglerate_set_level_percent(struct anglerate *self, uint8_t roll, uint8_t p
  * correction allowing pilot to do full spins while maintaining a degree of
  * angle correction.
  *
+ * The controller is split into two loops. The inner rate loop runs on every
+ * gyro sample. The outer angle loop only runs once every angle_loop_div
+ * updates and its output is held in between. Constants that are derived from
+ * the gains are computed in anglerate_reload_config() and not in the loops.
+ * The rate pid itself is compiled into per axis gain and limit arrays (struct
+ * anglerate_pid) and evaluated for all axes in one pass.
+ *
  * Current implementaiton includes two variations of the same basic algorithm
  * where one is using fixed point math while the other uses floating point
  * math. The original Multiwii23 controller has been removed to simplify code
@@ -45,20 +45,66 @@ struct pid_controller_output{
 	float axis_D[3];
 };
 
+/**
+ * Compiled rate pid. Gains and limits are kept as per axis float arrays so
+ * that the rate loop can update all three axes in one pass without looking at
+ * the config. Rebuilt by anglerate_reload_config().
+ */
+struct anglerate_pid {
+	float kp[3];
+	float ki[3];
+	float kd[3];
+	float i_limit[3];
+	float d_limit[3];
+	float out_limit;
+};
+
+//! number of throttle steps in the precomputed tpa table
+#define ANGLERATE_TPA_LUT_SIZE 32
+
+//! rate profile settings that the tpa table was built from
+struct anglerate_tpa_source {
+	uint16_t curve_throttle[TPA_CURVE_POINTS];
+	uint8_t curve[3][TPA_CURVE_POINTS];
+	uint16_t breakpoint;
+	uint8_t rate;
+	bool built;
+};
+
+//! controller constants derived from the config, see anglerate_reload_config()
+struct anglerate_coeffs {
+	float stick_rate[3];		//!< converts user input into deg/s in rate mode
+	float level_kp;
+	float level_ki;
+	float level_kd;
+	float max_angle;			//!< max inclination in decidegrees
+	float trim[2];				//!< acc trims for roll and pitch
+	uint8_t angle_div;			//!< angle loop runs once per this many rate loop updates
+	float tpa[3][ANGLERATE_TPA_LUT_SIZE + 1];	//!< P and D weight per axis at evenly spaced throttle from low to high
+	struct anglerate_tpa_source tpa_source;
+};
+
 struct anglerate {
-	// PIDweight is a scale factor for PIDs which is derived from the throttle and TPA setting, and 100 = 100% scale means no PID reduction
-	uint8_t PIDweight[3];
+	// pid_weight is a scale factor for P and D which is derived from the throttle and TPA setting, 1.0 means no PID reduction
+	float pid_weight[3];
 
 	//int32_t lastITerm[3], ITermLimit[3];
 	float lastITermf[3], ITermLimitf[3];
 	float angle_I[3];
 	float angle_E[3];
+	float angle_rate[2];		//!< output of the angle loop, held between angle loop updates
+	float angle_dt;				//!< time since the last angle loop update
+	uint8_t angle_count;		//!< rate loop updates since the last angle loop update
+
+	struct anglerate_pid pid;
+	struct anglerate_coeffs k;
 
 	biquad_t deltaFilterState[3];
 
 	int16_t body_rates[3];
 	int16_t body_angles[3];
 	int16_t user[3]; //!< user input command
+	int16_t throttle; //!< centered throttle used to look up the tpa weights
 
 	// used for luxfloat
 	float lastRateForDelta[3];
@@ -98,11 +144,15 @@ const struct pid_controller_output *anglerate_get_output_ptr(struct anglerate *s
 void anglerate_input_body_rates(struct anglerate *self, int16_t x, int16_t y, int16_t z);
 void anglerate_input_body_angles(struct anglerate *self, int16_t roll, int16_t pitch, int16_t yaw);
 void anglerate_input_user(struct anglerate *self, int16_t roll, int16_t pitch, int16_t yaw);
+//! sets throttle (-500 to 500) that selects the tpa weight applied to P and D on each axis
+void anglerate_input_throttle(struct anglerate *self, int16_t throttle);
 
 static inline int16_t anglerate_get_roll(struct anglerate *self) { return self->output.axis[0]; }
 static inline int16_t anglerate_get_pitch(struct anglerate *self) { return self->output.axis[1]; }
 static inline int16_t anglerate_get_yaw(struct anglerate *self) { return self->output.axis[2]; }
 
+//! recomputes controller constants after the pid, rate or imu config has changed
+void anglerate_reload_config(struct anglerate *self);
 void anglerate_update(struct anglerate *self, float dT);
 
 void anglerate_enable_antiwindup(struct anglerate *self, bool on);
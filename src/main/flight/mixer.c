@@ -534,13 +534,32 @@ static const struct mixer_rule_def mixerGimbal[] = {
 	{ MIXER_OUTPUT_S2, MIXER_INPUT_G2_GIMBAL_PITCH,1000 },
 };
 
-static void _update_motor_and_servo_count(struct mixer *self){
-	self->motorCount = 0;
-	self->servoCount = 0;
+/**
+ * Compiles the active rules into the gain matrix and counts the motors and
+ * servos that are driven by them. Rules that reference invalid channels are
+ * dropped here so that mixer_update() does not need to check them.
+ */
+static void _compile_rules(struct mixer *self){
+	struct mixer_matrix *m = &self->matrix;
 	uint8_t motor[MIXER_OUTPUT_COUNT] = {0};
 	uint8_t servo[MIXER_OUTPUT_COUNT] = {0};
+
+	memset(m, 0, sizeof(*m));
+	self->motorCount = 0;
+	self->servoCount = 0;
+
 	for(int c = 0; c < self->ruleCount; c++){
-		struct mixer_rule_def *rule = &self->active_rules[c];
+		const struct mixer_rule_def *rule = &self->active_rules[c];
+		if(rule->input >= MIXER_INPUT_COUNT || rule->output >= MIXER_OUTPUT_COUNT) continue;
+
+		int col = 0;
+		while(col < m->input_count && m->inputs[col] != rule->input) col++;
+		if(col == m->input_count){
+			if(m->input_count == MIXER_MATRIX_MAX_INPUTS) continue;
+			m->inputs[m->input_count++] = rule->input;
+		}
+		m->gain[col][rule->output] += rule->scale * 0.001f;
+
 		if(rule->output < MIXER_OUTPUT_SERVOS) motor[rule->output] = true;
 		else servo[rule->output] = true;
 	}
@@ -593,11 +612,170 @@ static void _load_preset(struct mixer *self, mixer_mode_t preset){
 	self->ruleCount = constrain(rule_count, 0, MIXER_MAX_RULES);
 	memcpy(self->active_rules, rules, sizeof(struct mixer_rule_def) * self->ruleCount);
 
-	_update_motor_and_servo_count(self);
+	_compile_rules(self);
 
 	self->mode = preset;
 }
 
+/**
+ * Airmode. Keeps the full differential thrust and moves the collective thrust
+ * up or down to fit. Everything is scaled down only if the differential alone
+ * does not fit into the throttle range.
+ */
+static void _desat_airmode(struct mixer *self, int16_t *output, uint16_t count){
+	// find the minimum and maximum value
+	int16_t minmotor = 0, maxmotor = 0;
+	for(uint16_t c = 0; c < count; c++){
+		if(output[c] < minmotor) minmotor = output[c];
+		if(output[c] > maxmotor) maxmotor = output[c];
+	}
+	int16_t motorrange = maxmotor - minmotor;
+	int16_t throttlerange = self->maxthrottle - self->minthrottle;
+	if(motorrange > throttlerange && motorrange > 0){
+		self->motorLimitReached = true;
+		float scale = (float)throttlerange / motorrange;
+		for(uint16_t c = 0; c < count; c++){
+			output[c] = lrintf(output[c] * scale);
+		}
+	} else if((self->midthrottle + maxmotor) > self->maxthrottle) {
+		self->motorLimitReached = true;
+		// if we went over the top limit we move the throttle down
+		int16_t offset = (self->midthrottle + maxmotor) - self->maxthrottle;
+		for(uint16_t c = 0; c < count; c++){
+			output[c] -= offset;
+		}
+	} else if((self->midthrottle + minmotor) < self->minthrottle){
+		self->motorLimitReached = true;
+		// if we went below the minimum throttle then we move the throttle up
+		int16_t offset = self->minthrottle - (self->midthrottle + minmotor);
+		for(uint16_t c = 0; c < count; c++){
+			output[c] += offset;
+		}
+	} else {
+		self->motorLimitReached = false;
+	}
+}
+
+/**
+ * Throttle priority. The mean of the motor outputs is taken as the collective
+ * thrust and is kept (limited to the throttle range). Differential thrust
+ * around it is scaled down until all motors fit.
+ */
+static void _desat_throttle(struct mixer *self, int16_t *output, uint16_t count){
+	if(!count) return;
+
+	int32_t sum = 0;
+	for(uint16_t c = 0; c < count; c++){
+		sum += output[c];
+	}
+	const int16_t lo = self->minthrottle - self->midthrottle;
+	const int16_t hi = self->maxthrottle - self->midthrottle;
+	const int16_t collective = constrain(sum / count, lo, hi);
+
+	int16_t mindiff = 0, maxdiff = 0;
+	for(uint16_t c = 0; c < count; c++){
+		int16_t diff = output[c] - collective;
+		if(diff < mindiff) mindiff = diff;
+		if(diff > maxdiff) maxdiff = diff;
+	}
+
+	float scale = 1.0f;
+	if(maxdiff > hi - collective)
+		scale = MIN(scale, (float)(hi - collective) / maxdiff);
+	if(mindiff < lo - collective)
+		scale = MIN(scale, (float)(lo - collective) / mindiff);
+
+	self->motorLimitReached = scale < 1.0f;
+	for(uint16_t c = 0; c < count; c++){
+		output[c] = collective + lrintf((output[c] - collective) * scale);
+	}
+}
+
+/**
+ * Attitude priority. Over the top of the range collective thrust is moved
+ * down like in airmode. At the bottom collective thrust is never raised above
+ * what was commanded and differential thrust is reduced instead.
+ */
+static void _desat_attitude(struct mixer *self, int16_t *output, uint16_t count){
+	int16_t maxmotor = 0;
+	for(uint16_t c = 0; c < count; c++){
+		if(output[c] > maxmotor) maxmotor = output[c];
+	}
+	int16_t offset = (self->midthrottle + maxmotor) - self->maxthrottle;
+	if(offset > 0){
+		for(uint16_t c = 0; c < count; c++){
+			output[c] -= offset;
+		}
+	}
+	_desat_throttle(self, output, count);
+	if(offset > 0) self->motorLimitReached = true;
+}
+
+static void (*const _desat_modes[MIXER_DESAT_COUNT])(struct mixer *self, int16_t *output, uint16_t count) = {
+	[MIXER_DESAT_AIRMODE] = _desat_airmode,
+	[MIXER_DESAT_THROTTLE] = _desat_throttle,
+	[MIXER_DESAT_ATTITUDE] = _desat_attitude,
+};
+
+/**
+ * Rebuilds the thrust curve for the current throttle range. The curve blends
+ * between linear and square root response because thrust of a propeller grows
+ * roughly with the square of the pwm command.
+ */
+static void _update_thrust_lut(struct mixer *self){
+	const float range = self->maxthrottle - self->minthrottle;
+	const float k = self->thrust_linear * 0.01f;
+	for(int i = 0; i <= MIXER_THRUST_LUT_SIZE; i++){
+		float f = (float)i / MIXER_THRUST_LUT_SIZE;
+		self->thrust_lut[i] = self->minthrottle + range * ((1.0f - k) * f + k * sqrtf(f));
+	}
+	self->thrust_lut_scale = (range > 0)?(MIXER_THRUST_LUT_SIZE / range):0;
+}
+
+//! maps a motor value that is already within min and max throttle through the thrust curve
+static inline int16_t _thrust_lookup(const struct mixer *self, int16_t value){
+	const float pos = (value - self->minthrottle) * self->thrust_lut_scale;
+	const int i = MIN((int)pos, MIXER_THRUST_LUT_SIZE - 1);
+	const float *lut = &self->thrust_lut[i];
+	return lrintf(lut[0] + (lut[1] - lut[0]) * (pos - i));
+}
+
+/**
+ * Brings the mixer up to date with the config. Loads a new preset if the
+ * mixer mode has changed and precomputes servo scaling and limits so that
+ * mixer_update() does not have to look at the config.
+ */
+void mixer_reload_config(struct mixer *self){
+	const struct servo_profile *servos = &config_get_profile(self->config)->servos;
+
+	if(self->mode != self->config->mixer.mixerMode)
+		_load_preset(self, self->config->mixer.mixerMode);
+
+	self->mincommand = self->config->pwm_out.mincommand;
+	self->motor_pole_pairs = MAX(self->config->pwm_out.motor_poles / 2, 1);
+
+	uint8_t desat = self->config->mixer.desat_mode;
+	self->desaturate = _desat_modes[(desat < MIXER_DESAT_COUNT)?desat:MIXER_DESAT_AIRMODE];
+
+	const uint8_t thrust_linear = constrain(self->config->mixer.thrust_linear, 0, 100);
+	if(thrust_linear != self->thrust_linear){
+		self->thrust_linear = thrust_linear;
+		_update_thrust_lut(self);
+	}
+
+	for(int i = 0; i < MIXER_MAX_SERVOS; i++){
+		const struct servo_config *conf = &servos->servoConf[i];
+		uint16_t servo_width = conf->max - conf->min;
+		// TODO: the 0 and 100 were supposed to be part of servo mixer rule but never seemed to be used so replaced by constants for now.
+		self->servo.min[i] = constrain(0 * servo_width / 100 - servo_width / 2, -500, 500);
+		int16_t tmp = 100 * (uint32_t)servo_width / 100;
+		self->servo.max[i] = constrain(tmp - servo_width / 2, -500, 500);
+		self->servo.middle[i] = constrain(conf->middle, 1000, 2000);
+		self->servo.forward_middle[i] = conf->middle;
+		self->servo.rate[i] = conf->rate * 0.01f;
+	}
+}
+
 /**
  * Initializes an empty mixer objects clearing memory first.
  */
@@ -618,8 +796,8 @@ void mixer_init(struct mixer *self, const struct config const *config, const str
 		self->config->pwm_out.minthrottle,
 		self->config->pwm_out.maxthrottle);
 
-	// load preset from config
-	_load_preset(self, self->config->mixer.mixerMode);
+	// load preset and limits from config
+	mixer_reload_config(self);
 }
 
 #if 0
@@ -690,7 +868,7 @@ void mixer_load_motor_mixer(struct mixer *self, const struct motor_mixer *motors
 		if(!found[3] && fabsf(rule->throttle) > 1e-6f)
 			self->active_rules[self->ruleCount++] = (struct mixer_rule_def){ .input = MIXER_INPUT_G0_THROTTLE, .output = MIXER_OUTPUT_MOTORS + c, .scale = rule->throttle * 1000.0f };
 	}
-	_update_motor_and_servo_count(self);
+	_compile_rules(self);
 }
 
 /**
@@ -712,7 +890,7 @@ void mixer_load_servo_mixer(struct mixer *self, const struct servo_mixer *servos
 		if(!found)
 			self->active_rules[self->ruleCount++] = (struct mixer_rule_def){ .input = rule->inputSource, .output = rule->targetChannel, .scale = rule->rate * 10.0f };
 	}
-	_update_motor_and_servo_count(self);
+	_compile_rules(self);
 }
 /**
  * Exports servo settings from the internal rules representation into config servo_mixer
@@ -742,6 +920,7 @@ int mixer_save_servo_mixer(struct mixer *self, struct servo_mixer *output){
 void mixer_clear_rules(struct mixer *self){
 	self->ruleCount = 0;
 	memset(self->active_rules, 0, sizeof(self->active_rules));
+	_compile_rules(self);
 }
 
 /**
@@ -769,42 +948,12 @@ void mixer_set_throttle_range(struct mixer *self, int16_t mid, int16_t min, int1
 	min = constrain(min, 1000, 2000);
 	if(max < min) max = min;
 	self->midthrottle = constrain(mid, min, max);
+	// the thrust curve does not depend on mid throttle
+	if(min == self->minthrottle && max == self->maxthrottle)
+		return;
 	self->minthrottle = min;
 	self->maxthrottle = max;
-}
-
-static void _scale_motors(struct mixer *self, int16_t *output, uint16_t count){
-	// find the minimum and maximum value
-	int16_t minmotor = 0, maxmotor = 0;
-	for(uint16_t c = 0; c < count; c++){
-		if(output[c] < minmotor) minmotor = output[c];
-		if(output[c] > maxmotor) maxmotor = output[c];
-	}
-	int16_t motorrange = maxmotor - minmotor;
-	int16_t throttlerange = self->maxthrottle - self->minthrottle;
-	if(motorrange > throttlerange && motorrange > 0){
-		self->motorLimitReached = true;
-		float scale = (float)throttlerange / motorrange;
-		for(uint16_t c = 0; c < count; c++){
-			output[c] = lrintf(output[c] * scale);
-		}
-	} else if((self->midthrottle + maxmotor) > self->maxthrottle) {
-		self->motorLimitReached = true;
-		// if we went over the top limit we move the throttle down
-		int16_t offset = (self->midthrottle + maxmotor) - self->maxthrottle;
-		for(uint16_t c = 0; c < count; c++){
-			output[c] -= offset;
-		}
-	} else if((self->midthrottle + minmotor) < self->minthrottle){
-		self->motorLimitReached = true;
-		// if we went below the minimum throttle then we move the throttle up
-		int16_t offset = self->minthrottle - (self->midthrottle + minmotor);
-		for(uint16_t c = 0; c < count; c++){
-			output[c] += offset;
-		}
-	} else {
-		self->motorLimitReached = false;
-	}
+	_update_thrust_lut(self);
 }
 
 /**
@@ -814,19 +963,18 @@ static void _scale_motors(struct mixer *self, int16_t *output, uint16_t count){
  * If mixer is in disarmed state then it will forward group 4 inputs (motor
  * passthrough) to the outputs. This feature can be used to test motors when
  * mixer is not mixing (without changing mixing mode).
+ *
+ * All rules and limits are taken from the compiled state so config changes
+ * only take effect after mixer_reload_config().
  */
 void mixer_update(struct mixer *self){
 	// we will copy this into mixer output when we are done
 	int16_t output[MIXER_OUTPUT_COUNT];
-	memset(output, 0, sizeof(output));
-
-	if(self->mode != self->config->mixer.mixerMode)
-		_load_preset(self, self->config->mixer.mixerMode);
 
 	// if we are disarmed then we write preset disarmed values (this is necessary so we can test motors from configurator)
 	if(!(self->flags & MIXER_FLAG_ARMED)){
 		for(int c = 0; c < MIXER_MAX_MOTORS; c++){
-			output[MIXER_OUTPUT_MOTORS + c] = constrain(self->midthrottle + self->input[MIXER_INPUT_GROUP_MOTOR_PASSTHROUGH + c], self->config->pwm_out.mincommand, 2000);
+			output[MIXER_OUTPUT_MOTORS + c] = constrain(self->midthrottle + self->input[MIXER_INPUT_GROUP_MOTOR_PASSTHROUGH + c], self->mincommand, 2000);
 		}
 		// set servos to middle
 		for(int c = 0; c < MIXER_MAX_SERVOS; c++){
@@ -835,43 +983,42 @@ void mixer_update(struct mixer *self){
 		goto finish;
 	}
 
-	// mix all outputs according to rules. This will put range centered around zero into all output channels.
-	for(int c = 0; c < self->ruleCount; c++){
-		struct mixer_rule_def *rule = &self->active_rules[c];
-		if(rule->input > MIXER_INPUT_COUNT || rule->output > MIXER_OUTPUT_COUNT) continue;
-		output[rule->output] += (((int32_t)self->input[rule->input] * rule->scale) / 1000);
+	// mix all outputs as a matrix vector product. This will put range centered around zero into all output channels.
+	float mixed[MIXER_OUTPUT_COUNT] = {0};
+	for(int col = 0; col < self->matrix.input_count; col++){
+		const float x = self->input[self->matrix.inputs[col]];
+		const float *gain = self->matrix.gain[col];
+		for(int c = 0; c < MIXER_OUTPUT_COUNT; c++){
+			mixed[c] += gain[c] * x;
+		}
+	}
+	for(int c = 0; c < MIXER_OUTPUT_COUNT; c++){
+		output[c] = lrintf(mixed[c]);
 	}
 
 	// since multiple motors can only mean differential thrust, we need to make sure that we fit the full motor range into the min/max throttle range.
-	_scale_motors(self, output + MIXER_OUTPUT_MOTORS, self->motorCount);
+	self->desaturate(self, output + MIXER_OUTPUT_MOTORS, self->motorCount);
 
 	// we center the outputs on midrc always regardless of midthrottle because
 	for(int c = MIXER_OUTPUT_MOTORS; c < MIXER_MAX_MOTORS; c++){
-		output[c] = constrain(self->midthrottle + output[c], self->minthrottle, self->maxthrottle);
+		output[c] = _thrust_lookup(self, constrain(self->midthrottle + output[c], self->minthrottle, self->maxthrottle));
 	}
 
 	// set unused outputs to mincommand
 	for(int c = self->motorCount; c < MIXER_MAX_MOTORS; c++){
-		output[c] = self->config->pwm_out.mincommand;
+		output[c] = self->mincommand;
 	}
 
 	// limit servos according to config
 	for (int i = 0; i < MIXER_MAX_SERVOS; i++) {
-		const struct servo_config *conf = &config_get_profile(self->config)->servos.servoConf[i];
-		uint16_t servo_width = conf->max - conf->min;
-		// TODO: the 0 and 100 were supposed to be part of servo mixer rule but never seemed to be used so replaced by constants for now.
-		int16_t min = constrain(0 * servo_width / 100 - servo_width / 2, -500, 500);
-		int16_t tmp = 100 * (uint32_t)servo_width / 100;
-		int16_t max = constrain(tmp - servo_width / 2, -500, 500);
-		int16_t middle = constrain(conf->middle, 1000, 2000);
-		output[MIXER_OUTPUT_SERVOS + i] = middle + constrain((output[MIXER_OUTPUT_SERVOS + i] * (int32_t)conf->rate) / 100L, min, max);
+		int16_t value = mixed[MIXER_OUTPUT_SERVOS + i] * self->servo.rate[i];
+		output[MIXER_OUTPUT_SERVOS + i] = self->servo.middle[i] + constrain(value, self->servo.min[i], self->servo.max[i]);
 	}
 
 finish:
 	// forward rc channels to servos that are not controller by the mixer
 	for(int i = self->servoCount, chan = 0; i < MIXER_MAX_SERVOS && chan < MIXER_INPUT_G3_RC_AUX3; i++, chan++){
-		const struct servo_config *conf = &config_get_profile(self->config)->servos.servoConf[i];
-		output[MIXER_OUTPUT_SERVOS + i] = constrain(conf->middle + self->input[MIXER_INPUT_G3_RC_AUX1+chan], 1000, 2000);
+		output[MIXER_OUTPUT_SERVOS + i] = constrain(self->servo.forward_middle[i] + self->input[MIXER_INPUT_G3_RC_AUX1+chan], 1000, 2000);
 	}
 
 	memcpy(self->output, output, sizeof(self->output));
@@ -880,6 +1027,15 @@ finish:
 	for(int c = 0; c < MIXER_MAX_MOTORS; c++){
 		if(self->pwm && self->pwm->write_motor) self->pwm->write_motor(self->pwm, c, output[c]);
 	}
+	if(self->pwm && self->pwm->flush_motors) self->pwm->flush_motors(self->pwm);
+	// motor speed reported by the escs (used to steer the gyro rpm filters)
+	for(int c = 0; c < MIXER_MAX_MOTORS; c++){
+		uint32_t erpm = 0;
+		if(c < self->motorCount && self->pwm && self->pwm->read_motor_erpm && self->pwm->read_motor_erpm(self->pwm, c, &erpm) == 0)
+			self->motor_rpm[c] = MIN(erpm / self->motor_pole_pairs, UINT16_MAX);
+		else
+			self->motor_rpm[c] = 0;
+	}
 	for(int c = 0; c < MIXER_MAX_SERVOS; c++){
 		if(self->pwm && self->pwm->write_servo) self->pwm->write_servo(self->pwm, c, output[MIXER_OUTPUT_SERVOS + c]);
 	}
@@ -903,6 +1059,12 @@ uint16_t mixer_get_servo_value(struct mixer *self, uint8_t id){
 	return self->output[MIXER_OUTPUT_SERVOS + id];
 }
 
+//! returns motor speed from esc telemetry or 0 if motor is out of range or speed is not known
+uint16_t mixer_get_motor_rpm(struct mixer *self, uint8_t id){
+	if(id >= MIXER_MAX_MOTORS) return 0;
+	return self->motor_rpm[id];
+}
+
 /*
 static uint16_t _get_constrained_output(struct mixer *self, uint8_t id){
 	int16_t val = self->output[id];
@@ -991,6 +1153,26 @@ uint8_t mixer_get_servo_count(struct mixer *self){
 *
 * All mixer rules are additive to the given output channel. Each rule defines a
 * scale operation for a particular input to the mixer.
+*
+* Rules are not evaluated one by one at runtime. When the preset or the rules
+* change they are compiled into a gain matrix with one column for every input
+* that is referenced by a rule (at most MIXER_MATRIX_MAX_INPUTS) and one row for
+* every output. Each update is then a single matrix vector product followed by
+* motor scaling and servo limits, which are also precomputed from the config
+* by mixer_reload_config().
+*
+* Motor saturation
+* ----------------
+*
+* When the mixed motor outputs do not fit into the throttle range the mixer
+* resolves it according to the desat_mode setting:
+* - AIRMODE: differential thrust is kept and collective thrust is moved.
+* - THROTTLE: collective thrust is kept and differential thrust is reduced.
+* - ATTITUDE: collective thrust is moved down at the top of the range but is
+* never raised at the bottom.
+*
+* Motor values are finally passed through a thrust curve table that is built
+* from the thrust_linear setting and the current throttle range.
 */
 
 
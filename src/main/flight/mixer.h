@@ -52,6 +52,29 @@ struct config;
 #define YAW_JUMP_PREVENTION_LIMIT_LOW 80
 #define YAW_JUMP_PREVENTION_LIMIT_HIGH 500
 
+//! number of segments in the thrust curve lookup table
+#define MIXER_THRUST_LUT_SIZE 32
+
+//! maximum number of distinct mixer inputs that can be referenced by the active rules
+#define MIXER_MATRIX_MAX_INPUTS 16
+
+//! mixing rules compiled into a dense gain matrix, see mixer_reload_config()
+struct mixer_matrix {
+	uint8_t inputs[MIXER_MATRIX_MAX_INPUTS];	//!< mixer input that feeds each column
+	uint8_t input_count;
+	//! one column per used input with one gain per output. Column major so that the product runs over contiguous outputs.
+	float gain[MIXER_MATRIX_MAX_INPUTS][MIXER_OUTPUT_COUNT];
+};
+
+//! servo output scaling and limits compiled from the servo config
+struct mixer_servo_limits {
+	float rate[MIXER_MAX_SERVOS];		//!< servo rate as a factor
+	int16_t min[MIXER_MAX_SERVOS];		//!< lowest offset from middle
+	int16_t max[MIXER_MAX_SERVOS];		//!< highest offset from middle
+	int16_t middle[MIXER_MAX_SERVOS];	//!< middle constrained to valid pwm range
+	int16_t forward_middle[MIXER_MAX_SERVOS];	//!< middle used for forwarded rc channels
+};
+
 struct mixer {
 	int16_t input[MIXER_INPUT_COUNT];
 
@@ -73,8 +96,25 @@ struct mixer {
 
 	struct mixer_rule_def active_rules[MIXER_MAX_RULES];
 
+	struct mixer_matrix matrix;
+	struct mixer_servo_limits servo;
+
 	//! output offset, min and max for motors
 	int16_t midthrottle, minthrottle, maxthrottle;
+	//! value written to motors that are not in use
+	int16_t mincommand;
+
+	//! resolves motor saturation, selected from the config by mixer_reload_config()
+	void (*desaturate)(struct mixer *self, int16_t *output, uint16_t count);
+
+	//! thrust curve that maps commanded motor value to pwm. Points are evenly spaced between min and max throttle.
+	float thrust_lut[MIXER_THRUST_LUT_SIZE + 1];
+	float thrust_lut_scale;
+	uint8_t thrust_linear;
+
+	//! motor speed from esc telemetry, 0 if unknown
+	uint16_t motor_rpm[MIXER_MAX_MOTORS];
+	uint8_t motor_pole_pairs;
 
 	biquad_t servoFilterState[MAX_SUPPORTED_SERVOS];
 
@@ -89,6 +129,9 @@ struct mixer {
 //! initializes a mixer struct
 void mixer_init(struct mixer *self, const struct config *config, const struct system_calls_pwm *pwm);
 
+//! reloads preset, rule matrix and output limits from the config. Must be called after the config has changed.
+void mixer_reload_config(struct mixer *self);
+
 //! inputs a command to one of the input channels of the mixer
 void mixer_input_command(struct mixer *self, mixer_input_t i, int16_t value);
 
@@ -110,6 +153,9 @@ uint16_t mixer_get_servo_value(struct mixer *self, uint8_t id);
 //! returns a value of specified motor channel (id 0 is the first motor)
 uint16_t mixer_get_motor_value(struct mixer *self, uint8_t id);
 
+//! returns speed of a motor in rpm as reported by its esc or 0 if not known
+uint16_t mixer_get_motor_rpm(struct mixer *self, uint8_t id);
+
 //! returns total number of motors that are being actively mixed by the mixer as part of current profile
 uint8_t mixer_get_motor_count(struct mixer *self);
 
@@ -0,0 +1,155 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "common/maths.h"
+
+#include "posest.h"
+
+// cm per 1e-7 degree of latitude (and longitude at the equator)
+#define POSEST_CM_PER_DEG_E7 1.113195f
+
+void posest_init(struct posest *self)
+{
+	memset(self, 0, sizeof(*self));
+	self->gps_delay = POSEST_DEFAULT_GPS_DELAY_US;
+	self->pos_gain = POSEST_DEFAULT_POS_GAIN;
+	self->vel_gain = POSEST_DEFAULT_VEL_GAIN;
+}
+
+void posest_reset(struct posest *self)
+{
+	memset(&self->state, 0, sizeof(self->state));
+	self->head = 0;
+	self->count = 0;
+	self->have_origin = false;
+}
+
+void posest_set_gps_delay(struct posest *self, sys_micros_t delay_us)
+{
+	self->gps_delay = delay_us;
+}
+
+void posest_set_gains(struct posest *self, float pos_gain, float vel_gain)
+{
+	self->pos_gain = constrainf(pos_gain, 0.0f, 1.0f);
+	self->vel_gain = constrainf(vel_gain, 0.0f, 1.0f);
+}
+
+static void _record(struct posest *self)
+{
+	self->head = (uint8_t)((self->head + 1) % POSEST_HISTORY_SIZE);
+	self->history[self->head] = self->state;
+	if(self->count < POSEST_HISTORY_SIZE)
+		self->count++;
+}
+
+void posest_predict(struct posest *self, const float acc_ned[3], sys_micros_t now)
+{
+	if(self->count){
+		float dt = (float)(now - self->state.t) * 1e-6f;
+		if(dt <= 0)
+			return;
+		for(int i = 0; i < 3; i++){
+			self->state.vel[i] += acc_ned[i] * dt;
+			self->state.pos[i] += self->state.vel[i] * dt;
+		}
+	}
+	self->state.t = now;
+	_record(self);
+}
+
+static void _to_ned(struct posest *self, const struct posest_gps_fix *fix, float pos[3])
+{
+	pos[0] = (float)(fix->lat - self->origin[0]) * POSEST_CM_PER_DEG_E7;
+	pos[1] = (float)(fix->lon - self->origin[1]) * POSEST_CM_PER_DEG_E7 * self->lon_scale;
+	pos[2] = -(float)(fix->alt - self->origin_alt);
+}
+
+static void _apply_correction(struct posest_state *st, const float dp[3], const float dv[3], sys_micros_t t_meas)
+{
+	float dt = (float)(st->t - t_meas) * 1e-6f;
+	for(int i = 0; i < 3; i++){
+		st->pos[i] += dp[i] + dv[i] * dt;
+		st->vel[i] += dv[i];
+	}
+}
+
+int posest_input_gps(struct posest *self, const struct posest_gps_fix *fix)
+{
+	if(!self->count)
+		return -EINVAL;
+
+	if(!self->have_origin){
+		self->origin[0] = fix->lat;
+		self->origin[1] = fix->lon;
+		self->origin_alt = fix->alt;
+		self->lon_scale = cos_approx((float)fix->lat * 1e-7f * RAD);
+		self->have_origin = true;
+		// start from the fix, there is nothing to fuse it with yet. The history is kept so that the next fix
+		// can still be matched against its measurement time.
+		for(int c = 0; c < self->count; c++){
+			struct posest_state *st = &self->history[(self->head + POSEST_HISTORY_SIZE - c) % POSEST_HISTORY_SIZE];
+			for(int i = 0; i < 3; i++){
+				st->pos[i] = 0;
+				st->vel[i] = (float)fix->vel_ned[i];
+			}
+		}
+		self->state = self->history[self->head];
+		self->fused++;
+		return 0;
+	}
+
+	sys_micros_t t_meas = fix->timestamp - self->gps_delay;
+
+	// find the newest recorded state that is not newer than the measurement
+	int idx = self->head;
+	int n = 0;
+	while(n < self->count && (int32_t)(self->history[idx].t - t_meas) > 0){
+		idx = (idx + POSEST_HISTORY_SIZE - 1) % POSEST_HISTORY_SIZE;
+		n++;
+	}
+	if(n == self->count){
+		self->rejected++;
+		return -ERANGE;
+	}
+
+	// innovation against the state we had when the fix was measured
+	// recorded states are one prediction period apart so extrapolate the rest of the way to the measurement
+	const struct posest_state *past = &self->history[idx];
+	float tau = (float)(t_meas - past->t) * 1e-6f;
+	float pos[3], dp[3], dv[3];
+	_to_ned(self, fix, pos);
+	for(int i = 0; i < 3; i++){
+		dp[i] = (pos[i] - past->pos[i] - past->vel[i] * tau) * self->pos_gain;
+		dv[i] = ((float)fix->vel_ned[i] - past->vel[i]) * self->vel_gain;
+	}
+
+	// carry the correction through the newer history and into the current state
+	for(int c = 0; c <= n; c++){
+		int j = (self->head + POSEST_HISTORY_SIZE - c) % POSEST_HISTORY_SIZE;
+		_apply_correction(&self->history[j], dp, dv, past->t);
+	}
+	self->state = self->history[self->head];
+	self->fused++;
+	return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../system_calls.h"
+
+/*
+ * Delayed state position estimator. Earth frame accelerations are integrated into position and velocity at the
+ * prediction rate and every predicted state is kept in a short history ring. A gps fix describes where we were when
+ * the receiver measured it, which is 100-200ms before the fix arrives, so it is compared against the state recorded
+ * at that time instead of the current one. The resulting correction is applied to the old state and carried forward
+ * through the newer history to now. Integration is linear in the state so carrying the correction forward is the
+ * same as replaying all predictions from the corrected state, but costs one pass over the history.
+ *
+ * Positions are north, east, down in cm relative to the first fix. Velocities are in cm/s.
+ */
+
+//! number of predicted states kept. At 100Hz prediction this covers 320ms of receiver delay.
+#define POSEST_HISTORY_SIZE 32
+
+//! default delay between the start of the ubx frame and the actual measurement
+#define POSEST_DEFAULT_GPS_DELAY_US 50000
+//! default fraction of the position innovation applied per fix
+#define POSEST_DEFAULT_POS_GAIN 0.3f
+//! default fraction of the velocity innovation applied per fix
+#define POSEST_DEFAULT_VEL_GAIN 0.5f
+
+struct posest_gps_fix {
+	int32_t lat, lon;		//!< degrees * 1e7
+	int32_t alt;			//!< cm above mean sea level
+	int32_t vel_ned[3];		//!< cm/s
+	sys_micros_t timestamp;	//!< local time at which the fix started to arrive
+};
+
+struct posest_state {
+	sys_micros_t t;
+	float pos[3];
+	float vel[3];
+};
+
+struct posest {
+	//! current estimate
+	struct posest_state state;
+	//! ring of past estimates, history[head] is the most recent one
+	struct posest_state history[POSEST_HISTORY_SIZE];
+	uint8_t head;
+	uint8_t count;
+
+	bool have_origin;
+	int32_t origin[2];
+	int32_t origin_alt;
+	float lon_scale;
+
+	sys_micros_t gps_delay;
+	float pos_gain, vel_gain;
+
+	uint32_t fused;
+	uint32_t rejected;
+};
+
+void posest_init(struct posest *self);
+//! forget the origin and all history. The next fix becomes the new origin.
+void posest_reset(struct posest *self);
+//! set the delay between the fix timestamp and the time the receiver actually measured the position
+void posest_set_gps_delay(struct posest *self, sys_micros_t delay_us);
+void posest_set_gains(struct posest *self, float pos_gain, float vel_gain);
+//! integrate earth frame (north, east, down) acceleration in cm/s/s up to time now and record the result
+void posest_predict(struct posest *self, const float acc_ned[3], sys_micros_t now);
+/**
+ * Fuse a gps fix at the time it was measured and propagate the correction to the current state.
+ * @return 0 on success, -EINVAL before the first prediction and -ERANGE if the fix is older than the history.
+ */
+int posest_input_gps(struct posest *self, const struct posest_gps_fix *fix);
+
+static inline const float *posest_get_position(const struct posest *self) { return self->state.pos; }
+static inline const float *posest_get_velocity(const struct posest *self) { return self->state.vel; }
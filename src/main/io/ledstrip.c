@@ -69,6 +69,8 @@
 
 
 static void updateLedRingCounts(struct ledstrip *self);
+static void updateFunctionMasks(struct ledstrip *self);
+static void markAllLedsDirty(struct ledstrip *self);
 
 static void determineLedStripDimensions(struct ledstrip *self){
 	int maxX = 0;
@@ -107,10 +109,14 @@ static void updateLedCount(struct ledstrip *self){
 }
 
 void ledstrip_reload_config(struct ledstrip *self){
+	self->configGeneration = config_get_generation();
 	updateLedCount(self);
 	determineLedStripDimensions(self);
 	determineOrientationLimits(self);
 	updateLedRingCounts(self);
+	updateFunctionMasks(self);
+	markAllLedsDirty(self);
+	ws2811SetGamma(self->config->ledstrip.gamma);
 }
 
 // get specialColor by index
@@ -236,26 +242,64 @@ static void applyLedModeLayer(struct ledstrip *self){
 }
 #endif 
 
-static void applyLedHue(struct ledstrip *self, ledFunctionId_e flag, int16_t value, int16_t minRange, int16_t maxRange){
-	int scaled = scaleRange(value, minRange, maxRange, -60, +60);
-	scaled += HSV_HUE_MAX;   // wrap negative values correctly
+/*
+ * Layers are composited per led from the bottom of layerTable to the top. Every layer reports the set of leds it
+ * paints and a key that changes whenever anything its colors depend on changes. Leds are only recomposited when a
+ * layer covering them changed its key or mask, and only recomposited leds are handed to the driver, which in turn
+ * only re-encodes leds whose color actually changed.
+ */
 
-	for (int i = 0; i < self->ledCount; ++i) {
-		const struct led_config *ledConfig = &self->config->ledstrip.leds[i];
-		if (!(ledConfig->flags & LED_FLAG_FUNCTION(flag)))
-			continue;
+static void markAllLedsDirty(struct ledstrip *self){
+	self->dirtyLeds = 0xFFFFFFFF;
+	memset(self->layerMask, 0, sizeof(self->layerMask));
+}
 
-		hsvColor_t color;
-		getLedHsv(i, &color);
-		color.h = (color.h + scaled) % (HSV_HUE_MAX + 1);
-		setLedHsv(i, &color);
+static void updateFunctionMasks(struct ledstrip *self){
+	memset(self->functionMask, 0, sizeof(self->functionMask));
+	for (int ledIndex = 0; ledIndex < self->ledCount; ledIndex++) {
+		const struct led_config *ledConfig = &self->config->ledstrip.leds[ledIndex];
+		for (int fn = 0; fn < LED_FUNCTION_COUNT; fn++) {
+			if (ledConfig->flags & LED_FLAG_FUNCTION(fn))
+				self->functionMask[fn] |= 1UL << ledIndex;
+		}
 	}
+	self->allLeds = (self->ledCount >= 32) ? 0xFFFFFFFF : ((1UL << self->ledCount) - 1);
 }
 
-static void applyLedHueLayer(struct ledstrip *self)
-{
-	applyLedHue(self, LED_FUNCTION_THROTTLE, rx_get_channel(self->rx, THROTTLE), PWM_RANGE_MIN, PWM_RANGE_MAX);
-	applyLedHue(self, LED_FUNCTION_RSSI, rx_get_rssi(self->rx), 0, 1023);
+// stands in for the flight mode layer until it is ported: leds show their configured color or stay dark
+static uint32_t updateLedColorLayer(struct ledstrip *self, bool updateNow, uint32_t *timer, uint32_t *mask){
+	(void)updateNow;
+	(void)timer;
+	*mask = self->allLeds;
+	return 0;
+}
+
+static void paintLedColorLayer(struct ledstrip *self, int ledIndex, hsvColor_t *color){
+	const struct led_config *ledConfig = &self->config->ledstrip.leds[ledIndex];
+	if (ledConfig->flags & LED_FLAG_FUNCTION(LED_FUNCTION_COLOR))
+		*color = self->config->ledstrip.colors[ledConfig->color];
+}
+
+static uint16_t ledHueOffset(int16_t value, int16_t minRange, int16_t maxRange){
+	int scaled = scaleRange(value, minRange, maxRange, -60, +60);
+	return scaled + HSV_HUE_MAX;   // wrap negative values correctly
+}
+
+static uint32_t updateLedHueLayer(struct ledstrip *self, bool updateNow, uint32_t *timer, uint32_t *mask){
+	(void)updateNow;
+	(void)timer;
+	self->throttleHue = ledHueOffset(rx_get_channel(self->rx, THROTTLE), PWM_RANGE_MIN, PWM_RANGE_MAX);
+	self->rssiHue = ledHueOffset(rx_get_rssi(self->rx), 0, 1023);
+	*mask = self->functionMask[LED_FUNCTION_THROTTLE] | self->functionMask[LED_FUNCTION_RSSI];
+	return ((uint32_t)self->throttleHue << 16) | self->rssiHue;
+}
+
+static void paintLedHueLayer(struct ledstrip *self, int ledIndex, hsvColor_t *color){
+	const struct led_config *ledConfig = &self->config->ledstrip.leds[ledIndex];
+	if (ledConfig->flags & LED_FLAG_FUNCTION(LED_FUNCTION_THROTTLE))
+		color->h = (color->h + self->throttleHue) % (HSV_HUE_MAX + 1);
+	if (ledConfig->flags & LED_FLAG_FUNCTION(LED_FUNCTION_RSSI))
+		color->h = (color->h + self->rssiHue) % (HSV_HUE_MAX + 1);
 }
 
 typedef enum {
@@ -282,18 +326,15 @@ const hsvColor_t hsv[] = {
 	[COLOR_DEEP_PINK] =	{330,   0, 255},
 };
 
-static void applyLedWarningLayer(struct ledstrip *self, bool updateNow, uint32_t *timer){
-	static uint8_t warningFlashCounter = 0;
-	static uint8_t warningFlags = 0;		  // non-zero during blinks
-
+static uint32_t updateLedWarningLayer(struct ledstrip *self, bool updateNow, uint32_t *timer, uint32_t *mask){
 	if (updateNow) {
 		// keep counter running, so it stays in sync with blink
-		warningFlashCounter++;
-		if (warningFlashCounter >= 20) {
-			warningFlashCounter = 0;
+		self->warningFlashCounter++;
+		if (self->warningFlashCounter >= 20) {
+			self->warningFlashCounter = 0;
 		}
-		if (warningFlashCounter == 0) {	  // update when old flags was processed
-			warningFlags = 0;
+		if (self->warningFlashCounter == 0) {	  // update when old flags was processed
+			self->warningFlags = 0;
 			// TODO: refactor. This type of battery logic should be outside of ledstrip module!
 			/*
 			if (feature(FEATURE_VBAT) && battery_get_state(self->battery) != BATTERY_OK)
@@ -305,41 +346,47 @@ static void applyLedWarningLayer(struct ledstrip *self, bool updateNow, uint32_t
 		*timer += LED_STRIP_HZ(10);
 	}
 
-	if (warningFlags) {
-		const hsvColor_t *warningColor =  &HSV(BLACK);
-
-		bool colorOn = (warningFlashCounter % 2) == 0;   // w_w_
-		warningFlags_e warningId = warningFlashCounter / 4;
-		if(warningFlags & (1 << warningId)) {
-			switch(warningId) {
-				case WARNING_ARMING_DISABLED:
-					warningColor = colorOn ? &HSV(GREEN)  : &HSV(BLACK);
-					break;
-				case WARNING_LOW_BATTERY:
-					warningColor = colorOn ? &HSV(RED)	: &HSV(BLACK);
-					break;
-				case WARNING_FAILSAFE:
-					warningColor = colorOn ? &HSV(YELLOW) : &HSV(BLUE);
-					break;
-				default:;
-			}
-		}
-
-		for (int ledIndex = 0; ledIndex < self->ledCount; ledIndex++) {
-			const struct led_config *ledConfig = &self->config->ledstrip.leds[ledIndex];
-			if (!(ledConfig->flags & LED_FLAG_FUNCTION(LED_FUNCTION_WARNING)))
-				continue;
+	if (!self->warningFlags) {
+		*mask = 0;
+		return 0;
+	}
 
-			setLedHsv(ledIndex, warningColor);
+	const hsvColor_t *warningColor =  &HSV(BLACK);
+
+	bool colorOn = (self->warningFlashCounter % 2) == 0;   // w_w_
+	warningFlags_e warningId = self->warningFlashCounter / 4;
+	if(self->warningFlags & (1 << warningId)) {
+		switch(warningId) {
+			case WARNING_ARMING_DISABLED:
+				warningColor = colorOn ? &HSV(GREEN)  : &HSV(BLACK);
+				break;
+			case WARNING_LOW_BATTERY:
+				warningColor = colorOn ? &HSV(RED)	: &HSV(BLACK);
+				break;
+			case WARNING_FAILSAFE:
+				warningColor = colorOn ? &HSV(YELLOW) : &HSV(BLUE);
+				break;
+			default:;
 		}
 	}
+	self->warningColor = warningColor;
+
+	*mask = self->functionMask[LED_FUNCTION_WARNING];
+	return (uint32_t)(warningColor - hsv) + 1;
+}
+
+static void paintLedWarningLayer(struct ledstrip *self, int ledIndex, hsvColor_t *color){
+	(void)ledIndex;
+	*color = *self->warningColor;
 }
 
 #ifdef GPS
-static void __attribute__((unused)) applyLedGpsLayer(struct ledstrip *self, bool updateNow, uint32_t *timer){
+static uint32_t updateLedGpsLayer(struct ledstrip *self, bool updateNow, uint32_t *timer, uint32_t *mask){
 	(void)self;
 	(void)updateNow;
 	(void)timer;
+	*mask = 0;
+	return 0;
 /*
 	static uint8_t gpsFlashCounter = 0;
 	static uint8_t gpsPauseCounter = 0;
@@ -379,13 +426,17 @@ static void __attribute__((unused)) applyLedGpsLayer(struct ledstrip *self, bool
 	}
 */
 }
+
+static void paintLedGpsLayer(struct ledstrip *self, int ledIndex, hsvColor_t *color){
+	(void)self;
+	(void)ledIndex;
+	(void)color;
+}
 #endif
 
 #define INDICATOR_DEADBAND 25
 
-static void applyLedIndicatorLayer(struct ledstrip *self, bool updateNow, uint32_t *timer){
-	static uint8_t flashCounter = 0;
-
+static uint32_t updateLedIndicatorLayer(struct ledstrip *self, bool updateNow, uint32_t *timer, uint32_t *mask){
 	if(updateNow) {
 		if (!rx_has_signal(self->rx)) {
 			*timer += LED_STRIP_HZ(5);  // try again soon
@@ -395,9 +446,12 @@ static void applyLedIndicatorLayer(struct ledstrip *self, bool updateNow, uint32
 			scale += (50 - INDICATOR_DEADBAND);  // start increasing frequency right after deadband
 			*timer += LED_STRIP_HZ(5) * 50 / MAX(50, scale);   // 5 - 50Hz update, 2.5 - 25Hz blink
 
-			flashCounter = !flashCounter;
+			self->indicatorFlashCounter = !self->indicatorFlashCounter;
 		}
 	}
+	// TODO: indicator leds need rc commands which the ledstrip does not have access to yet
+	*mask = 0;
+	return self->indicatorFlashCounter;
 /*
 	const hsvColor_t *flashColor = flashCounter ? &HSV(ORANGE) : &HSV(BLACK); // TODO - use user color?
 
@@ -424,6 +478,12 @@ static void applyLedIndicatorLayer(struct ledstrip *self, bool updateNow, uint32
 	*/
 }
 
+static void paintLedIndicatorLayer(struct ledstrip *self, int ledIndex, hsvColor_t *color){
+	(void)self;
+	(void)ledIndex;
+	(void)color;
+}
+
 #define ROTATION_SEQUENCE_LED_COUNT 6 // 2 on, 4 off
 #define ROTATION_SEQUENCE_LED_WIDTH 2 // 2 on
 
@@ -443,89 +503,93 @@ static void updateLedRingCounts(struct ledstrip *self){
 	self->ledRingSeqLen = seqLen;
 }
 
-static void applyLedThrustRingLayer(struct ledstrip *self, bool updateNow, uint32_t *timer)
+static uint32_t updateLedThrustRingLayer(struct ledstrip *self, bool updateNow, uint32_t *timer, uint32_t *mask)
 {
-	static uint8_t rotationPhase;
-	int ledRingIndex = 0;
-
 	if(updateNow) {
-		rotationPhase = rotationPhase > 0 ? rotationPhase - 1 : self->ledRingSeqLen - 1;
+		self->rotationPhase = self->rotationPhase > 0 ? self->rotationPhase - 1 : self->ledRingSeqLen - 1;
 
 		int scale = scaleRange(rx_get_channel(self->rx, THROTTLE), PWM_RANGE_MIN, PWM_RANGE_MAX, 10, 100);
 		*timer += LED_STRIP_HZ(5) * 10 / scale;  // 5 - 50Hz update rate
 	}
 
-	for (int ledIndex = 0; ledIndex < self->ledCount; ledIndex++) {
-		const struct led_config *ledConfig = &self->config->ledstrip.leds[ledIndex];
-		if (!(ledConfig->flags & LED_FLAG_FUNCTION(LED_FUNCTION_THRUST_RING)))
-			continue;
-
-		bool applyColor;
-		applyColor = (ledRingIndex + rotationPhase) % self->ledRingSeqLen < ROTATION_SEQUENCE_LED_WIDTH;
+	*mask = self->functionMask[LED_FUNCTION_THRUST_RING];
+	return self->rotationPhase;
+}
 
-		const hsvColor_t *ringColor = applyColor ? &self->config->ledstrip.colors[ledConfig->color] : &HSV(BLACK);
-		setLedHsv(ledIndex, ringColor);
+static void paintLedThrustRingLayer(struct ledstrip *self, int ledIndex, hsvColor_t *color)
+{
+	const struct led_config *ledConfig = &self->config->ledstrip.leds[ledIndex];
+	// position of this led within the ring is the number of ring leds in front of it
+	int ledRingIndex = __builtin_popcount(self->functionMask[LED_FUNCTION_THRUST_RING] & ((1UL << ledIndex) - 1));
 
-		ledRingIndex++;
-	}
+	bool applyColor = (ledRingIndex + self->rotationPhase) % self->ledRingSeqLen < ROTATION_SEQUENCE_LED_WIDTH;
+	*color = applyColor ? self->config->ledstrip.colors[ledConfig->color] : HSV(BLACK);
 }
 
 // blink twice, then wait
-static void applyLedBlinkLayer(struct ledstrip *self, bool updateNow, uint32_t *timer)
+static uint32_t updateLedBlinkLayer(struct ledstrip *self, bool updateNow, uint32_t *timer, uint32_t *mask)
 {
-	static uint8_t blinkCounter = 0;
 	const int blinkCycleLength = 20;
 
 	if (updateNow) {
-		blinkCounter++;
-		if (blinkCounter >= blinkCycleLength) {
-			blinkCounter = 0;
+		self->blinkCounter++;
+		if (self->blinkCounter >= blinkCycleLength) {
+			self->blinkCounter = 0;
 		}
 		*timer += LED_STRIP_HZ(10);
 	}
 
-	bool ledOn = (blinkCounter & 1) == 0 && blinkCounter < 4;  // b_b_____...
+	self->blinkOn = (self->blinkCounter & 1) == 0 && self->blinkCounter < 4;  // b_b_____...
 
-	for (int i = 0; i < self->ledCount; ++i) {
-		const struct led_config *ledConfig = &self->config->ledstrip.leds[i];
-		if (!(ledConfig->flags & LED_FLAG_FUNCTION(LED_FUNCTION_BLINK)))
-			continue;
+	*mask = self->functionMask[LED_FUNCTION_BLINK];
+	return self->blinkOn;
+}
 
-		const hsvColor_t *blinkColor = ledOn ? &self->config->ledstrip.colors[ledConfig->color] : getSC(self, LED_SCOLOR_BLINKBACKGROUND);
-		setLedHsv(i, blinkColor);
-	}
+static void paintLedBlinkLayer(struct ledstrip *self, int ledIndex, hsvColor_t *color)
+{
+	const struct led_config *ledConfig = &self->config->ledstrip.leds[ledIndex];
+	*color = self->blinkOn ? self->config->ledstrip.colors[ledConfig->color] : *getSC(self, LED_SCOLOR_BLINKBACKGROUND);
 }
 
 
 #ifdef USE_LED_ANIMATION
 
-static void applyLedAnimationLayer(bool updateNow, uint32_t *timer)
+static uint32_t updateLedAnimationLayer(struct ledstrip *self, bool updateNow, uint32_t *timer, uint32_t *mask)
 {
-	static uint8_t frameCounter = 0;
-	const int animationFrames = ledGridHeight;
+	const int animationFrames = self->ledGridHeight;
 	if(updateNow) {
-		frameCounter = (frameCounter + 1 < animationFrames) ? frameCounter + 1 : 0;
+		self->animationFrame = (self->animationFrame + 1 < animationFrames) ? self->animationFrame + 1 : 0;
 		*timer += LED_STRIP_HZ(20);
 	}
 
+	*mask = 0;
 	if (ARMING_FLAG(ARMED))
-		return;
-
-	int previousRow = frameCounter > 0 ? frameCounter - 1 : animationFrames - 1;
-	int currentRow = frameCounter;
-	int nextRow = (frameCounter + 1 < animationFrames) ? frameCounter + 1 : 0;
+		return 0;
 
-	for (int ledIndex = 0; ledIndex < ledCount; ledIndex++) {
-		const struct led_config *ledConfig = &self->config->ledstrip.leds[ledIndex];
+	// the animation covers the rows just before, at and after the current frame
+	for (int ledIndex = 0; ledIndex < self->ledCount; ledIndex++) {
+		int dist = (ledGetY(&self->config->ledstrip.leds[ledIndex]) - self->animationFrame + animationFrames) % animationFrames;
+		if (dist <= 1 || dist == animationFrames - 1)
+			*mask |= 1UL << ledIndex;
+	}
+	return self->animationFrame + 1;
+}
 
-		if (ledGetY(ledConfig) == previousRow) {
-			setLedHsv(ledIndex, getSC(LED_SCOLOR_ANIMATION));
-			scaleLedValue(ledIndex, 50);
-		} else if (ledGetY(ledConfig) == currentRow) {
-			setLedHsv(ledIndex, getSC(LED_SCOLOR_ANIMATION));
-		} else if (ledGetY(ledConfig) == nextRow) {
-			scaleLedValue(ledIndex, 50);
-		}
+static void paintLedAnimationLayer(struct ledstrip *self, int ledIndex, hsvColor_t *color)
+{
+	const int animationFrames = self->ledGridHeight;
+	int previousRow = self->animationFrame > 0 ? self->animationFrame - 1 : animationFrames - 1;
+	int currentRow = self->animationFrame;
+	int nextRow = (self->animationFrame + 1 < animationFrames) ? self->animationFrame + 1 : 0;
+	int row = ledGetY(&self->config->ledstrip.leds[ledIndex]);
+
+	if (row == previousRow) {
+		*color = *getSC(self, LED_SCOLOR_ANIMATION);
+		color->v = color->v * 50 / 100;
+	} else if (row == currentRow) {
+		*color = *getSC(self, LED_SCOLOR_ANIMATION);
+	} else if (row == nextRow) {
+		color->v = color->v * 50 / 100;
 	}
 }
 #endif
@@ -544,40 +608,40 @@ typedef enum {
 	timTimerCount
 } timId_e;
 
-static uint32_t timerVal[timTimerCount];
+typedef char static_assertion_ledstrip_timer_count[(timTimerCount <= LEDSTRIP_MAX_TIMERS) ? 1 : -1];
 
-// function to apply layer.
-// function must replan self using timer pointer
-// when updateNow is true (timer triggered), state must be updated first,
-//  before calculating led state. Otherwise update started by different trigger
-//  may modify LED state.
-typedef void applyLayerFn_timed(struct ledstrip *self, bool updateNow, uint32_t* timer);
-typedef void applyLayerFn(struct ledstrip *self);
+// update function of a layer. It returns the key of the layer and the set of leds it paints.
+// When updateNow is true (timer triggered), state must be updated first and the function must replan itself
+// using the timer pointer. Otherwise update started by different trigger may modify LED state.
+typedef uint32_t updateLayerFn(struct ledstrip *self, bool updateNow, uint32_t *timer, uint32_t *mask);
+// paints the layer on top of color for one of the leds in its mask
+typedef void paintLayerFn(struct ledstrip *self, int ledIndex, hsvColor_t *color);
 
 static const struct {
 	int8_t timId;						  // timer id for update, -1 if none
-	union {
-		applyLayerFn *apply;			   // function to apply layer unconditionally
-		applyLayerFn_timed *applyTimed;	// apply with timer
-	} f;
+	updateLayerFn *update;
+	paintLayerFn *paint;
 } layerTable[] = {
+	{ -1,			 &updateLedColorLayer,		&paintLedColorLayer },
 	// LAYER 1
-	{ -1,			 .f.apply	  = &applyLedHueLayer },
+	{ -1,			 &updateLedHueLayer,		&paintLedHueLayer },
 	// LAYER 2
-	{timWarning,	  .f.applyTimed = &applyLedWarningLayer},
+	{timWarning,	  &updateLedWarningLayer,	&paintLedWarningLayer },
 #ifdef GPS
-	{timGps,		  .f.applyTimed = &applyLedGpsLayer},
+	{timGps,		  &updateLedGpsLayer,		&paintLedGpsLayer },
 #endif
 	// LAYER 3
-	{timIndicator,	.f.applyTimed = &applyLedIndicatorLayer},
+	{timIndicator,	&updateLedIndicatorLayer,	&paintLedIndicatorLayer },
 	// LAYER 4
-	{timBlink,		.f.applyTimed = &applyLedBlinkLayer},
+	{timBlink,		&updateLedBlinkLayer,		&paintLedBlinkLayer },
 #ifdef USE_LED_ANIMATION
-	{timAnimation,	.f.applyTimed = &applyLedAnimationLayer},
+	{timAnimation,	&updateLedAnimationLayer,	&paintLedAnimationLayer },
 #endif
-	{timRotation,	 .f.applyTimed = &applyLedThrustRingLayer},
+	{timRotation,	 &updateLedThrustRingLayer,	&paintLedThrustRingLayer },
 };
 
+typedef char static_assertion_ledstrip_layer_count[(ARRAYLEN(layerTable) <= LEDSTRIP_MAX_LAYERS) ? 1 : -1];
+
 void ledstrip_update(struct ledstrip *self){
 
 	if (!(self->ledStripInitialised && isWS2811LedStripReady())) {
@@ -591,29 +655,57 @@ void ledstrip_update(struct ledstrip *self){
 	// test all led timers, setting corresponding bits
 	uint32_t timActive = 0;
 	for(timId_e timId = 0; timId < timTimerCount; timId++) {
-		if(cmp32(now, timerVal[timId]) < 0)
+		if(cmp32(now, self->timerVal[timId]) < 0)
 			continue;  // not ready yet
 		timActive |= 1 << timId;
 		// sanitize timer value, so that it can be safely incremented. Handles inital timerVal value.
 		// max delay is limited to 5s
-		if(cmp32(now, timerVal[timId]) >= LED_STRIP_MS(100) || cmp32(now, timerVal[timId]) < LED_STRIP_HZ(5000) ) {
-			timerVal[timId] = now;
+		if(cmp32(now, self->timerVal[timId]) >= LED_STRIP_MS(100) || cmp32(now, self->timerVal[timId]) < LED_STRIP_HZ(5000) ) {
+			self->timerVal[timId] = now;
 		}
 	}
 
 	if (!timActive)
 		return;		  // no change this update, keep old state
 
-	// apply all layers; triggered timed functions has to update timers
+	// config can be changed from cli and msp at any time
+	if (config_get_generation() != self->configGeneration)
+		ledstrip_reload_config(self);
+
+	// update all layers; triggered timed functions has to update timers
+	uint32_t dirty = self->dirtyLeds;
 	for(unsigned i = 0; i < ARRAYLEN(layerTable); i++) {
 		int timId = layerTable[i].timId;
+		uint32_t mask = 0;
+		uint32_t key;
 		if(timId >= 0) {
-			uint32_t *timer = &timerVal[timId];
 			bool updateNow = timActive & (1 << timId);
-			(*layerTable[i].f.applyTimed)(self, updateNow, timer);
+			key = layerTable[i].update(self, updateNow, &self->timerVal[timId], &mask);
 		} else {
-			(*layerTable[i].f.apply)(self);
+			key = layerTable[i].update(self, false, NULL, &mask);
+		}
+		if(key != self->layerKey[i] || mask != self->layerMask[i]) {
+			// both the leds the layer used to paint and the ones it paints now have to be recomposited
+			dirty |= mask | self->layerMask[i];
+			self->layerKey[i] = key;
+			self->layerMask[i] = mask;
+		}
+	}
+	self->dirtyLeds = 0;
+
+	if (!dirty)
+		return;
+
+	for (int ledIndex = 0; ledIndex < WS2811_LED_STRIP_LENGTH; ledIndex++) {
+		uint32_t bit = 1UL << ledIndex;
+		if (!(dirty & bit))
+			continue;
+		hsvColor_t color = HSV(BLACK);
+		for(unsigned i = 0; i < ARRAYLEN(layerTable); i++) {
+			if (self->layerMask[i] & bit)
+				layerTable[i].paint(self, ledIndex, &color);
 		}
+		setLedHsv(ledIndex, &color);
 	}
 
 	ws2811UpdateStrip();
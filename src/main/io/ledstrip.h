@@ -21,6 +21,9 @@
 
 #include "../config/ledstrip.h"
 
+#define LEDSTRIP_MAX_LAYERS 8
+#define LEDSTRIP_MAX_TIMERS 8
+
 static inline int ledGetX(const struct led_config *lcfg) { return (lcfg->xy >> LED_X_BIT_OFFSET) & LED_XY_MASK; }
 static inline int ledGetY(const struct led_config *lcfg) { return (lcfg->xy >> LED_Y_BIT_OFFSET) & LED_XY_MASK; }
 static inline void ledSetXY(struct led_config *lcfg, int x, int y) {
@@ -43,6 +46,30 @@ struct ledstrip {
 	uint8_t ledRingCount;
 	uint8_t ledRingSeqLen;
 
+	//! bitmask of leds that have each led function
+	uint32_t functionMask[LED_FUNCTION_COUNT];
+	uint32_t allLeds;
+	//! leds that must be recomposited on next update regardless of layer changes
+	uint32_t dirtyLeds;
+	//! key and led mask each layer had when the leds were last composited
+	uint32_t layerKey[LEDSTRIP_MAX_LAYERS];
+	uint32_t layerMask[LEDSTRIP_MAX_LAYERS];
+	//! config generation the derived led state was last built from
+	uint16_t configGeneration;
+	uint32_t timerVal[LEDSTRIP_MAX_TIMERS];
+
+	// layer state
+	uint16_t throttleHue;
+	uint16_t rssiHue;
+	uint8_t warningFlashCounter;
+	uint8_t warningFlags;
+	const hsvColor_t *warningColor;
+	uint8_t indicatorFlashCounter;
+	uint8_t rotationPhase;
+	uint8_t blinkCounter;
+	bool blinkOn;
+	uint8_t animationFrame;
+
 	const struct system_calls *system;
 	struct failsafe *failsafe;
 	struct battery *battery;
@@ -0,0 +1,255 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <platform.h>
+
+#include "common/crc.h"
+#include "common/lz.h"
+#include "common/maths.h"
+#include "common/streambuf.h"
+
+#include "drivers/flashfs.h"
+#ifdef USE_SDCARD
+#include "drivers/asyncfatfs/asyncfatfs.h"
+#endif
+
+#include "log_download.h"
+
+#ifdef USE_SDCARD
+// afatfs can only report an opened file through a plain callback, so the sdcard transfer is global. Starting a new
+// sdcard transfer closes the file of the previous one.
+static afatfsFilePtr_t log_download_file = NULL;
+static struct log_download *log_download_sd_owner = NULL;
+
+static void _log_download_file_opened(afatfsFilePtr_t file){
+	struct log_download *self = log_download_sd_owner;
+	log_download_file = file;
+	if(!self)
+		return;
+	self->opening = false;
+	self->file_pos = 0;
+	if(!file)
+		self->failed = true;
+}
+
+static void _log_download_close_file(struct log_download *self){
+	if(log_download_sd_owner != self)
+		return;
+	if(log_download_file)
+		afatfs_fclose(log_download_file, NULL);
+	log_download_file = NULL;
+	log_download_sd_owner = NULL;
+}
+
+static bool _log_download_open_file(struct log_download *self, sbuf_t *src){
+	char filename[13];
+	int len = MIN(sbufBytesRemaining(src), (int)sizeof(filename) - 1);
+	if(len <= 0 || afatfs_getFilesystemState() != AFATFS_FILESYSTEM_STATE_READY)
+		return false;
+	sbufReadData(src, filename, len);
+	filename[len] = 0;
+
+	if(log_download_sd_owner){
+		log_download_sd_owner->active = false;
+		_log_download_close_file(log_download_sd_owner);
+	}
+	log_download_sd_owner = self;
+	self->opening = true;
+	if(!afatfs_fopen(filename, "r", _log_download_file_opened)){
+		log_download_sd_owner = NULL;
+		return false;
+	}
+	return true;
+}
+#endif
+
+/**
+ * Read up to len bytes of the log at offset. Returns number of bytes read, 0 if no data is available right now
+ * and -1 on error.
+ */
+static int _log_download_read(struct log_download *self, uint32_t offset, uint8_t *buf, uint32_t len){
+	switch(self->source){
+#ifdef USE_FLASHFS
+		case LOG_DOWNLOAD_SOURCE_FLASH:
+			return flashfsReadAbs(offset, buf, len);
+#endif
+#ifdef USE_SDCARD
+		case LOG_DOWNLOAD_SOURCE_SDCARD: {
+			if(self->file_pos != offset){
+				// the seek completes in the background, reads return nothing until it is done
+				if(afatfs_fseek(log_download_file, offset, AFATFS_SEEK_SET) == AFATFS_OPERATION_FAILURE)
+					return -1;
+				self->file_pos = offset;
+			}
+			uint32_t count = afatfs_fread(log_download_file, buf, len);
+			self->file_pos += count;
+			if(count == 0 && afatfs_feof(log_download_file))
+				self->end = offset;
+			return count;
+		}
+#endif
+		default:
+			(void)offset; (void)buf; (void)len;
+			return -1;
+	}
+}
+
+void log_download_init(struct log_download *self){
+	memset(self, 0, sizeof(*self));
+}
+
+void log_download_begin(struct log_download *self, sbuf_t *src, sbuf_t *dst, sys_micros_t now){
+	log_download_end(self);
+
+	uint8_t source = sbufReadU8(src);
+	uint8_t flags = sbufReadU8(src);
+	uint32_t offset = sbufReadU32(src);
+	uint32_t length = sbufReadU32(src);
+	uint16_t chunk_size = sbufReadU16(src);
+	uint8_t window = sbufReadU8(src);
+
+	self->source = source;
+	self->flags = flags;
+	self->chunk_size = chunk_size ? constrain(chunk_size, 1, LOG_DOWNLOAD_MAX_CHUNK) : LOG_DOWNLOAD_MAX_CHUNK;
+	self->window = constrain(window, 1, LOG_DOWNLOAD_MAX_WINDOW);
+	self->acked = self->next = offset;
+	self->acked_at = now;
+	self->end = LOG_DOWNLOAD_SIZE_UNKNOWN;
+
+	switch(source){
+#ifdef USE_FLASHFS
+		case LOG_DOWNLOAD_SOURCE_FLASH: {
+			uint32_t used = flashfsGetOffset();
+			self->end = (length && length < used - MIN(offset, used)) ? offset + length : used;
+			self->active = offset <= used;
+			break;
+		}
+#endif
+#ifdef USE_SDCARD
+		case LOG_DOWNLOAD_SOURCE_SDCARD:
+			self->active = _log_download_open_file(self, src);
+			if(length)
+				self->end = offset + length;
+			break;
+#endif
+		default:
+			(void)length;
+			break;
+	}
+
+	sbufWriteU8(dst, self->active);
+	sbufWriteU32(dst, (self->active && self->end != LOG_DOWNLOAD_SIZE_UNKNOWN) ? self->end - offset : LOG_DOWNLOAD_SIZE_UNKNOWN);
+}
+
+void log_download_ack(struct log_download *self, uint32_t offset, bool resend, sys_micros_t now){
+	if(!self->active)
+		return;
+	if(offset > self->acked && offset <= self->next){
+		self->acked = offset;
+		self->acked_at = now;
+	}
+	if(resend)
+		self->next = self->acked;
+	if(self->acked >= self->end)
+		log_download_end(self);
+}
+
+void log_download_end(struct log_download *self){
+#ifdef USE_SDCARD
+	_log_download_close_file(self);
+#endif
+	self->active = false;
+	self->opening = false;
+	self->failed = false;
+}
+
+static void _log_download_write_header(sbuf_t *dst, uint32_t offset, uint16_t size, uint8_t flags, uint32_t crc){
+	sbufWriteU32(dst, offset);
+	sbufWriteU16(dst, size);
+	sbufWriteU8(dst, flags);
+	sbufWriteU32(dst, crc);
+}
+
+int log_download_next_chunk(struct log_download *self, sbuf_t *dst, sys_micros_t now){
+	static uint8_t raw[LOG_DOWNLOAD_MAX_CHUNK];
+
+	if(!self->active || self->opening)
+		return 0;
+
+	if(self->failed){
+		_log_download_write_header(dst, self->next, 0, LOG_DOWNLOAD_CHUNK_LAST | LOG_DOWNLOAD_CHUNK_ERROR, 0);
+		log_download_end(self);
+		return 1;
+	}
+
+	// the host did not acknowledge some of the data in time, assume it was lost and send it again
+	if(self->next != self->acked && (now - self->acked_at) > LOG_DOWNLOAD_ACK_TIMEOUT){
+		self->next = self->acked;
+		self->acked_at = now;
+	}
+
+	// nothing to send at all (the transfer started at the end of the log), the host still needs to hear where it ends
+	if(self->acked >= self->end){
+		if(sbufBytesRemaining(dst) < LOG_DOWNLOAD_CHUNK_HEADER_SIZE)
+			return 0;
+		_log_download_write_header(dst, self->end, 0, LOG_DOWNLOAD_CHUNK_LAST, 0);
+		log_download_end(self);
+		return 1;
+	}
+
+	if(self->next >= self->end || (self->next - self->acked) >= (uint32_t)self->window * self->chunk_size)
+		return 0;
+	if(sbufBytesRemaining(dst) < LOG_DOWNLOAD_CHUNK_HEADER_SIZE + self->chunk_size)
+		return 0;
+
+	uint32_t offset = self->next;
+	int len = _log_download_read(self, offset, raw, MIN(self->chunk_size, self->end - offset));
+	if(len < 0){
+		self->failed = true;
+		return 0;
+	}
+	if(len == 0){
+		if(self->end != offset)
+			return 0;
+		// we just found the end of the file, tell the host where it is
+		_log_download_write_header(dst, offset, 0, LOG_DOWNLOAD_CHUNK_LAST, 0);
+		if(self->acked >= self->end)
+			log_download_end(self);
+		return 1;
+	}
+
+	uint8_t flags = (offset + len == self->end) ? LOG_DOWNLOAD_CHUNK_LAST : 0;
+	uint8_t *payload = sbufPtr(dst) + LOG_DOWNLOAD_CHUNK_HEADER_SIZE;
+	int size = -1;
+	if(self->flags & LOG_DOWNLOAD_FLAG_COMPRESS)
+		size = lz_compress(raw, len, payload, len - 1);	// only worth it if it is smaller
+	if(size > 0){
+		flags |= LOG_DOWNLOAD_CHUNK_COMPRESSED;
+	} else {
+		memcpy(payload, raw, len);
+		size = len;
+	}
+
+	_log_download_write_header(dst, offset, size, flags, crc32_ieee_buf(0, raw, len));
+	sbufAdvance(dst, size);
+	self->next = offset + len;
+	return 1;
+}
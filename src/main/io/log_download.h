@@ -0,0 +1,77 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "common/streambuf.h"
+#include "system_calls.h"
+
+/*
+ * Bulk download of blackbox logs from the dataflash or the sdcard. The host starts a transfer and the flight
+ * controller then pushes chunks of the log without waiting for a request per chunk, keeping up to `window` bytes
+ * unacknowledged at any time. The host acknowledges received data by offset. Anything not acknowledged within
+ * LOG_DOWNLOAD_ACK_TIMEOUT is sent again (go back N).
+ */
+
+typedef enum {
+	LOG_DOWNLOAD_SOURCE_FLASH = 0,
+	LOG_DOWNLOAD_SOURCE_SDCARD = 1
+} log_download_source_t;
+
+//! transfer flags set by the host
+#define LOG_DOWNLOAD_FLAG_COMPRESS		(1 << 0)
+
+//! flags of a data chunk
+#define LOG_DOWNLOAD_CHUNK_COMPRESSED	(1 << 0)
+#define LOG_DOWNLOAD_CHUNK_LAST			(1 << 1)
+#define LOG_DOWNLOAD_CHUNK_ERROR		(1 << 2)
+
+//! largest chunk whose frame still fits into the free space a serial port can report (255 bytes)
+#define LOG_DOWNLOAD_MAX_CHUNK 224
+#define LOG_DOWNLOAD_MAX_WINDOW 16
+//! u32 offset, u16 size, u8 flags, u32 crc32
+#define LOG_DOWNLOAD_CHUNK_HEADER_SIZE 11
+#define LOG_DOWNLOAD_ACK_TIMEOUT 500000
+//! size reported when the length of the log is not known until its end is read (sdcard)
+#define LOG_DOWNLOAD_SIZE_UNKNOWN 0xFFFFFFFF
+
+struct log_download {
+	bool active;
+	bool opening;			//!< waiting for the sdcard file to be opened
+	bool failed;			//!< reading failed, the host is told with an error chunk
+	uint8_t source;
+	uint8_t flags;
+	uint16_t chunk_size;
+	uint8_t window;			//!< number of chunks that may be unacknowledged
+	uint32_t end;			//!< offset one past the last byte of the transfer
+	uint32_t acked;			//!< the host has received everything before this offset
+	uint32_t next;			//!< offset of the next chunk to send
+	sys_micros_t acked_at;	//!< time of the last acknowledgement that moved the window
+	uint32_t file_pos;		//!< read position in the sdcard file, kept without USE_SDCARD so struct serial_msp has one layout
+};
+
+void log_download_init(struct log_download *self);
+//! start a transfer as described in the request. Writes the reply (u8 accepted, u32 size) to dst.
+void log_download_begin(struct log_download *self, sbuf_t *src, sbuf_t *dst, sys_micros_t now);
+//! host has received everything before offset. With resend set, everything after offset is sent again.
+void log_download_ack(struct log_download *self, uint32_t offset, bool resend, sys_micros_t now);
+void log_download_end(struct log_download *self);
+//! write the next chunk to dst. Returns 1 if a chunk was written, 0 if nothing can be sent right now.
+int log_download_next_chunk(struct log_download *self, sbuf_t *dst, sys_micros_t now);
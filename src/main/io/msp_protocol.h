@@ -59,7 +59,7 @@
 #define MSP_PROTOCOL_VERSION                0
 
 #define API_VERSION_MAJOR                   1 // increment when major changes are made
-#define API_VERSION_MINOR                   19 // increment when any change is made, reset to zero when major changes are released after changing API_VERSION_MAJOR
+#define API_VERSION_MINOR                   23 // increment when any change is made, reset to zero when major changes are released after changing API_VERSION_MAJOR
 
 #define API_VERSION_LENGTH                  2
 
@@ -255,3 +255,16 @@
 #define MSP_SERVO_MIX_RULES      241    //out message         Returns servo mixer configuration
 #define MSP_SET_SERVO_MIX_RULE   242    //in message          Sets servo mixer configuration
 #define MSP_SET_4WAY_IF          245    //in message          Sets 4way interface
+
+//
+// MSPv2 commands. These use 16 bit ids and are only reachable using the '$X' framing.
+//
+#define MSP2_BATCH               0x1F00 //in/out message      Process several commands in one frame. Request is a list of (u16 cmd, u16 size, data[size]),
+                                        //                    reply is a list of (u16 cmd, i8 result, u16 size, data[size]) for each command that fit into the reply.
+#define MSP2_STREAM_SUBSCRIBE    0x1F01 //in message          Replace the streaming subscriptions of the port with a list of (u16 cmd, u16 rate_hz).
+                                        //                    Replies with the number of accepted subscriptions. Empty list stops streaming.
+#define MSP2_CONFIG_SAVE_STATUS  0x1F02 //out message         Progress of the background config save (u8 busy, u8 pending, u8 progress, i16 last result)
+#define MSP2_LOG_READ_BEGIN      0x1F03 //in message          Start pushing a blackbox log from flash or sdcard to the port, see MSP_extensions.md
+#define MSP2_LOG_READ_DATA       0x1F04 //out message         Chunk of the log being downloaded (u32 offset, u16 size, u8 flags, u32 crc32, data[size])
+#define MSP2_LOG_READ_ACK        0x1F05 //in message          Acknowledge received log data up to an offset (u32 offset, u8 resend)
+#define MSP2_LOG_READ_END        0x1F06 //in message          Stop the log download of the port
@@ -240,18 +240,21 @@ static void applyStepAdjustment(struct rc_adj *self, struct rate_profile *contro
     };
 }
 
-static void applySelectAdjustment(struct rc_adj *self, uint8_t adjustmentFunction, uint8_t position)
+static bool applySelectAdjustment(struct rc_adj *self, uint8_t adjustmentFunction, uint8_t position)
 {
     bool applied = false;
 
     switch(adjustmentFunction) {
-        case ADJUSTMENT_RATE_PROFILE:
-            /*if (getCurrentControlRateProfile() != position) {
-                changeControlRateProfile(position);
-                blackboxLogInflightAdjustmentEvent(ADJUSTMENT_RATE_PROFILE, position);
+        case ADJUSTMENT_RATE_PROFILE: {
+            struct config_profile *profile = config_get_profile_rw(self->config);
+            if (position < MAX_CONTROL_RATE_PROFILE_COUNT && profile->rate.profile_id != position) {
+                profile->rate.profile_id = position;
+                //blackboxLogInflightAdjustmentEvent(ADJUSTMENT_RATE_PROFILE, position);
+                // writing flash stalls the cpu so the new selection is only saved after landing
+                ninja_config_save_on_disarm(self->ninja);
                 applied = true;
-            }*/
-            break;
+            }
+        } break;
 		default:
 			break;
     }
@@ -262,6 +265,7 @@ static void applySelectAdjustment(struct rc_adj *self, uint8_t adjustmentFunctio
     if (applied) {
         beeper_write(&self->ninja->beeper, buf);
     }
+    return applied;
 }
 
 #define RESET_FREQUENCY_2HZ (1000 / 2)
@@ -312,11 +316,15 @@ void rc_adj_update(struct rc_adj *self){
             }
 
             applyStepAdjustment(self, config_get_rate_profile_rw(self->config), adjustmentFunction, delta);
+            config_notify_changed();
         } else if (adjustmentState->config.mode == ADJUSTMENT_MODE_SELECT) {
             uint16_t rangeWidth = ((2100 - 900) / adjustmentState->config.data.selectConfig.switchPositions);
             uint8_t position = (constrain(rcin, 900, 2100 - 1) - 900) / rangeWidth;
 
-            applySelectAdjustment(self, adjustmentFunction, position);
+            // only a changed selection is worth reloading the config consumers for
+            if (applySelectAdjustment(self, adjustmentFunction, position)) {
+                config_notify_changed();
+            }
         }
         MARK_ADJUSTMENT_FUNCTION_AS_BUSY(adjustmentIndex);
     }
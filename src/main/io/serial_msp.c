@@ -23,6 +23,8 @@
 #include <platform.h>
 #include "target.h"
 
+#include "common/crc.h"
+#include "common/maths.h"
 #include "common/streambuf.h"
 #include "common/utils.h"
 
@@ -34,6 +36,7 @@
 #include "drivers/pwm_output.h"
 
 #include "io/serial.h"
+#include "io/msp_protocol.h"
 #include "io/serial_msp.h"
 #include "io/serial_4way.h"
 #include "cli.h"
@@ -87,14 +90,16 @@ void serial_msp_release_port(struct serial_msp *self, serialPort_t *serialPort)
     for (int i = 0; i < MAX_MSP_PORT_COUNT; i++) {
         struct serial_msp_port *mspPort = &self->ports[i];
         if (mspPort->port == serialPort) {
+            log_download_end(&mspPort->download);
             closeSerialPort(mspPort->port);
             resetMspPort(mspPort, NULL);
         }
     }
 }
 
-void serial_msp_init(struct serial_msp *self, const struct config *config, struct msp *msp){
+void serial_msp_init(struct serial_msp *self, const struct system_calls *system, const struct config *config, struct msp *msp){
 	memset(self, 0, sizeof(*self));
+	self->system = system;
 	self->config = config;
 	self->msp = msp;
     for(int i = 0; i < MAX_MSP_PORT_COUNT; i++)
@@ -114,11 +119,17 @@ static uint8_t mspSerialChecksumBuf(uint8_t checksum, uint8_t *data, int len)
     return checksum;
 }
 
-static void mspSerialResponse(struct serial_msp_port *msp, mspPacket_t *reply)
+static void mspSerialResponseV1(struct serial_msp_port *msp, mspPacket_t *reply)
 {
-    serialBeginWrite(msp->port);
     int len = sbufBytesRemaining(&reply->buf);
-    uint8_t hdr[] = {'$', 'M', reply->result < 0 ? '!' : '>', len, reply->cmd};
+    int result = reply->result;
+    if(len > 255) {
+        // does not fit into the v1 size field. Report an error instead of sending a truncated reply.
+        len = 0;
+        result = -1;
+    }
+    serialBeginWrite(msp->port);
+    uint8_t hdr[] = {'$', 'M', result < 0 ? '!' : '>', len, reply->cmd};
     uint8_t csum = 0;                                       // initial checksum value
     serialWriteBuf(msp->port, hdr, sizeof(hdr));
     csum = mspSerialChecksumBuf(csum, hdr + 3, 2);          // checksum starts from len field
@@ -130,7 +141,98 @@ static void mspSerialResponse(struct serial_msp_port *msp, mspPacket_t *reply)
     serialEndWrite(msp->port);
 }
 
-static void mspSerialProcessReceivedCommand(struct serial_msp_port *msp, struct msp *processor){
+static void mspSerialResponseV2(struct serial_msp_port *msp, mspPacket_t *reply)
+{
+    serialBeginWrite(msp->port);
+    int len = sbufBytesRemaining(&reply->buf);
+    uint8_t hdr[] = {
+        '$', 'X', reply->result < 0 ? '!' : '>',
+        0,                                                  // flags
+        (uint16_t)reply->cmd & 0xff, ((uint16_t)reply->cmd >> 8) & 0xff,
+        len & 0xff, (len >> 8) & 0xff
+    };
+    serialWriteBuf(msp->port, hdr, sizeof(hdr));
+    uint8_t crc = crc8_dvb_s2_buf(0, hdr + 3, MSP_V2_HEADER_SIZE);   // crc starts from flags field
+    if(len > 0) {
+        serialWriteBuf(msp->port, sbufPtr(&reply->buf), len);
+        crc = crc8_dvb_s2_buf(crc, sbufPtr(&reply->buf), len);
+    }
+    serialWrite(msp->port, crc);
+    serialEndWrite(msp->port);
+}
+
+static void mspSerialResponse(struct serial_msp_port *msp, mspPacket_t *reply)
+{
+    // reply using the same framing as the request so that v1 clients keep working unchanged
+    if(msp->version == MSP_V2)
+        mspSerialResponseV2(msp, reply);
+    else
+        mspSerialResponseV1(msp, reply);
+}
+
+// commands that only read state and can therefore be sent repeatedly without a request
+static const uint16_t mspStreamableCommands[] = {
+    MSP_STATUS,
+    MSP_STATUS_EX,
+    MSP_RAW_IMU,
+    MSP_SERVO,
+    MSP_MOTOR,
+    MSP_RC,
+    MSP_RAW_GPS,
+    MSP_COMP_GPS,
+    MSP_ATTITUDE,
+    MSP_ALTITUDE,
+    MSP_ANALOG,
+    MSP_SONAR_ALTITUDE,
+    MSP_DEBUG,
+};
+
+static bool mspStreamIsAllowed(uint16_t cmd)
+{
+    for(unsigned i = 0; i < ARRAYLEN(mspStreamableCommands); i++)
+        if(mspStreamableCommands[i] == cmd)
+            return true;
+    return false;
+}
+
+static int mspSerialSubscribe(struct serial_msp_port *msp, sbuf_t *src, sys_micros_t now)
+{
+    msp->streamCount = 0;
+    msp->streamNext = 0;
+    while(sbufBytesRemaining(src) >= 4 && msp->streamCount < MSP_STREAM_MAX_SUBSCRIPTIONS) {
+        uint16_t cmd = sbufReadU16(src);
+        uint16_t rate = sbufReadU16(src);
+        if(!rate || !mspStreamIsAllowed(cmd))
+            continue;
+        struct serial_msp_stream *stream = &msp->streams[msp->streamCount++];
+        stream->cmd = cmd;
+        stream->size = 0;
+        stream->period = 1000000 / MIN(rate, MSP_STREAM_MAX_RATE_HZ);
+        stream->next_at = now;
+    }
+    return msp->streamCount;
+}
+
+static void mspSerialDownloadCommand(struct serial_msp_port *msp, mspPacket_t *command, sbuf_t *dst, sys_micros_t now)
+{
+    sbuf_t *src = &command->buf;
+    switch(command->cmd) {
+        case MSP2_LOG_READ_BEGIN:
+            log_download_begin(&msp->download, src, dst, now);
+            break;
+        case MSP2_LOG_READ_ACK: {
+            uint32_t offset = sbufReadU32(src);
+            bool resend = sbufBytesRemaining(src) > 0 && sbufReadU8(src);
+            log_download_ack(&msp->download, offset, resend, now);
+            break;
+        }
+        case MSP2_LOG_READ_END:
+            log_download_end(&msp->download);
+            break;
+    }
+}
+
+static void mspSerialProcessReceivedCommand(struct serial_msp_port *msp, struct msp *processor, sys_micros_t now){
     mspPacket_t command = {
         .buf = {
             .ptr = msp->inBuf,
@@ -149,7 +251,21 @@ static void mspSerialProcessReceivedCommand(struct serial_msp_port *msp, struct
         .cmd = -1,
         .result = 0,
     };
-    if(msp_process(processor, &command, &reply)) {
+    if(command.cmd == MSP2_STREAM_SUBSCRIBE) {
+        // subscriptions belong to the port so they are handled here and not by the msp processor
+        reply.cmd = command.cmd;
+        reply.result = 1;
+        sbufWriteU8(&reply.buf, mspSerialSubscribe(msp, &command.buf, now));
+        sbufSwitchToReader(&reply.buf, outBuf);
+        mspSerialResponse(msp, &reply);
+    } else if(command.cmd == MSP2_LOG_READ_BEGIN || command.cmd == MSP2_LOG_READ_ACK || command.cmd == MSP2_LOG_READ_END) {
+        // log downloads are pushed to the port like streams
+        reply.cmd = command.cmd;
+        reply.result = 1;
+        mspSerialDownloadCommand(msp, &command, &reply.buf, now);
+        sbufSwitchToReader(&reply.buf, outBuf);
+        mspSerialResponse(msp, &reply);
+    } else if(msp_process(processor, &command, &reply)) {
         // reply should be sent back
         sbufSwitchToReader(&reply.buf, outBuf);     // change streambuf direction
         mspSerialResponse(msp, &reply);
@@ -157,6 +273,79 @@ static void mspSerialProcessReceivedCommand(struct serial_msp_port *msp, struct
     msp->c_state = IDLE;
 }
 
+// v2 framing overhead: preamble, flags, cmd, size and crc
+#define MSP_V2_FRAME_OVERHEAD 9
+
+// push replies of subscribed commands that are due. A reply is only built when the previous reply of the same
+// command fits into the free transmit buffer so that we never block in serialWrite and do not generate replies
+// that are thrown away. Skipped replies are sent on a later call.
+static void mspSerialProcessStreams(struct serial_msp_port *msp, struct msp *processor, sys_micros_t now)
+{
+    static uint8_t streamBuf[MSP_PORT_OUTBUF_SIZE];
+    for(int c = 0; c < msp->streamCount; c++) {
+        int idx = (msp->streamNext + c) % msp->streamCount;
+        struct serial_msp_stream *stream = &msp->streams[idx];
+        if((now - stream->next_at) < 0)
+            continue;
+
+        if(serialTxBytesFree(msp->port) < MSP_V2_FRAME_OVERHEAD + stream->size) {
+            // link is saturated, let the next call start with this stream
+            msp->streamNext = idx;
+            return;
+        }
+
+        mspPacket_t command = {
+            .buf = { .ptr = NULL, .end = NULL },
+            .cmd = stream->cmd,
+            .result = 0,
+        };
+        mspPacket_t reply = {
+            .buf = { .ptr = streamBuf, .end = ARRAYEND(streamBuf) },
+            .cmd = -1,
+            .result = 0,
+        };
+        msp_process(processor, &command, &reply);
+        sbufSwitchToReader(&reply.buf, streamBuf);
+
+        uint16_t size = sbufBytesRemaining(&reply.buf);
+        if(size > stream->size && serialTxBytesFree(msp->port) < MSP_V2_FRAME_OVERHEAD + size) {
+            // reply grew since the last time, remember the new size and send it once there is room
+            stream->size = size;
+            msp->streamNext = idx;
+            return;
+        }
+        stream->size = size;
+        mspSerialResponseV2(msp, &reply);
+
+        // keep samples evenly spaced but do not try to catch up after a long stall
+        stream->next_at += stream->period;
+        if((now - stream->next_at) >= stream->period)
+            stream->next_at = now + stream->period;
+    }
+}
+
+// push chunks of an active log download while the window and the transmit buffer allow. The number of chunks per
+// call is limited because usb vcp ports report free space but block while sending.
+#define MSP_DOWNLOAD_MAX_CHUNKS_PER_CALL 4
+
+static void mspSerialProcessDownload(struct serial_msp_port *msp, sys_micros_t now)
+{
+    static uint8_t chunkBuf[LOG_DOWNLOAD_CHUNK_HEADER_SIZE + LOG_DOWNLOAD_MAX_CHUNK];
+    for(int c = 0; c < MSP_DOWNLOAD_MAX_CHUNKS_PER_CALL && msp->download.active; c++) {
+        if(serialTxBytesFree(msp->port) < MSP_V2_FRAME_OVERHEAD + sizeof(chunkBuf))
+            return;
+        mspPacket_t reply = {
+            .buf = { .ptr = chunkBuf, .end = ARRAYEND(chunkBuf) },
+            .cmd = MSP2_LOG_READ_DATA,
+            .result = 1,
+        };
+        if(!log_download_next_chunk(&msp->download, &reply.buf, now))
+            return;
+        sbufSwitchToReader(&reply.buf, chunkBuf);
+        mspSerialResponseV2(msp, &reply);
+    }
+}
+
 static bool mspSerialProcessReceivedByte(struct serial_msp_port *msp, uint8_t c)
 {
     switch(msp->c_state) {
@@ -167,7 +356,15 @@ static bool mspSerialProcessReceivedByte(struct serial_msp_port *msp, uint8_t c)
             msp->c_state = HEADER_M;
             break;
         case HEADER_M:
-            msp->c_state = (c == 'M') ? HEADER_ARROW : IDLE;
+            if(c == 'M') {
+                msp->version = MSP_V1;
+                msp->c_state = HEADER_ARROW;
+            } else if(c == 'X') {
+                msp->version = MSP_V2;
+                msp->c_state = HEADER_V2_ARROW;
+            } else {
+                msp->c_state = IDLE;
+            }
             break;
         case HEADER_ARROW:
             msp->c_state = (c == '<') ? HEADER_SIZE : IDLE;
@@ -198,6 +395,50 @@ static bool mspSerialProcessReceivedByte(struct serial_msp_port *msp, uint8_t c)
                 else
                     msp->c_state = IDLE;
             }
+            break;
+        case HEADER_V2_ARROW:
+            if(c == '<') {
+                msp->offset = 0;
+                msp->checksum = 0;
+                msp->c_state = HEADER_V2_FLAGS;
+            } else {
+                msp->c_state = IDLE;
+            }
+            break;
+        case HEADER_V2_FLAGS:
+            msp->flags = c;
+            msp->checksum = crc8_dvb_s2(msp->checksum, c);
+            msp->c_state = HEADER_V2_CMD;
+            break;
+        case HEADER_V2_CMD:
+            // 16 bit little endian command id
+            msp->checksum = crc8_dvb_s2(msp->checksum, c);
+            if(msp->offset++ == 0) {
+                msp->cmdMSP = c;
+            } else {
+                msp->cmdMSP |= (uint16_t)c << 8;
+                msp->offset = 0;
+                msp->c_state = HEADER_V2_SIZE;
+            }
+            break;
+        case HEADER_V2_SIZE:
+            // 16 bit little endian payload size
+            msp->checksum = crc8_dvb_s2(msp->checksum, c);
+            if(msp->offset++ == 0) {
+                msp->dataSize = c;
+            } else {
+                msp->dataSize |= (uint16_t)c << 8;
+                msp->offset = 0;
+                msp->c_state = (msp->dataSize > MSP_PORT_INBUF_SIZE) ? IDLE : HEADER_V2_DATA;
+            }
+            break;
+        case HEADER_V2_DATA:
+            if(msp->offset < msp->dataSize) {
+                msp->inBuf[msp->offset++] = c;
+                msp->checksum = crc8_dvb_s2(msp->checksum, c);
+            } else {
+                msp->c_state = (c == msp->checksum) ? COMMAND_RECEIVED : IDLE;
+            }
             break;
 		case COMMAND_RECEIVED:
 			break;
@@ -206,6 +447,7 @@ static bool mspSerialProcessReceivedByte(struct serial_msp_port *msp, uint8_t c)
 }
 
 void serial_msp_process(struct serial_msp *self, struct ninja *ninja){
+    sys_micros_t now = sys_micros(self->system);
     for (int i = 0; i < MAX_MSP_PORT_COUNT; i++) {
         struct serial_msp_port *msp = &self->ports[i];
         if (!msp->port) {
@@ -227,10 +469,13 @@ void serial_msp_process(struct serial_msp *self, struct ninja *ninja){
             }
 
             if (msp->c_state == COMMAND_RECEIVED) {
-                mspSerialProcessReceivedCommand(msp, self->msp);
+                mspSerialProcessReceivedCommand(msp, self->msp, now);
                 break; // process one command at a time so as not to block and handle modal command immediately
             }
         }
+
+        mspSerialProcessStreams(msp, self->msp, now);
+        mspSerialProcessDownload(msp, now);
 #ifdef USE_SERIAL_4WAY_BLHELI_INTERFACE
 		// TODO: 4way interface
 		/*
@@ -58,6 +58,8 @@
 #define MAX_MSP_PORT_COUNT 2
 
 #include "drivers/serial.h"
+#include "io/log_download.h"
+#include "system_calls.h"
 
 typedef enum {
     IDLE,
@@ -66,19 +68,53 @@ typedef enum {
     HEADER_SIZE,
     HEADER_CMD,
     HEADER_DATA,
+    HEADER_V2_ARROW,
+    HEADER_V2_FLAGS,
+    HEADER_V2_CMD,
+    HEADER_V2_SIZE,
+    HEADER_V2_DATA,
     COMMAND_RECEIVED
 } mspState_e;
 
-#define MSP_PORT_INBUF_SIZE 64
-#define MSP_PORT_OUTBUF_SIZE 256
+typedef enum {
+    MSP_V1 = 0,
+    MSP_V2
+} mspVersion_e;
+
+// v1 frames are limited to 255 bytes by the size field. v2 frames carry a 16 bit size, but are limited by our buffers.
+#define MSP_PORT_INBUF_SIZE 192
+#define MSP_PORT_OUTBUF_SIZE 512
+
+// size of the v2 header fields covered by the crc (flags, cmd, size)
+#define MSP_V2_HEADER_SIZE 5
+
+#define MSP_STREAM_MAX_SUBSCRIPTIONS 8
+#define MSP_STREAM_MAX_RATE_HZ 100
+
+//! a command whose reply is pushed to the client at a fixed rate without a request
+struct serial_msp_stream {
+    uint16_t cmd;
+    uint16_t size;                           // payload size of the last reply, used to check for tx space before building the next one
+    sys_micros_t period;
+    sys_micros_t next_at;
+};
 
 struct serial_msp_port {
     serialPort_t *port;                      // NULL when port unused.
     mspState_e c_state;
-    uint8_t offset;
-    uint8_t dataSize;
-    uint8_t cmdMSP;
+    mspVersion_e version;                    // framing version of the command being received
+    uint16_t offset;
+    uint16_t dataSize;
+    uint16_t cmdMSP;
+    uint8_t flags;
+    uint8_t checksum;                        // running crc8 of a v2 frame
     uint8_t inBuf[MSP_PORT_INBUF_SIZE];
+
+    struct serial_msp_stream streams[MSP_STREAM_MAX_SUBSCRIPTIONS];
+    uint8_t streamCount;
+    uint8_t streamNext;                      // round robin start so that one stream can not starve the others
+
+    struct log_download download;            // bulk log transfer pushed to this port
 };
 
 struct ninja;
@@ -86,13 +122,14 @@ struct msp;
 
 struct serial_msp {
 	struct serial_msp_port ports[MAX_MSP_PORT_COUNT];
+	const struct system_calls *system;
 	const struct config *config;
 	struct msp *msp;
 };
 
 // TODO: look into the dependency here. serial_msp is pointing to msp parser which processes commands received from multiple msp ports managed by single serial_msp object.
 
-void serial_msp_init(struct serial_msp *self, const struct config *config, struct msp *msp);
+void serial_msp_init(struct serial_msp *self, const struct system_calls *system, const struct config *config, struct msp *msp);
 void serial_msp_process(struct serial_msp *self, struct ninja *ninja);
 //void serial_msp_alloc_ports(struct serial_msp *self);
 void serial_msp_release_port(struct serial_msp *self, serialPort_t *serialPort);
@@ -19,6 +19,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include <platform.h>
 
@@ -49,6 +50,7 @@
 #include "drivers/serial_softserial.h"
 #include "drivers/serial_uart.h"
 #include "drivers/accgyro.h"
+#include "drivers/barometer.h"
 #include "drivers/compass.h"
 #include "drivers/pwm_mapping.h"
 #include "drivers/pwm_rx.h"
@@ -83,6 +85,7 @@
 #include "sensors/boardalignment.h"
 #include "sensors/initialisation.h"
 #include "sensors/instruments.h"
+#include "sensors/esc_telemetry.h"
 
 #include "telemetry/telemetry.h"
 
@@ -106,6 +109,7 @@
 
 // TODO: refactor this to use proper timeouts
 extern uint32_t currentTime;
+extern baro_t baro;
 /*
 static filterStatePt1_t filteredCycleTimeState;
 uint16_t filteredCycleTime;
@@ -121,6 +125,24 @@ uint16_t cycleTime;
 serialPort_t *loopbackPort;
 #endif
 
+#ifdef USE_DSHOT
+#define ESC_TELEMETRY_BAUDRATE 115200
+
+static struct esc_telemetry escTelemetry;
+static serialPort_t *escTelemetryPort = NULL;
+
+static void escTelemetryInit(const struct serial_config *serial, uint8_t motorCount)
+{
+    const struct serial_port_config *portConfig = findSerialPortConfig(serial, FUNCTION_ESC_TELEMETRY);
+    if (!portConfig)
+        return;
+
+    esc_telemetry_init(&escTelemetry, motorCount);
+    // bytes are read from the port buffer by the fastloop, see _flush_motors()
+    escTelemetryPort = openSerialPort(portConfig->identifier, FUNCTION_ESC_TELEMETRY, NULL, ESC_TELEMETRY_BAUDRATE, MODE_RX, SERIAL_NOT_INVERTED);
+}
+#endif
+
 const struct sonar_hardware *sonarGetHardwareConfiguration(current_sensor_type_t  currentMeterType);
 
 #ifdef STM32F303xC
@@ -345,6 +367,7 @@ static void init(const struct config *config)
 #endif
 
     pwm_params.useOneshot = feature(config, FEATURE_ONESHOT125);
+    pwm_params.motorProtocol = config->pwm_out.motor_protocol;
     pwm_params.motorPwmRate = config->pwm_out.motor_pwm_rate;
     pwm_params.idlePulse = config->pwm_out.mincommand;
     if (feature(config, FEATURE_3D))
@@ -356,6 +379,11 @@ static void init(const struct config *config)
 
     // pwmInit() needs to be called as soon as possible for ESC compatibility reasons
 	pwmInit(&pwm_params, &config->pwm_in);
+#ifdef USE_DSHOT
+    // escs only answer telemetry requests that are sent in dshot frames
+    if (pwmGetOutputConfiguration()->motorProtocol != MOTOR_PROTOCOL_PWM)
+        escTelemetryInit(&config->serial, pwmGetOutputConfiguration()->motorCount);
+#endif
     //pwmIOConfiguration_t *pwmIOConfiguration = pwmInit(&pwm_params);
 	//mixer_use_pwmio_config(&ninja.mixer, pwmIOConfiguration);
 
@@ -572,6 +600,31 @@ static void _write_motor(const struct system_calls_pwm *pwm, uint8_t id, uint16_
 	pwmWriteMotor(id, value);
 }
 
+static void _flush_motors(const struct system_calls_pwm *pwm){
+	(void)pwm;
+#ifdef USE_DSHOT
+	if(escTelemetryPort){
+		// answers are decoded here rather than in the uart interrupt so that the
+		// decoder state is only ever touched from the fastloop
+		while(serialRxBytesWaiting(escTelemetryPort))
+			esc_telemetry_input(&escTelemetry, serialRead(escTelemetryPort));
+		int motor = esc_telemetry_request(&escTelemetry, micros());
+		if(motor >= 0) pwmRequestDshotTelemetry(motor);
+	}
+	pwmCompleteDshotMotorUpdate();
+#endif
+}
+
+static int _read_motor_erpm(const struct system_calls_pwm *pwm, uint8_t id, uint32_t *erpm){
+	(void)pwm;
+#ifdef USE_DSHOT
+	if(escTelemetryPort) return esc_telemetry_get_erpm(&escTelemetry, id, micros(), erpm);
+#endif
+	(void)id;
+	(void)erpm;
+	return -ENOENT;
+}
+
 static void _write_servo(const struct system_calls_pwm *pwm, uint8_t id, uint16_t value){
 	(void)pwm;
 	pwmWriteServo(id, value);
@@ -609,10 +662,43 @@ static int _read_acc(const struct system_calls_imu *imu, int16_t output[3]){
 	return 0;
 }
 
+static barometerState_e baroState = BAROMETER_NEEDS_SAMPLES;
+static bool baroStarted = false;
+static uint32_t baroReadyAt = 0;
+
 static int _read_pressure(const struct system_calls_imu *sys, uint32_t *pressure){
 	(void)sys;
-	*pressure = 111000;
-	return 0;
+	// baro is filled in by sensorsAutodetect and left empty when no sensor was found
+	if(!baro.calculate) return -ENODEV;
+
+	uint32_t now = micros();
+	if(!baroStarted){
+		baro.start_ut();
+		baroReadyAt = now + baro.ut_delay;
+		baroStarted = true;
+		return -EAGAIN;
+	}
+	if((int32_t)(now - baroReadyAt) < 0) return -EAGAIN;
+
+	// the driver converts temperature and pressure in turns, only the pressure step yields a sample
+	switch(baroState){
+		case BAROMETER_NEEDS_SAMPLES:
+			baro.get_ut();
+			baro.start_up();
+			baroReadyAt = now + baro.up_delay;
+			baroState = BAROMETER_NEEDS_CALCULATION;
+			return -EAGAIN;
+		case BAROMETER_NEEDS_CALCULATION: {
+			int32_t temperature;
+			baro.get_up();
+			baro.start_ut();
+			baro.calculate(pressure, &temperature);
+			baroReadyAt = now + baro.ut_delay;
+			baroState = BAROMETER_NEEDS_SAMPLES;
+			return 0;
+		}
+	}
+	return -EAGAIN;
 }
 
 static int _read_temperature(const struct system_calls_imu *sys, int16_t *temp){
@@ -678,6 +764,8 @@ static struct system_calls syscalls = {
 	.pwm = {
 		.write_motor = _write_motor,
 		.write_servo = _write_servo,
+		.flush_motors = _flush_motors,
+		.read_motor_erpm = _read_motor_erpm,
 		.read_ppm = _read_ppm,
 		.read_pwm = _read_pwm
 	},
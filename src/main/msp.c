@@ -42,6 +42,7 @@
 #include "drivers/serial.h"
 #include "drivers/bus_i2c.h"
 #include "drivers/sdcard.h"
+#include "drivers/asyncfatfs/asyncfatfs.h"
 #include "drivers/flashfs.h"
 #include "common/buf_writer.h"
 
@@ -767,7 +768,7 @@ static int processOutCommand(struct msp *self, mspPacket_t *cmd, mspPacket_t *re
             sbufWriteU8(dst, wp_no);
             sbufWriteU32(dst, lat);
             sbufWriteU32(dst, lon);
-            sbufWriteU32(dst, ins_get_altitude_cm(&self->ninja->ins));           // altitude (cm) will come here -- temporary implementation to test feature with apps
+            sbufWriteU32(dst, (uint32_t)ins_get_altitude_cm(&self->ninja->ins)); // altitude (cm, signed) will come here -- temporary implementation to test feature with apps
             sbufWriteU16(dst, 0);                 // heading  will come here (deg)
             sbufWriteU16(dst, 0);                 // time to stay (ms) will come here
             sbufWriteU8(dst, 0);                  // nav flag will come here
@@ -785,6 +786,13 @@ static int processOutCommand(struct msp *self, mspPacket_t *cmd, mspPacket_t *re
             break;
 #endif
 
+        case MSP2_CONFIG_SAVE_STATUS:
+            sbufWriteU8(dst, config_save_busy(&self->ninja->config_save));
+            sbufWriteU8(dst, self->ninja->config_save_pending);
+            sbufWriteU8(dst, config_save_progress(&self->ninja->config_save));
+            sbufWriteU16(dst, self->ninja->config_save_result);
+            break;
+
         case MSP_DEBUG: 
             // output some useful QA statistics
             // debug[x] = ((hse_value / 1000000) * 1000) + (SystemCoreClock / 1000000);         // XX0YY [crystal clock : core clock]
@@ -1471,6 +1479,55 @@ static int processInCommand(struct msp *self, mspPacket_t *cmd){
     return 1;     // message was handled succesfully
 }
 
+// a sub reply can be as large as any other reply
+#define MSP_BATCH_SCRATCH_SIZE MSP_PORT_OUTBUF_SIZE
+#define MSP_BATCH_ENTRY_HEADER_SIZE 5
+
+// run each sub command of a batch request and append its reply to the batch reply.
+// Stops at the first reply that does not fit, the client is expected to request the remaining commands again.
+static int processBatchCommand(struct msp *self, mspPacket_t *cmd, mspPacket_t *reply){
+    static uint8_t scratch[MSP_BATCH_SCRATCH_SIZE];
+    sbuf_t *src = &cmd->buf;
+    sbuf_t *dst = &reply->buf;
+
+    while(sbufBytesRemaining(src) >= 4) {
+        uint16_t id = sbufReadU16(src);
+        int len = sbufReadU16(src);
+        if(len > sbufBytesRemaining(src))
+            return -1;
+
+        mspPacket_t sub = {
+            .buf = { .ptr = sbufPtr(src), .end = sbufPtr(src) + len },
+            .cmd = id,
+            .result = 0,
+        };
+        mspPacket_t subReply = {
+            .buf = { .ptr = scratch, .end = ARRAYEND(scratch) },
+            .cmd = -1,
+            .result = 0,
+        };
+        sbufAdvance(src, len);
+
+        int status = -1;
+        // nested batches are not allowed
+        if(id != MSP2_BATCH)
+            status = msp_process(self, &sub, &subReply);
+        else
+            subReply.result = -1;
+
+        sbufSwitchToReader(&subReply.buf, scratch);
+        int replyLen = (status > 0) ? sbufBytesRemaining(&subReply.buf) : 0;
+        if(sbufBytesRemaining(dst) < MSP_BATCH_ENTRY_HEADER_SIZE + replyLen)
+            break;
+
+        sbufWriteU16(dst, id);
+        sbufWriteU8(dst, subReply.result);
+        sbufWriteU16(dst, replyLen);
+        sbufWriteData(dst, scratch, replyLen);
+    }
+    return 1;
+}
+
 void msp_init(struct msp *self, struct ninja *nin, struct config *config){
 	self->ninja = nin;
 	self->config = config;
@@ -1486,8 +1543,14 @@ int msp_process(struct msp *self, mspPacket_t *command, mspPacket_t *reply)
     reply->cmd = command->cmd;
     int status;
     do {
-        if((status = processInCommand(self, command)) != 0)
+        if(command->cmd == MSP2_BATCH) {
+            status = processBatchCommand(self, command, reply);
             break;
+        }
+        if((status = processInCommand(self, command)) != 0) {
+            config_notify_changed();
+            break;
+        }
         if((status = processOutCommand(self, command, reply)) != 0)
             break;
         //if((status = processPgCommand(self, command, reply)) != 0)
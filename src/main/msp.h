@@ -21,7 +21,7 @@
 
 typedef struct mspPacket_s {
     sbuf_t buf;
-    int16_t cmd;
+    uint16_t cmd;
     int16_t result;
 } mspPacket_t;
 
@@ -44,7 +44,6 @@
 #include "flight/rate_profile.h"
 #include "flight/mixer.h"
 #include "flight/anglerate.h"
-#include "flight/altitudehold.h"
 #include "flight/failsafe.h"
 #include "flight/gtune.h"
 #include "flight/navigation.h"
@@ -124,7 +123,7 @@ void ninja_init(struct ninja *self, struct fastloop *fl, const struct system_cal
 #endif
 
 	msp_init(&self->msp, self, self->config);
-	serial_msp_init(&self->serial_msp, self->config, &self->msp);
+	serial_msp_init(&self->serial_msp, self->system, self->config, &self->msp);
 
 	cli_init(&self->cli, self, self->config, self->system);
 
@@ -145,8 +144,9 @@ void ninja_init(struct ninja *self, struct fastloop *fl, const struct system_cal
 #endif
 
 #ifdef TELEMETRY
+	telemetry_init(&self->telemetry, self->system, self->config);
 	if (feature(self->config, FEATURE_TELEMETRY)) {
-		telemetryInit();
+		telemetry_open_ports(&self->telemetry);
 	}
 #endif
 
@@ -214,6 +214,10 @@ void ninja_disarm(struct ninja *self){
 	//mixer_enable_armed(&self->mixer, false);
 	beeper_start(&self->beeper, BEEPER_DISARMING);	  // emit disarm tone
 	self->is_armed = false;
+	if(self->config_save_on_disarm){
+		self->config_save_on_disarm = false;
+		ninja_config_save(self);
+	}
 }
 
 	/*
@@ -452,9 +456,7 @@ static void _run_control_loop(struct ninja *self){
 }
 
 	if (rc_key_state(&self->rc, RC_KEY_FUNC_ALTHOLD) == RC_KEY_PRESSED) {
-		althold_input_throttle(&self->althold, ctrl.throttle);
-		althold_update(&self->althold);
-		ctrl.throttle = althold_get_throttle(&self->althold);
+		ctrl.mode |= FL_ALTHOLD;
 	}
 
 	for(int c = 0; c < 8; c++)
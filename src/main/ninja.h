@@ -3,7 +3,6 @@
 #include <stdio.h>
 
 #include "flight/anglerate.h"
-#include "flight/altitudehold.h"
 #include "flight/failsafe.h"
 #include "flight/mixer.h"
 
@@ -26,6 +25,7 @@
 #include "ninja_config.h"
 #include "fastloop.h"
 #include "blackbox.h"
+#include "telemetry/telemetry.h"
 
 struct ninja;
 
@@ -56,7 +56,7 @@ struct ninja {
 	struct gps gps;
 	struct serial_msp serial_msp;
 	struct msp msp;
-	struct althold althold;
+	struct telemetry telemetry;
 
 	bool isRXDataNew;
 
@@ -89,6 +89,8 @@ struct ninja {
 
 	struct fastloop *fastloop;
 	//sys_micros_t loop_time;
+	//! timestamp of the last gps solution passed to the position estimator
+	sys_micros_t gps_fix_time;
 
 	struct ninja_sched sched;
 
@@ -105,6 +107,13 @@ struct ninja {
 	//! pointer to current configuration
 	struct config_store *config_store;
 	struct config *config;
+
+	//! copy of the config that is being written to eeprom in the background
+	struct config_store config_save_buffer;
+	struct config_save config_save;
+	bool config_save_pending;
+	bool config_save_on_disarm;
+	int16_t config_save_result;
 };
 
 void ninja_init(struct ninja *self, struct fastloop *fl, const struct system_calls *syscalls, struct config_store *config);
@@ -200,14 +200,59 @@ void ninja_config_load(struct ninja *self){
     rx_resume_signal(&self->rx);
 }
 
+static void _config_save_start(struct ninja *self){
+	memcpy(&self->config_save_buffer, self->config_store, sizeof(struct config_store));
+	config_save_begin(&self->config_save, &self->config_save_buffer, self->system);
+	self->config_save_pending = false;
+}
+
+/**
+ * Requests the config to be saved. The config is copied and then written to
+ * eeprom in small steps by the config save task so this never blocks. If a
+ * save is already in progress then another one is done when it completes.
+ */
 void ninja_config_save(struct ninja *self){
+	if(config_save_busy(&self->config_save)){
+		self->config_save_pending = true;
+		return;
+	}
+	_config_save_start(self);
+}
+
+/**
+ * Requests the config to be saved once the craft is disarmed. Used for changes
+ * made in flight since writing internal flash stalls the cpu.
+ */
+void ninja_config_save_on_disarm(struct ninja *self){
+	if(!ninja_is_armed(self)){
+		ninja_config_save(self);
+		return;
+	}
+	self->config_save_on_disarm = true;
+}
+
+//! does one step of a background save, called from the config save task
+void ninja_config_save_update(struct ninja *self){
+	if(!config_save_busy(&self->config_save)){
+		if(!self->config_save_pending)
+			return;
+		_config_save_start(self);
+	}
+	int ret = config_save_step(&self->config_save);
+	if(ret <= 0)
+		self->config_save_result = ret;
+}
+
+//! completes all requested saves before returning. Used before rebooting.
+int ninja_config_flush(struct ninja *self){
     rx_suspend_signal(&self->rx);
 
-	if(config_save(self->config_store, self->system) < 0){
-		// handle fail
+	while(config_save_busy(&self->config_save) || self->config_save_pending){
+		ninja_config_save_update(self);
 	}
 
     rx_resume_signal(&self->rx);
+	return self->config_save_result;
 }
 
 void ninja_config_reset(struct ninja *self){
@@ -3,3 +3,6 @@
 void ninja_config_reset(struct ninja *self);
 void ninja_config_load(struct ninja *self);
 void ninja_config_save(struct ninja *self);
+void ninja_config_save_on_disarm(struct ninja *self);
+void ninja_config_save_update(struct ninja *self);
+int ninja_config_flush(struct ninja *self);
@@ -50,6 +50,8 @@
 #include "common/utils.h"
 
 #include "drivers/system.h"
+#include "drivers/flashfs.h"
+#include "drivers/asyncfatfs/asyncfatfs.h"
 #include "config/feature.h"
 
 #include "io/serial.h"
@@ -187,6 +189,13 @@ void ninja_sched_init(struct ninja_sched *self, const struct system_calls_time *
 	}
 	ninja_sched_set_task_enabled(self, TASK_BATTERY, feature(self->config, FEATURE_VBAT) || feature(self->config, FEATURE_CURRENT_METER));
 	ninja_sched_set_task_enabled(self, TASK_RX, true);
+	ninja_sched_set_task_enabled(self, TASK_CONFIG_SAVE, true);
+#ifdef USE_FLASHFS
+	ninja_sched_set_task_enabled(self, TASK_FLASHFS_ERASE, true);
+#endif
+#ifdef USE_SDCARD
+	ninja_sched_set_task_enabled(self, TASK_SDCARD, true);
+#endif
 #ifdef GPS
 	ninja_sched_set_task_enabled(self, TASK_GPS, feature(self->config, FEATURE_GPS));
 #endif
@@ -466,6 +475,20 @@ static void _task_gps(struct ninja_sched *sched){
 		gps_update(&self->gps);
 	}
 
+	// each new 3d solution goes to the position estimator in the fastloop together with the time it was received
+	if(self->gps.GPS_fix && self->gps.GPS_fix_time != self->gps_fix_time){
+		const struct ubx_solution *sol = &self->gps.ubx.sol;
+		struct posest_gps_fix fix = {
+			.lat = self->gps.GPS_coord[LAT],
+			.lon = self->gps.GPS_coord[LON],
+			.alt = sol->alt_msl / 10,
+			.vel_ned = { self->gps.GPS_velned[0], self->gps.GPS_velned[1], self->gps.GPS_velned[2] },
+			.timestamp = self->gps.GPS_fix_time
+		};
+		fastloop_write_gps(self->fastloop, &fix);
+		self->gps_fix_time = self->gps.GPS_fix_time;
+	}
+
 	// TODO: better way to detect if we have gps
 	/*
 	if (sensors(SENSOR_GPS)) {
@@ -490,13 +513,8 @@ static void _task_mag(struct ninja_sched *sched){
 
 #ifdef BARO
 static void _task_baro(struct ninja_sched *sched){
-	struct ninja *self = container_of(sched, struct ninja, sched);
-	// TODO: baro read
-	uint32_t pressure = 101325;
-	if(sys_read_pressure(self->system, &pressure) == 0){
-		//ins_process_pressure(&self->ins, pressure);
-		//uint32_t alt = ins_get_altitude_cm(&self->ins);
-	}
+	(void)sched;
+	// pressure is sampled by the fastloop which owns the altitude estimator
 	/*
 	if (sensors(SENSOR_BARO)) {
 		uint32_t newDeadline = baroUpdate();
@@ -549,15 +567,61 @@ static void _task_display(struct ninja_sched *sched){
 #endif
 
 #ifdef TELEMETRY
-static void _task_telemetry(struct ninja_sched *sched){
-	(void)sched;
-/*
-	telemetryCheckState();
+static void _telemetry_snapshot(struct ninja *self, struct telemetry_state *state){
+	memset(state, 0, sizeof(*state));
+	state->timestamp = sys_micros(self->system);
+	state->roll = self->fout.roll;
+	state->pitch = self->fout.pitch;
+	state->yaw = self->fout.yaw;
+	memcpy(state->gyr, self->fout.w, sizeof(state->gyr));
+	memcpy(state->acc, self->fout.acc, sizeof(state->acc));
+	memcpy(state->motors, self->fout.motors, sizeof(state->motors));
+	state->vbat = battery_get_voltage(&self->bat);
+	state->current = battery_get_current(&self->bat);
+	state->mah_drawn = battery_get_spent_capacity(&self->bat);
+	state->rssi = rx_get_rssi(&self->rx);
+	state->armed = ninja_is_armed(self);
+	state->failsafe = failsafe_is_active(&self->failsafe);
+
+	if(rc_key_state(&self->rc, RC_KEY_FUNC_LEVEL) == RC_KEY_PRESSED)
+		state->flight_mode = TELEMETRY_MODE_ANGLE;
+	else if(rc_key_state(&self->rc, RC_KEY_FUNC_BLEND) == RC_KEY_PRESSED)
+		state->flight_mode = TELEMETRY_MODE_HORIZON;
+	else if(rc_key_state(&self->rc, RC_KEY_FUNC_ALTHOLD) == RC_KEY_PRESSED)
+		state->flight_mode = TELEMETRY_MODE_ALTHOLD;
+	else if(rc_key_state(&self->rc, RC_KEY_FUNC_HEADFIX) == RC_KEY_PRESSED)
+		state->flight_mode = TELEMETRY_MODE_HEADFREE;
+	else
+		state->flight_mode = TELEMETRY_MODE_RATE;
 
-	if (!cliMode && feature(FEATURE_TELEMETRY)) {
-		telemetryProcess(rcControlsConfig()->deadband3d_throttle);
+#ifdef GPS
+	if(feature(self->config, FEATURE_GPS)){
+		state->has_gps = true;
+		state->gps_fix = self->gps.GPS_fix;
+		state->num_sat = self->gps.GPS_numSat;
+		state->lat = self->gps.GPS_coord[LAT];
+		state->lon = self->gps.GPS_coord[LON];
+		state->gps_altitude = self->gps.GPS_altitude * 100;
+		state->ground_speed = self->gps.GPS_speed;
+		state->ground_course = self->gps.GPS_ground_course;
 	}
-	*/
+#endif
+}
+
+static void _task_telemetry(struct ninja_sched *sched){
+	struct ninja *self = container_of(sched, struct ninja, sched);
+	struct telemetry_state state;
+
+	if(!telemetry_is_active(&self->telemetry))
+		return;
+
+	// state is gathered once here and shared by all protocols
+	_telemetry_snapshot(self, &state);
+	telemetry_update(&self->telemetry, &state);
+
+	// the gcs can only ask for a save while disarmed but it may have armed since
+	if(telemetry_save_requested(&self->telemetry) && !ninja_is_armed(self))
+		ninja_config_save(self);
 }
 #endif
 
@@ -570,6 +634,25 @@ static void _task_ledstrip(struct ninja_sched *sched){
 }
 #endif
 
+static void _task_config_save(struct ninja_sched *sched){
+	struct ninja *self = container_of(sched, struct ninja, sched);
+	ninja_config_save_update(self);
+}
+
+#ifdef USE_FLASHFS
+static void _task_flashfs_erase(struct ninja_sched *sched){
+	(void)sched;
+	flashfsEraseUpdate();
+}
+#endif
+
+#ifdef USE_SDCARD
+static void _task_sdcard(struct ninja_sched *sched){
+	(void)sched;
+	afatfs_poll();
+}
+#endif
+
 static cfTask_t cfTasks[TASK_COUNT] = {
 	[TASK_SYSTEM] = {
 		.taskName = "SYSTEM",
@@ -627,7 +710,7 @@ static cfTask_t cfTasks[TASK_COUNT] = {
 	[TASK_GPS] = {
 		.taskName = "GPS",
 		.taskFunc = _task_gps,
-		.desiredPeriod = 1000000 / 10,		  // GPS usually don't go faster than 10Hz
+		.desiredPeriod = 1000000 / 100,		 // 100 Hz, bounds the error of the solution timestamps to 10ms
 		.staticPriority = TASK_PRIORITY_MEDIUM,
 	},
 #endif
@@ -673,6 +756,31 @@ static cfTask_t cfTasks[TASK_COUNT] = {
 		.staticPriority = TASK_PRIORITY_LOW,
 	},
 
+	[TASK_CONFIG_SAVE] = {
+		.taskName = "CONFIG_SAVE",
+		.taskFunc = _task_config_save,
+		.desiredPeriod = 1000000 / 500,		 // 500 Hz, every 2 ms. Does nothing unless a save is in progress.
+		.staticPriority = TASK_PRIORITY_LOW,
+	},
+
+#ifdef USE_FLASHFS
+	[TASK_FLASHFS_ERASE] = {
+		.taskName = "FLASHFS_ERASE",
+		.taskFunc = _task_flashfs_erase,
+		.desiredPeriod = 1000000 / 50,		  // 50 Hz, a sector erase takes longer than this anyway
+		.staticPriority = TASK_PRIORITY_IDLE,
+	},
+#endif
+
+#ifdef USE_SDCARD
+	[TASK_SDCARD] = {
+		.taskName = "SDCARD",
+		.taskFunc = _task_sdcard,
+		.desiredPeriod = 1000000 / 250,		// 250 Hz, enough for 64 kB/s of blackbox data in asyncfatfs_unittest, 100 Hz isn't
+		.staticPriority = TASK_PRIORITY_LOW,
+	},
+#endif
+
 #ifdef DISPLAY
 	[TASK_DISPLAY] = {
 		.taskName = "DISPLAY",
@@ -54,6 +54,13 @@ typedef enum {
     TASK_LEDSTRIP,
 #endif
     TASK_TRANSPONDER,
+    TASK_CONFIG_SAVE,
+#ifdef USE_FLASHFS
+    TASK_FLASHFS_ERASE,
+#endif
+#ifdef USE_SDCARD
+    TASK_SDCARD,
+#endif
 
     /* Count of real tasks */
     TASK_COUNT,
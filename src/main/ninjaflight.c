@@ -169,17 +169,6 @@ static void updateLEDs(void)
     }
 }
 #endif
-#define TELEMETRY_FUNCTION_MASK (FUNCTION_TELEMETRY_FRSKY | FUNCTION_TELEMETRY_HOTT | FUNCTION_TELEMETRY_SMARTPORT | FUNCTION_TELEMETRY_LTM | FUNCTION_TELEMETRY_MAVLINK)
-
-#ifdef TELEMETRY
-static void releaseSharedTelemetryPorts(void) {
-    serialPort_t *sharedPort = findSharedSerialPort(TELEMETRY_FUNCTION_MASK, FUNCTION_MSP);
-     while (sharedPort) {
-         mspSerialReleasePortIfAllocated(sharedPort);
-         sharedPort = findNextSharedSerialPort(TELEMETRY_FUNCTION_MASK, FUNCTION_MSP);
-     }
-}
-#endif
 #if 0
 static void updateMagHold(void)
 {
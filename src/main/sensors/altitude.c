@@ -0,0 +1,148 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Altitude estimator. State is altitude, vertical speed and accelerometer
+ * bias. The accelerometer drives the prediction at imu rate so the estimate
+ * has no lag, while baro and sonar pull it back at whatever rate they deliver
+ * samples. How much each measurement is trusted follows from the configured
+ * noise of the sensors instead of fixed complementary filter weights.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "common/maths.h"
+
+#include "altitude.h"
+
+//! bias random walk in cm/s/s per sqrt(s). Lets the filter follow slow accelerometer drift.
+#define INS_ALT_BIAS_NOISE 2.0f
+//! initial uncertainty of vertical speed (cm/s) and accelerometer bias (cm/s/s)
+#define INS_ALT_VEL_STDDEV0 100.0f
+#define INS_ALT_BIAS_STDDEV0 50.0f
+//! baro is only used to track its offset for this long after the last sonar sample (s)
+#define INS_ALT_SONAR_TIMEOUT 0.5f
+//! rate at which the baro offset follows the estimate while sonar is valid (per baro sample)
+#define INS_ALT_BARO_OFFSET_GAIN 0.1f
+
+static float _noise_var(uint16_t stddev){
+	float s = MAX(stddev, 1);
+	return s * s;
+}
+
+void ins_altitude_init(struct ins_altitude *self, const struct barometer_config *config){
+	memset(self, 0, sizeof(*self));
+	self->config = config;
+	self->sonar_age = INS_ALT_SONAR_TIMEOUT;
+}
+
+void ins_altitude_reset(struct ins_altitude *self, float alt){
+	memset(self->x, 0, sizeof(self->x));
+	memset(self->P, 0, sizeof(self->P));
+	self->x[INS_ALT_POS] = alt;
+	self->P[INS_ALT_POS][INS_ALT_POS] = _noise_var(self->config->alt_baro_noise);
+	self->P[INS_ALT_VEL][INS_ALT_VEL] = INS_ALT_VEL_STDDEV0 * INS_ALT_VEL_STDDEV0;
+	self->P[INS_ALT_BIAS][INS_ALT_BIAS] = INS_ALT_BIAS_STDDEV0 * INS_ALT_BIAS_STDDEV0;
+	self->acc = 0;
+	self->baro_offset = 0;
+	self->sonar_offset = 0;
+	self->initialized = true;
+}
+
+void ins_altitude_predict(struct ins_altitude *self, float acc, float dt){
+	self->sonar_age = MIN(self->sonar_age + dt, INS_ALT_SONAR_TIMEOUT);
+	if(!self->initialized) return;
+
+	const float dt2 = 0.5f * dt * dt;
+	float *x = self->x;
+	const float a = acc - x[INS_ALT_BIAS];
+	x[INS_ALT_POS] += x[INS_ALT_VEL] * dt + a * dt2;
+	x[INS_ALT_VEL] += a * dt;
+	self->acc = a;
+
+	// P = F * P * F' + Q
+	const float F[INS_ALT_STATES][INS_ALT_STATES] = {
+		{ 1, dt, -dt2 },
+		{ 0, 1, -dt },
+		{ 0, 0, 1 }
+	};
+	float FP[INS_ALT_STATES][INS_ALT_STATES];
+	for(int i = 0; i < INS_ALT_STATES; i++){
+		for(int j = 0; j < INS_ALT_STATES; j++){
+			FP[i][j] = F[i][0] * self->P[0][j] + F[i][1] * self->P[1][j] + F[i][2] * self->P[2][j];
+		}
+	}
+	for(int i = 0; i < INS_ALT_STATES; i++){
+		for(int j = 0; j < INS_ALT_STATES; j++){
+			self->P[i][j] = FP[i][0] * F[j][0] + FP[i][1] * F[j][1] + FP[i][2] * F[j][2];
+		}
+	}
+
+	// acceleration noise enters position and velocity through the same integration as the acceleration itself
+	const float q = _noise_var(self->config->alt_acc_noise);
+	const float g[2] = { dt2, dt };
+	for(int i = 0; i < 2; i++){
+		for(int j = 0; j < 2; j++){
+			self->P[i][j] += q * g[i] * g[j];
+		}
+	}
+	self->P[INS_ALT_BIAS][INS_ALT_BIAS] += INS_ALT_BIAS_NOISE * INS_ALT_BIAS_NOISE * dt;
+}
+
+//! kalman update with a direct measurement of altitude with variance r
+static void _ins_altitude_correct(struct ins_altitude *self, float z, float r){
+	const float s = self->P[INS_ALT_POS][INS_ALT_POS] + r;
+	const float y = z - self->x[INS_ALT_POS];
+	float K[INS_ALT_STATES];
+	float P0[INS_ALT_STATES];
+	for(int i = 0; i < INS_ALT_STATES; i++){
+		K[i] = self->P[i][INS_ALT_POS] / s;
+		P0[i] = self->P[INS_ALT_POS][i];
+	}
+	for(int i = 0; i < INS_ALT_STATES; i++){
+		self->x[i] += K[i] * y;
+		for(int j = 0; j < INS_ALT_STATES; j++){
+			self->P[i][j] -= K[i] * P0[j];
+		}
+	}
+}
+
+void ins_altitude_input_baro(struct ins_altitude *self, float alt){
+	if(!self->initialized){
+		ins_altitude_reset(self, alt);
+		return;
+	}
+	if(self->sonar_age < INS_ALT_SONAR_TIMEOUT){
+		// sonar is more accurate so only keep baro aligned with the estimate
+		self->baro_offset += (alt - self->x[INS_ALT_POS] - self->baro_offset) * INS_ALT_BARO_OFFSET_GAIN;
+		return;
+	}
+	_ins_altitude_correct(self, alt - self->baro_offset, _noise_var(self->config->alt_baro_noise));
+}
+
+void ins_altitude_input_sonar(struct ins_altitude *self, float alt){
+	if(!self->initialized){
+		ins_altitude_reset(self, alt);
+	} else if(self->sonar_age >= INS_ALT_SONAR_TIMEOUT){
+		// sonar measures height above ground so line it up with the estimate when it comes into range
+		self->sonar_offset = self->x[INS_ALT_POS] - alt;
+	}
+	self->sonar_age = 0;
+	_ins_altitude_correct(self, alt + self->sonar_offset, _noise_var(self->config->alt_sonar_noise));
+}
@@ -0,0 +1,62 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../config/barometer.h"
+
+//! states of the altitude filter
+enum {
+	INS_ALT_POS = 0,	//!< altitude in cm
+	INS_ALT_VEL,		//!< vertical speed in cm/s
+	INS_ALT_BIAS,		//!< accelerometer bias in cm/s/s
+	INS_ALT_STATES
+};
+
+/**
+ * Vertical kalman filter. Predicted with earth frame vertical acceleration at
+ * imu rate and corrected with baro and sonar altitude whenever a new sample
+ * arrives. Baro and sonar have different zero points so each is tracked with an
+ * offset and switching between them does not make the estimate jump.
+ */
+struct ins_altitude {
+	float x[INS_ALT_STATES];
+	float P[INS_ALT_STATES][INS_ALT_STATES];
+	float acc;				//!< last bias corrected acceleration in cm/s/s
+	float baro_offset;		//!< difference between baro altitude and the estimate while sonar is valid
+	float sonar_offset;		//!< difference between the estimate and sonar altitude when sonar came into range
+	float sonar_age;		//!< seconds since the last sonar sample
+	bool initialized;
+	const struct barometer_config *config;
+};
+
+void ins_altitude_init(struct ins_altitude *self, const struct barometer_config *config);
+void ins_altitude_reset(struct ins_altitude *self, float alt);
+
+//! propagates the estimate with vertical acceleration (cm/s/s, gravity removed, positive up) over dt seconds
+void ins_altitude_predict(struct ins_altitude *self, float acc, float dt);
+//! corrects the estimate with a barometric altitude in cm
+void ins_altitude_input_baro(struct ins_altitude *self, float alt);
+//! corrects the estimate with a tilt compensated sonar altitude in cm
+void ins_altitude_input_sonar(struct ins_altitude *self, float alt);
+
+static inline float ins_altitude_get_cm(const struct ins_altitude *self) { return self->x[INS_ALT_POS]; }
+static inline float ins_altitude_get_velocity_cms(const struct ins_altitude *self) { return self->x[INS_ALT_VEL]; }
+static inline float ins_altitude_get_accel_cmss(const struct ins_altitude *self) { return self->acc; }
@@ -101,17 +101,6 @@ void baro_init(struct baro *self, const struct config *config){
 bool isBaroReady(struct baro *self) {
 	return self->baroReady;
 }
-/*
-static PT_THREAD(_fsm_baro(struct baro *self)){
-	uint32_t pressure = 0;
-	PT_BEGIN(&self->state);
-	while(true){
-		PT_WAIT_UNTIL(sys_read_pressure(self->system, &pressure) == 0);
-	}
-	PT_END();
-}
-*/
-
 void baro_process_pressure(struct baro *self, uint32_t pressure){
 	self->baroPressureSum = recalculateBarometerTotal(self, config_get_profile(self->config)->baro.baro_sample_count, self->baroPressureSum, pressure);
 }
@@ -0,0 +1,97 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * KISS/BLHeli32 esc telemetry. Each frame is big endian:
+ * temperature (1), voltage (2), current (2), consumption (2), erpm / 100 (2), crc8 (1)
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include "common/crc.h"
+
+#include "esc_telemetry.h"
+
+void esc_telemetry_init(struct esc_telemetry *self, uint8_t motor_count){
+	memset(self, 0, sizeof(*self));
+	self->motor = -1;
+	self->motor_count = (motor_count < ESC_TELEMETRY_MAX_MOTORS)?motor_count:ESC_TELEMETRY_MAX_MOTORS;
+	self->max_age = (sys_micros_t)ESC_TELEMETRY_STALE_ROUNDS * self->motor_count * ESC_TELEMETRY_TIMEOUT_US;
+}
+
+int esc_telemetry_request(struct esc_telemetry *self, sys_micros_t now){
+	if(!self->motor_count)
+		return -1;
+
+	if(self->motor >= 0){
+		if((now - self->request_time) < ESC_TELEMETRY_TIMEOUT_US)
+			return -1;
+		// esc did not answer in time so its old values can no longer be trusted
+		self->data[self->motor].valid = false;
+		self->errors++;
+	}
+
+	self->len = 0;
+	self->request_time = now;
+	self->motor = self->next;
+	self->next = (self->next + 1) % self->motor_count;
+	return self->motor;
+}
+
+void esc_telemetry_input(struct esc_telemetry *self, uint8_t byte){
+	if(self->motor < 0)
+		return;
+
+	self->buf[self->len++] = byte;
+	if(self->len < ESC_TELEMETRY_FRAME_SIZE)
+		return;
+
+	if(esc_telemetry_decode(self->buf, &self->data[self->motor])){
+		self->data[self->motor].time = self->request_time;
+	} else {
+		self->data[self->motor].valid = false;
+		self->errors++;
+	}
+	self->len = 0;
+	self->motor = -1;
+}
+
+int esc_telemetry_get_erpm(const struct esc_telemetry *self, uint8_t id, sys_micros_t now, uint32_t *erpm){
+	if(id >= self->motor_count || !self->data[id].valid)
+		return -ENOENT;
+	// an old speed would put the gyro notches on the wrong frequency, no filtering is better
+	if((now - self->data[id].time) > self->max_age)
+		return -ENOENT;
+	*erpm = self->data[id].erpm;
+	return 0;
+}
+
+bool esc_telemetry_decode(const uint8_t frame[ESC_TELEMETRY_FRAME_SIZE], struct esc_telemetry_data *out){
+	if(crc8_smbus_buf(0, frame, ESC_TELEMETRY_FRAME_SIZE - 1) != frame[ESC_TELEMETRY_FRAME_SIZE - 1])
+		return false;
+
+	out->temperature = (int8_t)frame[0];
+	out->voltage = (frame[1] << 8) | frame[2];
+	out->current = (frame[3] << 8) | frame[4];
+	out->consumption = (frame[5] << 8) | frame[6];
+	out->erpm = (uint32_t)((frame[7] << 8) | frame[8]) * 100;
+	out->valid = true;
+	return true;
+}
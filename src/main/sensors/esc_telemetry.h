@@ -0,0 +1,84 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "system_calls.h"
+
+//! size of one KISS/BLHeli32 telemetry frame including the crc
+#define ESC_TELEMETRY_FRAME_SIZE 10
+//! maximum number of escs that are polled
+#define ESC_TELEMETRY_MAX_MOTORS 8
+//! time an esc gets to answer a request before we move on to the next one
+#define ESC_TELEMETRY_TIMEOUT_US 2000
+//! values are no longer used once this many polling rounds have passed without a new answer
+#define ESC_TELEMETRY_STALE_ROUNDS 2
+
+//! values reported by one esc
+struct esc_telemetry_data {
+	int8_t temperature;		//!< degrees C
+	uint16_t voltage;		//!< 0.01V
+	uint16_t current;		//!< 0.01A
+	uint16_t consumption;	//!< mAh
+	uint32_t erpm;			//!< electrical rpm (motor rpm times number of pole pairs)
+	sys_micros_t time;		//!< time of the request that this answer belongs to
+	bool valid;				//!< false until a frame has been received or if the esc stopped answering
+};
+
+/**
+ * Polls escs one at a time over the shared telemetry wire. The esc whose
+ * dshot frame has the telemetry bit set answers with one frame on the serial
+ * line. Only one request is outstanding at a time so that answers can be
+ * attributed to the right motor. Each motor is therefore only updated once
+ * per round, at 1/motor_count of the polling rate.
+ *
+ * Not thread safe. Bytes must be fed from the same thread that makes the
+ * requests, not from the uart interrupt, so that a request can never reset
+ * a frame that is half way through being decoded.
+ */
+struct esc_telemetry {
+	uint8_t buf[ESC_TELEMETRY_FRAME_SIZE];
+	uint8_t len;
+	int8_t motor;		//!< motor that is currently answering or -1 if idle
+	uint8_t next;		//!< next motor to poll
+	uint8_t motor_count;
+	sys_micros_t request_time;
+	sys_micros_t max_age;	//!< answers older than this are not reported
+	uint16_t errors;	//!< frames that failed crc or did not arrive in time
+	struct esc_telemetry_data data[ESC_TELEMETRY_MAX_MOTORS];
+};
+
+void esc_telemetry_init(struct esc_telemetry *self, uint8_t motor_count);
+
+/**
+ * Picks the next esc to poll.
+ *
+ * @return motor index whose next dshot frame must carry the telemetry bit or -1 if a request is still pending
+ */
+int esc_telemetry_request(struct esc_telemetry *self, sys_micros_t now);
+
+//! feeds one byte received on the telemetry line
+void esc_telemetry_input(struct esc_telemetry *self, uint8_t byte);
+
+//! returns 0 and the last reported erpm of the motor or -ENOENT if no valid data is available or it is too old
+int esc_telemetry_get_erpm(const struct esc_telemetry *self, uint8_t id, sys_micros_t now, uint32_t *erpm);
+
+//! decodes a complete frame. Returns false if the crc does not match.
+bool esc_telemetry_decode(const uint8_t frame[ESC_TELEMETRY_FRAME_SIZE], struct esc_telemetry_data *out);
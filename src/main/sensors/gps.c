@@ -41,17 +41,14 @@
 #include "io/serial.h"
 
 #include "gps.h"
+#include "ubx.h"
 
 #define LOG_ERROR		'?'
 #define LOG_IGNORED	  '!'
 #define LOG_SKIPPED	  '>'
+// ublox packets are tagged by the ubx parser: P/S/O/V/I for the legacy messages and T for NAV-PVT
 #define LOG_NMEA_GGA	 'g'
 #define LOG_NMEA_RMC	 'r'
-#define LOG_UBLOX_SOL	'O'
-#define LOG_UBLOX_STATUS 'S'
-#define LOG_UBLOX_SVINFO 'I'
-#define LOG_UBLOX_POSLLH 'P'
-#define LOG_UBLOX_VELNED 'V'
 
 #define GPS_SV_MAXSATS   16
 
@@ -100,6 +97,9 @@ static const uint8_t ubloxInit[] = {
 	0xB5, 0x62, 0x06, 0x01, 0x03, 0x00, 0xF0, 0x04, 0x00, 0xFE, 0x17,		   // RMC: Recommended Minimum data
 
 	// Enable UBLOX messages
+	// NAV-PVT carries position, velocity and fix in one message on u-blox 7 and later. The legacy messages below
+	// are still enabled for u-blox 6 receivers and get switched off again once the first NAV-PVT arrives.
+	0xB5, 0x62, 0x06, 0x01, 0x03, 0x00, 0x01, 0x07, 0x01, 0x13, 0x51,		   // set PVT MSG rate
 	0xB5, 0x62, 0x06, 0x01, 0x03, 0x00, 0x01, 0x02, 0x01, 0x0E, 0x47,		   // set POSLLH MSG rate
 	0xB5, 0x62, 0x06, 0x01, 0x03, 0x00, 0x01, 0x03, 0x01, 0x0F, 0x49,		   // set STATUS MSG rate
 	0xB5, 0x62, 0x06, 0x01, 0x03, 0x00, 0x01, 0x06, 0x01, 0x12, 0x4F,		   // set SOL MSG rate
@@ -107,7 +107,7 @@ static const uint8_t ubloxInit[] = {
 	0xB5, 0x62, 0x06, 0x01, 0x03, 0x00, 0x01, 0x30, 0x05, 0x40, 0xA7,		   // set SVINFO MSG rate (evey 5 cycles - low bandwidth)
 	0xB5, 0x62, 0x06, 0x01, 0x03, 0x00, 0x01, 0x12, 0x01, 0x1E, 0x67,		   // set VELNED MSG rate
 
-	0xB5, 0x62, 0x06, 0x08, 0x06, 0x00, 0xC8, 0x00, 0x01, 0x00, 0x01, 0x00, 0xDE, 0x6A,			 // set rate to 5Hz (measurement period: 200ms, navigation rate: 1 cycle)
+	0xB5, 0x62, 0x06, 0x08, 0x06, 0x00, 0x64, 0x00, 0x01, 0x00, 0x01, 0x00, 0x7A, 0x12,			 // set rate to 10Hz (measurement period: 100ms, navigation rate: 1 cycle)
 };
 
 // UBlox 6 Protocol documentation - GPS.G6-SW-10018-F
@@ -155,9 +155,9 @@ static void shiftPacketLog(struct gps *self)
 	}
 }
 
-static void gpsNewData(struct gps *self, uint16_t c);
+static void gpsNewData(struct gps *self, uint16_t c, sys_micros_t now);
 static bool gpsNewFrameNMEA(struct gps *self, char c);
-static bool gpsNewFrameUBLOX(struct gps *self, uint8_t data);
+static bool gpsNewFrameUBLOX(struct gps *self, uint8_t data, sys_micros_t now);
 
 static void gpsSetState(struct gps *self, gpsState_e state){
 	self->gpsData.state = state;
@@ -175,6 +175,7 @@ int gps_init(struct gps *self, const struct system_calls *system, const struct c
 	self->gpsData.baudrateIndex = 0;
 	self->gpsData.errors = 0;
 	self->gpsData.timeouts = 0;
+	ubx_parser_init(&self->ubx);
 
 	// init gpsData structure. if we're not actually enabled, don't bother doing anything else
 	gpsSetState(self, GPS_UNKNOWN);
@@ -274,6 +275,7 @@ static void gpsInitUblox(struct gps *self)
 			}
 
 			if (self->gpsData.messageState == GPS_MESSAGE_STATE_IDLE) {
+				self->gpsData.rateFallback = false;
 				self->gpsData.messageState++;
 			}
 
@@ -324,10 +326,18 @@ static void gpsInitHardware(struct gps *self)
 
 void gps_update(struct gps *self)
 {
-	// read out available GPS bytes
+	// Read out available GPS bytes. The uart doesn't timestamp what it receives, so the time of each byte is worked
+	// out backwards from now assuming that the waiting bytes arrived back to back. If the receiver paused after the
+	// last of them the error is at most the time since the previous poll, which the GPS task period bounds.
 	if (self->gpsPort) {
-		while (serialRxBytesWaiting(self->gpsPort))
-			gpsNewData(self, serialRead(self->gpsPort));
+		uint32_t baudRate = serialGetBaudRate(self->gpsPort);
+		uint32_t byteTime = baudRate ? 10000000 / baudRate : 0;	// 10 bits per byte, in us
+		uint8_t waiting;
+		while ((waiting = serialRxBytesWaiting(self->gpsPort)) > 0) {
+			sys_micros_t now = sys_micros(self->system);
+			while (waiting--)
+				gpsNewData(self, serialRead(self->gpsPort), now - (sys_micros_t)(waiting * byteTime));
+		}
 	}
 
 	switch (self->gpsData.state) {
@@ -364,12 +374,12 @@ void gps_update(struct gps *self)
 	}
 }
 
-static bool gpsNewFrame(struct gps *self, uint8_t c){
+static bool gpsNewFrame(struct gps *self, uint8_t c, sys_micros_t now){
 	switch (self->config->gps.provider) {
 		case GPS_NMEA:		  // NMEA
 			return gpsNewFrameNMEA(self, c);
 		case GPS_UBLOX:		 // UBX binary
-			return gpsNewFrameUBLOX(self, c);
+			return gpsNewFrameUBLOX(self, c, now);
 		default:
 		case GPS_PROVIDER_MAX:
 			break;
@@ -377,9 +387,9 @@ static bool gpsNewFrame(struct gps *self, uint8_t c){
 
 	return false;
 }
-static void gpsNewData(struct gps *self, uint16_t c)
+static void gpsNewData(struct gps *self, uint16_t c, sys_micros_t now)
 {
-	if (!gpsNewFrame(self, c)) {
+	if (!gpsNewFrame(self, c, now)) {
 		return;
 	}
 
@@ -674,348 +684,93 @@ static bool gpsNewFrameNMEA(struct gps *self, char c)
 }
 
 // UBX support
-typedef struct {
-	uint8_t preamble1;
-	uint8_t preamble2;
-	uint8_t msg_class;
-	uint8_t msg_id;
-	uint16_t length;
-} ubx_header;
-
-typedef struct {
-	uint32_t time;			  // GPS msToW
-	int32_t longitude;
-	int32_t latitude;
-	int32_t altitude_ellipsoid;
-	int32_t altitude_msl;
-	uint32_t horizontal_accuracy;
-	uint32_t vertical_accuracy;
-} ubx_nav_posllh;
-
-typedef struct {
-	uint32_t time;			  // GPS msToW
-	uint8_t fix_type;
-	uint8_t fix_status;
-	uint8_t differential_status;
-	uint8_t res;
-	uint32_t time_to_first_fix;
-	uint32_t uptime;			// milliseconds
-} ubx_nav_status;
-
-typedef struct {
-	uint32_t time;
-	int32_t time_nsec;
-	int16_t week;
-	uint8_t fix_type;
-	uint8_t fix_status;
-	int32_t ecef_x;
-	int32_t ecef_y;
-	int32_t ecef_z;
-	uint32_t position_accuracy_3d;
-	int32_t ecef_x_velocity;
-	int32_t ecef_y_velocity;
-	int32_t ecef_z_velocity;
-	uint32_t speed_accuracy;
-	uint16_t position_DOP;
-	uint8_t res;
-	uint8_t satellites;
-	uint32_t res2;
-} ubx_nav_solution;
-
-typedef struct {
-	uint32_t time;			  // GPS msToW
-	int32_t ned_north;
-	int32_t ned_east;
-	int32_t ned_down;
-	uint32_t speed_3d;
-	uint32_t speed_2d;
-	int32_t heading_2d;
-	uint32_t speed_accuracy;
-	uint32_t heading_accuracy;
-} ubx_nav_velned;
-
-typedef struct {
-	uint8_t chn;				// Channel number, 255 for SVx not assigned to channel
-	uint8_t svid;			   // Satellite ID
-	uint8_t flags;			  // Bitmask
-	uint8_t quality;			// Bitfield
-	uint8_t cno;				// Carrier to Noise Ratio (Signal Strength) // dbHz, 0-55.
-	uint8_t elev;			   // Elevation in integer degrees
-	int16_t azim;			   // Azimuth in integer degrees
-	int32_t prRes;			  // Pseudo range residual in centimetres
-} ubx_nav_svinfo_channel;
-
-typedef struct {
-	uint32_t time;			  // GPS Millisecond time of week
-	uint8_t numCh;			  // Number of channels
-	uint8_t globalFlags;		// Bitmask, Chip hardware generation 0:Antaris, 1:u-blox 5, 2:u-blox 6
-	uint16_t reserved2;		 // Reserved
-	ubx_nav_svinfo_channel channel[16];		 // 16 satellites * 12 byte
-} ubx_nav_svinfo;
-
-enum {
-	PREAMBLE1 = 0xb5,
-	PREAMBLE2 = 0x62,
-	CLASS_NAV = 0x01,
-	CLASS_ACK = 0x05,
-	CLASS_CFG = 0x06,
-	MSG_ACK_NACK = 0x00,
-	MSG_ACK_ACK = 0x01,
-	MSG_POSLLH = 0x2,
-	MSG_STATUS = 0x3,
-	MSG_SOL = 0x6,
-	MSG_VELNED = 0x12,
-	MSG_SVINFO = 0x30,
-	MSG_CFG_PRT = 0x00,
-	MSG_CFG_RATE = 0x08,
-	MSG_CFG_SET_RATE = 0x01,
-	MSG_CFG_NAV_SETTINGS = 0x24
-} ubx_protocol_bytes;
-
-enum {
-	FIX_NONE = 0,
-	FIX_DEAD_RECKONING = 1,
-	FIX_2D = 2,
-	FIX_3D = 3,
-	FIX_GPS_DEAD_RECKONING = 4,
-	FIX_TIME = 5
-} ubs_nav_fix_type;
-
-enum {
-	NAV_STATUS_FIX_VALID = 1
-} ubx_nav_status_bits;
-
-// Packet checksum accumulators
-static uint8_t _ck_a;
-static uint8_t _ck_b;
-
-// State machine state
-static bool _skip_packet;
-static uint8_t _step;
-static uint8_t _msg_id;
-static uint16_t _payload_length;
-static uint16_t _payload_counter;
-
-static bool next_fix;
-static uint8_t _class;
-
-// do we have new position information?
-static bool _new_position;
-
-// do we have new speed information?
-static bool _new_speed;
-
-// Example packet sizes from UBlox u-center from a Glonass capable GPS receiver.
-//15:17:55  R -> UBX NAV-STATUS,  Size  24,  'Navigation Status'
-//15:17:55  R -> UBX NAV-POSLLH,  Size  36,  'Geodetic Position'
-//15:17:55  R -> UBX NAV-VELNED,  Size  44,  'Velocity in WGS 84'
-//15:17:55  R -> UBX NAV-CLOCK,  Size  28,  'Clock Status'
-//15:17:55  R -> UBX NAV-AOPSTATUS,  Size  24,  'AOP Status'
-//15:17:55  R -> UBX 03-09,  Size 208,  'Unknown'
-//15:17:55  R -> UBX 03-10,  Size 336,  'Unknown'
-//15:17:55  R -> UBX NAV-SOL,  Size  60,  'Navigation Solution'
-//15:17:55  R -> UBX NAV,  Size 100,  'Navigation'
-//15:17:55  R -> UBX NAV-SVINFO,  Size 328,  'Satellite Status and Information'
-
-// from the UBlox6 document, the largest payout we receive i the NAV-SVINFO and the payload size
-// is calculated as 8 + 12*numCh.  numCh in the case of a Glonass receiver is 28.
-#define MAX_UBLOX_PAYLOAD_SIZE 344
-#define UBLOX_BUFFER_SIZE MAX_UBLOX_PAYLOAD_SIZE
-
-
-// Receive buffer
-static union {
-	ubx_nav_posllh posllh;
-	ubx_nav_status status;
-	ubx_nav_solution solution;
-	ubx_nav_velned velned;
-	ubx_nav_svinfo svinfo;
-	uint8_t bytes[UBLOX_BUFFER_SIZE];
-} _buffer;
+// once the receiver talks NAV-PVT the legacy messages only waste bandwidth and cpu time so they are turned off again
+static const uint8_t ubloxDisableLegacy[] = {
+	0xB5, 0x62, 0x06, 0x01, 0x03, 0x00, 0x01, 0x02, 0x00, 0x0D, 0x46,		   // disable POSLLH
+	0xB5, 0x62, 0x06, 0x01, 0x03, 0x00, 0x01, 0x03, 0x00, 0x0E, 0x48,		   // disable STATUS
+	0xB5, 0x62, 0x06, 0x01, 0x03, 0x00, 0x01, 0x06, 0x00, 0x11, 0x4E,		   // disable SOL
+	0xB5, 0x62, 0x06, 0x01, 0x03, 0x00, 0x01, 0x12, 0x00, 0x1D, 0x66,		   // disable VELNED
+};
 
-/*
-static void _update_checksum(uint8_t *data, uint8_t len, uint8_t *ck_a, uint8_t *ck_b)
+// navigation rate of 5Hz for receivers that NAK the 10Hz set by ubloxInit
+static const uint8_t ubloxRate5Hz[] = {
+	0xB5, 0x62, 0x06, 0x08, 0x06, 0x00, 0xC8, 0x00, 0x01, 0x00, 0x01, 0x00, 0xDE, 0x6A,			 // set rate to 5Hz (measurement period: 200ms, navigation rate: 1 cycle)
+};
+
+static void gpsApplyUbloxSolution(struct gps *self)
 {
-	while (len--) {
-		*ck_a += *data;
-		*ck_b += *ck_a;
-		data++;
-	}
+	const struct ubx_solution *sol = &self->ubx.sol;
+
+	self->GPS_coord[LON] = sol->lon;
+	self->GPS_coord[LAT] = sol->lat;
+	self->GPS_altitude = sol->alt_msl / 10 / 100;  //alt in m
+	self->GPS_speed = sol->ground_speed;	// cm/s
+	self->GPS_ground_course = (uint16_t) (sol->heading / 10000);	 // Heading 2D deg * 100000 rescaled to deg * 10
+	for(int i = 0; i < 3; i++)
+		self->GPS_velned[i] = sol->vel_ned[i];
+	self->GPS_numSat = sol->num_sat;
+	self->GPS_hdop = sol->pdop;
+	self->GPS_fix = sol->fix_ok;
+	self->GPS_fix_time = sol->timestamp;
 }
-*/
 
-static bool UBLOX_parse_gps(struct gps *self)
+static void gpsApplyUbloxSvinfo(struct gps *self)
 {
-	uint32_t i;
-
-	*self->gpsPacketLogChar = LOG_IGNORED;
-
-	switch (_msg_id) {
-	case MSG_POSLLH:
-		*self->gpsPacketLogChar = LOG_UBLOX_POSLLH;
-		//i2c_dataset.time				= _buffer.posllh.time;
-		self->GPS_coord[LON] = _buffer.posllh.longitude;
-		self->GPS_coord[LAT] = _buffer.posllh.latitude;
-		self->GPS_altitude = _buffer.posllh.altitude_msl / 10 / 100;  //alt in m
-		if (next_fix) {
-			// TODO: gps fix 
-		} else {
-
-		}
-		_new_position = true;
-		break;
-	case MSG_STATUS:
-		*self->gpsPacketLogChar = LOG_UBLOX_STATUS;
-		next_fix = (_buffer.status.fix_status & NAV_STATUS_FIX_VALID) && (_buffer.status.fix_type == FIX_3D);
-		// TODO: gps fix
-		//if (!next_fix)
-		//	DISABLE_STATE(GPS_FIX);
-		break;
-	case MSG_SOL:
-		*self->gpsPacketLogChar = LOG_UBLOX_SOL;
-		next_fix = (_buffer.solution.fix_status & NAV_STATUS_FIX_VALID) && (_buffer.solution.fix_type == FIX_3D);
-		// TODO: gps fix
-		//if (!next_fix)
-	//		DISABLE_STATE(GPS_FIX);
-		self->GPS_numSat = _buffer.solution.satellites;
-		self->GPS_hdop = _buffer.solution.position_DOP;
-		break;
-	case MSG_VELNED:
-		*self->gpsPacketLogChar = LOG_UBLOX_VELNED;
-		// speed_3d						= _buffer.velned.speed_3d;  // cm/s
-		self->GPS_speed = _buffer.velned.speed_2d;	// cm/s
-		self->GPS_ground_course = (uint16_t) (_buffer.velned.heading_2d / 10000);	 // Heading 2D deg * 100000 rescaled to deg * 10
-		_new_speed = true;
-		break;
-	case MSG_SVINFO:
-		*self->gpsPacketLogChar = LOG_UBLOX_SVINFO;
-		self->GPS_numCh = _buffer.svinfo.numCh;
-		if (self->GPS_numCh > 16)
-			self->GPS_numCh = 16;
-		for (i = 0; i < self->GPS_numCh; i++){
-			self->GPS_svinfo_chn[i]= _buffer.svinfo.channel[i].chn;
-			self->GPS_svinfo_svid[i]= _buffer.svinfo.channel[i].svid;
-			self->GPS_svinfo_quality[i]=_buffer.svinfo.channel[i].quality;
-			self->GPS_svinfo_cno[i]= _buffer.svinfo.channel[i].cno;
-		}
-		self->GPS_svInfoReceivedCount++;
-		break;
-	default:
-		return false;
-	}
-
-	// we only return true when we get new position and speed data
-	// this ensures we don't use stale data
-	if (_new_position && _new_speed) {
-		_new_speed = _new_position = false;
-		return true;
+	const struct ubx_svinfo *sv = &self->ubx.svinfo;
+
+	self->GPS_numCh = sv->num_ch;
+	for (uint32_t i = 0; i < self->GPS_numCh; i++){
+		self->GPS_svinfo_chn[i] = sv->chn[i];
+		self->GPS_svinfo_svid[i] = sv->svid[i];
+		self->GPS_svinfo_quality[i] = sv->quality[i];
+		self->GPS_svinfo_cno[i] = sv->cno[i];
 	}
-	return false;
+	self->GPS_svInfoReceivedCount++;
 }
 
-static bool gpsNewFrameUBLOX(struct gps *self, uint8_t data)
+static bool gpsNewFrameUBLOX(struct gps *self, uint8_t data, sys_micros_t now)
 {
-	bool parsed = false;
-
-	switch (_step) {
-		case 0: // Sync char 1 (0xB5)
-			if (PREAMBLE1 == data) {
-				_skip_packet = false;
-				_step++;
-			} else {
-				self->GPS_garbageByteCount++;
-			}
-			break;
-		case 1: // Sync char 2 (0x62)
-			if (PREAMBLE2 != data) {
-				_step = 0;
-				break;
-			}
-			_step++;
-			break;
-		case 2: // Class
-			_step++;
-			_class = data;
-			_ck_b = _ck_a = data;   // reset the checksum accumulators
-			break;
-		case 3: // Id
-			_step++;
-			_ck_b += (_ck_a += data);	   // checksum byte
-			_msg_id = data;
-			break;
-		case 4: // Payload length (part 1)
-			_step++;
-			_ck_b += (_ck_a += data);	   // checksum byte
-			_payload_length = data; // payload length low byte
-			break;
-		case 5: // Payload length (part 2)
-			_step++;
-			_ck_b += (_ck_a += data);	   // checksum byte
-			_payload_length |= (uint16_t)(data << 8);
+	bool had_pvt = self->ubx.have_pvt;
+	uint32_t frames = self->ubx.frames;
+	int ret = ubx_parser_input(&self->ubx, data, now);
 
-			if (_payload_length > MAX_UBLOX_PAYLOAD_SIZE ) {
-				// we can't receive the whole packet, just log the error and start searching for the next packet.
-				shiftPacketLog(self);
-				*self->gpsPacketLogChar = LOG_SKIPPED;
-				self->gpsData.errors++;
-				_step = 0;
-				break;
-			}
+	self->GPS_garbageByteCount = self->ubx.garbage;
+	self->gpsData.errors = self->ubx.errors;
+	self->GPS_packetCount = self->ubx.frames;
 
-			if (_payload_length > UBLOX_BUFFER_SIZE) {
-				_skip_packet = true;
-			}
+	if (ret == 0 && frames == self->ubx.frames)
+		return false;
 
-			// prepare to receive payload
-			_payload_counter = 0;
+	// a frame was either completed or rejected
+	shiftPacketLog(self);
+	*self->gpsPacketLogChar = self->ubx.tag;
 
-			if (_payload_length == 0) {
-				_step = 7;
-			}
-			break;
-		case 6:
-			_ck_b += (_ck_a += data);	   // checksum byte
-			if (_payload_counter < UBLOX_BUFFER_SIZE) {
-				_buffer.bytes[_payload_counter] = data;
-			}
-			// NOTE: check counter BEFORE increasing so that a payload_size of 65535 is correctly handled.  This can happen if garbage data is received.
-			if (_payload_counter ==  _payload_length - 1) {
-				_step++;
-			}
-			_payload_counter++;
-			break;
-		case 7:
-			_step++;
-			if (_ck_a != data) {
-				_skip_packet = true;		  // bad checksum
-				self->gpsData.errors++;
-			}
-			break;
-		case 8:
-			_step = 0;
+	if (ret < 0)
+		return false;
 
-			shiftPacketLog(self);
+	if (self->ubx.updated & UBX_UPDATE_SVINFO)
+		gpsApplyUbloxSvinfo(self);
 
-			if (_ck_b != data) {
-				*self->gpsPacketLogChar = LOG_ERROR;
-				self->gpsData.errors++;
-				break;			  // bad checksum
-			}
+	if (!had_pvt && self->ubx.have_pvt && self->config->gps.autoConfig == GPS_AUTOCONFIG_ON) {
+		for (uint32_t i = 0; i < sizeof(ubloxDisableLegacy); i++)
+			serialWrite(self->gpsPort, ubloxDisableLegacy[i]);
+	}
 
-			self->GPS_packetCount++;
+	// older receivers can't do 10Hz, ask once for 5Hz instead
+	if ((self->ubx.updated & UBX_UPDATE_ACK) && !self->ubx.ack.ok && self->ubx.ack.msg_class == UBX_CLASS_CFG
+			&& self->ubx.ack.msg_id == UBX_CFG_RATE && !self->gpsData.rateFallback) {
+		self->gpsData.rateFallback = true;
+		for (uint32_t i = 0; i < sizeof(ubloxRate5Hz); i++)
+			serialWrite(self->gpsPort, ubloxRate5Hz[i]);
+	}
 
-			if (_skip_packet) {
-				*self->gpsPacketLogChar = LOG_SKIPPED;
-				break;
-			}
+	// we only return true when we get new position and speed data
+	// this ensures we don't use stale data
+	if (ret != UBX_SOLUTION)
+		return false;
 
-			if (UBLOX_parse_gps(self)) {
-				parsed = true;
-			}
-		default:
-			break;
-	}
-	return parsed;
+	gpsApplyUbloxSolution(self);
+	return true;
 }
 
 void gps_enable_passthrough(struct gps *self, serialPort_t *gpsPassthroughPort)
@@ -1040,7 +795,7 @@ void gps_enable_passthrough(struct gps *self, serialPort_t *gpsPassthroughPort)
 		if (serialRxBytesWaiting(self->gpsPort)) {
 			sys_led_on(self->system, 0);
 			c = serialRead(self->gpsPort);
-			gpsNewData(self, c);
+			gpsNewData(self, c, sys_micros(self->system));
 			serialWrite(gpsPassthroughPort, c);
 			sys_led_on(self->system, 0);
 		}
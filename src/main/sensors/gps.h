@@ -21,6 +21,8 @@
 #include "../system_calls.h"
 #include "../drivers/serial.h"
 
+#include "ubx.h"
+
 #define LAT 0
 #define LON 1
 
@@ -62,6 +64,7 @@ typedef struct gpsData_s {
     uint32_t state_position;        // incremental variable for loops
     sys_millis_t state_ts;              // timestamp for last state_position increment
     gpsMessageState_e messageState;
+    bool rateFallback;              // the receiver refused the 10Hz navigation rate and was set to 5Hz
 } gpsData_t;
 
 #define GPS_PACKET_LOG_ENTRY_COUNT 21 // To make this useful we should log as many packets as we can fit characters a single line of a OLED display.
@@ -78,9 +81,12 @@ struct gps {
 	uint8_t GPS_update;                 // it's a binary toogle to distinct a GPS position update
 	uint32_t GPS_packetCount;
 	uint32_t GPS_svInfoReceivedCount;
-	uint16_t GPS_altitude;              // altitude in 0.1m
-	uint16_t GPS_speed;                 // speed in 0.1m/s
+	uint16_t GPS_altitude;              // altitude in m
+	uint16_t GPS_speed;                 // speed in cm/s
 	uint16_t GPS_ground_course;         // degrees * 10
+	int32_t GPS_velned[3];              // velocity north, east, down in cm/s
+	bool GPS_fix;                       // last solution had a valid 3d fix
+	sys_micros_t GPS_fix_time;          // local time at which the frames of the last solution started to arrive, within one GPS task period
 	uint8_t GPS_numCh;                  // Number of channels
 	uint8_t GPS_svinfo_chn[16];         // Channel number
 	uint8_t GPS_svinfo_svid[16];        // Satellite ID
@@ -89,6 +95,8 @@ struct gps {
 
 	uint32_t GPS_garbageByteCount;
 
+	struct ubx_parser ubx;
+
 	serialPort_t *gpsPort;
 	const struct system_calls *system;
 	const struct config *config;
@@ -44,6 +44,45 @@ void ins_gyro_init(struct ins_gyro *self, const struct gyro_config *config){
 	if (config->soft_gyro_lpf_hz) {
 		ins_gyro_set_filter_hz(self, config->soft_gyro_lpf_hz);
 	}
+
+	self->rpm_notch_harmonics = MIN(config->rpm_notch_harmonics, GYRO_RPM_NOTCH_HARMONICS);
+	self->rpm_notch_q = MAX(config->rpm_notch_q, 100) * 0.01f;
+	self->rpm_notch_min_hz = config->rpm_notch_min_hz;
+	ins_gyro_set_sample_rate(self, 1000);
+}
+
+/**
+ * Moves the center of one rpm notch filter per sample so that the cost of
+ * recalculating coefficients is spread over several samples. With four
+ * motors and three harmonics every filter is updated every 12 samples.
+ */
+static void _update_rpm_notch(struct ins_gyro *self){
+	uint8_t m = self->rpm_notch_next / self->rpm_notch_harmonics;
+	uint8_t h = self->rpm_notch_next % self->rpm_notch_harmonics;
+	if(++self->rpm_notch_next >= GYRO_RPM_NOTCH_MOTORS * self->rpm_notch_harmonics)
+		self->rpm_notch_next = 0;
+
+	float hz = self->motor_hz[m] * (h + 1);
+	bool active = self->motor_hz[m] >= self->rpm_notch_min_hz && hz <= self->rpm_notch_max_hz;
+	biquad_t *f = self->rpm_notch[m][h];
+
+	if(active && !self->rpm_notch_active[m][h]){
+		// history from when the filter was last used would cause a transient
+		for (int axis = 0; axis < 3; axis++) {
+			BiQuadNewNotch(hz, self->rpm_notch_q, &f[axis], self->sample_period_us);
+		}
+	} else if(active){
+		// coefficients are the same for all axes so only calculate them once
+		BiQuadSetNotch(hz, self->rpm_notch_q, &f[0], self->sample_period_us);
+		for (int axis = 1; axis < 3; axis++) {
+			f[axis].b0 = f[0].b0;
+			f[axis].b1 = f[0].b1;
+			f[axis].b2 = f[0].b2;
+			f[axis].a1 = f[0].a1;
+			f[axis].a2 = f[0].a2;
+		}
+	}
+	self->rpm_notch_active[m][h] = active;
 }
 
 static void _add_calibration_samples(struct ins_gyro *self, int32_t raw[3]){
@@ -75,6 +114,24 @@ static void _add_calibration_samples(struct ins_gyro *self, int32_t raw[3]){
 void ins_gyro_process_sample(struct ins_gyro *self, int32_t x, int32_t y, int32_t z){
 	int32_t raw[3] = { x, y, z };
 
+	if (self->rpm_notch_harmonics) {
+		_update_rpm_notch(self);
+
+		float sample[3] = { x, y, z };
+		for (int m = 0; m < GYRO_RPM_NOTCH_MOTORS; m++) {
+			for (int h = 0; h < self->rpm_notch_harmonics; h++) {
+				if (!self->rpm_notch_active[m][h])
+					continue;
+				for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
+					sample[axis] = applyBiQuadFilter(sample[axis], &self->rpm_notch[m][h][axis]);
+				}
+			}
+		}
+		for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
+			raw[axis] = lrintf(sample[axis]);
+		}
+	}
+
 	if (self->use_filter) {
 		for (int axis = 0; axis < XYZ_AXIS_COUNT; axis++) {
 			raw[axis] = lrintf(applyBiQuadFilter((float)raw[axis], &self->gyroFilterState[axis]));
@@ -102,6 +159,21 @@ void ins_gyro_set_filter_hz(struct ins_gyro *self, uint16_t hz){
 	self->use_filter = true;
 }
 
+void ins_gyro_set_sample_rate(struct ins_gyro *self, uint16_t hz){
+	if(!hz)
+		return;
+	self->sample_period_us = 1000000 / hz;
+	// notches close to nyquist can not be placed accurately and only add delay
+	self->rpm_notch_max_hz = 0.45f * hz;
+	memset(self->rpm_notch_active, 0, sizeof(self->rpm_notch_active));
+}
+
+void ins_gyro_set_motor_rpm(struct ins_gyro *self, uint8_t motor, uint16_t rpm){
+	if(motor >= GYRO_RPM_NOTCH_MOTORS)
+		return;
+	self->motor_hz[motor] = rpm / 60.0f;
+}
+
 void ins_gyro_calibrate(struct ins_gyro *self){
 	for(int c = 0; c < 3; c++) {
 		self->gyroADC[c] = 0;
@@ -23,6 +23,11 @@
 #include "../config/gyro.h"
 #include "../config/sensors.h"
 
+//! motors whose speed can be tracked by the rpm notch filters
+#define GYRO_RPM_NOTCH_MOTORS 4
+//! highest harmonic of motor speed that can be filtered
+#define GYRO_RPM_NOTCH_HARMONICS 3
+
 struct ins_gyro {
 	sensor_align_e align;
 
@@ -34,6 +39,18 @@ struct ins_gyro {
 	biquad_t gyroFilterState[3];
 	bool use_filter;
 
+	//! notch filters that follow motor speed and its harmonics, one per axis
+	biquad_t rpm_notch[GYRO_RPM_NOTCH_MOTORS][GYRO_RPM_NOTCH_HARMONICS][3];
+	bool rpm_notch_active[GYRO_RPM_NOTCH_MOTORS][GYRO_RPM_NOTCH_HARMONICS];
+	float motor_hz[GYRO_RPM_NOTCH_MOTORS];
+	uint8_t rpm_notch_harmonics;
+	//! filter whose center is moved on the next sample
+	uint8_t rpm_notch_next;
+	float rpm_notch_q;
+	float rpm_notch_min_hz;
+	float rpm_notch_max_hz;
+	uint32_t sample_period_us;
+
 	int32_t g[3];
 	stdev_t var[3];
 
@@ -50,3 +67,8 @@ static inline int32_t ins_gyro_get_y(struct ins_gyro *self) { return self->gyroA
 static inline int32_t ins_gyro_get_z(struct ins_gyro *self) { return self->gyroADC[Z]; }
 
 void ins_gyro_set_filter_hz(struct ins_gyro *self, uint16_t hz);
+
+//! sets the rate at which samples are processed. Needed to place the rpm notch filters correctly.
+void ins_gyro_set_sample_rate(struct ins_gyro *self, uint16_t hz);
+//! sets the current speed of a motor. The rpm notch filters of that motor follow it over the next few samples.
+void ins_gyro_set_motor_rpm(struct ins_gyro *self, uint8_t motor, uint16_t rpm);
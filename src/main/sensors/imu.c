@@ -156,8 +156,8 @@ static void _imu_update_acceleration(struct imu *self, float dT){
 			accel_ned.V.Z -= self->acc_1G;
 	} else {
 	#endif
-		//accel_ned.V.Z -= self->acc_1G;
-	//}
+	// remove gravity so that the sum only contains vertical acceleration
+	accel_ned.V.Z -= SYSTEM_ACCEL_1G;
 
 	const struct accelerometer_config *ac = &config_get_profile(self->config)->acc;
 	float fc_acc = 0.5f / (M_PIf * ac->accz_lpf_cutoff);
@@ -442,18 +442,29 @@ float imu_get_velocity_integration_time(struct imu *self){
 	return self->accTimeSum; // delta acc reading time in seconds
 }
 
-// TODO: remove this function completely once althold has been refactored
+//! returns earth frame vertical acceleration in cm/s/s averaged since the last imu_reset_velocity_estimate()
 float imu_get_avg_vertical_accel_cmss(struct imu *self){
 	float acc_z = 0;
-	// Integrator - velocity, cm/sec
 	if (self->accSumCount) {
-		acc_z = (float)self->accSum[2] / (float)self->accSumCount;
+		acc_z = (float)self->accSum[2] * self->accVelScale / (float)self->accSumCount;
 	}
 	return acc_z;
 }
 
+//! returns earth frame acceleration (north, east, down) in cm/s/s averaged since the last imu_reset_velocity_estimate()
+void imu_get_avg_accel_ned_cmss(struct imu *self, float acc_ned[3]){
+	acc_ned[0] = acc_ned[1] = acc_ned[2] = 0;
+	if (self->accSumCount) {
+		float scale = self->accVelScale / (float)self->accSumCount;
+		acc_ned[0] = (float)self->accSum[0] * scale;
+		acc_ned[1] = (float)self->accSum[1] * scale;
+		// the sum is positive up
+		acc_ned[2] = -(float)self->accSum[2] * scale;
+	}
+}
+
 float imu_get_est_vertical_vel_cms(struct imu *self){
-	return imu_get_avg_vertical_accel_cmss(self) * self->accVelScale * (float)self->accTimeSum;
+	return imu_get_avg_vertical_accel_cmss(self) * (float)self->accTimeSum;
 }
 
 void imu_enable_fast_dcm_convergence(struct imu *self, bool on){
@@ -118,6 +118,7 @@ void imu_get_rotation(struct imu *self, quat_t *q);
 void imu_enable_fast_dcm_convergence(struct imu *self, bool on);
 
 float imu_get_avg_vertical_accel_cmss(struct imu *self);
+void imu_get_avg_accel_ned_cmss(struct imu *self, float acc_ned[3]);
 float imu_get_est_vertical_vel_cms(struct imu *self);
 float imu_get_velocity_integration_time(struct imu *self);
 void imu_reset_velocity_estimate(struct imu *self);
@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include <math.h>
 
 #include <platform.h>
 
@@ -8,6 +9,8 @@
 
 #include "imu.h"
 #include "barometer.h"
+#include "sonar.h"
+#include "altitude.h"
 #include "instruments.h"
 
 #include "system_calls.h"
@@ -30,6 +33,9 @@
  * - Accelerometer
  * - Gyroscope
  * - Magnetometer
+ * - Barometer
+ * - Sonar
+ * - GPS
  *
  * Estimated quantities include:
  * - Orientation (quaternion and euler angles)
@@ -51,6 +57,8 @@ void ins_init(struct instruments *self, const struct config *config){
 	self->sensors = INS_USE_SENSOR_ACC | INS_USE_SENSOR_GYRO | INS_USE_SENSOR_MAG;
 
 	baro_init(&self->baro, config);
+	ins_altitude_init(&self->alt, &config_get_profile(self->config)->baro);
+	posest_init(&self->pos);
 
     board_alignment_init(&self->alignment, &self->config->alignment);
 
@@ -62,6 +70,7 @@ void ins_init(struct instruments *self, const struct config *config){
 	ins_gyro_init(&self->gyro,
 		&self->config->gyro
 	);
+	ins_gyro_set_sample_rate(&self->gyro, GYRO_STANDARD_RATE / (self->config->imu.gyro_sample_div + 1));
 
 	ins_mag_init(&self->mag,
 		&config_get_profile(self->config)->mag,
@@ -148,6 +157,18 @@ void ins_process_mag(struct instruments *self, int32_t x, int32_t y, int32_t z){
 
 void ins_process_pressure(struct instruments *self, uint32_t pressure){
 	baro_process_pressure(&self->baro, pressure);
+	baro_update(&self->baro);
+	ins_altitude_input_baro(&self->alt, (int32_t)baro_get_altitude(&self->baro));
+}
+
+//! maximum tilt at which sonar range is still used as altitude (cos of 25 degrees)
+#define INS_SONAR_MAX_TILT_COS 0.906f
+
+void ins_process_sonar(struct instruments *self, int32_t range){
+	float cos_tilt = imu_get_cos_tilt_angle(&self->imu);
+	if(range == SONAR_OUT_OF_RANGE || cos_tilt < INS_SONAR_MAX_TILT_COS)
+		return;
+	ins_altitude_input_sonar(&self->alt, range * cos_tilt);
 }
 
 void ins_update(struct instruments *self, float dt){
@@ -157,19 +178,43 @@ void ins_update(struct instruments *self, float dt){
 	else
 		imu_enable_fast_dcm_convergence(&self->imu, false);
 	imu_update(&self->imu, dt);
-	baro_update(&self->baro);
+
+	// vertical acceleration collected by the imu since the last update drives the altitude estimate
+	float dt_acc = imu_get_velocity_integration_time(&self->imu);
+	ins_altitude_predict(&self->alt, imu_get_avg_vertical_accel_cmss(&self->imu), dt_acc);
+
+	// the position estimate is predicted at a lower rate so collect the acceleration until then
+	float acc_ned[3];
+	imu_get_avg_accel_ned_cmss(&self->imu, acc_ned);
+	for(int i = 0; i < 3; i++)
+		self->pos_acc[i] += acc_ned[i] * dt_acc;
+	self->pos_acc_time += dt_acc;
+	imu_reset_velocity_estimate(&self->imu);
 }
 
-//! returns estimated altitude above sea level in cm
-uint32_t ins_get_altitude_cm(struct instruments *self){
-	return baro_get_altitude(&self->baro);
+void ins_update_position(struct instruments *self, sys_micros_t now){
+	float acc_ned[3] = {0, 0, 0};
+	if(self->pos_acc_time > 0){
+		for(int i = 0; i < 3; i++)
+			acc_ned[i] = self->pos_acc[i] / self->pos_acc_time;
+	}
+	posest_predict(&self->pos, acc_ned, now);
+	memset(self->pos_acc, 0, sizeof(self->pos_acc));
+	self->pos_acc_time = 0;
+}
+
+void ins_process_gps(struct instruments *self, const struct posest_gps_fix *fix){
+	posest_input_gps(&self->pos, fix);
+}
+
+//! returns estimated altitude in cm, negative below the reference point
+int32_t ins_get_altitude_cm(struct instruments *self){
+	return lrintf(ins_altitude_get_cm(&self->alt));
 }
 
 //! returns vertical speed in cm/s
 int16_t ins_get_vertical_speed_cms(struct instruments *self){
-	(void)self;
-	// TODO: calculate vertical speed
-	return 0;
+	return lrintf(ins_altitude_get_velocity_cms(&self->alt));
 }
 
 /**
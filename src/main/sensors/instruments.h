@@ -7,14 +7,22 @@
 #include "compass.h"
 #include "boardalignment.h"
 #include "barometer.h"
+#include "altitude.h"
+#include "../flight/posest.h"
 
 struct instruments {
 	struct ins_acc acc;
 	struct ins_gyro gyro;
 	struct ins_mag mag;
 	struct baro baro;
+	struct ins_altitude alt;
+	struct posest pos;
 	struct imu imu;
 
+	//! earth frame acceleration (cm/s/s) integrated over pos_acc_time seconds for the next position prediction
+	float pos_acc[3];
+	float pos_acc_time;
+
 	struct board_alignment alignment;
 	sensor_align_e mag_align;
 	sensor_align_e gyr_align;
@@ -36,8 +44,13 @@ void ins_process_gyro(struct instruments *self, int32_t x, int32_t y, int32_t z)
 void ins_process_acc(struct instruments *self, int32_t x, int32_t y, int32_t z);
 void ins_process_mag(struct instruments *self, int32_t x, int32_t y, int32_t z);
 void ins_process_pressure(struct instruments *self, uint32_t pressure);
+void ins_process_sonar(struct instruments *self, int32_t range);
+//! fuses a gps fix into the position estimate at the time the fix was measured
+void ins_process_gps(struct instruments *self, const struct posest_gps_fix *fix);
 
 void ins_update(struct instruments *self, float dt);
+//! advances the position estimate to now with the acceleration collected by ins_update since the last call
+void ins_update_position(struct instruments *self, sys_micros_t now);
 
 static inline void ins_reset_imu(struct instruments *self) { imu_reset(&self->imu); }
 
@@ -57,14 +70,26 @@ static inline int16_t ins_get_roll_dd(struct instruments *self){ return imu_get_
 static inline int16_t ins_get_pitch_dd(struct instruments *self){ return imu_get_pitch_dd(&self->imu); }
 static inline int16_t ins_get_yaw_dd(struct instruments *self){ return imu_get_yaw_dd(&self->imu); }
 
-//! returns estimated altitude above sea level in cm
-uint32_t ins_get_altitude_cm(struct instruments *self);
+//! returns estimated altitude in cm, negative below the reference point
+int32_t ins_get_altitude_cm(struct instruments *self);
 
 //! returns vertical speed in cm/s
 int16_t ins_get_vertical_speed_cms(struct instruments *self);
 
+//! unquantized altitude estimate for controllers. Altitude in cm, speed in cm/s and acceleration in cm/s/s.
+static inline float ins_get_altitude_cmf(struct instruments *self){ return ins_altitude_get_cm(&self->alt); }
+static inline float ins_get_vertical_speed_cmsf(struct instruments *self){ return ins_altitude_get_velocity_cms(&self->alt); }
+static inline float ins_get_vertical_accel_cmss(struct instruments *self){ return ins_altitude_get_accel_cmss(&self->alt); }
+static inline bool ins_has_altitude(struct instruments *self){ return self->alt.initialized; }
+
+//! position (north, east, down) in cm relative to the first gps fix and velocity in cm/s
+static inline const float *ins_get_position_cm(struct instruments *self){ return posest_get_position(&self->pos); }
+static inline const float *ins_get_velocity_cms(struct instruments *self){ return posest_get_velocity(&self->pos); }
+static inline bool ins_has_position(struct instruments *self){ return self->pos.have_origin; }
+
 static inline void ins_set_gyro_alignment(struct instruments *self, sensor_align_e align) { self->gyr_align = align; }
 static inline void ins_set_acc_alignment(struct instruments *self, sensor_align_e align) { self->acc_align = align; }
 static inline void ins_set_mag_alignment(struct instruments *self, sensor_align_e align) { self->mag_align = align; }
 
 static inline void ins_set_gyro_filter_hz(struct instruments *self, uint16_t hz) { ins_gyro_set_filter_hz(&self->gyro, hz); }
+static inline void ins_set_motor_rpm(struct instruments *self, uint8_t motor, uint16_t rpm) { ins_gyro_set_motor_rpm(&self->gyro, motor, rpm); }
@@ -0,0 +1,295 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ubx.h"
+
+enum {
+	UBX_STEP_SYNC1 = 0,
+	UBX_STEP_SYNC2,
+	UBX_STEP_CLASS,
+	UBX_STEP_ID,
+	UBX_STEP_LEN1,
+	UBX_STEP_LEN2,
+	UBX_STEP_PAYLOAD,
+	UBX_STEP_CK_A,
+	UBX_STEP_CK_B
+};
+
+// flags for message table entries
+#define UBX_LEGACY_NAV (1 << 0)
+
+struct ubx_message {
+	uint8_t msg_class;
+	uint8_t msg_id;
+	uint16_t min_length;
+	uint8_t flags;
+	char tag;
+	uint8_t (*decode)(struct ubx_parser *self, const uint8_t *p);
+};
+
+// payloads are little endian and not aligned so fields are always read byte wise
+static inline uint16_t _u16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t _u32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline int32_t _i32(const uint8_t *p)
+{
+	return (int32_t)_u32(p);
+}
+
+static uint8_t _decode_nav_pvt(struct ubx_parser *self, const uint8_t *p)
+{
+	struct ubx_solution *sol = &self->sol;
+	sol->itow = _u32(p + 0);
+	sol->fix_type = p[20];
+	sol->fix_ok = (p[21] & 0x01) && sol->fix_type == UBX_FIX_3D;
+	sol->num_sat = p[23];
+	sol->lon = _i32(p + 24);
+	sol->lat = _i32(p + 28);
+	sol->alt_msl = _i32(p + 36);
+	sol->h_acc = _u32(p + 40);
+	sol->v_acc = _u32(p + 44);
+	// pvt reports velocities in mm/s
+	sol->vel_ned[0] = _i32(p + 48) / 10;
+	sol->vel_ned[1] = _i32(p + 52) / 10;
+	sol->vel_ned[2] = _i32(p + 56) / 10;
+	sol->ground_speed = (uint32_t)_i32(p + 60) / 10;
+	sol->heading = _i32(p + 64);
+	sol->s_acc = _u32(p + 68) / 10;
+	sol->pdop = _u16(p + 76);
+	self->have_pvt = true;
+	return UBX_UPDATE_POSITION | UBX_UPDATE_VELOCITY | UBX_UPDATE_FIX;
+}
+
+static uint8_t _decode_nav_posllh(struct ubx_parser *self, const uint8_t *p)
+{
+	self->sol.itow = _u32(p + 0);
+	self->sol.lon = _i32(p + 4);
+	self->sol.lat = _i32(p + 8);
+	self->sol.alt_msl = _i32(p + 16);
+	self->sol.h_acc = _u32(p + 20);
+	self->sol.v_acc = _u32(p + 24);
+	return UBX_UPDATE_POSITION;
+}
+
+static uint8_t _decode_nav_status(struct ubx_parser *self, const uint8_t *p)
+{
+	self->sol.fix_type = p[4];
+	self->sol.fix_ok = (p[5] & 0x01) && p[4] == UBX_FIX_3D;
+	return UBX_UPDATE_FIX;
+}
+
+static uint8_t _decode_nav_sol(struct ubx_parser *self, const uint8_t *p)
+{
+	self->sol.fix_type = p[10];
+	self->sol.fix_ok = (p[11] & 0x01) && p[10] == UBX_FIX_3D;
+	self->sol.pdop = _u16(p + 44);
+	self->sol.num_sat = p[47];
+	return UBX_UPDATE_FIX;
+}
+
+static uint8_t _decode_nav_velned(struct ubx_parser *self, const uint8_t *p)
+{
+	self->sol.vel_ned[0] = _i32(p + 4);
+	self->sol.vel_ned[1] = _i32(p + 8);
+	self->sol.vel_ned[2] = _i32(p + 12);
+	self->sol.ground_speed = _u32(p + 20);
+	self->sol.heading = _i32(p + 24);
+	self->sol.s_acc = _u32(p + 28);
+	return UBX_UPDATE_VELOCITY;
+}
+
+static uint8_t _decode_nav_svinfo(struct ubx_parser *self, const uint8_t *p)
+{
+	struct ubx_svinfo *sv = &self->svinfo;
+	uint8_t num_ch = p[4];
+	// only decode the channels that actually arrived
+	if(num_ch > (self->length - 8) / 12)
+		num_ch = (uint8_t)((self->length - 8) / 12);
+	if(num_ch > UBX_MAX_SV)
+		num_ch = UBX_MAX_SV;
+	sv->num_ch = num_ch;
+	for(int i = 0; i < num_ch; i++){
+		const uint8_t *ch = p + 8 + 12 * i;
+		sv->chn[i] = ch[0];
+		sv->svid[i] = ch[1];
+		sv->quality[i] = ch[3];
+		sv->cno[i] = ch[4];
+	}
+	return UBX_UPDATE_SVINFO;
+}
+
+static uint8_t _decode_ack(struct ubx_parser *self, const uint8_t *p)
+{
+	self->ack.msg_class = p[0];
+	self->ack.msg_id = p[1];
+	self->ack.ok = self->msg_id == UBX_ACK_ACK;
+	return UBX_UPDATE_ACK;
+}
+
+static const struct ubx_message _messages[] = {
+	{ UBX_CLASS_NAV, UBX_NAV_PVT, 84, 0, 'T', _decode_nav_pvt },
+	{ UBX_CLASS_NAV, UBX_NAV_POSLLH, 28, UBX_LEGACY_NAV, 'P', _decode_nav_posllh },
+	{ UBX_CLASS_NAV, UBX_NAV_STATUS, 16, UBX_LEGACY_NAV, 'S', _decode_nav_status },
+	{ UBX_CLASS_NAV, UBX_NAV_SOL, 52, UBX_LEGACY_NAV, 'O', _decode_nav_sol },
+	{ UBX_CLASS_NAV, UBX_NAV_VELNED, 36, UBX_LEGACY_NAV, 'V', _decode_nav_velned },
+	{ UBX_CLASS_NAV, UBX_NAV_SVINFO, 8, 0, 'I', _decode_nav_svinfo },
+	{ UBX_CLASS_ACK, UBX_ACK_ACK, 2, 0, 'A', _decode_ack },
+	{ UBX_CLASS_ACK, UBX_ACK_NAK, 2, 0, 'N', _decode_ack },
+};
+
+void ubx_parser_init(struct ubx_parser *self)
+{
+	memset(self, 0, sizeof(*self));
+	self->tag = '!';
+}
+
+static const struct ubx_message *_find_message(uint8_t msg_class, uint8_t msg_id)
+{
+	for(unsigned i = 0; i < sizeof(_messages) / sizeof(_messages[0]); i++){
+		if(_messages[i].msg_class == msg_class && _messages[i].msg_id == msg_id)
+			return &_messages[i];
+	}
+	return NULL;
+}
+
+static int _dispatch(struct ubx_parser *self)
+{
+	const struct ubx_message *msg = _find_message(self->msg_class, self->msg_id);
+	self->frames++;
+	self->updated = 0;
+
+	if(!msg || ((msg->flags & UBX_LEGACY_NAV) && self->have_pvt)){
+		self->tag = '!';
+		return 0;
+	}
+	self->tag = msg->tag;
+	if(self->length < msg->min_length){
+		self->errors++;
+		self->tag = '>';
+		return -EMSGSIZE;
+	}
+
+	self->updated = msg->decode(self, self->payload);
+
+	// svinfo and acks arrive in between epochs, only navigation frames start one
+	if(!(self->updated & UBX_UPDATE_NAV))
+		return UBX_FRAME;
+	if(!self->pending)
+		self->epoch_start = self->frame_start;
+	self->pending |= self->updated;
+
+	// only report a solution once both position and speed belong to the same epoch so stale data is never used
+	if((self->pending & (UBX_UPDATE_POSITION | UBX_UPDATE_VELOCITY)) == (UBX_UPDATE_POSITION | UBX_UPDATE_VELOCITY)){
+		self->sol.timestamp = self->epoch_start;
+		self->pending = 0;
+		return UBX_SOLUTION;
+	}
+	return UBX_FRAME;
+}
+
+int ubx_parser_input(struct ubx_parser *self, uint8_t c, sys_micros_t now)
+{
+	switch(self->step){
+		case UBX_STEP_SYNC1:
+			if(c == UBX_PREAMBLE1){
+				self->frame_start = now;
+				self->step++;
+			} else {
+				self->garbage++;
+			}
+			break;
+		case UBX_STEP_SYNC2:
+			if(c == UBX_PREAMBLE2){
+				self->step++;
+			} else if(c != UBX_PREAMBLE1){
+				// a repeated first sync char may still start a valid frame
+				self->garbage++;
+				self->step = UBX_STEP_SYNC1;
+			} else {
+				self->frame_start = now;
+			}
+			break;
+		case UBX_STEP_CLASS:
+			self->msg_class = c;
+			self->ck_a = self->ck_b = c;
+			self->step++;
+			break;
+		case UBX_STEP_ID:
+			self->msg_id = c;
+			self->ck_b += (self->ck_a += c);
+			self->step++;
+			break;
+		case UBX_STEP_LEN1:
+			self->length = c;
+			self->ck_b += (self->ck_a += c);
+			self->step++;
+			break;
+		case UBX_STEP_LEN2:
+			self->length |= (uint16_t)(c << 8);
+			self->ck_b += (self->ck_a += c);
+			self->count = 0;
+			if(self->length > UBX_MAX_PAYLOAD){
+				// we can't receive the whole packet, just log the error and start searching for the next packet.
+				self->step = UBX_STEP_SYNC1;
+				self->skipped++;
+				self->errors++;
+				self->tag = '>';
+				return -EMSGSIZE;
+			}
+			self->step = (self->length)?UBX_STEP_PAYLOAD:UBX_STEP_CK_A;
+			break;
+		case UBX_STEP_PAYLOAD:
+			self->ck_b += (self->ck_a += c);
+			self->payload[self->count++] = c;
+			if(self->count == self->length)
+				self->step++;
+			break;
+		case UBX_STEP_CK_A:
+			if(c != self->ck_a){
+				self->step = UBX_STEP_SYNC1;
+				self->errors++;
+				self->tag = '?';
+				return -EBADMSG;
+			}
+			self->step++;
+			break;
+		case UBX_STEP_CK_B:
+			self->step = UBX_STEP_SYNC1;
+			if(c != self->ck_b){
+				self->errors++;
+				self->tag = '?';
+				return -EBADMSG;
+			}
+			return _dispatch(self);
+		default:
+			self->step = UBX_STEP_SYNC1;
+			break;
+	}
+	return 0;
+}
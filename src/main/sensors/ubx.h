@@ -0,0 +1,147 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../system_calls.h"
+
+/*
+ * Byte-wise UBX protocol parser. Frames are checksummed as the bytes arrive and dispatched through a table of
+ * known messages once the checksum matches. Decoded navigation data is accumulated into a single solution so that
+ * NAV-PVT (u-blox 7 and later, one message per epoch) and the legacy NAV-POSLLH/VELNED/SOL/STATUS set (u-blox 6)
+ * give the same result. The parser keeps everything inside the struct and never allocates.
+ */
+
+#define UBX_PREAMBLE1 0xB5
+#define UBX_PREAMBLE2 0x62
+
+#define UBX_CLASS_NAV 0x01
+#define UBX_CLASS_ACK 0x05
+#define UBX_CLASS_CFG 0x06
+
+#define UBX_NAV_POSLLH 0x02
+#define UBX_NAV_STATUS 0x03
+#define UBX_NAV_SOL 0x06
+#define UBX_NAV_PVT 0x07
+#define UBX_NAV_VELNED 0x12
+#define UBX_NAV_SVINFO 0x30
+
+#define UBX_ACK_NAK 0x00
+#define UBX_ACK_ACK 0x01
+
+#define UBX_CFG_RATE 0x08
+
+#define UBX_FIX_3D 0x03
+
+// from the UBlox6 document, the largest payload we receive is NAV-SVINFO which is 8 + 12*numCh. numCh is 28 on
+// a Glonass capable receiver.
+#define UBX_MAX_PAYLOAD 344
+#define UBX_MAX_SV 16
+
+//! returned by ubx_parser_input when a valid frame of a known message has been decoded
+#define UBX_FRAME 1
+//! returned by ubx_parser_input when the frame completed a new position and velocity solution
+#define UBX_SOLUTION 2
+
+//! bits in ubx_parser.updated describing what the last frame changed
+enum {
+	UBX_UPDATE_POSITION = (1 << 0),
+	UBX_UPDATE_VELOCITY = (1 << 1),
+	UBX_UPDATE_FIX = (1 << 2),
+	UBX_UPDATE_SVINFO = (1 << 3),
+	UBX_UPDATE_ACK = (1 << 4),
+};
+
+//! updates that belong to a navigation epoch and are timestamped with it
+#define UBX_UPDATE_NAV (UBX_UPDATE_POSITION | UBX_UPDATE_VELOCITY | UBX_UPDATE_FIX)
+
+struct ubx_solution {
+	uint32_t itow;				//!< GPS time of week of the navigation epoch (ms)
+	int32_t lat, lon;			//!< degrees * 1e7
+	int32_t alt_msl;			//!< height above mean sea level (mm)
+	int32_t vel_ned[3];			//!< velocity north, east, down (cm/s)
+	uint32_t ground_speed;		//!< 2d ground speed (cm/s)
+	int32_t heading;			//!< heading of motion (degrees * 1e5)
+	uint32_t h_acc;				//!< horizontal accuracy estimate (mm)
+	uint32_t v_acc;				//!< vertical accuracy estimate (mm)
+	uint32_t s_acc;				//!< speed accuracy estimate (cm/s)
+	uint16_t pdop;				//!< position dilution of precision * 100
+	uint8_t num_sat;
+	uint8_t fix_type;
+	bool fix_ok;				//!< valid 3d fix
+	sys_micros_t timestamp;		//!< local time at which the first frame of this epoch started to arrive
+};
+
+struct ubx_svinfo {
+	uint8_t num_ch;
+	uint8_t chn[UBX_MAX_SV];
+	uint8_t svid[UBX_MAX_SV];
+	uint8_t quality[UBX_MAX_SV];
+	uint8_t cno[UBX_MAX_SV];
+};
+
+//! answer of the receiver to the last configuration message
+struct ubx_ack {
+	uint8_t msg_class;
+	uint8_t msg_id;
+	bool ok;					//!< ACK-ACK, false for ACK-NAK
+};
+
+struct ubx_parser {
+	uint8_t step;
+	uint8_t msg_class;
+	uint8_t msg_id;
+	uint8_t ck_a, ck_b;
+	uint16_t length;
+	uint16_t count;
+	//! local time at which the sync char of the current frame was received
+	sys_micros_t frame_start;
+	//! frame start of the first frame of the epoch being accumulated
+	sys_micros_t epoch_start;
+	//! what the last decoded frame changed (UBX_UPDATE_*)
+	uint8_t updated;
+	//! updates accumulated since the last complete solution
+	uint8_t pending;
+	//! set once a NAV-PVT frame has been seen. Legacy nav messages are ignored after that.
+	bool have_pvt;
+	//! single character tag of the last frame for the packet log
+	char tag;
+
+	uint32_t frames;
+	uint32_t errors;
+	uint32_t skipped;
+	uint32_t garbage;
+
+	struct ubx_solution sol;
+	struct ubx_svinfo svinfo;
+	struct ubx_ack ack;
+
+	uint8_t payload[UBX_MAX_PAYLOAD];
+};
+
+void ubx_parser_init(struct ubx_parser *self);
+/**
+ * Feed one received byte into the parser.
+ * @param now local time at which the byte was received, used to timestamp the frame start
+ * @return UBX_SOLUTION when a new solution is available in self->sol, UBX_FRAME when some other known frame was
+ * decoded, 0 when more data is needed or the frame was ignored, -EBADMSG on checksum error and -EMSGSIZE when the
+ * frame is too long or too short for its message type.
+ */
+int ubx_parser_input(struct ubx_parser *self, uint8_t c, sys_micros_t now);
@@ -67,6 +67,8 @@
 #endif
 
 #include "sitl.h"
+#include "sdcard_sim.h"
+#include "drivers/asyncfatfs/asyncfatfs.h"
 #include "ninja.h"
 #include "fastloop.h"
 #include "blackbox.h"
@@ -118,6 +120,19 @@ static void *_application_thread(void *param){
 	// default sitl smaple rate (1000 looptime)
 	self->config.data.imu.gyro_sample_div = 8;
 
+#ifdef USE_SDCARD
+	// the card stays empty (not inserted) unless we are given an image to use
+	const char *sdcard_image = getenv("NINJASITL_SDCARD_IMAGE");
+	const char *sdcard_profile = getenv("NINJASITL_SDCARD_PROFILE");
+	if(sdcard_image){
+		const struct sdcard_sim_profile *profile = sdcard_profile ? sdcard_sim_find_profile(sdcard_profile) : NULL;
+		if((ret = sdcard_sim_init(sdcard_image, profile, &self->system->time)) < 0){
+			printf("ERROR opening sdcard image %s (%d)\n", sdcard_image, ret);
+		}
+	}
+	afatfs_init();
+#endif
+
 	fastloop_init(&self->fastloop, self->system, &self->config.data);
 	ninja_init(&self->ninja, &self->fastloop, self->system, &self->config);
 
@@ -144,6 +159,9 @@ static void application_init(struct application *self, struct system_calls *syst
 #include <fcntl.h>
 #include <termio.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 struct sitl_serial_port {
 	serialPort_t dev;
@@ -248,12 +266,110 @@ static struct serial_port_ops _serial_port_ops = {
 	.endWrite = _serial_end_write
 };
 
+/*
+ * A uart can instead be exposed as a udp socket so that a gcs can connect to
+ * it directly. Each datagram carries whatever was written in one call which
+ * for telemetry is one frame. Replies are sent to whoever last sent us data.
+ */
+struct sitl_udp_port {
+	serialPort_t dev;
+	int fd;
+	struct sockaddr_in peer;
+	uint8_t rx_buf[512];
+	ssize_t rx_len;
+	ssize_t rx_pos;
+};
+
+static void _udp_write(serialPort_t *port, void *data, int count){
+	struct sitl_udp_port *self = container_of(port, struct sitl_udp_port, dev);
+	if(sendto(self->fd, data, count, 0, (struct sockaddr*)&self->peer, sizeof(self->peer)) < 0)
+		perror("UART udp send");
+}
+
+static void _udp_write_char(serialPort_t *port, uint8_t ch){
+	_udp_write(port, &ch, 1);
+}
+
+static uint8_t _udp_rx_waiting(serialPort_t *port){
+	struct sitl_udp_port *self = container_of(port, struct sitl_udp_port, dev);
+	if(self->rx_pos == self->rx_len){
+		struct sockaddr_in from;
+		socklen_t fromlen = sizeof(from);
+		ssize_t r = recvfrom(self->fd, self->rx_buf, sizeof(self->rx_buf), MSG_DONTWAIT, (struct sockaddr*)&from, &fromlen);
+		if(r <= 0)
+			return 0;
+		self->peer = from;
+		self->rx_len = r;
+		self->rx_pos = 0;
+	}
+	return MIN(self->rx_len - self->rx_pos, 255);
+}
+
+static uint8_t _udp_read_char(serialPort_t *port){
+	struct sitl_udp_port *self = container_of(port, struct sitl_udp_port, dev);
+	if(!_udp_rx_waiting(port))
+		return 0;
+	return self->rx_buf[self->rx_pos++];
+}
+
+static struct serial_port_ops _udp_port_ops = {
+	.put = _udp_write_char,
+	.serialTotalRxWaiting = _udp_rx_waiting,
+	.serialTotalTxFree = _serial_tx_free,
+	.serialRead = _udp_read_char,
+	.serialSetBaudRate = _serial_set_baud_rate,
+	.isSerialTransmitBufferEmpty = _serial_tx_empty,
+	.setMode = _serial_set_mode,
+	.writeBuf = _udp_write,
+	.beginWrite = _serial_begin_write,
+	.endWrite = _serial_end_write
+};
+
+//! opens a udp socket that sends to address given as host:port
+static serialPort_t *_udp_open(uint8_t id, uint32_t baudRate, const char *address){
+	char host[32];
+	const char *sep = strchr(address, ':');
+	if(!sep || (size_t)(sep - address) >= sizeof(host)){
+		printf("UART%d: invalid udp address '%s', expected host:port\n", id, address);
+		return NULL;
+	}
+	memcpy(host, address, sep - address);
+	host[sep - address] = 0;
+
+	struct sitl_udp_port *port = calloc(1, sizeof(struct sitl_udp_port));
+	port->peer.sin_family = AF_INET;
+	port->peer.sin_port = htons(atoi(sep + 1));
+	if(inet_pton(AF_INET, host, &port->peer.sin_addr) != 1){
+		printf("UART%d: invalid udp host '%s'\n", id, host);
+		free(port);
+		return NULL;
+	}
+	port->fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if(port->fd < 0){
+		perror("UART udp socket");
+		free(port);
+		return NULL;
+	}
+	port->dev.vTable = &_udp_port_ops;
+	port->dev.identifier = id;
+	port->dev.baudRate = baudRate;
+	printf("UART%d, baud %d, sending udp to %s\n", id, baudRate, address);
+	return &port->dev;
+}
+
 serialPort_t *uartOpen(uint8_t id, serialReceiveCallbackPtr callback, uint32_t baudRate, portMode_t mode, portOptions_t options) { 
 	(void)id;
 	(void) callback;
 	(void)baudRate;
 	(void)mode;
 	(void)options;
+
+	char envname[32];
+	snprintf(envname, sizeof(envname), "NINJASITL_UART%d_UDP", id);
+	const char *udp = getenv(envname);
+	if(udp)
+		return _udp_open(id, baudRate, udp);
+
 	int fd = open("/dev/ptmx", O_RDWR);
 	if(fd <= 0){
 		perror("opening serial terminal");
@@ -295,6 +411,7 @@ int getLedHsv(void){ return 0; }
 bool isWS2811LedStripReady(void){ return false; }
 void ws2811LedStripInit(void){}
 void ws2811UpdateStrip(void){}
+void ws2811SetGamma(bool enabled){ (void)enabled; }
 #include "common/color.h"
 void setStripColor(const hsvColor_t *color){ (void) color; }
 
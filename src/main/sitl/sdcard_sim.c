@@ -0,0 +1,431 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <platform.h>
+
+#include "drivers/sdcard.h"
+#include "drivers/asyncfatfs/fat_standard.h"
+
+#include "sdcard_sim.h"
+
+#define SDCARD_SIM_BLOCK_SIZE 512
+
+// where the partition starts in images made by sdcard_sim_create_image()
+#define SDCARD_SIM_PARTITION_START 64
+
+const struct sdcard_sim_profile sdcard_sim_profiles[] = {
+	{
+		.name = "ideal"
+	}, {
+		.name = "class10",
+		.read_us = 300, .write_us = 700,
+		.multi_write_start_us = 2000, .multi_write_us = 250,
+		.jitter_us = 100,
+		.stall_interval = 2000, .stall_us = 40000
+	}, {
+		.name = "class4",
+		.read_us = 600, .write_us = 2500,
+		.multi_write_start_us = 5000, .multi_write_us = 900,
+		.jitter_us = 500,
+		.stall_interval = 500, .stall_us = 150000
+	}, {
+		.name = "flaky",
+		.read_us = 300, .write_us = 700,
+		.multi_write_start_us = 2000, .multi_write_us = 250,
+		.jitter_us = 100,
+		.stall_interval = 2000, .stall_us = 40000,
+		.read_errors_per_10k = 50, .write_errors_per_10k = 50
+	}, {
+		.name = NULL
+	}
+};
+
+static struct sdcard_sim {
+	uint8_t *image;
+	uint32_t blocks;
+	const struct system_calls_time *time;
+	struct sdcard_sim_profile profile;
+	uint32_t random;
+
+	// the operation the card is busy with
+	bool busy;
+	sys_micros_t started;
+	sys_micros_t busy_until;
+	struct {
+		sdcardBlockOperation_e operation;
+		uint32_t block;
+		uint8_t *buffer;
+		sdcard_operationCompleteCallback_c callback;
+		uint32_t callback_data;
+		bool failed;
+	} pending;
+
+	// multi-block write that the card is in the middle of
+	bool multi_write;
+	uint32_t multi_write_next;
+	uint32_t multi_write_remain;
+	uint32_t multi_write_start_cost;
+
+	uint32_t writes_since_stall;
+
+	sdcardMetadata_t metadata;
+	sdcard_profilerCallback_c profiler;
+	struct sdcard_sim_stats stats;
+} sim;
+
+static sys_micros_t _now(void){
+	return sim.time->micros(sim.time);
+}
+
+// xorshift, so that runs with the same profile fail in the same places
+static uint32_t _random(void){
+	sim.random ^= sim.random << 13;
+	sim.random ^= sim.random >> 17;
+	sim.random ^= sim.random << 5;
+	return sim.random;
+}
+
+static bool _should_fail(uint16_t errors_per_10k){
+	return errors_per_10k > 0 && (_random() % 10000) < errors_per_10k;
+}
+
+static void _begin_operation(uint32_t duration){
+	if(sim.profile.jitter_us)
+		duration += _random() % (sim.profile.jitter_us + 1);
+	sim.busy = true;
+	sim.started = _now();
+	sim.busy_until = sim.started + (sys_micros_t)duration;
+	sim.stats.busy_us += duration;
+	if(duration > sim.stats.max_op_us)
+		sim.stats.max_op_us = duration;
+}
+
+// the stop transmission token makes the card program the last block before it is ready again
+static void _end_multi_write(void){
+	sim.multi_write = false;
+	sim.pending.callback = NULL;
+	_begin_operation(sim.profile.multi_write_us);
+}
+
+void sdcard_init(bool useDMA){
+	(void)useDMA;
+}
+
+void sdcardInsertionDetectInit(void){
+}
+
+void sdcardInsertionDetectDeinit(void){
+}
+
+bool sdcard_isInserted(void){
+	return sim.image != NULL;
+}
+
+bool sdcard_isInitialized(void){
+	return sim.image != NULL;
+}
+
+bool sdcard_isFunctional(void){
+	return sim.image != NULL;
+}
+
+const sdcardMetadata_t* sdcard_getMetadata(void){
+	return &sim.metadata;
+}
+
+void sdcard_setProfilerCallback(sdcard_profilerCallback_c callback){
+	sim.profiler = callback;
+}
+
+bool sdcard_poll(void){
+	if(!sim.image)
+		return false;
+
+	if(sim.busy){
+		sys_micros_t now = _now();
+		if((now - sim.busy_until) < 0)
+			return false;
+
+		sim.busy = false;
+
+		sdcard_operationCompleteCallback_c callback = sim.pending.callback;
+		if(callback){
+			sim.pending.callback = NULL;
+
+			uint32_t duration = (uint32_t)(now - sim.started);
+			uint8_t *buffer = sim.pending.failed ? NULL : sim.pending.buffer;
+			uint8_t *block = sim.image + (size_t)sim.pending.block * SDCARD_SIM_BLOCK_SIZE;
+
+			if(sim.pending.operation == SDCARD_BLOCK_OPERATION_READ){
+				if(buffer)
+					memcpy(buffer, block, SDCARD_SIM_BLOCK_SIZE);
+			} else {
+				if(buffer)
+					memcpy(block, buffer, SDCARD_SIM_BLOCK_SIZE);
+				if(sim.multi_write && --sim.multi_write_remain == 0)
+					_end_multi_write();
+			}
+
+			if(sim.profiler)
+				sim.profiler(sim.pending.operation, sim.pending.block, duration);
+
+			callback(sim.pending.operation, sim.pending.block, buffer, sim.pending.callback_data);
+		}
+	}
+
+	return !sim.busy;
+}
+
+bool sdcard_readBlock(uint32_t blockIndex, uint8_t *buffer, sdcard_operationCompleteCallback_c callback, uint32_t callbackData){
+	if(!sim.image || sim.busy || blockIndex >= sim.blocks)
+		return false;
+
+	if(sim.multi_write){
+		_end_multi_write();
+		return false;
+	}
+
+	sim.pending.operation = SDCARD_BLOCK_OPERATION_READ;
+	sim.pending.block = blockIndex;
+	sim.pending.buffer = buffer;
+	sim.pending.callback = callback;
+	sim.pending.callback_data = callbackData;
+	sim.pending.failed = _should_fail(sim.profile.read_errors_per_10k);
+
+	sim.stats.reads++;
+	if(sim.pending.failed)
+		sim.stats.read_errors++;
+
+	_begin_operation(sim.profile.read_us);
+
+	return true;
+}
+
+sdcardOperationStatus_e sdcard_beginWriteBlocks(uint32_t blockIndex, uint32_t blockCount){
+	if(!sim.image || sim.busy)
+		return SDCARD_OPERATION_BUSY;
+
+	if(sim.multi_write){
+		// the caller is continuing the multi-block write that is already in progress
+		if(blockIndex == sim.multi_write_next)
+			return SDCARD_OPERATION_SUCCESS;
+		_end_multi_write();
+		return SDCARD_OPERATION_BUSY;
+	}
+
+	if(blockIndex >= sim.blocks || blockCount == 0)
+		return SDCARD_OPERATION_FAILURE;
+
+	sim.multi_write = true;
+	sim.multi_write_next = blockIndex;
+	sim.multi_write_remain = blockCount;
+	sim.multi_write_start_cost = sim.profile.multi_write_start_us;
+	sim.stats.multi_writes++;
+
+	return SDCARD_OPERATION_SUCCESS;
+}
+
+sdcardOperationStatus_e sdcard_writeBlock(uint32_t blockIndex, uint8_t *buffer, sdcard_operationCompleteCallback_c callback, uint32_t callbackData){
+	if(!sim.image || sim.busy)
+		return SDCARD_OPERATION_BUSY;
+
+	if(blockIndex >= sim.blocks)
+		return SDCARD_OPERATION_FAILURE;
+
+	uint32_t duration;
+
+	if(sim.multi_write){
+		if(blockIndex != sim.multi_write_next){
+			_end_multi_write();
+			return SDCARD_OPERATION_BUSY;
+		}
+		sim.multi_write_next++;
+		duration = sim.profile.multi_write_us + sim.multi_write_start_cost;
+		sim.multi_write_start_cost = 0;
+	} else {
+		duration = sim.profile.write_us;
+	}
+
+	if(sim.profile.stall_interval && ++sim.writes_since_stall >= sim.profile.stall_interval){
+		sim.writes_since_stall = 0;
+		duration += sim.profile.stall_us;
+	}
+
+	sim.pending.operation = SDCARD_BLOCK_OPERATION_WRITE;
+	sim.pending.block = blockIndex;
+	sim.pending.buffer = buffer;
+	sim.pending.callback = callback;
+	sim.pending.callback_data = callbackData;
+	sim.pending.failed = _should_fail(sim.profile.write_errors_per_10k);
+
+	sim.stats.writes++;
+	if(sim.pending.failed){
+		// like the real driver, a failed write takes the card out of multi-block mode
+		sim.stats.write_errors++;
+		sim.multi_write = false;
+	}
+
+	_begin_operation(duration);
+
+	return SDCARD_OPERATION_IN_PROGRESS;
+}
+
+const struct sdcard_sim_profile *sdcard_sim_find_profile(const char *name){
+	for(const struct sdcard_sim_profile *profile = sdcard_sim_profiles; profile->name; profile++){
+		if(strcmp(profile->name, name) == 0)
+			return profile;
+	}
+	return NULL;
+}
+
+void sdcard_sim_set_profile(const struct sdcard_sim_profile *profile){
+	sim.profile = profile ? *profile : sdcard_sim_profiles[0];
+}
+
+void sdcard_sim_get_stats(struct sdcard_sim_stats *stats){
+	*stats = sim.stats;
+}
+
+int sdcard_sim_init(const char *image_path, const struct sdcard_sim_profile *profile, const struct system_calls_time *time){
+	sdcard_sim_close();
+
+	int fd = open(image_path, O_RDWR);
+	if(fd < 0)
+		return -errno;
+
+	struct stat st;
+	if(fstat(fd, &st) < 0 || st.st_size < SDCARD_SIM_BLOCK_SIZE || (st.st_size % SDCARD_SIM_BLOCK_SIZE) != 0){
+		close(fd);
+		return -EINVAL;
+	}
+
+	void *image = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	// the mapping stays valid after the descriptor is closed
+	close(fd);
+	if(image == MAP_FAILED)
+		return -errno;
+
+	memset(&sim, 0, sizeof(sim));
+	sim.image = image;
+	sim.blocks = (uint32_t)(st.st_size / SDCARD_SIM_BLOCK_SIZE);
+	sim.time = time;
+	sim.random = 0x2545F491;
+	sdcard_sim_set_profile(profile);
+
+	sim.metadata.numBlocks = sim.blocks;
+	memcpy(sim.metadata.productName, "SITL ", sizeof(sim.metadata.productName));
+
+	return 0;
+}
+
+void sdcard_sim_close(void){
+	if(sim.image){
+		msync(sim.image, (size_t)sim.blocks * SDCARD_SIM_BLOCK_SIZE, MS_SYNC);
+		munmap(sim.image, (size_t)sim.blocks * SDCARD_SIM_BLOCK_SIZE);
+	}
+	sim.image = NULL;
+	sim.busy = false;
+	sim.multi_write = false;
+	sim.pending.callback = NULL;
+}
+
+static int _write_block(int fd, uint32_t block, const void *data){
+	if(pwrite(fd, data, SDCARD_SIM_BLOCK_SIZE, (off_t)block * SDCARD_SIM_BLOCK_SIZE) != SDCARD_SIM_BLOCK_SIZE)
+		return -EIO;
+	return 0;
+}
+
+int sdcard_sim_create_image(const char *path, uint32_t blocks){
+	if(blocks < 8192 || blocks > 4194304)
+		return -EINVAL;
+
+	uint32_t sectors = blocks - SDCARD_SIM_PARTITION_START;
+	uint32_t reserved = 1;
+	uint32_t root_entries = 512;
+	uint32_t root_sectors = root_entries * sizeof(fatDirectoryEntry_t) / SDCARD_SIM_BLOCK_SIZE;
+
+	// smallest cluster size that keeps the cluster count in FAT16 range
+	uint32_t sectors_per_cluster = 1;
+	while(sectors / sectors_per_cluster > FAT16_MAX_CLUSTERS)
+		sectors_per_cluster *= 2;
+
+	uint32_t clusters = sectors / sectors_per_cluster;
+	uint32_t fat_sectors = ((clusters + 2) * sizeof(uint16_t) + SDCARD_SIM_BLOCK_SIZE - 1) / SDCARD_SIM_BLOCK_SIZE;
+	uint32_t data_sectors = sectors - reserved - 2 * fat_sectors - root_sectors;
+	if(data_sectors / sectors_per_cluster <= FAT12_MAX_CLUSTERS)
+		return -EINVAL;
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+		return -errno;
+
+	int ret = 0;
+	if(ftruncate(fd, (off_t)blocks * SDCARD_SIM_BLOCK_SIZE) < 0)
+		ret = -errno;
+
+	uint8_t block[SDCARD_SIM_BLOCK_SIZE];
+
+	// master boot record with one partition covering the rest of the image
+	memset(block, 0, sizeof(block));
+	mbrPartitionEntry_t *partition = (mbrPartitionEntry_t*)(block + 446);
+	partition->type = MBR_PARTITION_TYPE_FAT16_LBA;
+	partition->lbaBegin = SDCARD_SIM_PARTITION_START;
+	partition->numSectors = sectors;
+	block[510] = 0x55;
+	block[511] = 0xAA;
+	if(!ret) ret = _write_block(fd, 0, block);
+
+	memset(block, 0, sizeof(block));
+	fatVolumeID_t *volume = (fatVolumeID_t*)block;
+	memcpy(volume->jmpBoot, "\xEB\x3C\x90", 3);
+	memcpy(volume->oemName, "NINJASIM", 8);
+	volume->bytesPerSector = SDCARD_SIM_BLOCK_SIZE;
+	volume->sectorsPerCluster = (uint8_t)sectors_per_cluster;
+	volume->reservedSectorCount = (uint16_t)reserved;
+	volume->numFATs = 2;
+	volume->rootEntryCount = (uint16_t)root_entries;
+	volume->media = 0xF8;
+	volume->FATSize16 = (uint16_t)fat_sectors;
+	volume->hiddenSectors = SDCARD_SIM_PARTITION_START;
+	volume->totalSectors32 = sectors;
+	volume->fatDescriptor.fat16.bootSignature = 0x29;
+	memcpy(volume->fatDescriptor.fat16.volumeLabel, "NO NAME    ", 11);
+	memcpy(volume->fatDescriptor.fat16.fileSystemType, "FAT16   ", 8);
+	block[510] = FAT_VOLUME_ID_SIGNATURE_1;
+	block[511] = FAT_VOLUME_ID_SIGNATURE_2;
+	if(!ret) ret = _write_block(fd, SDCARD_SIM_PARTITION_START, block);
+
+	// the first two entries of each FAT are reserved, the rest of the image is already zero (free)
+	memset(block, 0, sizeof(block));
+	block[0] = 0xF8; block[1] = 0xFF;
+	block[2] = 0xFF; block[3] = 0xFF;
+	for(uint32_t fat = 0; fat < 2 && !ret; fat++)
+		ret = _write_block(fd, SDCARD_SIM_PARTITION_START + reserved + fat * fat_sectors, block);
+
+	close(fd);
+	return ret;
+}
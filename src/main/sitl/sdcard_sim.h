@@ -0,0 +1,93 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "system_calls.h"
+
+/**
+ * @defgroup SDCARD_SIM SD card simulator
+ * @{
+ * Host side replacement for drivers/sdcard.c used by SITL and the unit tests.
+ * Blocks are backed by a memory mapped disk image file (for example one made
+ * with mkfs.fat, or with sdcard_sim_create_image()). Every operation keeps
+ * the card busy for a time taken from the active latency profile, and reads
+ * and writes can be made to fail at a configurable rate so that the error
+ * paths of asyncfatfs can be exercised. The simulator implements the
+ * interface declared in drivers/sdcard.h.
+ */
+
+//! Latency and error characteristics of a simulated card
+struct sdcard_sim_profile {
+	const char *name;
+	uint32_t read_us;				//!< time taken by a single block read
+	uint32_t write_us;				//!< time taken by a single block write
+	uint32_t multi_write_start_us;	//!< extra time taken by the first block of a multi-block write (pre-erase)
+	uint32_t multi_write_us;		//!< time taken by each block of a multi-block write
+	uint32_t jitter_us;				//!< random extra time added to every operation
+	uint32_t stall_interval;		//!< a long stall happens every this many writes (0 for never)
+	uint32_t stall_us;				//!< duration of the long stall (internal garbage collection)
+	uint16_t read_errors_per_10k;	//!< number of reads in 10000 that fail
+	uint16_t write_errors_per_10k;	//!< number of writes in 10000 that fail
+};
+
+//! Counters kept by the simulator
+struct sdcard_sim_stats {
+	uint32_t reads;
+	uint32_t writes;
+	uint32_t multi_writes;			//!< multi-block writes started
+	uint32_t read_errors;
+	uint32_t write_errors;
+	uint32_t busy_us;				//!< total time the card spent busy
+	uint32_t max_op_us;				//!< longest single operation
+};
+
+//! Built in profiles, terminated by an entry with a NULL name
+extern const struct sdcard_sim_profile sdcard_sim_profiles[];
+
+//! Look up a built in profile by name, returns NULL if there is no such profile
+const struct sdcard_sim_profile *sdcard_sim_find_profile(const char *name);
+
+/**
+ * Attach the simulator to a disk image file.
+ * @param image_path path of the image, which must be a multiple of 512 bytes long
+ * @param profile latency profile to use (NULL for the first built in profile)
+ * @param time clock that operation latencies are measured against
+ * @return 0 on success, negative errno on failure
+ */
+int sdcard_sim_init(const char *image_path, const struct sdcard_sim_profile *profile, const struct system_calls_time *time);
+
+//! Detach from the image file, which simulates removing the card
+void sdcard_sim_close(void);
+
+//! Change the latency profile of the card that is currently attached
+void sdcard_sim_set_profile(const struct sdcard_sim_profile *profile);
+
+void sdcard_sim_get_stats(struct sdcard_sim_stats *stats);
+
+/**
+ * Create an image file holding a single FAT16 partition.
+ * @param path file to create (an existing file is overwritten)
+ * @param blocks size of the image in 512 byte blocks, between 4MB and 2GB
+ * @return 0 on success, negative errno on failure
+ */
+int sdcard_sim_create_image(const char *path, uint32_t blocks);
+
+/** @} */
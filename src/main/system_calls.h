@@ -179,6 +179,23 @@ struct system_calls_pwm {
 	 * then value should be ignored.
 	 **/
 	void (*write_servo)(const struct system_calls_pwm *self, uint8_t id, uint16_t value);
+	/**
+	 * @param self instance of the system calls interface
+	 *
+	 * Called after all motor values of one update have been written. Outputs
+	 * that send all motors at once (such as dshot) start the transfer here.
+	 * Can be NULL if motor writes take effect immediately.
+	 */
+	void (*flush_motors)(const struct system_calls_pwm *self);
+	/**
+	 * @param self instance of the system calls interface
+	 * @param id motor id (typically in range 0 - 7)
+	 * @param erpm electrical rpm last reported by the esc
+	 * @return negative errno number if no recent speed is known for the motor, 0 on success
+	 *
+	 * Reads motor speed from esc telemetry. Can be NULL if escs do not report speed.
+	 */
+	int (*read_motor_erpm)(const struct system_calls_pwm *self, uint8_t id, uint32_t *erpm);
 	/**
 	 * @param chan pwm channel to read
 	 * @return pwm value of the given channel. If channel is out of range then
@@ -221,6 +238,13 @@ struct system_calls_imu {
 	 * @return negative errno number on error, 0 on success
 	 */
 	int (*read_acc)(const struct system_calls_imu *self, int16_t out[3]);
+	/**
+	 * Reads barometric pressure in pascal. Should return negative value if
+	 * there is no new sample since the last read so that the altitude
+	 * estimator only sees each sample once.
+	 *
+	 * @return 0 if a new sample was written to out, negative errno if there is no sample or no barometer
+	 */
 	int (*read_pressure)(const struct system_calls_imu *self, uint32_t *out);
 	int (*read_temperature)(const struct system_calls_imu *self, int16_t *out);
 };
@@ -76,6 +76,9 @@
 #define SDCARD_DMA_CHANNEL_TX               DMA1_Channel5
 #define SDCARD_DMA_CHANNEL_TX_COMPLETE_FLAG DMA1_FLAG_TC5
 
+// The F3 has the RAM for a bigger sector cache, which lets asyncfatfs build longer multi-block writes
+#define AFATFS_NUM_CACHE_SECTORS 16
+
 //#define USE_FLASHFS
 //#define USE_FLASH_M25P16
 
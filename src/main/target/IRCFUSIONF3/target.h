@@ -88,6 +88,8 @@
 #define M25P16_CS_GPIO          GPIOB
 #define M25P16_CS_PIN           GPIO_Pin_12
 #define M25P16_SPI_INSTANCE     SPI2
+#define M25P16_DMA_CHANNEL_TX               DMA1_Channel5
+#define M25P16_DMA_CHANNEL_TX_COMPLETE_FLAG DMA1_FLAG_TC5
 
 #define USE_ADC
 #define BOARD_HAS_VOLTAGE_DIVIDER
@@ -43,6 +43,9 @@
 //#define USE_FLASHFS
 //#define USE_FLASH_M25P16
 
+// SD card backed by an image file, see sitl/sdcard_sim.h
+#define USE_SDCARD
+
 #define USE_BEEPER 1
 #define LED0
 
@@ -150,7 +153,7 @@
 //#define GPS
 //#define GTUNE
 //#define SERIAL_RX
-//#define TELEMETRY
+#define TELEMETRY
 #define USE_SERVOS
 #define USE_CLI
 
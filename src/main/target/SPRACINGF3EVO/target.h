@@ -154,6 +154,9 @@
 #define SDCARD_DMA_CHANNEL_TX               DMA1_Channel5
 #define SDCARD_DMA_CHANNEL_TX_COMPLETE_FLAG DMA1_FLAG_TC5
 
+// The F3 has the RAM for a bigger sector cache, which lets asyncfatfs build longer multi-block writes
+#define AFATFS_NUM_CACHE_SECTORS 16
+
 #define MPU6500_CS_GPIO_CLK_PERIPHERAL   SPI1_GPIO_PERIPHERAL
 #define MPU6500_CS_GPIO                  SPI1_GPIO
 #define MPU6500_CS_PIN                   GPIO_Pin_9
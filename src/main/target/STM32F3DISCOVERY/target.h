@@ -96,6 +96,9 @@
 #define SDCARD_DMA_CHANNEL_TX               DMA1_Channel5
 #define SDCARD_DMA_CHANNEL_TX_COMPLETE_FLAG DMA1_FLAG_TC5
 
+// The F3 has the RAM for a bigger sector cache, which lets asyncfatfs build longer multi-block writes
+#define AFATFS_NUM_CACHE_SECTORS 16
+
 // Performance logging for SD card operations:
 // #define AFATFS_USE_INTROSPECTIVE_LOGGING
 
@@ -33,109 +33,84 @@
 
 #include <platform.h>
 
-#include "build_config.h"
-
 #include "common/maths.h"
-#include "common/axis.h"
-
-
-#include "drivers/system.h"
-#include "drivers/sensor.h"
-#include "drivers/accgyro.h"
-#include "drivers/serial.h"
-
-#include "sensors/acceleration.h"
-#include "sensors/battery.h"
-
-#include "io/serial.h"
-
-#include "flight/mixer.h"
-#include "flight/anglerate.h"
-#include "flight/failsafe.h"
-#include "flight/altitudehold.h"
-#include "flight/navigation.h"
+#include "common/utils.h"
 
 #include "telemetry/telemetry.h"
 #include "telemetry/ltm.h"
 
-// TODO: telemetry will be done after sitl serial interface
-#if 0
-#define TELEMETRY_LTM_INITIAL_PORT_MODE MODE_TX
-#define LTM_CYCLETIME   100
+#define LTM_HEADER_SIZE 3
+#define LTM_FRAME_SIZE(payload) (LTM_HEADER_SIZE + (payload) + 1)
 
-static serialPort_t *ltmPort;
-static serialPortConfig_t *portConfig;
-static bool ltmEnabled;
-static portSharing_e ltmPortSharing;
-static uint8_t ltm_crc;
+struct ltm_writer {
+	uint8_t *buf;
+	uint8_t pos;
+	uint8_t crc;
+};
 
-static void ltm_initialise_packet(uint8_t ltm_id)
+static void ltm_initialise_packet(struct ltm_writer *w, uint8_t *buf, uint8_t ltm_id)
 {
-    ltm_crc = 0;
-    serialWrite(ltmPort, '$');
-    serialWrite(ltmPort, 'T');
-    serialWrite(ltmPort, ltm_id);
+	w->buf = buf;
+	w->crc = 0;
+	w->buf[0] = '$';
+	w->buf[1] = 'T';
+	w->buf[2] = ltm_id;
+	w->pos = LTM_HEADER_SIZE;
 }
 
-static void ltm_serialise_8(uint8_t v)
+static void ltm_serialise_8(struct ltm_writer *w, uint8_t v)
 {
-    serialWrite(ltmPort, v);
-    ltm_crc ^= v;
+	w->buf[w->pos++] = v;
+	w->crc ^= v;
 }
 
-static void ltm_serialise_16(uint16_t v)
+static void ltm_serialise_16(struct ltm_writer *w, uint16_t v)
 {
-    ltm_serialise_8((uint8_t)v);
-    ltm_serialise_8((v >> 8));
+	ltm_serialise_8(w, (uint8_t)v);
+	ltm_serialise_8(w, (v >> 8));
 }
 
-static void ltm_serialise_32(uint32_t v)
+static void ltm_serialise_32(struct ltm_writer *w, uint32_t v)
 {
-    ltm_serialise_8((uint8_t)v);
-    ltm_serialise_8((v >> 8));
-    ltm_serialise_8((v >> 16));
-    ltm_serialise_8((v >> 24));
+	ltm_serialise_8(w, (uint8_t)v);
+	ltm_serialise_8(w, (v >> 8));
+	ltm_serialise_8(w, (v >> 16));
+	ltm_serialise_8(w, (v >> 24));
 }
 
-static void ltm_finalise(void)
+static int ltm_finalise(struct ltm_writer *w)
 {
-    serialWrite(ltmPort, ltm_crc);
+	w->buf[w->pos++] = w->crc;
+	return w->pos;
 }
 
 /*
  * GPS G-frame 5Hhz at > 2400 baud
  * LAT LON SPD ALT SAT/FIX
  */
-static void ltm_gframe(void)
+static int ltm_gframe(struct telemetry_port *port, const struct telemetry_state *state, uint8_t *buf)
 {
-#if defined(GPS)
-    uint8_t gps_fix_type = 0;
-    int32_t ltm_alt;
-
-    if (!sensors(SENSOR_GPS))
-        return;
-
-    if (!STATE(GPS_FIX))
-        gps_fix_type = 1;
-    else if (GPS_numSat < 5)
-        gps_fix_type = 2;
-    else
-        gps_fix_type = 3;
-
-    ltm_initialise_packet('G');
-    ltm_serialise_32(GPS_coord[LAT]);
-    ltm_serialise_32(GPS_coord[LON]);
-    ltm_serialise_8((uint8_t)(GPS_speed / 100));
-
-#if defined(BARO) || defined(SONAR)
-    ltm_alt = (sensors(SENSOR_SONAR) || sensors(SENSOR_BARO)) ? altitudeHoldGetEstimatedAltitude() : GPS_altitude * 100;
-#else
-    ltm_alt = GPS_altitude * 100;
-#endif
-    ltm_serialise_32(ltm_alt);
-    ltm_serialise_8((GPS_numSat << 2) | gps_fix_type);
-    ltm_finalise();
-#endif
+	(void)port;
+	struct ltm_writer w;
+	uint8_t gps_fix_type = 0;
+
+	if (!state->has_gps)
+		return 0;
+
+	if (!state->gps_fix)
+		gps_fix_type = 1;
+	else if (state->num_sat < 5)
+		gps_fix_type = 2;
+	else
+		gps_fix_type = 3;
+
+	ltm_initialise_packet(&w, buf, 'G');
+	ltm_serialise_32(&w, state->lat);
+	ltm_serialise_32(&w, state->lon);
+	ltm_serialise_8(&w, (uint8_t)(state->ground_speed / 100));
+	ltm_serialise_32(&w, state->gps_altitude);
+	ltm_serialise_8(&w, (state->num_sat << 2) | gps_fix_type);
+	return ltm_finalise(&w);
 }
 
 /*
@@ -148,53 +123,47 @@ static void ltm_gframe(void)
  *     11: Heading Hold / headFree, 12: Circle, 13: RTH, 14: FollowMe,
  *     15: LAND, 16:FlybyWireA, 17: FlybywireB, 18: Cruise, 19: Unknown
  */
-
-static void ltm_sframe(void)
+static int ltm_sframe(struct telemetry_port *port, const struct telemetry_state *state, uint8_t *buf)
 {
-    uint8_t lt_flightmode;
-    uint8_t lt_statemode;
-    if (FLIGHT_MODE(PASSTHRU_MODE))
-        lt_flightmode = 0;
-    else if (FLIGHT_MODE(GPS_HOME_MODE))
-        lt_flightmode = 13;
-    else if (FLIGHT_MODE(GPS_HOLD_MODE))
-        lt_flightmode = 9;
-    else if (FLIGHT_MODE(HEADFREE_MODE))
-        lt_flightmode = 4;
-    else if (FLIGHT_MODE(BARO_MODE))
-        lt_flightmode = 8;
-    else if (FLIGHT_MODE(ANGLE_MODE))
-        lt_flightmode = 2;
-    else if (FLIGHT_MODE(HORIZON_MODE))
-        lt_flightmode = 3;
-    else
-        lt_flightmode = 1;      // Rate mode
-
-    lt_statemode = (ARMING_FLAG(ARMED)) ? 1 : 0;
-    if (failsafeIsActive())
-        lt_statemode |= 2;
-    ltm_initialise_packet('S');
-    ltm_serialise_16(battery_get_voltage(&default_battery) * 100);    //vbat converted to mv
-    ltm_serialise_16(0);             //  current, not implemented
-    ltm_serialise_8((uint8_t)((rc_get_rssi() * 254) / 1023));        // scaled RSSI (uchar)
-    ltm_serialise_8(0);              // no airspeed
-    ltm_serialise_8((lt_flightmode << 2) | lt_statemode);
-    ltm_finalise();
+	(void)port;
+	struct ltm_writer w;
+	uint8_t lt_flightmode;
+	uint8_t lt_statemode;
+
+	switch (state->flight_mode) {
+		case TELEMETRY_MODE_ANGLE: lt_flightmode = 2; break;
+		case TELEMETRY_MODE_HORIZON: lt_flightmode = 3; break;
+		case TELEMETRY_MODE_ALTHOLD: lt_flightmode = 8; break;
+		case TELEMETRY_MODE_HEADFREE: lt_flightmode = 11; break;
+		case TELEMETRY_MODE_RATE:
+		default: lt_flightmode = 1; break;
+	}
+
+	lt_statemode = (state->armed) ? 1 : 0;
+	if (state->failsafe)
+		lt_statemode |= 2;
+	ltm_initialise_packet(&w, buf, 'S');
+	ltm_serialise_16(&w, state->vbat * 100);    //vbat converted to mv
+	ltm_serialise_16(&w, (uint16_t)constrain(state->mah_drawn, 0, 0xFFFF));
+	ltm_serialise_8(&w, (uint8_t)((state->rssi * 254) / 1023));        // scaled RSSI (uchar)
+	ltm_serialise_8(&w, 0);              // no airspeed
+	ltm_serialise_8(&w, (lt_flightmode << 2) | lt_statemode);
+	return ltm_finalise(&w);
 }
 
 /*
  * Attitude A-frame - 10 Hz at > 2400 baud
  *  PITCH ROLL HEADING
  */
-static void ltm_aframe(void)
+static int ltm_aframe(struct telemetry_port *port, const struct telemetry_state *state, uint8_t *buf)
 {
-    ltm_initialise_packet('A');
-	/* TODO: fix this after refactoring
-    ltm_serialise_16(DECIDEGREES_TO_DEGREES(ins_get_pitch_dd(&default_ins)));
-    ltm_serialise_16(DECIDEGREES_TO_DEGREES(ins_get_roll_dd(&default_ins)));
-    ltm_serialise_16(DECIDEGREES_TO_DEGREES(ins_get_yaw_dd(&default_ins)));
-    ltm_finalise();
-	*/
+	(void)port;
+	struct ltm_writer w;
+	ltm_initialise_packet(&w, buf, 'A');
+	ltm_serialise_16(&w, state->pitch / 10);
+	ltm_serialise_16(&w, state->roll / 10);
+	ltm_serialise_16(&w, state->yaw / 10);
+	return ltm_finalise(&w);
 }
 
 /*
@@ -202,87 +171,33 @@ static void ltm_aframe(void)
  *  This frame will be ignored by Ghettostation, but processed by GhettOSD if it is used as standalone onboard OSD
  *  home pos, home alt, direction to home
  */
-static void ltm_oframe(void)
-{
-    ltm_initialise_packet('O');
-#if defined(GPS)
-    ltm_serialise_32(GPS_home[LAT]);
-    ltm_serialise_32(GPS_home[LON]);
-#else
-    ltm_serialise_32(0);
-    ltm_serialise_32(0);
-#endif
-    ltm_serialise_32(0);                // Don't have GPS home altitude
-    ltm_serialise_8(1);                 // OSD always ON
-    ltm_serialise_8(STATE(GPS_FIX_HOME) ? 1 : 0);
-    ltm_finalise();
-}
-
-static void process_ltm(void)
+static int ltm_oframe(struct telemetry_port *port, const struct telemetry_state *state, uint8_t *buf)
 {
-    static uint8_t ltm_scheduler;
-    ltm_aframe();
-    if (ltm_scheduler & 1)
-        ltm_gframe();
-    else
-        ltm_sframe();
-    if (ltm_scheduler == 0)
-        ltm_oframe();
-    ltm_scheduler++;
-    ltm_scheduler %= 10;
+	(void)port;
+	(void)state;
+	struct ltm_writer w;
+	ltm_initialise_packet(&w, buf, 'O');
+	// TODO: no gps home position yet
+	ltm_serialise_32(&w, 0);
+	ltm_serialise_32(&w, 0);
+	ltm_serialise_32(&w, 0);                // Don't have GPS home altitude
+	ltm_serialise_8(&w, 1);                 // OSD always ON
+	ltm_serialise_8(&w, 0);
+	return ltm_finalise(&w);
 }
 
-void handleLtmTelemetry(void)
-{
-    static uint32_t ltm_lastCycleTime;
-    uint32_t now;
-    if (!ltmEnabled)
-        return;
-    if (!ltmPort)
-        return;
-    now = millis();
-    if ((now - ltm_lastCycleTime) >= LTM_CYCLETIME) {
-        process_ltm();
-        ltm_lastCycleTime = now;
-    }
-}
-
-void freeLtmTelemetryPort(void)
-{
-    closeSerialPort(ltmPort);
-    ltmPort = NULL;
-    ltmEnabled = false;
-}
-
-void initLtmTelemetry(void)
-{
-    portConfig = findSerialPortConfig(FUNCTION_TELEMETRY_LTM);
-    ltmPortSharing = determinePortSharing(portConfig, FUNCTION_TELEMETRY_LTM);
-}
-
-void configureLtmTelemetryPort(void)
-{
-    if (!portConfig) {
-        return;
-    }
-    baudRate_e baudRateIndex = portConfig->telemetry_baudrateIndex;
-    if (baudRateIndex == BAUD_AUTO) {
-        baudRateIndex = BAUD_19200;
-    }
-    ltmPort = openSerialPort(portConfig->identifier, FUNCTION_TELEMETRY_LTM, NULL, baudRates[baudRateIndex], TELEMETRY_LTM_INITIAL_PORT_MODE, SERIAL_NOT_INVERTED);
-    if (!ltmPort)
-        return;
-    ltmEnabled = true;
-}
-
-void checkLtmTelemetryState(void)
-{
-    bool newTelemetryEnabledValue = telemetryDetermineEnabledState(ltmPortSharing);
-    if (newTelemetryEnabledValue == ltmEnabled)
-        return;
-    if (newTelemetryEnabledValue)
-        configureLtmTelemetryPort();
-    else
-        freeLtmTelemetryPort();
-}
-#endif
+// attitude matters most to a ground station so it is the frame we keep when the link is slow
+static const struct telemetry_message ltm_messages[] = {
+	{ .priority = 0, .period_ms = 100, .size = LTM_FRAME_SIZE(6), .encode = ltm_aframe },
+	{ .priority = 1, .period_ms = 200, .size = LTM_FRAME_SIZE(7), .encode = ltm_sframe },
+	{ .priority = 1, .period_ms = 200, .size = LTM_FRAME_SIZE(14), .encode = ltm_gframe },
+	{ .priority = 2, .period_ms = 1000, .size = LTM_FRAME_SIZE(14), .encode = ltm_oframe },
+};
+
+const struct telemetry_protocol telemetry_ltm = {
+	.name = "LTM",
+	.function = FUNCTION_TELEMETRY_LTM,
+	.default_baudrate = 19200,
+	.messages = ltm_messages,
+	.num_messages = ARRAYLEN(ltm_messages)
+};
@@ -1,6 +1,4 @@
 /*
- * ltm.h
- *
  * This file is part of Ninjaflight.
  *
  * Ninjaflight is free software: you can redistribute it and/or modify
@@ -17,14 +15,9 @@
  * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#ifndef TELEMETRY_LTM_H_
-#define TELEMETRY_LTM_H_
-
-void initLtmTelemetry(void);
-void handleLtmTelemetry(void);
-void checkLtmTelemetryState(void);
+#pragma once
 
-void freeLtmTelemetryPort(void);
-void configureLtmTelemetryPort(void);
+struct telemetry_protocol;
 
-#endif /* TELEMETRY_LTM_H_ */
+//! LightTelemetry frames for ground osd, ground station hud and antenna trackers
+extern const struct telemetry_protocol telemetry_ltm;
@@ -16,535 +16,450 @@
  */
 
 /*
- * telemetry_mavlink.c
+ * MAVLink v2 telemetry and parameter endpoint.
  *
- * Author: Konstantin Sharlaimov
+ * Streams are sent through the telemetry scheduler at the rates set in the
+ * config. The gcs can list, read and write every variable of the cli settings
+ * table as a mavlink parameter. Parameter changes are made to the running
+ * config and are stored with the usual save command.
+ *
+ * The bundled headers only implement v1 framing so the v2 frame is put
+ * together here. Message payloads and crc extras still come from the headers.
  */
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <math.h>
 
-#include "platform.h"
-
-#include "build_config.h"
+#include <platform.h>
 
 #include "common/maths.h"
-#include "common/axis.h"
-#include "common/color.h"
+#include "common/utils.h"
 
 #include "config/config.h"
-#include "config/feature.h"
-
-#include "drivers/system.h"
-#include "drivers/sensor.h"
-#include "drivers/accgyro.h"
-#include "drivers/serial.h"
-#include "drivers/pwm_rx.h"
-
-#include "io/serial.h"
-#include "io/ledstrip.h"
-
-#include "sensors/acceleration.h"
-#include "sensors/gyro.h"
-#include "sensors/barometer.h"
-#include "sensors/boardalignment.h"
-#include "sensors/battery.h"
-
-#include "rx/rx.h"
-
-#include "flight/mixer.h"
-#include "flight/anglerate.h"
-#include "flight/failsafe.h"
-#include "flight/altitudehold.h"
-#include "flight/navigation.h"
 
 #include "telemetry/telemetry.h"
 #include "telemetry/mavlink.h"
 
 #include "mavlink/common/mavlink.h"
 
-#include "ninjaflight.h"
+#include "system_calls.h"
+#include "cli.h"
+
+#define MAVLINK_STX_V1 0xfe
+#define MAVLINK_STX_V2 0xfd
+#define MAVLINK_V1_HEADER_SIZE 6
+#define MAVLINK_IFLAG_SIGNED 0x01
+#define MAVLINK_SIGNATURE_SIZE 13
+#define MAVLINK_PARAM_ID_SIZE 16
+#define MAVLINK_COMPONENT_ID 1
+
+typedef enum {
+	MAVLINK_RX_IDLE = 0,
+	MAVLINK_RX_HEADER,
+	MAVLINK_RX_PAYLOAD,
+	MAVLINK_RX_CRC,
+	MAVLINK_RX_SIGNATURE
+} mavlink_rx_state_t;
+
+// same order as cli_var_type_t
+static const uint8_t mavlink_param_types[] = {
+	MAV_PARAM_TYPE_UINT8,
+	MAV_PARAM_TYPE_INT8,
+	MAV_PARAM_TYPE_UINT16,
+	MAV_PARAM_TYPE_INT16,
+	MAV_PARAM_TYPE_UINT32,
+	MAV_PARAM_TYPE_REAL32
+};
 
-// TODO: reenable telemetry after adding sitl serial ports
-#if 0
-#define TELEMETRY_MAVLINK_INITIAL_PORT_MODE MODE_TX
-#define TELEMETRY_MAVLINK_MAXRATE 50
-#define TELEMETRY_MAVLINK_DELAY ((1000 * 1000) / TELEMETRY_MAVLINK_MAXRATE)
+int mavlink_pack_v2(uint8_t *buf, uint8_t seq, uint8_t sysid, uint8_t compid, uint32_t msgid, uint8_t crc_extra, const void *payload, uint8_t size){
+	// v2 drops trailing zeros but always keeps the first payload byte
+	const uint8_t *data = (const uint8_t*)payload;
+	while(size > 1 && data[size - 1] == 0)
+		size--;
+
+	buf[0] = MAVLINK_STX_V2;
+	buf[1] = size;
+	buf[2] = 0; // incompat flags
+	buf[3] = 0; // compat flags
+	buf[4] = seq;
+	buf[5] = sysid;
+	buf[6] = compid;
+	buf[7] = msgid & 0xff;
+	buf[8] = (msgid >> 8) & 0xff;
+	buf[9] = (msgid >> 16) & 0xff;
+	memcpy(buf + MAVLINK_V2_HEADER_SIZE, data, size);
+
+	uint16_t crc;
+	crc_init(&crc);
+	for(int c = 1; c < MAVLINK_V2_HEADER_SIZE + size; c++)
+		crc_accumulate(buf[c], &crc);
+	crc_accumulate(crc_extra, &crc);
+	buf[MAVLINK_V2_HEADER_SIZE + size] = crc & 0xff;
+	buf[MAVLINK_V2_HEADER_SIZE + size + 1] = crc >> 8;
+	return MAVLINK_V2_FRAME_SIZE(size);
+}
 
+static uint8_t _mavlink_sysid(const struct telemetry_port *port){
+	return port->config->telemetry.mavlink_sysid;
+}
 
-static serialPort_t *mavlinkPort = NULL;
-static serialPortConfig_t *portConfig;
+static int _mavlink_send(struct telemetry_port *port, uint8_t *buf, uint32_t msgid, uint8_t crc_extra, const void *payload, uint8_t size){
+	return mavlink_pack_v2(buf, port->seq++, _mavlink_sysid(port), MAVLINK_COMPONENT_ID, msgid, crc_extra, payload, size);
+}
 
-static bool mavlinkTelemetryEnabled =  false;
-static portSharing_e mavlinkPortSharing;
+static int _mavlink_heartbeat(struct telemetry_port *port, const struct telemetry_state *state, uint8_t *buf){
+	mavlink_heartbeat_t msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.custom_mode = state->flight_mode;
+	msg.type = MAV_TYPE_QUADROTOR;
+	msg.autopilot = MAV_AUTOPILOT_GENERIC;
+	msg.base_mode = MAV_MODE_FLAG_CUSTOM_MODE_ENABLED | MAV_MODE_FLAG_MANUAL_INPUT_ENABLED;
+	if(state->flight_mode == TELEMETRY_MODE_ANGLE || state->flight_mode == TELEMETRY_MODE_HORIZON)
+		msg.base_mode |= MAV_MODE_FLAG_STABILIZE_ENABLED;
+	if(state->armed)
+		msg.base_mode |= MAV_MODE_FLAG_SAFETY_ARMED;
+	if(state->failsafe)
+		msg.system_status = MAV_STATE_CRITICAL;
+	else
+		msg.system_status = (state->armed)?MAV_STATE_ACTIVE:MAV_STATE_STANDBY;
+	msg.mavlink_version = MAVLINK_VERSION;
+	return _mavlink_send(port, buf, MAVLINK_MSG_ID_HEARTBEAT, MAVLINK_MSG_ID_HEARTBEAT_CRC, &msg, MAVLINK_MSG_ID_HEARTBEAT_LEN);
+}
 
-/* MAVLink datastream rates in Hz */
-static const uint8_t mavRates[] = {
-    //[MAV_DATA_STREAM_RAW_SENSORS] = 2, //2Hz
-    [MAV_DATA_STREAM_EXTENDED_STATUS] = 2, //2Hz
-    [MAV_DATA_STREAM_RC_CHANNELS] = 5, //5Hz
-    [MAV_DATA_STREAM_POSITION] = 2, //2Hz
-    [MAV_DATA_STREAM_EXTRA1] = 10, //10Hz
-    [MAV_DATA_STREAM_EXTRA2] = 10 //2Hz
-};
+static int _mavlink_attitude(struct telemetry_port *port, const struct telemetry_state *state, uint8_t *buf){
+	float cr = cos_approx(DECIDEGREES_TO_RADIANS(state->roll) * 0.5f);
+	float sr = sin_approx(DECIDEGREES_TO_RADIANS(state->roll) * 0.5f);
+	float cp = cos_approx(DECIDEGREES_TO_RADIANS(state->pitch) * 0.5f);
+	float sp = sin_approx(DECIDEGREES_TO_RADIANS(state->pitch) * 0.5f);
+	float cy = cos_approx(DECIDEGREES_TO_RADIANS(state->yaw) * 0.5f);
+	float sy = sin_approx(DECIDEGREES_TO_RADIANS(state->yaw) * 0.5f);
+
+	mavlink_attitude_quaternion_t msg;
+	msg.time_boot_ms = state->timestamp / 1000;
+	msg.q1 = cr * cp * cy + sr * sp * sy;
+	msg.q2 = sr * cp * cy - cr * sp * sy;
+	msg.q3 = cr * sp * cy + sr * cp * sy;
+	msg.q4 = cr * cp * sy - sr * sp * cy;
+	msg.rollspeed = DECIDEGREES_TO_RADIANS(state->gyr[0]);
+	msg.pitchspeed = DECIDEGREES_TO_RADIANS(state->gyr[1]);
+	msg.yawspeed = DECIDEGREES_TO_RADIANS(state->gyr[2]);
+	return _mavlink_send(port, buf, MAVLINK_MSG_ID_ATTITUDE_QUATERNION, MAVLINK_MSG_ID_ATTITUDE_QUATERNION_CRC, &msg, MAVLINK_MSG_ID_ATTITUDE_QUATERNION_LEN);
+}
+
+static int _mavlink_imu(struct telemetry_port *port, const struct telemetry_state *state, uint8_t *buf){
+	mavlink_highres_imu_t msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.time_usec = (uint32_t)state->timestamp;
+	msg.xacc = state->acc[0] * SYSTEM_ACCEL_SCALE;
+	msg.yacc = state->acc[1] * SYSTEM_ACCEL_SCALE;
+	msg.zacc = state->acc[2] * SYSTEM_ACCEL_SCALE;
+	msg.xgyro = DECIDEGREES_TO_RADIANS(state->gyr[0]);
+	msg.ygyro = DECIDEGREES_TO_RADIANS(state->gyr[1]);
+	msg.zgyro = DECIDEGREES_TO_RADIANS(state->gyr[2]);
+	msg.pressure_alt = state->altitude * 0.01f;
+	// accelerometer, gyro and pressure altitude
+	msg.fields_updated = 0x003f | (1 << 11);
+	return _mavlink_send(port, buf, MAVLINK_MSG_ID_HIGHRES_IMU, MAVLINK_MSG_ID_HIGHRES_IMU_CRC, &msg, MAVLINK_MSG_ID_HIGHRES_IMU_LEN);
+}
 
-#define MAXSTREAMS (sizeof(mavRates) / sizeof(mavRates[0]))
-
-static uint8_t mavTicks[MAXSTREAMS];
-static mavlink_message_t mavMsg;
-static uint8_t mavBuffer[MAVLINK_MAX_PACKET_LEN];
-static uint32_t lastMavlinkMessage = 0;
-
-static int mavlinkStreamTrigger(enum MAV_DATA_STREAM streamNum)
-{
-    uint8_t rate = (uint8_t) mavRates[streamNum];
-    if (rate == 0) {
-        return 0;
-    }
-
-    if (mavTicks[streamNum] == 0) {
-        // we're triggering now, setup the next trigger point
-        if (rate > TELEMETRY_MAVLINK_MAXRATE) {
-            rate = TELEMETRY_MAVLINK_MAXRATE;
-        }
-
-        mavTicks[streamNum] = (TELEMETRY_MAVLINK_MAXRATE / rate);
-        return 1;
-    }
-
-    // count down at TASK_RATE_HZ
-    mavTicks[streamNum]--;
-    return 0;
+static int _mavlink_servo_output(struct telemetry_port *port, const struct telemetry_state *state, uint8_t *buf){
+	mavlink_servo_output_raw_t msg;
+	msg.time_usec = (uint32_t)state->timestamp;
+	msg.servo1_raw = state->motors[0];
+	msg.servo2_raw = state->motors[1];
+	msg.servo3_raw = state->motors[2];
+	msg.servo4_raw = state->motors[3];
+	msg.servo5_raw = state->motors[4];
+	msg.servo6_raw = state->motors[5];
+	msg.servo7_raw = state->motors[6];
+	msg.servo8_raw = state->motors[7];
+	msg.port = 0;
+	return _mavlink_send(port, buf, MAVLINK_MSG_ID_SERVO_OUTPUT_RAW, MAVLINK_MSG_ID_SERVO_OUTPUT_RAW_CRC, &msg, MAVLINK_MSG_ID_SERVO_OUTPUT_RAW_LEN);
 }
 
+static int _mavlink_position(struct telemetry_port *port, const struct telemetry_state *state, uint8_t *buf){
+	if(!state->has_gps)
+		return 0;
+
+	float course = DECIDEGREES_TO_RADIANS(state->ground_course);
+	int16_t heading = state->yaw % 3600;
+	if(heading < 0)
+		heading += 3600;
+
+	mavlink_global_position_int_t msg;
+	msg.time_boot_ms = state->timestamp / 1000;
+	msg.lat = state->lat;
+	msg.lon = state->lon;
+	msg.alt = state->gps_altitude * 10;
+	msg.relative_alt = state->altitude * 10;
+	msg.vx = lrintf(state->ground_speed * cos_approx(course));
+	msg.vy = lrintf(state->ground_speed * sin_approx(course));
+	msg.vz = -state->vario;
+	msg.hdg = heading * 10;
+	return _mavlink_send(port, buf, MAVLINK_MSG_ID_GLOBAL_POSITION_INT, MAVLINK_MSG_ID_GLOBAL_POSITION_INT_CRC, &msg, MAVLINK_MSG_ID_GLOBAL_POSITION_INT_LEN);
+}
 
-static void mavlinkSerialWrite(uint8_t * buf, uint16_t length)
-{
-    for (int i = 0; i < length; i++)
-        serialWrite(mavlinkPort, buf[i]);
+//! sends one queued or listed parameter
+static int _mavlink_param_value(struct telemetry_port *port, const struct telemetry_state *state, uint8_t *buf){
+	(void)state;
+	struct mavlink_port *self = &port->priv.mavlink;
+	uint16_t index;
+
+	// single requests go before the rest of a list transfer
+	if(self->param_queue_len){
+		index = self->param_queue[0];
+		self->param_queue_len--;
+		memmove(self->param_queue, self->param_queue + 1, self->param_queue_len * sizeof(self->param_queue[0]));
+	} else if(self->param_remaining){
+		index = self->param_next++;
+		self->param_remaining--;
+	} else {
+		return 0;
+	}
+
+	mavlink_param_value_t msg;
+	memset(&msg, 0, sizeof(msg));
+	if(cli_var_get(port->config, index, &msg.param_value) < 0)
+		return 0;
+	const char *name = cli_var_name(index);
+	memcpy(msg.param_id, name, MIN(strlen(name), MAVLINK_PARAM_ID_SIZE));
+	msg.param_count = cli_var_count();
+	msg.param_index = index;
+	msg.param_type = mavlink_param_types[cli_var_type(index)];
+	return _mavlink_send(port, buf, MAVLINK_MSG_ID_PARAM_VALUE, MAVLINK_MSG_ID_PARAM_VALUE_CRC, &msg, MAVLINK_MSG_ID_PARAM_VALUE_LEN);
 }
 
-void freeMAVLinkTelemetryPort(void)
-{
-    closeSerialPort(mavlinkPort);
-    mavlinkPort = NULL;
-    mavlinkTelemetryEnabled = false;
+static void _mavlink_queue_param(struct mavlink_port *self, uint16_t index){
+	for(int c = 0; c < self->param_queue_len; c++){
+		if(self->param_queue[c] == index)
+			return;
+	}
+	// the gcs retries requests it does not get an answer to
+	if(self->param_queue_len < MAVLINK_PARAM_QUEUE_SIZE)
+		self->param_queue[self->param_queue_len++] = index;
 }
 
-void initMAVLinkTelemetry(void)
-{
-    portConfig = findSerialPortConfig(FUNCTION_TELEMETRY_MAVLINK);
-    mavlinkPortSharing = determinePortSharing(portConfig, FUNCTION_TELEMETRY_MAVLINK);
+//! finds a parameter by its mavlink id which is not terminated when it is 16 chars long
+static int _mavlink_find_param(const char *id){
+	size_t len = strnlen(id, MAVLINK_PARAM_ID_SIZE);
+	int index = cli_var_find(id, len);
+	if(index >= 0 || len < MAVLINK_PARAM_ID_SIZE)
+		return index;
+
+	// longer names are cut to 16 chars, accept them as long as the prefix is unique
+	int found = -ENOENT;
+	for(uint16_t c = 0; c < cli_var_count(); c++){
+		if(strncasecmp(cli_var_name(c), id, len) != 0)
+			continue;
+		if(found >= 0)
+			return -ENOENT;
+		found = c;
+	}
+	return found;
 }
 
-void configureMAVLinkTelemetryPort(void)
-{
-    if (!portConfig) {
-        return;
-    }
-
-    baudRate_e baudRateIndex = portConfig->telemetry_baudrateIndex;
-    if (baudRateIndex == BAUD_AUTO) {
-        // default rate for minimOSD
-        baudRateIndex = BAUD_57600;
-    }
-    
-    mavlinkPort = openSerialPort(portConfig->identifier, FUNCTION_TELEMETRY_MAVLINK, NULL, baudRates[baudRateIndex], TELEMETRY_MAVLINK_INITIAL_PORT_MODE, SERIAL_NOT_INVERTED);
-
-    if (!mavlinkPort) {
-        return;
-    }
-
-    mavlinkTelemetryEnabled = true;
+static bool _mavlink_is_target(const struct telemetry_port *port, uint8_t target_system){
+	return target_system == 0 || target_system == _mavlink_sysid(port);
 }
 
-void checkMAVLinkTelemetryState(void)
-{
-    bool newTelemetryEnabledValue = telemetryDetermineEnabledState(mavlinkPortSharing);
+static int _mavlink_command_ack(struct telemetry_port *port, const struct telemetry_state *state, uint8_t *buf){
+	(void)state;
+	struct mavlink_port *self = &port->priv.mavlink;
+	if(!self->ack_pending)
+		return 0;
+	self->ack_pending = false;
+	mavlink_command_ack_t msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.command = self->ack_command;
+	msg.result = self->ack_result;
+	return _mavlink_send(port, buf, MAVLINK_MSG_ID_COMMAND_ACK, MAVLINK_MSG_ID_COMMAND_ACK_CRC, &msg, MAVLINK_MSG_ID_COMMAND_ACK_LEN);
+}
 
-    if (newTelemetryEnabledValue == mavlinkTelemetryEnabled) {
-        return;
-    }
+static uint8_t _mavlink_command(struct telemetry_port *port, const struct telemetry_state *state, const mavlink_command_long_t *cmd){
+	switch(cmd->command){
+		case MAV_CMD_PREFLIGHT_STORAGE:
+			// writing flash stalls the cpu so it is only done on the ground
+			if(state->armed)
+				return MAV_RESULT_TEMPORARILY_REJECTED;
+			// parameters are always read from eeprom at boot so only writing is supported
+			if(lrintf(cmd->param1) != 1)
+				return MAV_RESULT_UNSUPPORTED;
+			port->save_requested = true;
+			return MAV_RESULT_ACCEPTED;
+		default:
+			return MAV_RESULT_UNSUPPORTED;
+	}
+}
 
-    if (newTelemetryEnabledValue)
-        configureMAVLinkTelemetryPort();
-    else
-        freeMAVLinkTelemetryPort();
+static void _mavlink_handle_message(struct telemetry_port *port, const struct telemetry_state *state, uint32_t msgid, const uint8_t *payload){
+	struct mavlink_port *self = &port->priv.mavlink;
+	switch(msgid){
+		case MAVLINK_MSG_ID_PARAM_REQUEST_LIST: {
+			mavlink_param_request_list_t msg;
+			memcpy(&msg, payload, MAVLINK_MSG_ID_PARAM_REQUEST_LIST_LEN);
+			if(!_mavlink_is_target(port, msg.target_system))
+				break;
+			self->param_next = 0;
+			self->param_remaining = cli_var_count();
+		} break;
+		case MAVLINK_MSG_ID_PARAM_REQUEST_READ: {
+			mavlink_param_request_read_t msg;
+			memcpy(&msg, payload, MAVLINK_MSG_ID_PARAM_REQUEST_READ_LEN);
+			if(!_mavlink_is_target(port, msg.target_system))
+				break;
+			int index = (msg.param_index >= 0)?msg.param_index:_mavlink_find_param(msg.param_id);
+			if(index >= 0 && index < cli_var_count())
+				_mavlink_queue_param(self, index);
+		} break;
+		case MAVLINK_MSG_ID_PARAM_SET: {
+			mavlink_param_set_t msg;
+			memcpy(&msg, payload, MAVLINK_MSG_ID_PARAM_SET_LEN);
+			if(!_mavlink_is_target(port, msg.target_system))
+				break;
+			int index = _mavlink_find_param(msg.param_id);
+			if(index < 0)
+				break;
+			// out of range values and changes while armed are not applied and the reply tells the gcs the value we kept
+			if(!state->armed)
+				cli_var_set(port->config, index, msg.param_value);
+			_mavlink_queue_param(self, index);
+		} break;
+		case MAVLINK_MSG_ID_COMMAND_LONG: {
+			mavlink_command_long_t msg;
+			memcpy(&msg, payload, MAVLINK_MSG_ID_COMMAND_LONG_LEN);
+			if(!_mavlink_is_target(port, msg.target_system))
+				break;
+			self->ack_command = msg.command;
+			self->ack_result = _mavlink_command(port, state, &msg);
+			self->ack_pending = true;
+		} break;
+		default:
+			break;
+	}
 }
 
-static void mavlinkSendSystemStatus(void)
-{
-    uint16_t msgLength;
-    
-    uint32_t onboardControlAndSensors = 35843;
-    
-    /*
-    onboard_control_sensors_present Bitmask
-    fedcba9876543210
-    1000110000000011    For all   = 35843
-    0001000000000100    With Mag  = 4100
-    0010000000001000    With Baro = 8200
-    0100000000100000    With GPS  = 16416
-    0000001111111111
-    */
-    
-    if (sensors(SENSOR_MAG))  onboardControlAndSensors |=  4100;
-    if (sensors(SENSOR_BARO)) onboardControlAndSensors |=  8200;
-    if (sensors(SENSOR_GPS))  onboardControlAndSensors |= 16416;
-    
-    mavlink_msg_sys_status_pack(0, 200, &mavMsg,
-        // onboard_control_sensors_present Bitmask showing which onboard controllers and sensors are present. 
-        //Value of 0: not present. Value of 1: present. Indices: 0: 3D gyro, 1: 3D acc, 2: 3D mag, 3: absolute pressure, 
-        // 4: differential pressure, 5: GPS, 6: optical flow, 7: computer vision position, 8: laser based position, 
-        // 9: external ground-truth (Vicon or Leica). Controllers: 10: 3D angular rate control 11: attitude stabilization, 
-        // 12: yaw position, 13: z/altitude control, 14: x/y position control, 15: motor outputs / control
-        onboardControlAndSensors,
-        // onboard_control_sensors_enabled Bitmask showing which onboard controllers and sensors are enabled
-        onboardControlAndSensors,
-        // onboard_control_sensors_health Bitmask showing which onboard controllers and sensors are operational or have an error.
-        onboardControlAndSensors & 1023,
-        // load Maximum usage in percent of the mainloop time, (0%: 0, 100%: 1000) should be always below 1000
-        0,
-        // voltage_battery Battery voltage, in millivolts (1 = 1 millivolt)
-        feature(FEATURE_VBAT) ? battery_get_voltage(&default_battery) * 100 : 0,
-        // current_battery Battery current, in 10*milliamperes (1 = 10 milliampere), -1: autopilot does not measure the current
-        feature(FEATURE_VBAT) ? battery_get_current(&default_battery) : -1,
-        // battery_remaining Remaining battery energy: (0%: 0, 100%: 100), -1: autopilot estimate the remaining battery
-        feature(FEATURE_VBAT) ? battery_get_remaining_percent(&default_battery) : 100,
-        // drop_rate_comm Communication drops in percent, (0%: 0, 100%: 10'000), (UART, I2C, SPI, CAN), dropped packets on all links (packets that were corrupted on reception on the MAV)
-        0,
-        // errors_comm Communication errors (UART, I2C, SPI, CAN), dropped packets on all links (packets that were corrupted on reception on the MAV)
-        0,
-        // errors_count1 Autopilot-specific errors
-        0,
-        // errors_count2 Autopilot-specific errors
-        0,
-        // errors_count3 Autopilot-specific errors
-        0,
-        // errors_count4 Autopilot-specific errors
-        0);
-    msgLength = mavlink_msg_to_send_buffer(mavBuffer, &mavMsg);
-    mavlinkSerialWrite(mavBuffer, msgLength);
+//! returns crc extra of messages we handle or -1 for messages we ignore
+static int _mavlink_crc_extra(uint32_t msgid){
+	switch(msgid){
+		case MAVLINK_MSG_ID_HEARTBEAT: return MAVLINK_MSG_ID_HEARTBEAT_CRC;
+		case MAVLINK_MSG_ID_PARAM_REQUEST_LIST: return MAVLINK_MSG_ID_PARAM_REQUEST_LIST_CRC;
+		case MAVLINK_MSG_ID_PARAM_REQUEST_READ: return MAVLINK_MSG_ID_PARAM_REQUEST_READ_CRC;
+		case MAVLINK_MSG_ID_PARAM_SET: return MAVLINK_MSG_ID_PARAM_SET_CRC;
+		case MAVLINK_MSG_ID_COMMAND_LONG: return MAVLINK_MSG_ID_COMMAND_LONG_CRC;
+		default: return -1;
+	}
 }
 
-static void mavlinkSendRCChannelsAndRSSI(void)
-{
-    uint16_t msgLength;
-    mavlink_msg_rc_channels_raw_pack(0, 200, &mavMsg,
-        // time_boot_ms Timestamp (milliseconds since system boot)
-        millis(),
-        // port Servo output port (set of 8 outputs = 1 port). Most MAVs will just use one, but this allows to encode more than 8 servos.
-        0,
-        // chan1_raw RC channel 1 value, in microseconds
-        (rxRuntimeConfig.channelCount >= 1) ? rc_get_channel_value(0) : 0,
-        // chan2_raw RC channel 2 value, in microseconds
-        (rxRuntimeConfig.channelCount >= 2) ? rc_get_channel_value(1) : 0,
-        // chan3_raw RC channel 3 value, in microseconds
-        (rxRuntimeConfig.channelCount >= 3) ? rc_get_channel_value(2) : 0,
-        // chan4_raw RC channel 4 value, in microseconds
-        (rxRuntimeConfig.channelCount >= 4) ? rc_get_channel_value(3) : 0,
-        // chan5_raw RC channel 5 value, in microseconds
-        (rxRuntimeConfig.channelCount >= 5) ? rc_get_channel_value(4) : 0,
-        // chan6_raw RC channel 6 value, in microseconds
-        (rxRuntimeConfig.channelCount >= 6) ? rc_get_channel_value(5) : 0,
-        // chan7_raw RC channel 7 value, in microseconds
-        (rxRuntimeConfig.channelCount >= 7) ? rc_get_channel_value(6) : 0,
-        // chan8_raw RC channel 8 value, in microseconds
-        (rxRuntimeConfig.channelCount >= 8) ? rc_get_channel_value(7) : 0,
-        // rssi Receive signal strength indicator, 0: 0%, 255: 100%
-        scaleRange(rc_get_rssi(), 0, 1023, 0, 255));
-    msgLength = mavlink_msg_to_send_buffer(mavBuffer, &mavMsg);
-    mavlinkSerialWrite(mavBuffer, msgLength);
+static void _mavlink_frame_done(struct telemetry_port *port, const struct telemetry_state *state){
+	struct mavlink_port *self = &port->priv.mavlink;
+	uint8_t len = self->rx_header[0];
+	uint32_t msgid;
+	if(self->rx_v2)
+		msgid = self->rx_header[6] | (self->rx_header[7] << 8) | ((uint32_t)self->rx_header[8] << 16);
+	else
+		msgid = self->rx_header[4];
+
+	int crc_extra = _mavlink_crc_extra(msgid);
+	if(crc_extra < 0 || len > MAVLINK_RX_PAYLOAD_SIZE)
+		return;
+	crc_accumulate(crc_extra, &self->rx_crc);
+	if(self->rx_crc != self->rx_crc_received){
+		self->rx_errors++;
+		return;
+	}
+	self->rx_frames++;
+
+	// v2 senders drop trailing zeros from the payload
+	memset(self->rx_payload + len, 0, MAVLINK_RX_PAYLOAD_SIZE - len);
+	_mavlink_handle_message(port, state, msgid, self->rx_payload);
 }
 
-#if defined(GPS)
-static void mavlinkSendPosition(void)
-{
-    uint16_t msgLength;
-    uint8_t gpsFixType = 0;
-    
-    if (!sensors(SENSOR_GPS))
-        return;
-
-    if (!STATE(GPS_FIX)) {
-        gpsFixType = 1;
-    }
-    else {
-        if (GPS_numSat < 5) {
-            gpsFixType = 2;
-        }
-        else {
-            gpsFixType = 3;
-        }
-    }
-        
-    mavlink_msg_gps_raw_int_pack(0, 200, &mavMsg,
-        // time_usec Timestamp (microseconds since UNIX epoch or microseconds since system boot)
-        micros(),
-        // fix_type 0-1: no fix, 2: 2D fix, 3: 3D fix. Some applications will not use the value of this field unless it is at least two, so always correctly fill in the fix.
-        gpsFixType,
-        // lat Latitude in 1E7 degrees
-        GPS_coord[LAT],
-        // lon Longitude in 1E7 degrees
-        GPS_coord[LON],
-        // alt Altitude in 1E3 meters (millimeters) above MSL
-        GPS_altitude * 1000,
-        // eph GPS HDOP horizontal dilution of position in cm (m*100). If unknown, set to: 65535
-        65535,
-        // epv GPS VDOP horizontal dilution of position in cm (m*100). If unknown, set to: 65535
-        65535,
-        // vel GPS ground speed (m/s * 100). If unknown, set to: 65535
-        GPS_speed,
-        // cog Course over ground (NOT heading, but direction of movement) in degrees * 100, 0.0..359.99 degrees. If unknown, set to: 65535
-        GPS_ground_course * 10,
-        // satellites_visible Number of satellites visible. If unknown, set to 255
-        GPS_numSat);
-    msgLength = mavlink_msg_to_send_buffer(mavBuffer, &mavMsg);
-    mavlinkSerialWrite(mavBuffer, msgLength);
-
-    // Global position
-    mavlink_msg_global_position_int_pack(0, 200, &mavMsg,
-        // time_usec Timestamp (microseconds since UNIX epoch or microseconds since system boot)
-        micros(),
-        // lat Latitude in 1E7 degrees
-        GPS_coord[LAT],
-        // lon Longitude in 1E7 degrees
-        GPS_coord[LON],
-        // alt Altitude in 1E3 meters (millimeters) above MSL
-        GPS_altitude * 1000,
-        // relative_alt Altitude above ground in meters, expressed as * 1000 (millimeters)
-#if defined(BARO) || defined(SONAR)
-        (sensors(SENSOR_SONAR) || sensors(SENSOR_BARO)) ? altitudeHoldGetEstimatedAltitude() * 10 : GPS_altitude * 1000,
-#else
-        GPS_altitude * 1000,
-#endif
-        // Ground X Speed (Latitude), expressed as m/s * 100
-        0,
-        // Ground Y Speed (Longitude), expressed as m/s * 100
-        0,
-        // Ground Z Speed (Altitude), expressed as m/s * 100
-        0,
-        // heading Current heading in degrees, in compass units (0..360, 0=north)
-        DECIDEGREES_TO_DEGREES(ins_get_yaw_dd(&default_ins))
-    );
-    msgLength = mavlink_msg_to_send_buffer(mavBuffer, &mavMsg);
-    mavlinkSerialWrite(mavBuffer, msgLength);
-
-    mavlink_msg_gps_global_origin_pack(0, 200, &mavMsg,
-        // latitude Latitude (WGS84), expressed as * 1E7
-        GPS_home[LAT],
-        // longitude Longitude (WGS84), expressed as * 1E7
-        GPS_home[LON],
-        // altitude Altitude(WGS84), expressed as * 1000
-        0); // FIXME
-    msgLength = mavlink_msg_to_send_buffer(mavBuffer, &mavMsg);
-    mavlinkSerialWrite(mavBuffer, msgLength);
+static void _mavlink_receive(struct telemetry_port *port, const struct telemetry_state *state, uint8_t ch){
+	struct mavlink_port *self = &port->priv.mavlink;
+	switch((mavlink_rx_state_t)self->rx_state){
+		case MAVLINK_RX_IDLE:
+			if(ch != MAVLINK_STX_V1 && ch != MAVLINK_STX_V2)
+				break;
+			self->rx_v2 = ch == MAVLINK_STX_V2;
+			self->rx_pos = 0;
+			crc_init(&self->rx_crc);
+			self->rx_state = MAVLINK_RX_HEADER;
+			break;
+		case MAVLINK_RX_HEADER:
+			self->rx_header[self->rx_pos++] = ch;
+			crc_accumulate(ch, &self->rx_crc);
+			if(self->rx_pos == ((self->rx_v2)?MAVLINK_V2_HEADER_SIZE:MAVLINK_V1_HEADER_SIZE) - 1){
+				self->rx_pos = 0;
+				self->rx_state = (self->rx_header[0])?MAVLINK_RX_PAYLOAD:MAVLINK_RX_CRC;
+			}
+			break;
+		case MAVLINK_RX_PAYLOAD:
+			// long payloads still go through the crc but are not stored
+			if(self->rx_pos < MAVLINK_RX_PAYLOAD_SIZE)
+				self->rx_payload[self->rx_pos] = ch;
+			crc_accumulate(ch, &self->rx_crc);
+			if(++self->rx_pos == self->rx_header[0]){
+				self->rx_pos = 0;
+				self->rx_state = MAVLINK_RX_CRC;
+			}
+			break;
+		case MAVLINK_RX_CRC:
+			if(self->rx_pos++ == 0){
+				self->rx_crc_received = ch;
+				break;
+			}
+			self->rx_crc_received |= (uint16_t)ch << 8;
+			_mavlink_frame_done(port, state);
+			self->rx_pos = 0;
+			if(self->rx_v2 && (self->rx_header[1] & MAVLINK_IFLAG_SIGNED))
+				self->rx_state = MAVLINK_RX_SIGNATURE;
+			else
+				self->rx_state = MAVLINK_RX_IDLE;
+			break;
+		case MAVLINK_RX_SIGNATURE:
+			// signing is not supported, the signature is skipped
+			if(++self->rx_pos == MAVLINK_SIGNATURE_SIZE)
+				self->rx_state = MAVLINK_RX_IDLE;
+			break;
+	}
 }
-#endif
-
-static void mavlinkSendAttitude(void)
-{
-    uint16_t msgLength;
-	/* TODO: fix this after refactoring
-    mavlink_msg_attitude_pack(0, 200, &mavMsg,
-        // time_boot_ms Timestamp (milliseconds since system boot)
-        millis(),
-        // roll Roll angle (rad)
-        DECIDEGREES_TO_RADIANS(ins_get_roll_dd(&default_ins)),
-        // pitch Pitch angle (rad)
-        DECIDEGREES_TO_RADIANS(-ins_get_pitch_dd(&default_ins)),
-        // yaw Yaw angle (rad)
-        DECIDEGREES_TO_RADIANS(ins_get_yaw_dd(&default_ins)),
-        // rollspeed Roll angular speed (rad/s)
-        0,
-        // pitchspeed Pitch angular speed (rad/s)
-        0,
-        // yawspeed Yaw angular speed (rad/s)
-        0);
-		*/
-    msgLength = mavlink_msg_to_send_buffer(mavBuffer, &mavMsg);
-    mavlinkSerialWrite(mavBuffer, msgLength);
+
+static uint8_t _mavlink_rate_attitude(const struct config *config){
+	return config->telemetry.mavlink_rate_att;
 }
 
-static void mavlinkSendHUDAndHeartbeat(void)
-{
-    uint16_t msgLength;
-	/*
-    float mavAltitude = 0;
-    float mavGroundSpeed = 0;
-    float mavAirSpeed = 0;
-*/
-#if defined(GPS)
-    // use ground speed if source available
-    if (sensors(SENSOR_GPS)) {
-        mavGroundSpeed = GPS_speed / 100.0;
-    }
-#endif
-    
-    // select best source for altitude
-#if defined(BARO) || defined(SONAR)
-    if (sensors(SENSOR_SONAR) || sensors(SENSOR_BARO)) {
-        // Baro or sonar generally is a better estimate of altitude than GPS MSL altitude
-        mavAltitude = altitudeHoldGetEstimatedAltitude() / 100.0;
-    }
-#if defined(GPS)
-    else if (sensors(SENSOR_GPS)) {
-        // No sonar or baro, just display altitude above MLS
-        mavAltitude = GPS_altitude;
-    }
-#endif
-#elif defined(GPS)
-    if (sensors(SENSOR_GPS)) {
-        // No sonar or baro, just display altitude above MLS
-        mavAltitude = GPS_altitude;
-    }
-#endif
-   	/* TODO: fix this after refactoring 
-    mavlink_msg_vfr_hud_pack(0, 200, &mavMsg,
-        // airspeed Current airspeed in m/s
-        mavAirSpeed,
-        // groundspeed Current ground speed in m/s
-        mavGroundSpeed,
-        // heading Current heading in degrees, in compass units (0..360, 0=north)
-        DECIDEGREES_TO_DEGREES(ins_get_yaw_dd(&default_ins)),
-        // throttle Current throttle setting in integer percent, 0 to 100
-        scaleRange(constrain(rc_get_channel_value(THROTTLE), PWM_RANGE_MIN, PWM_RANGE_MAX), PWM_RANGE_MIN, PWM_RANGE_MAX, 0, 100),
-        // alt Current altitude (MSL), in meters, if we have sonar or baro use them, otherwise use GPS (less accurate)
-        mavAltitude,
-        // climb Current climb rate in meters/second
-        0);
-	*/
-    msgLength = mavlink_msg_to_send_buffer(mavBuffer, &mavMsg);
-    mavlinkSerialWrite(mavBuffer, msgLength);
-
-    
-    uint8_t mavModes = MAV_MODE_FLAG_MANUAL_INPUT_ENABLED;
-    if (ARMING_FLAG(ARMED))
-        mavModes |= MAV_MODE_FLAG_SAFETY_ARMED;
-        
-    uint8_t mavSystemType;
-    switch(mixerConfig()->mixerMode)                               // Set system_type here
-    {
-        case MIXER_TRI:
-            mavSystemType = MAV_TYPE_TRICOPTER;
-            break;
-        case MIXER_QUADP:
-        case MIXER_QUADX:
-        case MIXER_Y4:
-        case MIXER_VTAIL4:
-            mavSystemType = MAV_TYPE_QUADROTOR;
-            break;
-        case MIXER_Y6:
-        case MIXER_HEX6:
-        case MIXER_HEX6X:
-            mavSystemType = MAV_TYPE_HEXAROTOR;
-            break;
-        case MIXER_OCTOX8:
-        case MIXER_OCTOFLATP:
-        case MIXER_OCTOFLATX:
-            mavSystemType = MAV_TYPE_OCTOROTOR;
-            break;
-        case MIXER_FLYING_WING:
-        case MIXER_AIRPLANE:
-            mavSystemType = MAV_TYPE_FIXED_WING;
-            break;
-        case MIXER_HELI_120_CCPM:
-        case MIXER_HELI_90_DEG:
-            mavSystemType = MAV_TYPE_HELICOPTER;
-            break;
-        default:
-            mavSystemType = MAV_TYPE_GENERIC;
-            break;
-    }    
-        
-    // Custom mode for compatibility with APM OSDs
-    uint8_t mavCustomMode = 1;  // Acro by default
-    
-    if (FLIGHT_MODE(ANGLE_MODE) || FLIGHT_MODE(HORIZON_MODE)) {
-        mavCustomMode = 0;      //Stabilize
-        mavModes |= MAV_MODE_FLAG_STABILIZE_ENABLED;
-    }
-    if (FLIGHT_MODE(BARO_MODE) || FLIGHT_MODE(SONAR_MODE))
-        mavCustomMode = 2;      //Alt Hold
-    if (FLIGHT_MODE(GPS_HOME_MODE))
-        mavCustomMode = 6;      //Return to Launch
-    if (FLIGHT_MODE(GPS_HOLD_MODE))
-        mavCustomMode = 16;     //Position Hold (Earlier called Hybrid)
-    
-    uint8_t mavSystemState = 0;
-    if (ARMING_FLAG(ARMED)) {
-        if (failsafeIsActive()) {
-            mavSystemState = MAV_STATE_CRITICAL;
-        }
-        else {
-            mavSystemState = MAV_STATE_ACTIVE;
-        }
-    }
-	/*
-	TODO: fix this after refactoring. Need to get this from instrument panel
-    else if (isCalibrating()) {
-        mavSystemState = MAV_STATE_CALIBRATING;
-    }
-	*/
-    else {
-        mavSystemState = MAV_STATE_STANDBY;
-    }
-    
-    mavlink_msg_heartbeat_pack(0, 200, &mavMsg,
-        // type Type of the MAV (quadrotor, helicopter, etc., up to 15 types, defined in MAV_TYPE ENUM)
-        mavSystemType,
-        // autopilot Autopilot type / class. defined in MAV_AUTOPILOT ENUM
-        MAV_AUTOPILOT_GENERIC,
-        // base_mode System mode bitfield, see MAV_MODE_FLAGS ENUM in mavlink/include/mavlink_types.h
-        mavModes,
-        // custom_mode A bitfield for use for autopilot-specific flags.
-        mavCustomMode,
-        // system_status System status flag, see MAV_STATE ENUM
-        mavSystemState);
-    msgLength = mavlink_msg_to_send_buffer(mavBuffer, &mavMsg);
-    mavlinkSerialWrite(mavBuffer, msgLength);
+static uint8_t _mavlink_rate_imu(const struct config *config){
+	return config->telemetry.mavlink_rate_imu;
 }
 
-static void processMAVLinkTelemetry(void)
-{
-    // is executed @ TELEMETRY_MAVLINK_MAXRATE rate
-    if (mavlinkStreamTrigger(MAV_DATA_STREAM_EXTENDED_STATUS)) {
-        mavlinkSendSystemStatus();
-    }
-    
-    if (mavlinkStreamTrigger(MAV_DATA_STREAM_RC_CHANNELS)) {
-        mavlinkSendRCChannelsAndRSSI();
-    }
-
-#ifdef GPS
-    if (mavlinkStreamTrigger(MAV_DATA_STREAM_POSITION)) {
-        mavlinkSendPosition();
-    }
-#endif
-
-    if (mavlinkStreamTrigger(MAV_DATA_STREAM_EXTRA1)) {
-        mavlinkSendAttitude();
-    }
-    
-    if (mavlinkStreamTrigger(MAV_DATA_STREAM_EXTRA2)) {
-        mavlinkSendHUDAndHeartbeat();
-    }
+static uint8_t _mavlink_rate_servo(const struct config *config){
+	return config->telemetry.mavlink_rate_servo;
 }
 
-void handleMAVLinkTelemetry(void)
-{
-    if (!mavlinkTelemetryEnabled) {
-        return;
-    }
-
-    if (!mavlinkPort) {
-        return;
-    }
-    
-    uint32_t now = micros();
-    if ((now - lastMavlinkMessage) >= TELEMETRY_MAVLINK_DELAY) {
-        processMAVLinkTelemetry();
-        lastMavlinkMessage = now;
-    }
+static uint8_t _mavlink_rate_position(const struct config *config){
+	return config->telemetry.mavlink_rate_pos;
 }
-#endif
+
+// heartbeat keeps the gcs connected and parameter replies keep its requests from timing out
+static const struct telemetry_message mavlink_messages[] = {
+	{ .priority = 0, .period_ms = 1000, .size = MAVLINK_V2_FRAME_SIZE(MAVLINK_MSG_ID_HEARTBEAT_LEN), .encode = _mavlink_heartbeat },
+	{ .priority = 1, .period_ms = 10, .size = MAVLINK_V2_FRAME_SIZE(MAVLINK_MSG_ID_PARAM_VALUE_LEN), .encode = _mavlink_param_value },
+	{ .priority = 1, .period_ms = 10, .size = MAVLINK_V2_FRAME_SIZE(MAVLINK_MSG_ID_COMMAND_ACK_LEN), .encode = _mavlink_command_ack },
+	{ .priority = 2, .size = MAVLINK_V2_FRAME_SIZE(MAVLINK_MSG_ID_ATTITUDE_QUATERNION_LEN), .encode = _mavlink_attitude, .rate_hz = _mavlink_rate_attitude },
+	{ .priority = 2, .size = MAVLINK_V2_FRAME_SIZE(MAVLINK_MSG_ID_HIGHRES_IMU_LEN), .encode = _mavlink_imu, .rate_hz = _mavlink_rate_imu },
+	{ .priority = 3, .size = MAVLINK_V2_FRAME_SIZE(MAVLINK_MSG_ID_SERVO_OUTPUT_RAW_LEN), .encode = _mavlink_servo_output, .rate_hz = _mavlink_rate_servo },
+	{ .priority = 3, .size = MAVLINK_V2_FRAME_SIZE(MAVLINK_MSG_ID_GLOBAL_POSITION_INT_LEN), .encode = _mavlink_position, .rate_hz = _mavlink_rate_position },
+};
+
+const struct telemetry_protocol telemetry_mavlink = {
+	.name = "MAVLINK",
+	.function = FUNCTION_TELEMETRY_MAVLINK,
+	.default_baudrate = 57600,
+	.messages = mavlink_messages,
+	.num_messages = ARRAYLEN(mavlink_messages),
+	.receive = _mavlink_receive
+};
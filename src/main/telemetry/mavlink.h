@@ -15,14 +15,49 @@
  * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#ifndef TELEMETRY_MAVLINK_H_
-#define TELEMETRY_MAVLINK_H_
+#pragma once
 
-void initMAVLinkTelemetry(void);
-void handleMAVLinkTelemetry(void);
-void checkMAVLinkTelemetryState(void);
+#include <stdbool.h>
+#include <stdint.h>
 
-void freeMAVLinkTelemetryPort(void);
-void configureMAVLinkTelemetryPort(void);
+//! header of a mavlink v2 frame including the start byte
+#define MAVLINK_V2_HEADER_SIZE 10
+#define MAVLINK_V2_FRAME_SIZE(payload) (MAVLINK_V2_HEADER_SIZE + (payload) + 2)
+//! incoming payloads longer than this are checked and dropped, all messages we handle fit
+#define MAVLINK_RX_PAYLOAD_SIZE 33
+//! parameter replies that can wait for bandwidth at the same time
+#define MAVLINK_PARAM_QUEUE_SIZE 4
 
-#endif /* TELEMETRY_MSP_H_ */
+//! per port state of the mavlink endpoint
+struct mavlink_port {
+	// receiver
+	uint8_t rx_state;
+	uint8_t rx_pos;
+	bool rx_v2;
+	uint8_t rx_header[9];
+	uint8_t rx_payload[MAVLINK_RX_PAYLOAD_SIZE];
+	uint16_t rx_crc;
+	uint16_t rx_crc_received;
+	uint32_t rx_frames;
+	uint32_t rx_errors;
+
+	// parameter transfer
+	uint16_t param_next;			//!< next parameter of a list transfer
+	uint16_t param_remaining;		//!< parameters left in the list transfer
+	uint16_t param_queue[MAVLINK_PARAM_QUEUE_SIZE];	//!< single parameters requested or changed by the gcs
+	uint8_t param_queue_len;
+
+	// reply to the last COMMAND_LONG
+	bool ack_pending;
+	uint16_t ack_command;
+	uint8_t ack_result;
+};
+
+struct telemetry_protocol;
+extern const struct telemetry_protocol telemetry_mavlink;
+
+/**
+ * Writes a mavlink v2 frame into buf. Trailing zeros of the payload are
+ * truncated as the v2 protocol allows. Returns the length of the frame.
+ */
+int mavlink_pack_v2(uint8_t *buf, uint8_t seq, uint8_t sysid, uint8_t compid, uint32_t msgid, uint8_t crc_extra, const void *payload, uint8_t size);
@@ -18,65 +18,227 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 
 #include <platform.h>
 
+#include "common/maths.h"
+#include "common/utils.h"
 #include "config/config.h"
 
 #include "drivers/serial.h"
-#include "drivers/serial_softserial.h"
 #include "io/serial.h"
 
-#include "rx/rx.h"
-
 #include "telemetry/telemetry.h"
-#include "telemetry/frsky.h"
-#include "telemetry/hott.h"
-#include "telemetry/smartport.h"
 #include "telemetry/ltm.h"
 #include "telemetry/mavlink.h"
 
-// TODO: telemetry
-#if 0
-void telemetryInit(void)
-{
-    initFrSkyTelemetry();
-    initHoTTTelemetry();
-    initSmartPortTelemetry();
-    initLtmTelemetry();
-    initMAVLinkTelemetry();
-    telemetryCheckState();
+/*
+ * Unified telemetry scheduler.
+ *
+ * The telemetry task hands us a snapshot of the vehicle state once per cycle.
+ * Each open port has a byte budget that refills at the rate the link can carry.
+ * Messages that are due are sent highest priority first for as long as they
+ * fit in the budget, so a slow link drops low priority frames instead of
+ * backing up. The total amount written per cycle is bounded as well so that
+ * the task never holds up the rx task behind it.
+ */
+
+static const struct telemetry_protocol * const telemetry_protocols[] = {
+	&telemetry_ltm,
+	&telemetry_mavlink,
+};
+
+// elapsed time is clamped so that the byte-microsecond product stays within 32 bits
+#define TELEMETRY_MAX_REFILL_US 100000
+
+void telemetry_init(struct telemetry *self, const struct system_calls *system, struct config *config){
+	memset(self, 0, sizeof(*self));
+	self->system = system;
+	self->config = config;
+}
+
+int telemetry_add_port(struct telemetry *self, const struct telemetry_protocol *proto, serialPort_t *serial, uint32_t baudrate){
+	if(!serial || !proto || proto->num_messages > TELEMETRY_MAX_MESSAGES || baudrate < 10)
+		return -EINVAL;
+	if(self->num_ports == TELEMETRY_MAX_PORTS)
+		return -ENOMEM;
+
+	struct telemetry_port *port = &self->ports[self->num_ports];
+	memset(port, 0, sizeof(*port));
+	port->proto = proto;
+	port->serial = serial;
+	port->config = self->config;
+	// 8N1 so ten bits per byte
+	port->bytes_per_sec = MIN(baudrate / 10, 0xffff);
+
+	// allow bursts of up to 50ms worth of data but always at least the largest frame
+	uint16_t largest = 0;
+	for(int c = 0; c < proto->num_messages; c++)
+		largest = MAX(largest, proto->messages[c].size);
+	if(largest > TELEMETRY_MAX_FRAME_SIZE)
+		return -EMSGSIZE;
+	port->burst = MAX(largest, port->bytes_per_sec / 20);
+	port->budget = port->burst;
+
+	sys_micros_t now = sys_micros(self->system);
+	port->last_refill = now;
+	for(int c = 0; c < proto->num_messages; c++)
+		port->due[c] = now;
+
+	self->num_ports++;
+	return 0;
+}
+
+static void _port_failed(struct telemetry *self, serialPortIdentifier_e identifier, int error){
+	if(self->num_failed == ARRAYLEN(self->failed))
+		return;
+	self->failed[self->num_failed].identifier = identifier;
+	self->failed[self->num_failed].error = error;
+	self->num_failed++;
 }
 
-bool telemetryDetermineEnabledState(portSharing_e portSharing)
-{
-    bool enabled = portSharing == PORTSHARING_NOT_SHARED;
+int telemetry_open_ports(struct telemetry *self){
+	const struct serial_config *serial = &self->config->serial;
+	int failed = 0;
+	self->num_failed = 0;
+	for(unsigned p = 0; p < ARRAYLEN(telemetry_protocols); p++){
+		const struct telemetry_protocol *proto = telemetry_protocols[p];
+		for(const struct serial_port_config *pc = findSerialPortConfig(serial, proto->function);
+			pc != NULL;
+			pc = findNextSerialPortConfig(serial, proto->function)){
+			// TODO: ports shared with msp are not switched over to telemetry yet
+			if(isSerialPortOpen(pc) || determinePortSharing(pc, proto->function) == PORTSHARING_SHARED)
+				continue;
+			uint32_t baudrate = (pc->telemetry_baudrateIndex == BAUD_AUTO)?proto->default_baudrate:baudRates[pc->telemetry_baudrateIndex];
+			serialPort_t *port = openSerialPort(pc->identifier, proto->function, NULL, baudrate, (proto->receive)?MODE_RXTX:MODE_TX, SERIAL_NOT_INVERTED);
+			if(!port){
+				_port_failed(self, pc->identifier, -ENODEV);
+				failed++;
+				continue;
+			}
+			int ret = telemetry_add_port(self, proto, port, baudrate);
+			if(ret < 0){
+				closeSerialPort(port);
+				_port_failed(self, pc->identifier, ret);
+				failed++;
+			}
+		}
+	}
+	return failed;
+}
+
+bool telemetry_is_active(const struct telemetry *self){
+	return self->num_ports > 0;
+}
+
+bool telemetry_save_requested(struct telemetry *self){
+	bool requested = false;
+	for(int c = 0; c < self->num_ports; c++){
+		requested |= self->ports[c].save_requested;
+		self->ports[c].save_requested = false;
+	}
+	return requested;
+}
 
-    if (portSharing == PORTSHARING_SHARED) {
-        if (telemetryConfig()->telemetry_switch)
-            enabled = rcModeIsActive(BOXTELEMETRY);
-        else
-            enabled = ARMING_FLAG(ARMED);
-    }
+static void _port_refill(struct telemetry_port *self, sys_micros_t now){
+	int32_t elapsed = now - self->last_refill;
+	self->last_refill = now;
+	if(elapsed <= 0)
+		return;
+	if(elapsed > TELEMETRY_MAX_REFILL_US)
+		elapsed = TELEMETRY_MAX_REFILL_US;
+	self->budget_frac += (uint32_t)elapsed * self->bytes_per_sec;
+	uint32_t bytes = self->budget_frac / 1000000;
+	self->budget_frac -= bytes * 1000000;
+	self->budget = MIN(self->budget + bytes, self->burst);
+	if(self->budget == self->burst)
+		self->budget_frac = 0;
+}
 
-    return enabled;
+//! returns interval of a message in microseconds, 0 if the message is disabled
+static sys_micros_t _port_period(const struct telemetry_port *self, int id){
+	const struct telemetry_message *msg = &self->proto->messages[id];
+	if(!msg->rate_hz)
+		return (sys_micros_t)msg->period_ms * 1000;
+	uint8_t hz = msg->rate_hz(self->config);
+	return (hz)?(1000000 / hz):0;
 }
 
-void telemetryCheckState(void)
-{
-    checkFrSkyTelemetryState();
-    checkHoTTTelemetryState();
-    checkSmartPortTelemetryState();
-    checkLtmTelemetryState();
-    checkMAVLinkTelemetryState();
+//! returns the most important due message or -1 if nothing is due
+static int _port_next_message(struct telemetry_port *self, sys_micros_t now){
+	int best = -1;
+	for(int c = 0; c < self->proto->num_messages; c++){
+		if((int32_t)(now - self->due[c]) < 0)
+			continue;
+		if(!_port_period(self, c)){
+			// disabled, starts right away once it is enabled again
+			self->due[c] = now;
+			continue;
+		}
+		if(best < 0 || self->proto->messages[c].priority < self->proto->messages[best].priority ||
+			(self->proto->messages[c].priority == self->proto->messages[best].priority &&
+			(int32_t)(self->due[best] - self->due[c]) > 0))
+			best = c;
+	}
+	return best;
 }
 
-void telemetryProcess(uint16_t deadband3d_throttle)
-{
-    handleFrSkyTelemetry(deadband3d_throttle);
-    handleHoTTTelemetry();
-    handleSmartPortTelemetry();
-    handleLtmTelemetry();
-    handleMAVLinkTelemetry();
+static uint16_t _port_send(struct telemetry_port *self, const struct telemetry_state *state, sys_micros_t now, uint16_t limit){
+	uint8_t buf[TELEMETRY_MAX_FRAME_SIZE];
+	uint16_t sent = 0;
+
+	_port_refill(self, now);
+
+	int id;
+	while((id = _port_next_message(self, now)) >= 0){
+		const struct telemetry_message *msg = &self->proto->messages[id];
+		// stop rather than let smaller, less important frames overtake this one
+		if(msg->size > self->budget || msg->size > limit - sent || msg->size > serialTxBytesFree(self->serial)){
+			self->deferred++;
+			break;
+		}
+
+		int len = msg->encode(self, state, buf);
+		if(len > 0){
+			serialWriteBuf(self->serial, buf, len);
+			self->budget -= len;
+			self->frames++;
+			self->bytes += len;
+			sent += len;
+		}
+
+		// keep the original cadence unless we have fallen more than a period behind
+		sys_micros_t period = _port_period(self, id);
+		self->due[id] += period;
+		if((int32_t)(now - self->due[id]) >= 0)
+			self->due[id] = now + period;
+	}
+	return sent;
+}
+
+void telemetry_update(struct telemetry *self, const struct telemetry_state *state){
+	if(!self->num_ports)
+		return;
+
+	memcpy(&self->state, state, sizeof(self->state));
+	sys_micros_t now = sys_micros(self->system);
+
+	for(int c = 0; c < self->num_ports; c++){
+		struct telemetry_port *port = &self->ports[c];
+		if(!port->proto->receive)
+			continue;
+		int n = MIN(serialRxBytesWaiting(port->serial), TELEMETRY_MAX_RX_PER_CYCLE);
+		while(n--)
+			port->proto->receive(port, state, serialRead(port->serial));
+	}
+
+	// ports take turns at being served first so that one busy port can not use up the cycle limit every time
+	uint16_t left = TELEMETRY_MAX_BYTES_PER_CYCLE;
+	for(int c = 0; c < self->num_ports && left; c++){
+		struct telemetry_port *port = &self->ports[(self->next_port + c) % self->num_ports];
+		left -= _port_send(port, &self->state, now, left);
+	}
+	self->next_port = (self->next_port + 1) % self->num_ports;
 }
-#endif
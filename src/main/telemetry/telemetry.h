@@ -18,16 +18,146 @@
 #pragma once
 
 #include "../config/telemetry.h"
+#include "../config/serial.h"
 
 // TODO: remove dependency on io/serial
 #include "io/serial.h"
+#include "system_calls.h"
 
-void telemetryInit(void);
+#include "telemetry/mavlink.h"
 
-void telemetryCheckState(void);
-void telemetryProcess(uint16_t deadband3d_throttle);
+struct config;
 
-bool telemetryDetermineEnabledState(portSharing_e portSharing);
+//! maximum number of telemetry ports open at the same time
+#define TELEMETRY_MAX_PORTS 2
+//! maximum number of messages a protocol can schedule
+#define TELEMETRY_MAX_MESSAGES 12
+//! largest single frame any protocol may produce
+#define TELEMETRY_MAX_FRAME_SIZE 80
+//! upper bound on bytes written per telemetry cycle across all ports so that the task stays short
+#define TELEMETRY_MAX_BYTES_PER_CYCLE 96
+//! upper bound on bytes parsed from each port per telemetry cycle
+#define TELEMETRY_MAX_RX_PER_CYCLE 64
 
-void telemetryUseConfig(struct telemetry_config *telemetryConfig);
+typedef enum {
+	TELEMETRY_MODE_RATE = 0,
+	TELEMETRY_MODE_ANGLE,
+	TELEMETRY_MODE_HORIZON,
+	TELEMETRY_MODE_ALTHOLD,
+	TELEMETRY_MODE_HEADFREE
+} telemetry_flight_mode_t;
 
+/**
+ * Vehicle state as seen by all telemetry protocols. It is gathered once per
+ * telemetry cycle and every encoder works from this copy instead of poking
+ * into the rest of the flight controller.
+ */
+struct telemetry_state {
+	sys_micros_t timestamp;
+	int16_t roll, pitch, yaw;		//!< attitude in decidegrees
+	int16_t gyr[3];					//!< body rates in deci-deg per sec
+	int16_t acc[3];					//!< acceleration, SYSTEM_ACCEL_1G is 1G
+	int16_t motors[8];
+	uint16_t vbat;					//!< battery voltage in 0.1V
+	int32_t current;				//!< battery current in 0.01A
+	int32_t mah_drawn;
+	uint16_t rssi;					//!< 0 - 1023
+	int32_t altitude;				//!< estimated altitude in cm
+	int16_t vario;					//!< vertical speed in cm/s
+	bool armed;
+	bool failsafe;
+	telemetry_flight_mode_t flight_mode;
+	bool has_gps;
+	bool gps_fix;
+	uint8_t num_sat;
+	int32_t lat, lon;				//!< degrees * 1e7
+	int32_t gps_altitude;			//!< cm
+	uint16_t ground_speed;			//!< cm/s
+	uint16_t ground_course;			//!< decidegrees
+};
+
+struct telemetry_port;
+
+/**
+ * A message a protocol can send. Encoders write one complete frame into buf
+ * and return its length, 0 if there is nothing to send this time (for example
+ * gps frames without a gps) or a negative errno.
+ */
+struct telemetry_message {
+	uint8_t priority;				//!< 0 is the most important
+	uint16_t period_ms;				//!< desired interval between frames
+	uint8_t size;					//!< largest frame the encoder produces
+	int (*encode)(struct telemetry_port *port, const struct telemetry_state *state, uint8_t *buf);
+	//! optional, rate in Hz taken from the config instead of period_ms. 0 disables the message.
+	uint8_t (*rate_hz)(const struct config *config);
+};
+
+struct telemetry_protocol {
+	const char *name;
+	serialPortFunction_e function;
+	uint32_t default_baudrate;		//!< used when the port is configured for auto baud
+	const struct telemetry_message *messages;
+	uint8_t num_messages;
+	//! optional, called for every byte received on ports that run this protocol
+	void (*receive)(struct telemetry_port *port, const struct telemetry_state *state, uint8_t ch);
+};
+
+/**
+ * A serial port running one protocol. The port is given a byte budget that
+ * refills at the link rate and due messages are sent in priority order as
+ * long as they fit in the budget.
+ */
+struct telemetry_port {
+	const struct telemetry_protocol *proto;
+	serialPort_t *serial;
+	uint16_t bytes_per_sec;
+	uint16_t burst;					//!< budget never grows beyond this
+	uint16_t budget;				//!< bytes we may send right now
+	uint32_t budget_frac;			//!< sub byte remainder in byte-microseconds
+	sys_micros_t last_refill;
+	sys_micros_t due[TELEMETRY_MAX_MESSAGES];
+	uint8_t seq;					//!< frame sequence for protocols that need one
+	struct config *config;
+	bool save_requested;			//!< the other end asked for the config to be written to eeprom
+
+	//! state private to the protocol running on the port
+	union {
+		struct mavlink_port mavlink;
+	} priv;
+
+	uint32_t frames;
+	uint32_t bytes;
+	uint32_t deferred;				//!< times a due message had to wait for bandwidth
+};
+
+//! a serial port that is configured for telemetry but could not be opened
+struct telemetry_port_error {
+	serialPortIdentifier_e identifier;
+	int16_t error;					//!< negative errno
+};
+
+struct telemetry {
+	const struct system_calls *system;
+	struct config *config;
+	struct telemetry_state state;
+	struct telemetry_port ports[TELEMETRY_MAX_PORTS];
+	uint8_t num_ports;
+	uint8_t next_port;				//!< port served first in the next cycle
+	struct telemetry_port_error failed[SERIAL_PORT_COUNT];
+	uint8_t num_failed;
+};
+
+void telemetry_init(struct telemetry *self, const struct system_calls *system, struct config *config);
+/**
+ * Opens all serial ports that are configured for a telemetry protocol. A port that fails does not stop the others
+ * from being opened, it is recorded in failed[] with the reason instead.
+ * @return number of ports that could not be opened
+ */
+int telemetry_open_ports(struct telemetry *self);
+//! attaches a protocol to an already open serial port. Returns negative errno on failure.
+int telemetry_add_port(struct telemetry *self, const struct telemetry_protocol *proto, serialPort_t *serial, uint32_t baudrate);
+bool telemetry_is_active(const struct telemetry *self);
+//! returns true once after a port has asked for the config to be saved
+bool telemetry_save_requested(struct telemetry *self);
+//! takes a snapshot of the state, handles incoming requests and sends whatever is due and fits in the bandwidth budget
+void telemetry_update(struct telemetry *self, const struct telemetry_state *state);
@@ -30,13 +30,14 @@ extern "C" {
 
 uint16_t mock_motor_pwm[8];
 uint16_t mock_servo_pwm[8];
+uint32_t mock_motor_erpm[8];
 uint16_t mock_rc_pwm[RX_MAX_SUPPORTED_RC_CHANNELS];
 uint16_t mock_pwm_errors = 0;
 int16_t mock_acc[3];
 int16_t mock_gyro[3];
 uint32_t mock_eeprom_written = 0;
-uint16_t mock_eeprom_pages = 2;
-uint16_t mock_eeprom_page_size = 512;
+uint16_t mock_eeprom_pages = 4;
+uint16_t mock_eeprom_page_size = 1024;
 uint8_t mock_eeprom_erase_byte = 0xff;
 static bool mock_clock_manual = false;
 int32_t mock_time_micros = 0;
@@ -69,6 +70,12 @@ void _write_servo(const struct system_calls_pwm *pwm, uint8_t id, uint16_t value
 	mock_servo_pwm[id] = value;
 }
 
+int _read_motor_erpm(const struct system_calls_pwm *pwm, uint8_t id, uint32_t *erpm){
+	(void)pwm;
+	*erpm = mock_motor_erpm[id];
+	return 0;
+}
+
 uint16_t _read_pwm(const struct system_calls_pwm *pwm, uint8_t id){
 	(void)pwm;
 	return mock_rc_pwm[id];
@@ -218,6 +225,7 @@ static struct system_calls syscalls = {
 	.pwm = {
 		.write_motor = _write_motor,
 		.write_servo = _write_servo,
+		.read_motor_erpm = _read_motor_erpm,
 		.read_pwm = _read_pwm, 
 		.read_ppm = _read_ppm
 	},
@@ -271,7 +279,10 @@ void mock_system_reset(){
 	//ninja_config_reset(NULL);
 	memset(mock_motor_pwm, 0, sizeof(mock_motor_pwm));
 	memset(mock_servo_pwm, 0, sizeof(mock_servo_pwm));
+	memset(mock_motor_erpm, 0, sizeof(mock_motor_erpm));
 	memset(mock_rc_pwm, 0, sizeof(mock_rc_pwm));
+	mock_eeprom_pages = 4;
+	mock_eeprom_page_size = 1024;
 	memset(mock_eeprom_data, mock_eeprom_erase_byte, sizeof(mock_eeprom_data));
 	mock_pwm_errors = 0;
 	mock_eeprom_written = 0;
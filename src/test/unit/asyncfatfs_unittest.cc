@@ -0,0 +1,283 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+extern "C" {
+#include "platform.h"
+#include "common/maths.h"
+#include "drivers/asyncfatfs/asyncfatfs.h"
+#include "sitl/sdcard_sim.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+// blackbox style logging: one fixed size frame per loop iteration, dropped if the buffers are full
+#define LOOP_PERIOD_US 1000
+#define FRAME_SIZE 64
+#define LOG_DURATION_US (10 * 1000000)
+// afatfs_poll() runs at the rate of the SDCARD task, not on every loop iteration
+#define POLL_PERIOD_US 4000
+
+struct log_result {
+	uint32_t frames_written;
+	uint32_t frames_dropped;
+	uint32_t bytes_per_second;
+	uint32_t max_frame_gap_us;	// longest time without being able to log a frame
+	uint32_t max_poll_ns;		// longest host time spent in a single afatfs_poll()
+};
+
+static afatfsFilePtr_t test_file;
+static bool test_file_closed;
+
+static void test_file_opened(afatfsFilePtr_t file){
+	test_file = file;
+}
+
+static void test_file_close_complete(void){
+	test_file_closed = true;
+}
+
+static void make_frame(uint8_t *frame, uint32_t seq){
+	memcpy(frame, &seq, sizeof(seq));
+	for(int c = sizeof(seq); c < FRAME_SIZE; c++)
+		frame[c] = (uint8_t)(seq * 31 + c);
+}
+
+static uint32_t host_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+class AsyncFatfsTest : public ::testing::Test {
+protected:
+	char image[32];
+	uint32_t loops;
+
+	virtual void SetUp(){
+		mock_system_reset();
+		mock_system_clock_mode(MOCK_CLOCK_MANUAL);
+		strcpy(image, "/tmp/afatfsXXXXXX");
+		int fd = mkstemp(image);
+		ASSERT_GE(fd, 0);
+		close(fd);
+		// 64MB card
+		ASSERT_EQ(0, sdcard_sim_create_image(image, 64 * 2048));
+		test_file = NULL;
+		test_file_closed = false;
+		loops = 0;
+	}
+
+	virtual void TearDown(){
+		afatfs_destroy(true);
+		sdcard_sim_close();
+		unlink(image);
+	}
+
+	// one loop iteration, returns the host time spent polling the filesystem
+	uint32_t poll(){
+		mock_time_micros += LOOP_PERIOD_US;
+		if(++loops % (POLL_PERIOD_US / LOOP_PERIOD_US))
+			return 0;
+		uint32_t start = host_ns();
+		afatfs_poll();
+		return host_ns() - start;
+	}
+
+	void mount(const char *profile){
+		ASSERT_EQ(0, sdcard_sim_init(image, sdcard_sim_find_profile(profile), &mock_syscalls()->time));
+		afatfs_init();
+		for(int c = 0; c < 100000 && afatfs_getFilesystemState() != AFATFS_FILESYSTEM_STATE_READY; c++)
+			poll();
+		ASSERT_EQ(AFATFS_FILESYSTEM_STATE_READY, afatfs_getFilesystemState());
+	}
+
+	// flush everything out to the image and detach from it
+	void unmount(){
+		for(int c = 0; c < 100000 && !afatfs_destroy(false); c++)
+			mock_time_micros += LOOP_PERIOD_US;
+		sdcard_sim_close();
+	}
+
+	void open(const char *name, const char *mode){
+		test_file = NULL;
+		ASSERT_TRUE(afatfs_fopen(name, mode, test_file_opened));
+		for(int c = 0; c < 100000 && !test_file; c++)
+			poll();
+		ASSERT_TRUE(test_file != NULL);
+	}
+
+	void close_file(){
+		test_file_closed = false;
+		for(int c = 0; c < 100000 && !afatfs_fclose(test_file, test_file_close_complete); c++)
+			poll();
+		for(int c = 0; c < 100000 && (!test_file_closed || !afatfs_flush()); c++)
+			poll();
+		ASSERT_TRUE(test_file_closed);
+	}
+
+	void log(struct log_result *result){
+		uint8_t frame[FRAME_SIZE];
+		uint32_t frame_pos = FRAME_SIZE;
+		int32_t last_frame_time = mock_time_micros;
+		uint32_t seq = 0;
+
+		memset(result, 0, sizeof(*result));
+		open("LOG00001.TXT", "as");
+
+		int32_t start = mock_time_micros;
+		while(mock_time_micros - start < LOG_DURATION_US){
+			// the file can be too busy to take all of a frame, finish that one before starting another
+			if(frame_pos < FRAME_SIZE){
+				frame_pos += afatfs_fwrite(test_file, frame + frame_pos, FRAME_SIZE - frame_pos);
+				result->frames_dropped++;
+			} else if(afatfs_getFreeBufferSpace() >= FRAME_SIZE){
+				make_frame(frame, seq);
+				frame_pos = afatfs_fwrite(test_file, frame, FRAME_SIZE);
+				result->frames_written++;
+				result->max_frame_gap_us = MAX(result->max_frame_gap_us, (uint32_t)(mock_time_micros - last_frame_time));
+				last_frame_time = mock_time_micros;
+			} else {
+				result->frames_dropped++;
+			}
+			seq++;
+			uint32_t poll_ns = poll();
+			result->max_poll_ns = MAX(result->max_poll_ns, poll_ns);
+		}
+		for(int c = 0; c < 100000 && frame_pos < FRAME_SIZE; c++){
+			frame_pos += afatfs_fwrite(test_file, frame + frame_pos, FRAME_SIZE - frame_pos);
+			poll();
+		}
+		ASSERT_EQ((uint32_t)FRAME_SIZE, frame_pos);
+		result->bytes_per_second = (uint32_t)((uint64_t)result->frames_written * FRAME_SIZE * 1000000 / LOG_DURATION_US);
+
+		close_file();
+	}
+
+	// read the log back and check that it holds whole frames in increasing sequence
+	void verify(uint32_t frames){
+		uint8_t frame[FRAME_SIZE], expected[FRAME_SIZE];
+		uint32_t read_frames = 0;
+		int64_t last_seq = -1;
+
+		open("LOG00001.TXT", "r");
+		for(int c = 0; c < 10000000 && !afatfs_feof(test_file); c++){
+			uint32_t got = 0;
+			while(got < FRAME_SIZE && !afatfs_feof(test_file)){
+				got += afatfs_fread(test_file, frame + got, FRAME_SIZE - got);
+				if(got < FRAME_SIZE)
+					poll();
+			}
+			if(got == 0)
+				break;
+			ASSERT_EQ((uint32_t)FRAME_SIZE, got);
+			uint32_t seq;
+			memcpy(&seq, frame, sizeof(seq));
+			ASSERT_GT((int64_t)seq, last_seq);
+			make_frame(expected, seq);
+			ASSERT_EQ(0, memcmp(frame, expected, FRAME_SIZE));
+			last_seq = seq;
+			read_frames++;
+		}
+		EXPECT_EQ(frames, read_frames);
+		close_file();
+	}
+};
+
+TEST_F(AsyncFatfsTest, TestImageMounts){
+	mount("ideal");
+	EXPECT_FALSE(afatfs_isFull());
+	EXPECT_GT(afatfs_getContiguousFreeSpace(), 0u);
+}
+
+TEST_F(AsyncFatfsTest, TestReadBackAfterRemount){
+	uint8_t frame[FRAME_SIZE];
+
+	mount("class10");
+	open("DATA.BIN", "w");
+	for(uint32_t seq = 0; seq < 1000; seq++){
+		make_frame(frame, seq);
+		uint32_t written = 0;
+		for(int c = 0; c < 1000 && written < FRAME_SIZE; c++){
+			written += afatfs_fwrite(test_file, frame + written, FRAME_SIZE - written);
+			poll();
+		}
+		ASSERT_EQ((uint32_t)FRAME_SIZE, written);
+	}
+	close_file();
+
+	// the data must have made it to the image, not just the cache
+	unmount();
+	mount("class10");
+
+	open("DATA.BIN", "r");
+	for(uint32_t seq = 0; seq < 1000; seq++){
+		uint8_t expected[FRAME_SIZE];
+		uint32_t got = 0;
+		for(int c = 0; c < 1000 && got < FRAME_SIZE; c++){
+			got += afatfs_fread(test_file, frame + got, FRAME_SIZE - got);
+			poll();
+		}
+		ASSERT_EQ((uint32_t)FRAME_SIZE, got);
+		make_frame(expected, seq);
+		ASSERT_EQ(0, memcmp(frame, expected, FRAME_SIZE));
+	}
+	close_file();
+}
+
+TEST_F(AsyncFatfsTest, TestLoggingSurvivesCardErrors){
+	struct log_result result;
+	struct sdcard_sim_stats stats;
+
+	mount("flaky");
+	log(&result);
+	sdcard_sim_get_stats(&stats);
+
+	EXPECT_GT(stats.write_errors, 0u);
+	EXPECT_NE(AFATFS_FILESYSTEM_STATE_FATAL, afatfs_getFilesystemState());
+	verify(result.frames_written);
+}
+
+TEST_F(AsyncFatfsTest, BenchmarkLogging){
+	for(const struct sdcard_sim_profile *profile = sdcard_sim_profiles; profile->name; profile++){
+		struct log_result result;
+		afatfsStatistics_t stats;
+
+		mount(profile->name);
+		log(&result);
+		afatfs_getStatistics(&stats);
+
+		printf("%-8s %7u B/s, dropped %5u/%u frames, worst stall %6u us, worst poll %6u ns, %u bursts (%u sectors), %u deferrals\n",
+			profile->name, result.bytes_per_second, result.frames_dropped, result.frames_dropped + result.frames_written,
+			result.max_frame_gap_us, result.max_poll_ns, stats.writeBursts, stats.writeBurstSectors, stats.writeDeferrals);
+
+		if(strcmp(profile->name, "ideal") == 0){
+			EXPECT_EQ(0u, result.frames_dropped);
+		}
+
+		verify(result.frames_written);
+
+		unmount();
+		ASSERT_EQ(0, sdcard_sim_create_image(image, 64 * 2048));
+	}
+}
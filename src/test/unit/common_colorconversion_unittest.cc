@@ -0,0 +1,82 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+extern "C" {
+    #include "common/color.h"
+    #include "common/colorconversion.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+TEST(ColorConversionUnittest, TestLutMatchesReference)
+{
+    int maxError = 0;
+    for (int h = 0; h <= HSV_HUE_MAX; h++) {
+        for (int s = 0; s <= 255; s += 5) {
+            for (int v = 0; v <= 255; v += 5) {
+                hsvColor_t hsv = { .h = (uint16_t)h, .s = (uint8_t)s, .v = (uint8_t)v };
+                rgbColor24bpp_t ref = hsvToRgb24(&hsv);
+                rgbColor24bpp_t lut = hsvToRgb24Lut(&hsv);
+                for (int c = 0; c < RGB_COLOR_COMPONENT_COUNT; c++) {
+                    int err = abs(ref.raw[c] - lut.raw[c]);
+                    if (err > maxError)
+                        maxError = err;
+                }
+            }
+        }
+    }
+    // the reference truncates its intermediate terms, the table rounds them
+    EXPECT_LE(maxError, 3);
+
+    // primaries and full value are exact
+    hsvColor_t red = { .h = 0, .s = 0, .v = 255 };
+    rgbColor24bpp_t rgb = hsvToRgb24Lut(&red);
+    EXPECT_EQ(255, rgb.rgb.r);
+    EXPECT_EQ(0, rgb.rgb.g);
+    EXPECT_EQ(0, rgb.rgb.b);
+
+    hsvColor_t cyan = { .h = 180, .s = 0, .v = 200 };
+    rgb = hsvToRgb24Lut(&cyan);
+    EXPECT_EQ(0, rgb.rgb.r);
+    EXPECT_EQ(200, rgb.rgb.g);
+    EXPECT_EQ(200, rgb.rgb.b);
+
+    // out of range hue wraps around
+    hsvColor_t wrapped = { .h = 360 + 120, .s = 0, .v = 255 };
+    rgb = hsvToRgb24Lut(&wrapped);
+    EXPECT_EQ(255, rgb.rgb.g);
+}
+
+TEST(ColorConversionUnittest, TestGamma)
+{
+    EXPECT_EQ(0, gammaTable[0]);
+    EXPECT_EQ(255, gammaTable[255]);
+    for (int i = 1; i < 256; i++)
+        EXPECT_GE(gammaTable[i], gammaTable[i - 1]);
+    // mid grey is well below half brightness after correction
+    EXPECT_LT(gammaTable[128], 64);
+
+    hsvColor_t white = { .h = 0, .s = 255, .v = 128 };
+    rgbColor24bpp_t rgb = hsvToRgb24Gamma(&white);
+    EXPECT_EQ(gammaTable[128], rgb.rgb.r);
+    EXPECT_EQ(gammaTable[128], rgb.rgb.g);
+    EXPECT_EQ(gammaTable[128], rgb.rgb.b);
+}
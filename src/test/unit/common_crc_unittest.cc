@@ -0,0 +1,67 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+extern "C" {
+    #include "common/crc.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+TEST(CrcUnittest, TestCrc8DvbS2)
+{
+    const char *check = "123456789";
+    // standard check value for CRC-8/DVB-S2
+    EXPECT_EQ(0xBC, crc8_dvb_s2_buf(0, check, strlen(check)));
+
+    // byte-wise update must give the same result as buffer update
+    uint8_t crc = 0;
+    for(size_t c = 0; c < strlen(check); c++)
+        crc = crc8_dvb_s2(crc, check[c]);
+    EXPECT_EQ(0xBC, crc);
+
+    EXPECT_EQ(0, crc8_dvb_s2_buf(0, check, 0));
+}
+
+TEST(CrcUnittest, TestCrc8Smbus)
+{
+    const char *check = "123456789";
+    // standard check value for CRC-8/SMBUS
+    EXPECT_EQ(0xF4, crc8_smbus_buf(0, check, strlen(check)));
+
+    uint8_t crc = 0;
+    for(size_t c = 0; c < strlen(check); c++)
+        crc = crc8_smbus(crc, check[c]);
+    EXPECT_EQ(0xF4, crc);
+}
+
+TEST(CrcUnittest, TestCrc32Ieee)
+{
+    const char *check = "123456789";
+    // standard check value for CRC-32/ISO-HDLC
+    EXPECT_EQ(0xCBF43926u, crc32_ieee_buf(0, check, strlen(check)));
+
+    // chained updates must give the same result as a single update
+    uint32_t crc = crc32_ieee_buf(0, check, 4);
+    crc = crc32_ieee_buf(crc, check + 4, strlen(check) - 4);
+    EXPECT_EQ(0xCBF43926u, crc);
+
+    EXPECT_EQ(0u, crc32_ieee_buf(0, check, 0));
+}
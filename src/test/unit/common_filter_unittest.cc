@@ -140,3 +140,34 @@ TEST(FilterUnittest, TestFilterApplyAveragef)
     EXPECT_EQ(4, valueState[3]);
 }
 
+
+// amplitude of a sine after it has passed through the filter and settled
+static float _biquad_gain(biquad_t *filter, float hz, float sample_rate)
+{
+    float peak = 0;
+    for (int i = 0; i < 4000; i++) {
+        float out = applyBiQuadFilter(sinf(2 * (float)M_PI * fmodf(hz * i / sample_rate, 1.0f)), filter);
+        if (i > 3000 && fabsf(out) > peak)
+            peak = fabsf(out);
+    }
+    return peak;
+}
+
+TEST(FilterUnittest, TestBiQuadNotch)
+{
+    biquad_t notch;
+
+    // 1khz sample rate, 200hz center
+    BiQuadNewNotch(200, 5, &notch, 1000);
+    EXPECT_LT(_biquad_gain(&notch, 200, 1000), 0.01f);
+
+    BiQuadNewNotch(200, 5, &notch, 1000);
+    EXPECT_GT(_biquad_gain(&notch, 100, 1000), 0.95f);
+
+    BiQuadNewNotch(200, 5, &notch, 1000);
+    EXPECT_GT(_biquad_gain(&notch, 300, 1000), 0.95f);
+
+    // moving the center keeps history but follows the new frequency
+    BiQuadSetNotch(300, 5, &notch, 1000);
+    EXPECT_LT(_biquad_gain(&notch, 300, 1000), 0.01f);
+}
@@ -0,0 +1,88 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+    #include "common/lz.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+static void expectRoundTrip(const uint8_t *data, int len)
+{
+    uint8_t packed[512];
+    uint8_t unpacked[256];
+
+    int packedLen = lz_compress(data, len, packed, sizeof(packed));
+    ASSERT_GE(packedLen, 0);
+    EXPECT_EQ(len, lz_decompress(packed, packedLen, unpacked, sizeof(unpacked)));
+    EXPECT_EQ(0, memcmp(data, unpacked, len));
+}
+
+TEST(LzUnittest, TestRoundTrip)
+{
+    uint8_t data[256];
+
+    // erased flash collapses to a couple of tokens
+    memset(data, 0xFF, sizeof(data));
+    expectRoundTrip(data, sizeof(data));
+    uint8_t packed[16];
+    EXPECT_LE(lz_compress(data, sizeof(data), packed, sizeof(packed)), 6);
+
+    // repeating pattern similar to blackbox frames
+    for(unsigned c = 0; c < sizeof(data); c++)
+        data[c] = (c % 17) < 5 ? 'I' : c & 0x0F;
+    expectRoundTrip(data, sizeof(data));
+
+    // random data must still round trip even though it does not compress
+    srand(1);
+    for(unsigned c = 0; c < sizeof(data); c++)
+        data[c] = rand();
+    expectRoundTrip(data, sizeof(data));
+
+    expectRoundTrip(data, 0);
+    expectRoundTrip(data, 2);
+}
+
+TEST(LzUnittest, TestOverflowAndCorruption)
+{
+    uint8_t data[200];
+    uint8_t packed[256];
+    uint8_t unpacked[200];
+
+    srand(2);
+    for(unsigned c = 0; c < sizeof(data); c++)
+        data[c] = rand();
+
+    // incompressible data does not fit into a buffer as large as the input
+    EXPECT_EQ(-1, lz_compress(data, sizeof(data), packed, sizeof(data)));
+
+    int packedLen = lz_compress(data, sizeof(data), packed, sizeof(packed));
+    ASSERT_GT(packedLen, 0);
+
+    // truncated block and too small output are detected
+    EXPECT_EQ(-1, lz_decompress(packed, packedLen - 1, unpacked, sizeof(unpacked)));
+    EXPECT_EQ(-1, lz_decompress(packed, packedLen, unpacked, sizeof(unpacked) - 1));
+
+    // a copy reaching back before the start of the output is rejected
+    const uint8_t bad[] = { 0x00, 'a', 0x80, 0x05 };
+    EXPECT_EQ(-1, lz_decompress(bad, sizeof(bad), unpacked, sizeof(unpacked)));
+}
@@ -202,9 +202,9 @@ TEST_F(ConfigTest, TestFirstLoad){
  * @ingroup CONFIG
  * @page CONFIG
  *
- * - Test that config saving and loading works. Must make sure that only deltas
- * are being written. At the very least checksum will be written as a delta
- * since it is not part of the data.
+ * - Test that config saving and loading works. First save writes a snapshot,
+ * after that only deltas are written and saving an unchanged config writes
+ * nothing at all.
  */
 TEST_F(ConfigTest, TestSaveLoad){
 	struct config_store a, b;
@@ -212,8 +212,12 @@ TEST_F(ConfigTest, TestSaveLoad){
 	memset(&b, 0, sizeof(b));
 	config_reset(&a);
 	EXPECT_EQ(0, config_save(&a, mock_syscalls()));
-	// since we are using default config, we should not have any writes besides crc (one size of a delta)
-	EXPECT_EQ(4, mock_eeprom_written);
+	EXPECT_TRUE(mock_eeprom_written >= sizeof(struct config_store));
+
+	// nothing changed so nothing should be written
+	mock_eeprom_written = 0;
+	EXPECT_EQ(0, config_save(&a, mock_syscalls()));
+	EXPECT_EQ(0, mock_eeprom_written);
 
 	EXPECT_EQ(0, config_load(&b, mock_syscalls()));
 	EXPECT_EQ(0, memcmp(&a, &b, sizeof(struct config)));
@@ -229,17 +233,21 @@ TEST_F(ConfigTest, TestBadEEPROMData){
 	struct config_store config;
 	struct config_store res;
 	config_reset(&res);
+	EXPECT_TRUE(config_save(&res, mock_syscalls()) == 0);
+
 	// modify some parameter
 	config_get_rate_profile_rw(&res.data)->rcRate8 = 8;
 
+	mock_eeprom_written = 0;
 	EXPECT_TRUE(config_save(&res, mock_syscalls()) == 0);
-	// we should have written two deltas (1 for checksum and one for data)
-	EXPECT_EQ(8, mock_eeprom_written);
+	// we should have written three records (data, checksum and commit)
+	EXPECT_EQ(12, mock_eeprom_written);
 	// loading will be successful
 	EXPECT_TRUE(config_load(&config, mock_syscalls()) == 0);
+	EXPECT_EQ(8, config_get_rate_profile(&config.data)->rcRate8);
 	memset(&config, 0, sizeof(config));
 	memset(&res, 0, sizeof(config));
-	// corrupt a few bytes
+	// corrupt the page header of the snapshot
 	mock_eeprom_data[2] = 0x66;
 	// loading should fail
 	EXPECT_TRUE(config_load(&config, mock_syscalls()) < 0);
@@ -248,6 +256,155 @@ TEST_F(ConfigTest, TestBadEEPROMData){
 	//EXPECT_EQ(0, memcmp(&config.data, &res.data, sizeof(struct config)));
 }
 
+/**
+ * @ingroup CONFIG
+ * @page CONFIG
+ *
+ * - Test that records of a save that was interrupted before it was committed
+ * are ignored when loading and that the next save recovers.
+ */
+TEST_F(ConfigTest, TestInterruptedSave){
+	static char before[MOCK_EEPROM_MAX_SIZE];
+	struct config_store a, b;
+	config_reset(&a);
+	EXPECT_EQ(0, config_save(&a, mock_syscalls()));
+	uint8_t rate = config_get_rate_profile(&a.data)->rcRate8;
+	memcpy(before, mock_eeprom_data, sizeof(before));
+
+	config_get_rate_profile_rw(&a.data)->rcRate8 = rate + 1;
+	EXPECT_EQ(0, config_save(&a, mock_syscalls()));
+
+	// find the records that were written and drop the last one (the commit)
+	int last = -1;
+	for(int c = 0; c < MOCK_EEPROM_MAX_SIZE; c++){
+		if(before[c] != mock_eeprom_data[c]) last = c;
+	}
+	ASSERT_TRUE(last >= 3);
+	memcpy(mock_eeprom_data + (last & ~3), before + (last & ~3), 4);
+
+	EXPECT_EQ(0, config_load(&b, mock_syscalls()));
+	EXPECT_EQ(rate, config_get_rate_profile(&b.data)->rcRate8);
+
+	// saving again must make the change stick
+	EXPECT_EQ(0, config_save(&a, mock_syscalls()));
+	EXPECT_EQ(0, config_load(&b, mock_syscalls()));
+	EXPECT_EQ(rate + 1, config_get_rate_profile(&b.data)->rcRate8);
+}
+
+/**
+ * @ingroup CONFIG
+ * @page CONFIG
+ *
+ * - Test that many saves wrap around the journal and compact it into new
+ * snapshots without ever losing the last saved config.
+ */
+TEST_F(ConfigTest, TestJournalCompaction){
+	struct config_store a, b;
+	config_reset(&a);
+	for(int c = 0; c < 1000; c++){
+		config_get_rate_profile_rw(&a.data)->rcRate8 = c & 0xff;
+		a.data.blackbox.rate_num = (c >> 8) + 1;
+		ASSERT_EQ(0, config_save(&a, mock_syscalls()));
+		ASSERT_EQ(0, config_load(&b, mock_syscalls()));
+		ASSERT_EQ(0, memcmp(&a, &b, sizeof(struct config_store)));
+	}
+}
+
+/**
+ * @ingroup CONFIG
+ * @page CONFIG
+ *
+ * - Test that losing power at any point of a compaction keeps the previously
+ * saved config loadable.
+ */
+TEST_F(ConfigTest, TestCompactionPowerLoss){
+	static const uint16_t sizes[][2] = { { 1024, 4 }, { 2048, 2 }, { 512, 8 } };
+	for(unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+		mock_system_reset();
+		mock_eeprom_page_size = sizes[s][0];
+		mock_eeprom_pages = sizes[s][1];
+
+		struct config_store a, b;
+		config_reset(&a);
+		ASSERT_EQ(0, config_save(&a, mock_syscalls()));
+		int compactions = 0;
+		for(int c = 0; c < 300 && compactions < 3; c++){
+			struct config_store prev = a;
+			config_get_rate_profile_rw(&a.data)->rcRate8 = c & 0xff;
+			a.data.blackbox.rate_num = (c >> 8) + 1;
+
+			struct config_save save;
+			config_save_begin(&save, &a, mock_syscalls());
+			static char backup[MOCK_EEPROM_MAX_SIZE];
+			int ret;
+			while((ret = config_save_step(&save)) > 0){
+				if(save.state != CONFIG_SAVE_COMPACT_PAGES && save.state != CONFIG_SAVE_COMPACT_IMAGE && save.state != CONFIG_SAVE_COMPACT_COMMIT)
+					continue;
+				// power is lost after this step, the old config must still be there
+				memcpy(backup, mock_eeprom_data, sizeof(backup));
+				ASSERT_EQ(0, config_load(&b, mock_syscalls())) << "page size " << sizes[s][0];
+				ASSERT_EQ(0, memcmp(&prev.data, &b.data, sizeof(struct config)));
+				memcpy(mock_eeprom_data, backup, sizeof(backup));
+				if(save.state == CONFIG_SAVE_COMPACT_COMMIT)
+					compactions++;
+			}
+			ASSERT_EQ(0, ret);
+			ASSERT_EQ(0, config_load(&b, mock_syscalls()));
+			ASSERT_EQ(0, memcmp(&a.data, &b.data, sizeof(struct config)));
+		}
+		EXPECT_GT(compactions, 0);
+	}
+}
+
+/**
+ * @ingroup CONFIG
+ * @page CONFIG
+ *
+ * - Test that a config written by older firmware as plain delta records is
+ * loaded and rewritten in the journal format without destroying the old
+ * records first.
+ */
+TEST_F(ConfigTest, TestLegacyLoad){
+	struct config_store def, a, b;
+	config_reset(&def);
+	config_reset(&a);
+	config_get_rate_profile_rw(&a.data)->rcRate8 = 42;
+	a.data.blackbox.rate_num = 3;
+	config_store_update_checksum(&a);
+
+	// old format: (addr | 0x8000, data) for every word that differs from defaults
+	const uint16_t *cur = (const uint16_t*)&a;
+	const uint16_t *dflt = (const uint16_t*)&def;
+	int pos = 0;
+	for(unsigned c = 0; c < sizeof(struct config_store) / sizeof(uint16_t); c++){
+		if(cur[c] == dflt[c]) continue;
+		uint16_t rec[2] = { (uint16_t)((c << 1) | 0x8000), cur[c] };
+		memcpy(mock_eeprom_data + pos, rec, sizeof(rec));
+		pos += sizeof(rec);
+	}
+	ASSERT_GT(pos, 0);
+	static char legacy[MOCK_EEPROM_MAX_SIZE];
+	memcpy(legacy, mock_eeprom_data, sizeof(legacy));
+
+	EXPECT_EQ(0, config_load(&b, mock_syscalls()));
+	EXPECT_EQ(0, memcmp(&a, &b, sizeof(struct config_store)));
+	// the old records are still there after the new snapshot has been written
+	EXPECT_EQ(0, memcmp(legacy, mock_eeprom_data, pos));
+
+	// next load comes from the journal
+	memset(&b, 0, sizeof(b));
+	mock_eeprom_written = 0;
+	EXPECT_EQ(0, config_load(&b, mock_syscalls()));
+	EXPECT_EQ(0u, mock_eeprom_written);
+	EXPECT_EQ(0, memcmp(&a, &b, sizeof(struct config_store)));
+	EXPECT_EQ(42, config_get_rate_profile(&b.data)->rcRate8);
+
+	// and further saves work as usual
+	config_get_rate_profile_rw(&a.data)->rcRate8 = 43;
+	EXPECT_EQ(0, config_save(&a, mock_syscalls()));
+	EXPECT_EQ(0, config_load(&b, mock_syscalls()));
+	EXPECT_EQ(43, config_get_rate_profile(&b.data)->rcRate8);
+}
 
 /**
  * @ingroup CONFIG
@@ -386,6 +543,46 @@ TEST_F(ConfigTest, TestFixups){
 	EXPECT_EQ(4, a.data.blackbox.rate_denom);
 }
 
+/**
+ * @ingroup CONFIG
+ * @page CONFIG
+ *
+ * - Test that a save can be done in small steps and that each step does only
+ * a bounded amount of work.
+ */
+TEST_F(ConfigTest, TestSaveInSteps){
+	struct config_store a, b;
+	struct config_save save;
+	config_reset(&a);
+
+	// first save has to write a snapshot
+	config_save_begin(&save, &a, mock_syscalls());
+	EXPECT_TRUE(config_save_busy(&save));
+	int steps = 0;
+	int ret;
+	while((ret = config_save_step(&save)) > 0){
+		EXPECT_TRUE(config_save_progress(&save) <= 100);
+		// no step should write more than one page
+		EXPECT_TRUE(mock_eeprom_written <= mock_eeprom_page_size);
+		mock_eeprom_written = 0;
+		steps++;
+	}
+	EXPECT_EQ(0, ret);
+	EXPECT_TRUE(steps > 1);
+	EXPECT_FALSE(config_save_busy(&save));
+	EXPECT_EQ(100, config_save_progress(&save));
+	EXPECT_EQ(0, config_load(&b, mock_syscalls()));
+	EXPECT_EQ(0, memcmp(&a, &b, sizeof(struct config_store)));
+
+	// a change is saved as deltas
+	config_get_rate_profile_rw(&a.data)->rcRate8 = 33;
+	config_save_begin(&save, &a, mock_syscalls());
+	while((ret = config_save_step(&save)) > 0);
+	EXPECT_EQ(0, ret);
+	EXPECT_EQ(0, config_load(&b, mock_syscalls()));
+	EXPECT_EQ(33, config_get_rate_profile(&b.data)->rcRate8);
+}
+
 //static uint8_t flash_data[512];
 extern uint8_t __config_start;
 //uint8_t *__config_start = flash_data;
@@ -0,0 +1,107 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+extern "C" {
+	#include "drivers/dshot.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+TEST(DshotTest, TestFrameChecksum){
+	// 1046 << 1 = 0x82c, checksum is xor of the three nibbles: 0xc ^ 0x2 ^ 0x8 = 0x6
+	EXPECT_EQ(0x82c6, dshot_frame(1046, false));
+	// telemetry bit is part of the checksummed packet
+	EXPECT_EQ(0x82d7, dshot_frame(1046, true));
+	EXPECT_EQ(0x0000, dshot_frame(DSHOT_CMD_MOTOR_STOP, false));
+	// value is limited to 11 bits
+	EXPECT_EQ(dshot_frame(0x7ff, false), dshot_frame(0xfff, false));
+
+	// every frame must satisfy the checksum the esc verifies
+	for(uint16_t v = 0; v <= DSHOT_MAX_THROTTLE; v++){
+		uint16_t f = dshot_frame(v, v & 1);
+		EXPECT_EQ(0, (f ^ (f >> 4) ^ (f >> 8) ^ (f >> 12)) & 0xf);
+		EXPECT_EQ(v, f >> 5);
+	}
+}
+
+TEST(DshotTest, TestThrottleFromPwm){
+	EXPECT_EQ(DSHOT_CMD_MOTOR_STOP, dshot_throttle_from_pwm(900));
+	EXPECT_EQ(DSHOT_CMD_MOTOR_STOP, dshot_throttle_from_pwm(1000));
+	EXPECT_GE(dshot_throttle_from_pwm(1001), DSHOT_MIN_THROTTLE);
+	EXPECT_EQ(DSHOT_MAX_THROTTLE, dshot_throttle_from_pwm(2000));
+	EXPECT_EQ(DSHOT_MAX_THROTTLE, dshot_throttle_from_pwm(2100));
+
+	uint16_t prev = 0;
+	for(uint16_t pwm = 1001; pwm <= 2000; pwm++){
+		uint16_t v = dshot_throttle_from_pwm(pwm);
+		EXPECT_GE(v, prev);
+		prev = v;
+	}
+}
+
+TEST(DshotTest, TestCommandRepeats){
+	EXPECT_EQ(1, dshot_command_repeats(DSHOT_CMD_BEEP1));
+	EXPECT_EQ(1, dshot_command_repeats(DSHOT_CMD_ESC_INFO));
+	EXPECT_EQ(6, dshot_command_repeats(DSHOT_CMD_SPIN_DIRECTION_NORMAL));
+	EXPECT_EQ(6, dshot_command_repeats(DSHOT_CMD_SPIN_DIRECTION_REVERSED));
+	EXPECT_EQ(6, dshot_command_repeats(DSHOT_CMD_3D_MODE_ON));
+	EXPECT_EQ(6, dshot_command_repeats(DSHOT_CMD_SAVE_SETTINGS));
+}
+
+TEST(DshotTest, TestTiming){
+	struct dshot_timing t;
+	dshot_timing_init(&t, 150, 24000000);
+	EXPECT_EQ(160, t.period);
+	EXPECT_EQ(120, t.bit1);
+	EXPECT_EQ(60, t.bit0);
+
+	dshot_timing_init(&t, 300, 24000000);
+	EXPECT_EQ(80, t.period);
+	EXPECT_EQ(60, t.bit1);
+	EXPECT_EQ(30, t.bit0);
+
+	dshot_timing_init(&t, 600, 24000000);
+	EXPECT_EQ(40, t.period);
+	EXPECT_EQ(30, t.bit1);
+	EXPECT_EQ(15, t.bit0);
+}
+
+TEST(DshotTest, TestEncodeInterleaved){
+	struct dshot_timing t;
+	dshot_timing_init(&t, 600, 24000000);
+
+	uint16_t frames[4] = { 0xffff, 0x0000, 0x8001, dshot_frame(1046, false) };
+	uint16_t buf[DSHOT_DMA_BUFFER_SIZE(4) + 1];
+	memset(buf, 0xaa, sizeof(buf));
+	dshot_encode(buf, frames, 4, &t);
+
+	for(int bit = 0; bit < DSHOT_FRAME_BITS; bit++){
+		for(int ch = 0; ch < 4; ch++){
+			uint16_t expected = (frames[ch] & (0x8000 >> bit))?t.bit1:t.bit0;
+			EXPECT_EQ(expected, buf[bit * 4 + ch]);
+		}
+	}
+	// trailing slots keep the line low
+	for(int c = DSHOT_FRAME_BITS * 4; c < DSHOT_DMA_BUFFER_SIZE(4); c++)
+		EXPECT_EQ(0, buf[c]);
+	// nothing written past the end
+	EXPECT_EQ(0xaaaa, buf[DSHOT_DMA_BUFFER_SIZE(4)]);
+}
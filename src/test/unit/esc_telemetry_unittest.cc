@@ -0,0 +1,138 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+extern "C" {
+	#include "common/crc.h"
+	#include "sensors/esc_telemetry.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+// builds a frame the way an esc sends it
+static void _make_frame(uint8_t frame[ESC_TELEMETRY_FRAME_SIZE], int8_t temp, uint16_t voltage, uint16_t current, uint16_t consumption, uint16_t erpm100){
+	frame[0] = temp;
+	frame[1] = voltage >> 8; frame[2] = voltage;
+	frame[3] = current >> 8; frame[4] = current;
+	frame[5] = consumption >> 8; frame[6] = consumption;
+	frame[7] = erpm100 >> 8; frame[8] = erpm100;
+	frame[9] = crc8_smbus_buf(0, frame, ESC_TELEMETRY_FRAME_SIZE - 1);
+}
+
+static void _send_frame(struct esc_telemetry *self, const uint8_t frame[ESC_TELEMETRY_FRAME_SIZE]){
+	for(int c = 0; c < ESC_TELEMETRY_FRAME_SIZE; c++)
+		esc_telemetry_input(self, frame[c]);
+}
+
+TEST(EscTelemetryTest, TestDecode){
+	uint8_t frame[ESC_TELEMETRY_FRAME_SIZE];
+	struct esc_telemetry_data data;
+	memset(&data, 0, sizeof(data));
+
+	_make_frame(frame, 45, 1620, 1234, 850, 1500);
+	EXPECT_TRUE(esc_telemetry_decode(frame, &data));
+	EXPECT_EQ(45, data.temperature);
+	EXPECT_EQ(1620, data.voltage);
+	EXPECT_EQ(1234, data.current);
+	EXPECT_EQ(850, data.consumption);
+	EXPECT_EQ(150000u, data.erpm);
+	EXPECT_TRUE(data.valid);
+
+	frame[8] ^= 1;
+	memset(&data, 0, sizeof(data));
+	EXPECT_FALSE(esc_telemetry_decode(frame, &data));
+	EXPECT_FALSE(data.valid);
+}
+
+TEST(EscTelemetryTest, TestPollRoundRobin){
+	struct esc_telemetry tel;
+	uint8_t frame[ESC_TELEMETRY_FRAME_SIZE];
+	uint32_t erpm;
+
+	esc_telemetry_init(&tel, 4);
+	EXPECT_EQ(-ENOENT, esc_telemetry_get_erpm(&tel, 0, 0, &erpm));
+
+	// bytes that arrive without a request are ignored
+	_make_frame(frame, 30, 1600, 0, 0, 10);
+	_send_frame(&tel, frame);
+	EXPECT_EQ(-ENOENT, esc_telemetry_get_erpm(&tel, 0, 0, &erpm));
+
+	for(int m = 0; m < 4; m++){
+		EXPECT_EQ(m, esc_telemetry_request(&tel, m * 100));
+		// no new request while waiting for the answer
+		EXPECT_EQ(-1, esc_telemetry_request(&tel, m * 100 + 50));
+		_make_frame(frame, 30, 1600, 0, 0, 100 * (m + 1));
+		_send_frame(&tel, frame);
+	}
+	for(int m = 0; m < 4; m++){
+		EXPECT_EQ(0, esc_telemetry_get_erpm(&tel, m, 1000, &erpm));
+		EXPECT_EQ(10000u * (m + 1), erpm);
+	}
+	EXPECT_EQ(-ENOENT, esc_telemetry_get_erpm(&tel, 4, 1000, &erpm));
+	EXPECT_EQ(0, tel.errors);
+
+	// wraps around to the first motor
+	EXPECT_EQ(0, esc_telemetry_request(&tel, 1000));
+}
+
+TEST(EscTelemetryTest, TestTimeoutAndErrors){
+	struct esc_telemetry tel;
+	uint8_t frame[ESC_TELEMETRY_FRAME_SIZE];
+	uint32_t erpm;
+
+	esc_telemetry_init(&tel, 2);
+
+	EXPECT_EQ(0, esc_telemetry_request(&tel, 0));
+	_make_frame(frame, 30, 1600, 0, 0, 200);
+	_send_frame(&tel, frame);
+	EXPECT_EQ(0, esc_telemetry_get_erpm(&tel, 0, 50, &erpm));
+
+	// motor 1 answers with a corrupt frame
+	EXPECT_EQ(1, esc_telemetry_request(&tel, 100));
+	frame[9] ^= 0xff;
+	_send_frame(&tel, frame);
+	EXPECT_EQ(-ENOENT, esc_telemetry_get_erpm(&tel, 1, 150, &erpm));
+	EXPECT_EQ(1, tel.errors);
+
+	// motor 0 does not answer at all and is marked invalid once the request times out
+	EXPECT_EQ(0, esc_telemetry_request(&tel, 200));
+	EXPECT_EQ(-1, esc_telemetry_request(&tel, 200 + ESC_TELEMETRY_TIMEOUT_US - 1));
+	EXPECT_EQ(1, esc_telemetry_request(&tel, 200 + ESC_TELEMETRY_TIMEOUT_US));
+	EXPECT_EQ(-ENOENT, esc_telemetry_get_erpm(&tel, 0, 200 + ESC_TELEMETRY_TIMEOUT_US, &erpm));
+	EXPECT_EQ(2, tel.errors);
+}
+
+TEST(EscTelemetryTest, TestStaleSpeedIsNotReported){
+	struct esc_telemetry tel;
+	uint8_t frame[ESC_TELEMETRY_FRAME_SIZE];
+	uint32_t erpm;
+
+	esc_telemetry_init(&tel, 2);
+	EXPECT_EQ(0, esc_telemetry_request(&tel, 0));
+	_make_frame(frame, 30, 1600, 0, 0, 200);
+	_send_frame(&tel, frame);
+
+	// the answer is good for a few polling rounds and then no longer trusted
+	const sys_micros_t max_age = ESC_TELEMETRY_STALE_ROUNDS * 2 * ESC_TELEMETRY_TIMEOUT_US;
+	EXPECT_EQ(0, esc_telemetry_get_erpm(&tel, 0, max_age, &erpm));
+	EXPECT_EQ(20000u, erpm);
+	EXPECT_EQ(-ENOENT, esc_telemetry_get_erpm(&tel, 0, max_age + 1, &erpm));
+}
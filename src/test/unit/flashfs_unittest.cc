@@ -0,0 +1,459 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern "C" {
+    #include "drivers/flashfs.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+#define FLASH_SECTORS 8
+#define FLASH_PAGES_PER_SECTOR 16
+#define FLASH_SECTOR_SIZE (FLASH_PAGES_PER_SECTOR * M25P16_PAGESIZE)
+#define FLASH_SIZE (FLASH_SECTORS * FLASH_SECTOR_SIZE)
+
+/*
+ * In memory flash chip. A page program reads its data out of the caller's buffer when the transfer completes, the way
+ * the dma would, so reusing buffer space that is still in flight shows up as corrupt data in the flash.
+ */
+static struct {
+    uint8_t data[FLASH_SIZE];
+
+    bool holdTransfer; // keep the dma transfer of the last page program running
+    bool holdBusy;     // keep the chip busy with the last program or erase
+
+    bool transferring;
+    bool busy;
+    uint32_t programAddress;
+    const uint8_t *programData;
+    int programLength;
+
+    int programs;
+    int erases;
+    bool programCrossedPage;
+} fakeFlash;
+
+static flashGeometry_t fakeGeometry = {
+    FLASH_SECTORS, FLASH_PAGES_PER_SECTOR, M25P16_PAGESIZE, FLASH_SECTOR_SIZE, FLASH_SIZE
+};
+
+static void fakeFlashFinishTransfer(void)
+{
+    if (!fakeFlash.transferring) {
+        return;
+    }
+    for (int i = 0; i < fakeFlash.programLength; i++) {
+        fakeFlash.data[fakeFlash.programAddress + i] &= fakeFlash.programData[i];
+    }
+    fakeFlash.transferring = false;
+}
+
+static void fakeFlashRelease(void)
+{
+    fakeFlash.holdTransfer = false;
+    fakeFlash.holdBusy = false;
+    fakeFlashFinishTransfer();
+    fakeFlash.busy = false;
+}
+
+class FlashfsTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        memset(&fakeFlash, 0, sizeof(fakeFlash));
+        memset(fakeFlash.data, 0xFF, sizeof(fakeFlash.data));
+    }
+
+    void fill(uint32_t start, uint32_t end, uint8_t value) {
+        memset(fakeFlash.data + start, value, end - start);
+    }
+
+    uint32_t bytesDropped(void) {
+        flashfsWriteStats_t stats;
+        flashfsGetWriteStats(&stats);
+        return stats.bytesDropped;
+    }
+};
+
+static uint8_t pattern(uint32_t i)
+{
+    return (uint8_t)(i * 7 + (i >> 8));
+}
+
+TEST_F(FlashfsTest, TestInitStartsAtFreeSpace)
+{
+    // given
+    fill(0, 5000, 0x55);
+
+    // when
+    flashfsInit();
+
+    // then
+    EXPECT_EQ(6144u, flashfsGetOffset());
+    EXPECT_EQ(0, flashfsGetSectorsPendingErase());
+}
+
+TEST_F(FlashfsTest, TestFullPageIsProgrammedWhenBuffered)
+{
+    uint8_t data[M25P16_PAGESIZE + 100];
+    for (unsigned i = 0; i < sizeof(data); i++) {
+        data[i] = pattern(i);
+    }
+    flashfsInit();
+
+    // when a whole page and a bit is written
+    flashfsWrite(data, sizeof(data), false);
+    fakeFlashRelease();
+
+    // then only the complete page went to the chip
+    EXPECT_EQ(1, fakeFlash.programs);
+    EXPECT_EQ(0, memcmp(fakeFlash.data, data, M25P16_PAGESIZE));
+    EXPECT_EQ(0xFF, fakeFlash.data[M25P16_PAGESIZE]);
+    EXPECT_EQ(sizeof(data), flashfsGetOffset());
+
+    // and the rest is programmed by a flush
+    flashfsFlushSync();
+    EXPECT_EQ(2, fakeFlash.programs);
+    EXPECT_EQ(0, memcmp(fakeFlash.data, data, sizeof(data)));
+}
+
+TEST_F(FlashfsTest, TestProgramsNeverCrossPages)
+{
+    uint8_t data[3 * M25P16_PAGESIZE];
+    for (unsigned i = 0; i < sizeof(data); i++) {
+        data[i] = pattern(i);
+    }
+    flashfsInit();
+    flashfsSeekAbs(100);
+
+    // when
+    flashfsWrite(data, sizeof(data), false);
+    flashfsFlushSync();
+
+    // then the write was split at the page boundaries
+    EXPECT_FALSE(fakeFlash.programCrossedPage);
+    EXPECT_EQ(4, fakeFlash.programs);
+    EXPECT_EQ(0, memcmp(fakeFlash.data + 100, data, sizeof(data)));
+    EXPECT_EQ(100 + sizeof(data), flashfsGetOffset());
+}
+
+TEST_F(FlashfsTest, TestRingWrapsAround)
+{
+    // given a start offset that is not page aligned so the ring wraps in the middle of pages
+    const uint32_t start = 1000;
+    const uint32_t total = 10 * FLASHFS_WRITE_BUFFER_SIZE;
+    flashfsInit();
+    flashfsSeekAbs(start);
+    const uint32_t dropped = bytesDropped();
+
+    // when data is written in odd sized chunks while the chip only takes a page every few writes
+    fakeFlash.holdBusy = true;
+    uint8_t chunk[77];
+    for (uint32_t written = 0; written < total; written += sizeof(chunk)) {
+        for (unsigned i = 0; i < sizeof(chunk); i++) {
+            chunk[i] = pattern(written + i);
+        }
+        flashfsWrite(chunk, sizeof(chunk), false);
+        if ((written / sizeof(chunk)) % 3 == 2) {
+            fakeFlashRelease();
+            fakeFlash.holdBusy = true;
+        }
+    }
+    fakeFlashRelease();
+    flashfsFlushSync();
+
+    // then nothing was lost or reordered
+    const uint32_t end = start + (total + sizeof(chunk) - 1) / sizeof(chunk) * sizeof(chunk);
+    EXPECT_EQ(dropped, bytesDropped());
+    EXPECT_EQ(end, flashfsGetOffset());
+    EXPECT_FALSE(fakeFlash.programCrossedPage);
+    for (uint32_t i = start; i < end; i++) {
+        ASSERT_EQ(pattern(i - start), fakeFlash.data[i]) << "at " << i;
+    }
+}
+
+TEST_F(FlashfsTest, TestFullRingDropsWhileBusy)
+{
+    uint8_t data[FLASHFS_WRITE_BUFFER_USABLE];
+    for (unsigned i = 0; i < sizeof(data); i++) {
+        data[i] = pattern(i);
+    }
+    flashfsInit();
+    const uint32_t dropped = bytesDropped();
+
+    // given a chip that is busy with something else
+    fakeFlash.busy = true;
+    fakeFlash.holdBusy = true;
+
+    // when the ring is filled
+    flashfsWrite(data, sizeof(data), false);
+
+    // then it takes all of it
+    EXPECT_EQ(0, fakeFlash.programs);
+    EXPECT_EQ(0u, flashfsGetWriteBufferFreeSpace());
+    EXPECT_EQ(dropped, bytesDropped());
+
+    // but anything more is dropped
+    flashfsWriteByte(0x42);
+    uint8_t more[10] = {0};
+    flashfsWrite(more, sizeof(more), false);
+    EXPECT_EQ(dropped + 11, bytesDropped());
+
+    // and once the chip is free the buffered data makes it to the flash
+    fakeFlashRelease();
+    flashfsFlushSync();
+    EXPECT_EQ(0, memcmp(fakeFlash.data, data, sizeof(data)));
+    EXPECT_EQ(sizeof(data), flashfsGetOffset());
+}
+
+TEST_F(FlashfsTest, TestInFlightBytesAreNotReused)
+{
+    uint8_t data[M25P16_PAGESIZE];
+    for (unsigned i = 0; i < sizeof(data); i++) {
+        data[i] = pattern(i);
+    }
+    flashfsInit();
+
+    // given a page whose dma transfer is still running
+    fakeFlash.holdTransfer = true;
+    flashfsWrite(data, sizeof(data), false);
+    EXPECT_EQ(1, fakeFlash.programs);
+
+    // then its buffer space is still taken
+    EXPECT_EQ(FLASHFS_WRITE_BUFFER_USABLE - M25P16_PAGESIZE, flashfsGetWriteBufferFreeSpace());
+
+    // when the rest of the ring is filled with other data
+    uint8_t other[FLASHFS_WRITE_BUFFER_USABLE - M25P16_PAGESIZE];
+    memset(other, 0x00, sizeof(other));
+    flashfsWrite(other, sizeof(other), false);
+    EXPECT_EQ(0u, flashfsGetWriteBufferFreeSpace());
+
+    // then the page in flight still reaches the flash intact
+    fakeFlashRelease();
+    EXPECT_EQ(0, memcmp(fakeFlash.data, data, sizeof(data)));
+    flashfsFlushSync();
+    EXPECT_EQ(0, memcmp(fakeFlash.data + sizeof(data), other, sizeof(other)));
+}
+
+TEST_F(FlashfsTest, TestWritesPastEndAreDropped)
+{
+    uint8_t data[200];
+    memset(data, 0x11, sizeof(data));
+    flashfsInit();
+    flashfsSeekAbs(FLASH_SIZE - 100);
+    const uint32_t dropped = bytesDropped();
+
+    // when
+    flashfsWrite(data, sizeof(data), true);
+    flashfsFlushSync();
+
+    // then the end of the flash is filled and the rest is dropped
+    EXPECT_TRUE(flashfsIsEOF());
+    EXPECT_EQ(dropped + 100, bytesDropped());
+    EXPECT_EQ(0x11, fakeFlash.data[FLASH_SIZE - 1]);
+}
+
+TEST_F(FlashfsTest, TestEraseStartsAheadOfTheLog)
+{
+    // given a full flash that was erased
+    fill(0, FLASH_SIZE, 0x55);
+    flashfsInit();
+    EXPECT_EQ((uint32_t)FLASH_SIZE, flashfsGetOffset());
+    flashfsEraseCompletely();
+    EXPECT_EQ(FLASH_SECTORS, flashfsGetSectorsPendingErase());
+    EXPECT_EQ(0u, flashfsGetErasedReserve());
+
+    // when the background erase runs
+    flashfsEraseUpdate();
+    fakeFlashRelease();
+    flashfsEraseUpdate();
+    fakeFlashRelease();
+
+    // then the sectors at the write pointer are erased first
+    EXPECT_EQ(2, fakeFlash.erases);
+    EXPECT_EQ(0xFF, fakeFlash.data[0]);
+    EXPECT_EQ(0xFF, fakeFlash.data[2 * FLASH_SECTOR_SIZE - 1]);
+    EXPECT_EQ(0x55, fakeFlash.data[2 * FLASH_SECTOR_SIZE]);
+    EXPECT_EQ((uint32_t)(2 * FLASH_SECTOR_SIZE), flashfsGetErasedReserve());
+}
+
+TEST_F(FlashfsTest, TestEraseIsSuspendedWhileLogging)
+{
+    fill(0, FLASH_SIZE, 0x55);
+    flashfsInit();
+    flashfsEraseCompletely();
+    flashfsEraseUpdate();
+    fakeFlashRelease();
+
+    // when a log is being written
+    flashfsSetLogging(true);
+    for (int i = 0; i < 10; i++) {
+        flashfsEraseUpdate();
+        fakeFlashRelease();
+    }
+
+    // then the background erase leaves the chip alone
+    EXPECT_EQ(1, fakeFlash.erases);
+    EXPECT_EQ(FLASH_SECTORS - 1, flashfsGetSectorsPendingErase());
+
+    // and carries on once logging stops
+    flashfsSetLogging(false);
+    flashfsEraseUpdate();
+    EXPECT_EQ(2, fakeFlash.erases);
+    fakeFlashRelease();
+}
+
+TEST_F(FlashfsTest, TestWriterErasesWhenReserveRunsOut)
+{
+    uint8_t data[M25P16_PAGESIZE];
+    memset(data, 0x11, sizeof(data));
+    fill(0, FLASH_SIZE, 0x55);
+    flashfsInit();
+    flashfsEraseCompletely();
+    flashfsSetLogging(true);
+
+    // when a page is written to a sector that is still waiting to be erased
+    flashfsWrite(data, sizeof(data), true);
+    flashfsFlushSync();
+    flashfsSetLogging(false);
+
+    // then it is erased first
+    EXPECT_EQ(1, fakeFlash.erases);
+    EXPECT_EQ(0, memcmp(fakeFlash.data, data, sizeof(data)));
+    EXPECT_EQ(0xFF, fakeFlash.data[sizeof(data)]);
+}
+
+TEST_F(FlashfsTest, TestFreeSpaceBeforeOldData)
+{
+    // given a log that was written while the erase of older logs further on was still going
+    fill(0, 3000, 0x11);
+    fill(3 * FLASH_SECTOR_SIZE, 6 * FLASH_SECTOR_SIZE, 0x55);
+
+    // when
+    flashfsInit();
+
+    // then logging continues after the new log and the old data is erased before it is reached
+    EXPECT_EQ(4096u, flashfsGetOffset());
+    EXPECT_EQ(3, flashfsGetSectorsPendingErase());
+    EXPECT_EQ((uint32_t)(3 * FLASH_SECTOR_SIZE - 4096), flashfsGetErasedReserve());
+}
+
+TEST_F(FlashfsTest, TestInterruptedEraseIsFinished)
+{
+    // given a sector whose erase was cut short, leaving an erased start followed by old data
+    fill(1000, 4 * FLASH_SECTOR_SIZE, 0x55);
+
+    // when
+    flashfsInit();
+
+    // then that sector is erased again before writing to it
+    EXPECT_EQ(0u, flashfsGetOffset());
+    EXPECT_EQ(4, flashfsGetSectorsPendingErase());
+    EXPECT_EQ(0u, flashfsGetErasedReserve());
+}
+
+TEST_F(FlashfsTest, TestOldDataAfterLogInSameSector)
+{
+    // given a log followed by old data in the same sector
+    fill(0, 1000, 0x11);
+    fill(3000, FLASH_SECTOR_SIZE, 0x55);
+
+    // when
+    flashfsInit();
+
+    // then the sector is kept for the log and writing continues in the next one
+    EXPECT_EQ((uint32_t)FLASH_SECTOR_SIZE, flashfsGetOffset());
+    EXPECT_EQ(0, flashfsGetSectorsPendingErase());
+}
+
+// STUBS
+
+extern "C" {
+
+int32_t millis(void)
+{
+    return 0;
+}
+
+const flashGeometry_t* m25p16_getGeometry(void)
+{
+    return &fakeGeometry;
+}
+
+bool m25p16_isTransferring(void)
+{
+    if (!fakeFlash.holdTransfer) {
+        fakeFlashFinishTransfer();
+    }
+    return fakeFlash.transferring;
+}
+
+bool m25p16_isReady(void)
+{
+    if (m25p16_isTransferring()) {
+        return false;
+    }
+    if (!fakeFlash.holdBusy) {
+        fakeFlash.busy = false;
+    }
+    return !fakeFlash.busy;
+}
+
+bool m25p16_waitForReady(uint32_t timeoutMillis)
+{
+    UNUSED(timeoutMillis);
+    if (fakeFlash.holdTransfer || fakeFlash.holdBusy) {
+        return false;
+    }
+    fakeFlashRelease();
+    return true;
+}
+
+void m25p16_pageProgramAsync(uint32_t address, const uint8_t *data, int length)
+{
+    EXPECT_FALSE(fakeFlash.busy);
+    if (address % M25P16_PAGESIZE + length > M25P16_PAGESIZE) {
+        fakeFlash.programCrossedPage = true;
+    }
+    fakeFlash.programAddress = address;
+    fakeFlash.programData = data;
+    fakeFlash.programLength = length;
+    fakeFlash.transferring = true;
+    fakeFlash.busy = true;
+    fakeFlash.programs++;
+}
+
+void m25p16_eraseSector(uint32_t address)
+{
+    EXPECT_FALSE(fakeFlash.busy);
+    EXPECT_EQ(0u, address % FLASH_SECTOR_SIZE);
+    memset(fakeFlash.data + address, 0xFF, FLASH_SECTOR_SIZE);
+    fakeFlash.busy = true;
+    fakeFlash.erases++;
+}
+
+int m25p16_readBytes(uint32_t address, uint8_t *buffer, int length)
+{
+    memcpy(buffer, fakeFlash.data + address, length);
+    return length;
+}
+
+}
@@ -17,193 +17,155 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <math.h>
 
 #include <limits.h>
 
-#include <platform.h>
-
-#include "build_config.h"
-
-//#define DEBUG_ALTITUDE_HOLD
-
-#define BARO
-
 extern "C" {
-    #include "debug.h"
+    #include <platform.h>
+    #include "build_config.h"
 
     #include "common/axis.h"
     #include "common/maths.h"
 
-    #include "drivers/sensor.h"
-    #include "drivers/accgyro.h"
-
-    #include "sensors/acceleration.h"
-    #include "sensors/barometer.h"
-
-    #include "rx/rx.h"
-
-    #include "flight/mixer.h"
-    #include "flight/anglerate.h"
-    #include "flight/altitudehold.h"
-
     #include "config/config.h"
-	#include "config/rc_controls.h"
-	#include "config/altitudehold.h"
-	#include "config/mixer.h"
-
-/*
-    PG_REGISTER_PROFILE(struct pid_config, pidProfile, PG_PID_PROFILE, 0);
-    PG_REGISTER_PROFILE(rcControlsConfig_t, rcControlsConfig, PG_RC_CONTROLS_CONFIG, 0);
-    PG_REGISTER_PROFILE(barometerConfig_t, barometerConfig, PG_BAROMETER_CONFIG, 0);
 
-    PG_REGISTER(motorAndServoConfig_t, motorAndServoConfig, PG_MOTOR_AND_SERVO_CONFIG, 0);
+    #include "sensors/instruments.h"
+    #include "sensors/altitude.h"
 
-	PG_REGISTER_WITH_RESET_TEMPLATE(airplaneConfig_t, airplaneConfig, PG_AIRPLANE_ALT_HOLD_CONFIG, 0);
-
-	PG_RESET_TEMPLATE(airplaneConfig_t, airplaneConfig,
-		.fixedwing_althold_dir = 1,
-	);
-*/
-
-	struct imu default_imu; 
-    extern uint32_t rcModeActivationMask;
+    #include "flight/altitudehold.h"
 }
 
 #include "unittest_macros.h"
 #include "gtest/gtest.h"
 
-#define DOWNWARDS_THRUST true
-#define UPWARDS_THRUST false
+#define ALTHOLD_DT (1.0f / ALTHOLD_UPDATE_HZ)
+
+class AltitudeHoldTest : public ::testing::Test {
+protected:
+	virtual void SetUp(){
+		config_reset(&config);
+		// profile is packed so work on a copy instead of a pointer into it
+		struct rc_controls_config rc = config_get_profile(&config.data)->rc;
+		rc.alt_hold_deadband = 40;
+		rc.alt_hold_fast_change = 1;
+		config_get_profile_rw(&config.data)->rc = rc;
+		ins_init(&ins, &config.data);
+		althold_init(&althold, &ins, &config.data);
+	}
+
+	//! puts the craft at given altitude and vertical speed
+	void set_altitude(float alt, float vel){
+		if(!ins.alt.initialized) ins_altitude_reset(&ins.alt, alt);
+		ins.alt.x[INS_ALT_POS] = alt;
+		ins.alt.x[INS_ALT_VEL] = vel;
+	}
+
+	struct config_store config;
+	struct instruments ins;
+	struct althold althold;
+};
 
+TEST_F(AltitudeHoldTest, TestPassthroughWithoutAltitude){
+	althold_input_throttle(&althold, 120);
+	althold_engage(&althold);
+	althold_input_throttle(&althold, 150);
+	althold_update(&althold, ALTHOLD_DT);
+	EXPECT_EQ(150, althold_get_throttle(&althold));
+}
 
-extern "C" {
-    bool isThrustFacingDownwards(union attitude_euler_angles * attitude);
-    uint16_t calculateTiltAngle(union attitude_euler_angles * attitude);
+TEST_F(AltitudeHoldTest, TestHoldsAltitude){
+	set_altitude(1000, 0);
+	althold_input_throttle(&althold, 100);
+	althold_engage(&althold);
+	althold_update(&althold, ALTHOLD_DT);
+	EXPECT_EQ(100, althold_get_throttle(&althold));
+
+	// below the setpoint we climb, above we descend
+	set_altitude(900, 0);
+	althold_update(&althold, ALTHOLD_DT);
+	EXPECT_GT(althold_get_throttle(&althold), 100);
+	set_altitude(1100, 0);
+	althold_update(&althold, ALTHOLD_DT);
+	EXPECT_LT(althold_get_throttle(&althold), 100);
+
+	// small stick movements inside the deadband do not change the setpoint
+	set_altitude(1000, 0);
+	althold_input_throttle(&althold, 130);
+	althold_update(&althold, ALTHOLD_DT);
+	EXPECT_NEAR(100, althold_get_throttle(&althold), 2);
 }
 
-typedef struct inclinationExpectation_s {
-    union attitude_euler_angles attitude;
-    bool expectDownwardsThrust;
-} inclinationExpectation_t;
+TEST_F(AltitudeHoldTest, TestOutputIsNotQuantized){
+	set_altitude(1000, 0);
+	althold_input_throttle(&althold, 0);
+	althold_engage(&althold);
 
-/*
-// TODO: this test needs to use imu
-TEST(AltitudeHoldTest, IsThrustFacingDownwards)
-{
-    // given
-
-    inclinationExpectation_t inclinationExpectations[] = {
-            { {{    0,    0,    0 }}, DOWNWARDS_THRUST },
-            { {{  799,  799,    0 }}, DOWNWARDS_THRUST },
-            { {{  800,  799,    0 }}, UPWARDS_THRUST },
-            { {{  799,  800,    0 }}, UPWARDS_THRUST },
-            { {{  800,  800,    0 }}, UPWARDS_THRUST },
-            { {{  801,  801,    0 }}, UPWARDS_THRUST },
-            { {{ -799, -799,    0 }}, DOWNWARDS_THRUST },
-            { {{ -800, -799,    0 }}, UPWARDS_THRUST },
-            { {{ -799, -800,    0 }}, UPWARDS_THRUST },
-            { {{ -800, -800,    0 }}, UPWARDS_THRUST },
-            { {{ -801, -801,    0 }}, UPWARDS_THRUST }
-    };
-    uint8_t testIterationCount = sizeof(inclinationExpectations) / sizeof(inclinationExpectation_t);
-
-    // expect
-
-    for (uint8_t index = 0; index < testIterationCount; index ++) {
-        inclinationExpectation_t *angleInclinationExpectation = &inclinationExpectations[index];
-#ifdef DEBUG_ALTITUDE_HOLD
-        printf("iteration: %d\n", index);
-#endif
-        bool result = isThrustFacingDownwards(&angleInclinationExpectation->attitude);
-        EXPECT_EQ(angleInclinationExpectation->expectDownwardsThrust, result);
-    }
+	// a slow sink shows up in the output well before a whole cm of error has built up
+	set_altitude(999.5f, -5);
+	althold_update(&althold, ALTHOLD_DT);
+	EXPECT_GT(althold_get_throttle(&althold), 0);
 }
-*/
-#if 0
-// TODO: reenable althold unit test and rewrite it properly
-TEST(AltitudeHoldTest, applyMultirotorAltHold)
-{
-    // given
-
-    memset(motorAndServoConfig(), 0, sizeof(motorAndServoConfig_t));
-    motorAndServoConfig()->minthrottle = 1150;
-    motorAndServoConfig()->maxthrottle = 1850;
-    memset(rcControlsConfig(), 0, sizeof(rcControlsConfig_t));
-    rcControlsConfig()->alt_hold_deadband = 40;
-    
-    rc_set_channel_value(THROTTLE, 1400);
-    rcCommand[THROTTLE] = 1500;
-    rcModeActivationMask |= (1 << BOXBARO);
-    althold_update(&althold);
-    
-    // when
-    apply_althold(&althold);
-    
-    // expect
-    EXPECT_EQ(1500, rcCommand[THROTTLE]);
-    
-    // and given
-    rcControlsConfig()->alt_hold_fast_change = 1;
-    
-    // when
-    applyAltHold();
-    
-    // expect
-    EXPECT_EQ(1500, rcCommand[THROTTLE]);
+
+TEST_F(AltitudeHoldTest, TestVelocityIntegral){
+	set_altitude(1000, 0);
+	althold_input_throttle(&althold, 0);
+	althold_engage(&althold);
+
+	// a craft that keeps sinking needs more and more throttle
+	set_altitude(1000, -20);
+	althold_update(&althold, ALTHOLD_DT);
+	int16_t first = althold_get_throttle(&althold);
+	for(int c = 0; c < ALTHOLD_UPDATE_HZ; c++)
+		althold_update(&althold, ALTHOLD_DT);
+	EXPECT_GT(althold_get_throttle(&althold), first);
 }
-#endif
-// STUBS
 
-extern "C" {
-uint32_t rcModeActivationMask;
-bool rcModeIsActive(boxId_e modeId) { return rcModeActivationMask & (1 << modeId); }
-int16_t rcCommand[4];
-int16_t rcData[RX_MAX_SUPPORTED_RC_CHANNELS];
-// TODO: proper way to do this is to write a mock receiver
-int16_t rc_get_channel_value(uint8_t id){ return rcData[id]; }
-void rc_set_channel_value(uint8_t id, int16_t value){ rcData[id] = value; }
-uint32_t accTimeSum ;        // keep track for integration of acc
-int accSumCount;
-float accVelScale;
-
-float imu_get_velocity_integration_time(struct imu *self){ UNUSED(self); return 0.001;}
-float imu_get_est_vertical_vel_cms(struct imu *self){ UNUSED(self); return 0; }
-void imu_reset_velocity_estimate(struct imu *self){ UNUSED(self); }
-float imu_get_avg_vertical_accel_cmss(struct imu *self){ UNUSED(self); return 0; }
-
-int16_t imu_get_roll_dd(struct imu *self){ return self->attitude.values.roll; }
-int16_t imu_get_pitch_dd(struct imu *self){ return self->attitude.values.pitch; }
-//uint16_t acc_1G;
-//int16_t heading;
-//gyro_t gyro;
-//int32_t accSum[XYZ_AXIS_COUNT];
-//int16_t magADC[XYZ_AXIS_COUNT];
-int32_t BaroAlt;
-int16_t debug[DEBUG16_VALUE_COUNT];
-
-uint8_t stateFlags;
-uint16_t flightModeFlags;
-uint8_t armingFlags;
-
-int32_t sonarAlt;
-int16_t sonarCfAltCm;
-int16_t sonarMaxAltWithTiltCm;
-
-void gyroUpdate(void) {};
-bool sensors(uint32_t mask)
-{
-    UNUSED(mask);
-    return false;
-};
-void updateAccelerationReadings(rollAndPitchTrims_t *rollAndPitchTrims)
-{
-    UNUSED(rollAndPitchTrims);
+TEST_F(AltitudeHoldTest, TestFastChange){
+	set_altitude(1000, 0);
+	althold_input_throttle(&althold, 100);
+	althold_engage(&althold);
+
+	// outside of the deadband the pilot has direct control with the deadband removed
+	althold_input_throttle(&althold, 200);
+	althold_update(&althold, ALTHOLD_DT);
+	EXPECT_EQ(160, althold_get_throttle(&althold));
+
+	// new altitude is held when the stick returns
+	set_altitude(1500, 0);
+	althold_input_throttle(&althold, 100);
+	althold_update(&althold, ALTHOLD_DT);
+	EXPECT_EQ(1500, althold.setpoint);
+	EXPECT_EQ(100, althold_get_throttle(&althold));
 }
 
-void imuResetAccelerationSum(void) {};
+TEST_F(AltitudeHoldTest, TestSlowChange){
+	config_get_profile_rw(&config.data)->rc.alt_hold_fast_change = 0;
+	set_altitude(1000, 0);
+	althold_input_throttle(&althold, 100);
+	althold_engage(&althold);
+
+	// stick commands climb rate
+	althold_input_throttle(&althold, 300);
+	althold_update(&althold, ALTHOLD_DT);
+	EXPECT_GT(althold_get_throttle(&althold), 100);
+
+	// climbing at the commanded 100cm/s needs no correction
+	althold_init(&althold, &ins, &config.data);
+	althold_input_throttle(&althold, 100);
+	althold_engage(&althold);
+	althold_input_throttle(&althold, 300);
+	set_altitude(1000, 100);
+	althold_update(&althold, ALTHOLD_DT);
+	EXPECT_EQ(100, althold_get_throttle(&althold));
+}
 
-uint32_t micros(void) { return 0; }
-bool isBaroCalibrationComplete(void) { return true; }
-void performBaroCalibrationCycle(void) {}
-int32_t baroCalculateAltitude(void) { return 0; }
+TEST_F(AltitudeHoldTest, TestNoCorrectionWhenInverted){
+	set_altitude(1000, 0);
+	althold_input_throttle(&althold, 100);
+	althold_engage(&althold);
+	set_altitude(500, 0);
+	ins.imu.attitude.values.roll = 900;
+	althold_update(&althold, ALTHOLD_DT);
+	EXPECT_EQ(100, althold_get_throttle(&althold));
 }
@@ -567,6 +567,172 @@ TEST_F(MixerBasicTest, TestMixerModeAirplane){
 	testedModes++;
 }
 
+/**
+ * @page MIXER
+ * @ingroup MIXER
+ *
+ * - Mixer rules and output limits are compiled when the mixer is initialized
+ * and when mixer_reload_config() is called. Config changes in between do not
+ * affect the outputs.
+ */
+TEST_F(MixerBasicTest, TestConfigChangesApplyOnReload){
+	config.data.pwm_out.mincommand = 1000;
+	config.data.pwm_out.minthrottle = 1050;
+	config.data.pwm_out.maxthrottle = 1850;
+
+	_init_mixer_defaults(MIXER_QUADX);
+	mixer_enable_armed(&mixer, true);
+
+	mixer_input_command(&mixer, MIXER_INPUT_G0_THROTTLE, 0);
+	mixer_input_command(&mixer, MIXER_INPUT_G0_PITCH, 100);
+	mixer_update(&mixer);
+	EXPECT_EQ(4, mixer_get_motor_count(&mixer));
+	EXPECT_EQ(1600, mock_motor_pwm[0]);
+	EXPECT_EQ(1000, mock_motor_pwm[4]);
+
+	config.data.mixer.mixerMode = MIXER_HEX6X;
+	config.data.pwm_out.mincommand = 1010;
+	mixer_update(&mixer);
+	EXPECT_EQ(4, mixer_get_motor_count(&mixer));
+	EXPECT_EQ(1000, mock_motor_pwm[4]);
+
+	mixer_reload_config(&mixer);
+	mixer_update(&mixer);
+	EXPECT_EQ(6, mixer_get_motor_count(&mixer));
+	EXPECT_EQ(1010, mock_motor_pwm[6]);
+	EXPECT_NE(1500, mock_motor_pwm[0]);
+}
+
+/**
+ * @page MIXER
+ * @ingroup MIXER
+ *
+ * - With throttle priority the collective thrust is kept and differential
+ * thrust is reduced until all motors fit. With attitude priority collective
+ * thrust is moved down at the top of the range but is not raised at the
+ * bottom.
+ */
+TEST_F(MixerBasicTest, TestDesatModes){
+	config.data.pwm_out.mincommand = 1000;
+	config.data.pwm_out.minthrottle = 1050;
+	config.data.pwm_out.maxthrottle = 1850;
+
+	config.data.mixer.desat_mode = MIXER_DESAT_THROTTLE;
+	_init_mixer_defaults(MIXER_QUADX);
+	mixer_enable_armed(&mixer, true);
+
+	// differential of 100 is halved so that the collective at 1800 is kept
+	mixer_input_command(&mixer, MIXER_INPUT_G0_PITCH, 100);
+	mixer_input_command(&mixer, MIXER_INPUT_G0_THROTTLE, 300);
+	mixer_update(&mixer);
+	EXPECT_EQ(1850, mock_motor_pwm[0]);
+	EXPECT_EQ(1750, mock_motor_pwm[1]);
+	EXPECT_EQ(1850, mock_motor_pwm[2]);
+	EXPECT_EQ(1750, mock_motor_pwm[3]);
+	EXPECT_EQ(true, mixer_motor_limit_reached(&mixer));
+
+	config.data.mixer.desat_mode = MIXER_DESAT_ATTITUDE;
+	mixer_reload_config(&mixer);
+
+	// at the top collective is moved down and differential is kept
+	mixer_update(&mixer);
+	EXPECT_EQ(1850, mock_motor_pwm[0]);
+	EXPECT_EQ(1650, mock_motor_pwm[1]);
+	EXPECT_EQ(1850, mock_motor_pwm[2]);
+	EXPECT_EQ(1650, mock_motor_pwm[3]);
+
+	// at the bottom collective is not raised
+	mixer_input_command(&mixer, MIXER_INPUT_G0_THROTTLE, -500);
+	mixer_update(&mixer);
+	for(int c = 0; c < 4; c++){
+		EXPECT_EQ(1050, mock_motor_pwm[c]);
+	}
+	EXPECT_EQ(true, mixer_motor_limit_reached(&mixer));
+
+	// airmode raises collective instead
+	config.data.mixer.desat_mode = MIXER_DESAT_AIRMODE;
+	mixer_reload_config(&mixer);
+	mixer_update(&mixer);
+	EXPECT_EQ(1250, mock_motor_pwm[0]);
+	EXPECT_EQ(1050, mock_motor_pwm[1]);
+}
+
+/**
+ * @page MIXER
+ * @ingroup MIXER
+ *
+ * - Motor values are mapped through a thrust curve. With thrust_linear set to
+ * 100 the pwm output is proportional to the square root of the commanded
+ * value within the throttle range.
+ */
+TEST_F(MixerBasicTest, TestThrustCurve){
+	config.data.pwm_out.mincommand = 1000;
+	config.data.pwm_out.minthrottle = 1000;
+	config.data.pwm_out.maxthrottle = 2000;
+
+	_init_mixer_defaults(MIXER_QUADX);
+	mixer_enable_armed(&mixer, true);
+
+	mixer_input_command(&mixer, MIXER_INPUT_G0_THROTTLE, 0);
+	mixer_update(&mixer);
+	EXPECT_EQ(1500, mock_motor_pwm[0]);
+
+	config.data.mixer.thrust_linear = 100;
+	mixer_reload_config(&mixer);
+
+	mixer_update(&mixer);
+	EXPECT_EQ(1707, mock_motor_pwm[0]);
+
+	mixer_input_command(&mixer, MIXER_INPUT_G0_THROTTLE, -250);
+	mixer_update(&mixer);
+	EXPECT_EQ(1500, mock_motor_pwm[0]);
+
+	mixer_input_command(&mixer, MIXER_INPUT_G0_THROTTLE, -500);
+	mixer_update(&mixer);
+	EXPECT_EQ(1000, mock_motor_pwm[0]);
+
+	mixer_input_command(&mixer, MIXER_INPUT_G0_THROTTLE, 500);
+	mixer_update(&mixer);
+	EXPECT_EQ(2000, mock_motor_pwm[0]);
+
+	// the curve follows a new throttle range
+	mixer_set_throttle_range(&mixer, 1500, 1100, 1900);
+	mixer_input_command(&mixer, MIXER_INPUT_G0_THROTTLE, -200);
+	mixer_update(&mixer);
+	EXPECT_EQ(1500, mock_motor_pwm[0]);
+	mixer_input_command(&mixer, MIXER_INPUT_G0_THROTTLE, -500);
+	mixer_update(&mixer);
+	EXPECT_EQ(1100, mock_motor_pwm[0]);
+}
+
+/**
+ * @page MIXER
+ * @ingroup MIXER
+ *
+ * - Motor speed reported by esc telemetry is converted from electrical rpm to
+ * rpm using the motor_poles setting. Outputs that are not used as motors
+ * report no speed.
+ */
+TEST_F(MixerBasicTest, TestMotorRpmFromTelemetry){
+	config.data.pwm_out.motor_poles = 14;
+	_init_mixer_defaults(MIXER_QUADX);
+	mixer_enable_armed(&mixer, true);
+
+	for(int c = 0; c < 8; c++)
+		mock_motor_erpm[c] = 70000 + c * 700;
+	mixer_update(&mixer);
+
+	EXPECT_EQ(10000, mixer_get_motor_rpm(&mixer, 0));
+	EXPECT_EQ(10300, mixer_get_motor_rpm(&mixer, 3));
+	EXPECT_EQ(0, mixer_get_motor_rpm(&mixer, 4));
+	EXPECT_EQ(0, mixer_get_motor_rpm(&mixer, MIXER_MAX_MOTORS));
+
+	config.data.pwm_out.motor_poles = 12;
+	mixer_reload_config(&mixer);
+	mixer_update(&mixer);
+	EXPECT_EQ(11666, mixer_get_motor_rpm(&mixer, 0));
+}
+
 TEST_F(MixerBasicTest, TestQuadMotors)
 {
 	config.data.pwm_out.mincommand = 1000;
@@ -0,0 +1,142 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+
+extern "C" {
+    #include "flight/posest.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+#define PREDICT_US 10000        // 100Hz prediction
+#define GPS_EVERY 10            // 10Hz gps
+#define GPS_LATENCY_US 150000   // time between measurement and the fix arriving
+
+// vehicle accelerates north, cruises and then brakes
+static float truthAccel(int32_t t)
+{
+    if (t < 2000000) return 200.0f;
+    if (t < 4000000) return 0.0f;
+    if (t < 5000000) return -300.0f;
+    return 0;
+}
+
+struct truth {
+    float pos[512 * 2];
+    float vel[512 * 2];
+};
+
+// runs the estimator over the same trajectory and returns the rms north position error over the last seconds
+static float simulate(struct posest *est, struct truth *tr, int steps)
+{
+    float p = 0, v = 0;
+    float origin = NAN;
+    float err2 = 0;
+    int errn = 0;
+    for (int k = 0; k < steps; k++) {
+        int32_t t = k * PREDICT_US;
+        float a = truthAccel(t);
+        v += a * PREDICT_US * 1e-6f;
+        p += v * PREDICT_US * 1e-6f;
+        tr->pos[k] = p;
+        tr->vel[k] = v;
+
+        // accelerometer with a bias, gps has to pull the estimate back
+        const float acc[3] = { a + 20.0f, 0, 0 };
+        posest_predict(est, acc, t);
+
+        int lag = GPS_LATENCY_US / PREDICT_US;
+        if (k % GPS_EVERY == 0 && k >= lag) {
+            struct posest_gps_fix fix;
+            memset(&fix, 0, sizeof(fix));
+            fix.lat = lrintf(tr->pos[k - lag] / 1.113195f);
+            fix.vel_ned[0] = lrintf(tr->vel[k - lag]);
+            // the fix shows up now but describes the vehicle GPS_LATENCY_US ago
+            fix.timestamp = t;
+            // the first fix becomes the origin of the estimate
+            if (isnan(origin))
+                origin = tr->pos[k - lag];
+            EXPECT_EQ(0, posest_input_gps(est, &fix));
+        }
+
+        if (t > 2500000) {
+            float e = posest_get_position(est)[0] - (p - origin);
+            err2 += e * e;
+            errn++;
+        }
+    }
+    return sqrtf(err2 / errn);
+}
+
+TEST(PositionEstimatorTest, TestDelayCompensation)
+{
+    static struct truth tr;
+    struct posest est, naive;
+
+    posest_init(&est);
+    posest_set_gps_delay(&est, GPS_LATENCY_US);
+    posest_init(&naive);
+    posest_set_gps_delay(&naive, 0);
+
+    float err = simulate(&est, &tr, 600);
+    float err_naive = simulate(&naive, &tr, 600);
+    printf("rms position error: compensated %.1fcm, uncompensated %.1fcm\n", (double)err, (double)err_naive);
+
+    // fusing fixes at their measurement time should remove most of the lag induced error
+    EXPECT_LT(err, 10.0f);
+    EXPECT_LT(err * 3, err_naive);
+    EXPECT_EQ(0u, est.rejected);
+    EXPECT_GT(est.fused, 50u);
+}
+
+TEST(PositionEstimatorTest, TestRejectsStaleFixes)
+{
+    struct posest est;
+    struct posest_gps_fix fix;
+    const float acc[3] = { 0, 0, 0 };
+
+    posest_init(&est);
+    memset(&fix, 0, sizeof(fix));
+    posest_set_gps_delay(&est, 0);
+
+    // nothing to fuse with before the first prediction
+    EXPECT_EQ(-EINVAL, posest_input_gps(&est, &fix));
+
+    for (int k = 0; k < 100; k++)
+        posest_predict(&est, acc, k * PREDICT_US);
+
+    fix.timestamp = 99 * PREDICT_US;
+    EXPECT_EQ(0, posest_input_gps(&est, &fix));
+
+    // older than the history, must not touch the state
+    fix.lat = 1000;
+    fix.timestamp = 99 * PREDICT_US - (POSEST_HISTORY_SIZE + 1) * PREDICT_US;
+    EXPECT_EQ(-ERANGE, posest_input_gps(&est, &fix));
+    EXPECT_EQ(1u, est.rejected);
+    EXPECT_FLOAT_EQ(0, posest_get_position(&est)[0]);
+
+    // a fix within the history moves the current state
+    fix.timestamp = 90 * PREDICT_US;
+    EXPECT_EQ(0, posest_input_gps(&est, &fix));
+    EXPECT_GT(posest_get_position(&est)[0], 0);
+}
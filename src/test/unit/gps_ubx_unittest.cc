@@ -0,0 +1,231 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+extern "C" {
+    #include "sensors/ubx.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+// builds a complete frame with checksum into buf and returns its length
+static int makeFrame(uint8_t *buf, uint8_t cls, uint8_t id, const uint8_t *payload, uint16_t len)
+{
+    buf[0] = UBX_PREAMBLE1;
+    buf[1] = UBX_PREAMBLE2;
+    buf[2] = cls;
+    buf[3] = id;
+    buf[4] = len & 0xff;
+    buf[5] = len >> 8;
+    memcpy(buf + 6, payload, len);
+    uint8_t a = 0, b = 0;
+    for (int i = 2; i < 6 + len; i++) {
+        a += buf[i];
+        b += a;
+    }
+    buf[6 + len] = a;
+    buf[7 + len] = b;
+    return len + 8;
+}
+
+static int makePvt(uint8_t *buf, int32_t lat, int32_t lon)
+{
+    uint8_t p[92];
+    memset(p, 0, sizeof(p));
+    put32(p + 0, 123400);           // iTOW
+    p[20] = UBX_FIX_3D;
+    p[21] = 0x01;                   // gnssFixOK
+    p[23] = 11;                     // numSV
+    put32(p + 24, lon);
+    put32(p + 28, lat);
+    put32(p + 36, 52300);           // hMSL mm
+    put32(p + 48, 1500);            // velN mm/s
+    put32(p + 52, (uint32_t)-700);  // velE
+    put32(p + 56, 200);             // velD
+    put32(p + 60, 1655);            // gSpeed
+    put32(p + 64, 33500000);        // headMot
+    p[76] = 150;                    // pDOP
+    return makeFrame(buf, UBX_CLASS_NAV, UBX_NAV_PVT, p, sizeof(p));
+}
+
+static int feed(struct ubx_parser *ubx, const uint8_t *buf, int len, sys_micros_t now)
+{
+    int ret = 0;
+    for (int i = 0; i < len; i++) {
+        int r = ubx_parser_input(ubx, buf[i], now + i * 100);
+        if (r != 0)
+            ret = r;
+    }
+    return ret;
+}
+
+TEST(GpsUbxUnittest, TestPvtSolution)
+{
+    struct ubx_parser ubx;
+    ubx_parser_init(&ubx);
+
+    uint8_t buf[128];
+    int len = makePvt(buf, 473977418, 85455938);
+
+    // garbage in front of the frame is skipped and the timestamp is taken at the sync char
+    const uint8_t junk[] = { 0x00, 0xB5, 0x11, 0x62 };
+    EXPECT_EQ(0, feed(&ubx, junk, sizeof(junk), 0));
+    EXPECT_EQ(UBX_SOLUTION, feed(&ubx, buf, len, 1000));
+
+    EXPECT_EQ(1000, ubx.sol.timestamp);
+    EXPECT_EQ(473977418, ubx.sol.lat);
+    EXPECT_EQ(85455938, ubx.sol.lon);
+    EXPECT_EQ(52300, ubx.sol.alt_msl);
+    EXPECT_EQ(150, ubx.sol.vel_ned[0]);
+    EXPECT_EQ(-70, ubx.sol.vel_ned[1]);
+    EXPECT_EQ(20, ubx.sol.vel_ned[2]);
+    EXPECT_EQ(165u, ubx.sol.ground_speed);
+    EXPECT_EQ(11, ubx.sol.num_sat);
+    EXPECT_EQ(150, ubx.sol.pdop);
+    EXPECT_TRUE(ubx.sol.fix_ok);
+    EXPECT_TRUE(ubx.have_pvt);
+    EXPECT_EQ('T', ubx.tag);
+    EXPECT_EQ(1u, ubx.frames);
+    EXPECT_EQ(0u, ubx.errors);
+    EXPECT_GT(ubx.garbage, 0u);
+}
+
+TEST(GpsUbxUnittest, TestChecksumAndLength)
+{
+    struct ubx_parser ubx;
+    ubx_parser_init(&ubx);
+
+    uint8_t buf[128];
+    int len = makePvt(buf, 1, 2);
+
+    // corrupt one payload byte
+    buf[30] ^= 0x40;
+    EXPECT_EQ(-EBADMSG, feed(&ubx, buf, len, 0));
+    EXPECT_EQ(1u, ubx.errors);
+    EXPECT_EQ(0u, ubx.frames);
+
+    // oversized frames are dropped after the header
+    const uint8_t big[] = { UBX_PREAMBLE1, UBX_PREAMBLE2, UBX_CLASS_NAV, UBX_NAV_PVT, 0xff, 0xff };
+    EXPECT_EQ(-EMSGSIZE, feed(&ubx, big, sizeof(big), 0));
+
+    // frames too short for their message type are rejected
+    uint8_t p[16] = { 0 };
+    len = makeFrame(buf, UBX_CLASS_NAV, UBX_NAV_PVT, p, sizeof(p));
+    EXPECT_EQ(-EMSGSIZE, feed(&ubx, buf, len, 0));
+    EXPECT_FALSE(ubx.have_pvt);
+
+    // the parser recovers on the next good frame
+    len = makePvt(buf, 10, 20);
+    EXPECT_EQ(UBX_SOLUTION, feed(&ubx, buf, len, 0));
+    EXPECT_EQ(10, ubx.sol.lat);
+}
+
+TEST(GpsUbxUnittest, TestLegacyMessages)
+{
+    struct ubx_parser ubx;
+    ubx_parser_init(&ubx);
+
+    uint8_t buf[128];
+    uint8_t p[52];
+    int len;
+
+    memset(p, 0, sizeof(p));
+    p[10] = UBX_FIX_3D;
+    p[11] = 0x01;
+    p[47] = 7;
+    len = makeFrame(buf, UBX_CLASS_NAV, UBX_NAV_SOL, p, 52);
+    EXPECT_EQ(UBX_FRAME, feed(&ubx, buf, len, 5000));
+
+    memset(p, 0, sizeof(p));
+    put32(p + 4, 200);
+    put32(p + 8, 300);
+    len = makeFrame(buf, UBX_CLASS_NAV, UBX_NAV_POSLLH, p, 28);
+    EXPECT_EQ(UBX_FRAME, feed(&ubx, buf, len, 8000));
+
+    memset(p, 0, sizeof(p));
+    put32(p + 4, 55);
+    put32(p + 20, 60);
+    len = makeFrame(buf, UBX_CLASS_NAV, UBX_NAV_VELNED, p, 36);
+    EXPECT_EQ(UBX_SOLUTION, feed(&ubx, buf, len, 12000));
+
+    // the solution is stamped with the first frame of the epoch
+    EXPECT_EQ(5000, ubx.sol.timestamp);
+    EXPECT_EQ(300, ubx.sol.lat);
+    EXPECT_EQ(200, ubx.sol.lon);
+    EXPECT_EQ(55, ubx.sol.vel_ned[0]);
+    EXPECT_EQ(60u, ubx.sol.ground_speed);
+    EXPECT_EQ(7, ubx.sol.num_sat);
+    EXPECT_TRUE(ubx.sol.fix_ok);
+
+    // once pvt is seen the legacy messages no longer touch the solution
+    len = makePvt(buf, 1000, 2000);
+    EXPECT_EQ(UBX_SOLUTION, feed(&ubx, buf, len, 20000));
+    memset(p, 0, sizeof(p));
+    put32(p + 8, 999);
+    len = makeFrame(buf, UBX_CLASS_NAV, UBX_NAV_POSLLH, p, 28);
+    EXPECT_EQ(0, feed(&ubx, buf, len, 30000));
+    EXPECT_EQ(1000, ubx.sol.lat);
+}
+
+TEST(GpsUbxUnittest, TestAck)
+{
+    struct ubx_parser ubx;
+    ubx_parser_init(&ubx);
+
+    uint8_t buf[16];
+    const uint8_t rate[] = { UBX_CLASS_CFG, UBX_CFG_RATE };
+
+    int len = makeFrame(buf, UBX_CLASS_ACK, UBX_ACK_NAK, rate, sizeof(rate));
+    EXPECT_EQ(UBX_FRAME, feed(&ubx, buf, len, 0));
+    EXPECT_EQ(UBX_UPDATE_ACK, ubx.updated);
+    EXPECT_EQ(UBX_CLASS_CFG, ubx.ack.msg_class);
+    EXPECT_EQ(UBX_CFG_RATE, ubx.ack.msg_id);
+    EXPECT_FALSE(ubx.ack.ok);
+    EXPECT_EQ('N', ubx.tag);
+
+    len = makeFrame(buf, UBX_CLASS_ACK, UBX_ACK_ACK, rate, sizeof(rate));
+    EXPECT_EQ(UBX_FRAME, feed(&ubx, buf, len, 0));
+    EXPECT_TRUE(ubx.ack.ok);
+}
+
+TEST(GpsUbxUnittest, TestSvinfoDoesNotStartEpoch)
+{
+    struct ubx_parser ubx;
+    ubx_parser_init(&ubx);
+
+    uint8_t buf[128];
+    uint8_t p[8];
+    memset(p, 0, sizeof(p));
+
+    // svinfo trails the solution of the previous epoch
+    int len = makeFrame(buf, UBX_CLASS_NAV, UBX_NAV_SVINFO, p, sizeof(p));
+    EXPECT_EQ(UBX_FRAME, feed(&ubx, buf, len, 5000));
+
+    // the next solution is stamped with its own frame
+    len = makePvt(buf, 1, 2);
+    EXPECT_EQ(UBX_SOLUTION, feed(&ubx, buf, len, 100000));
+    EXPECT_EQ(100000, ubx.sol.timestamp);
+}
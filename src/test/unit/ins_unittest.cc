@@ -41,6 +41,7 @@ extern "C" {
     #include "sensors/compass.h"
     #include "sensors/acceleration.h"
     #include "sensors/barometer.h"
+    #include "sensors/altitude.h"
 
     #include "config/config.h"
 
@@ -452,3 +453,189 @@ TEST(InsUnitTest, TestMagYawAngleCalculation){
 	config.data.sensors.trims.magZero.raw[2] = 0;
 }
 
+
+// peak gyro output for a sine input once the filters have settled
+static int32_t _gyro_sine_peak(struct ins_gyro *gyro, float hz, float sample_rate, int16_t amplitude){
+	int32_t peak = 0;
+	for(int c = 0; c < 4000; c++){
+		// keep the phase small, sinf is replaced by an approximation that is only valid for small angles
+		int32_t v = lrintf(amplitude * sinf(2 * M_PI * fmodf(hz * c / sample_rate, 1.0f)));
+		ins_gyro_process_sample(gyro, v, v, v);
+		if(c > 3000) peak = MAX(peak, ABS(ins_gyro_get_x(gyro)));
+	}
+	return peak;
+}
+
+TEST(InsUnitTest, TestGyroRpmNotch){
+	struct ins_gyro gyro;
+
+	config_reset(&config);
+	config.data.gyro.soft_gyro_lpf_hz = 0;
+	config.data.gyro.move_threshold = 0;
+	config.data.gyro.rpm_notch_harmonics = 2;
+	config.data.gyro.rpm_notch_min_hz = 100;
+	config.data.gyro.rpm_notch_q = 500;
+
+	ins_gyro_init(&gyro, &config.data.gyro);
+	ins_gyro_set_sample_rate(&gyro, 2000);
+	for(int c = 0; c < 1000; c++)
+		ins_gyro_process_sample(&gyro, 0, 0, 0);
+	EXPECT_TRUE(ins_gyro_is_calibrated(&gyro));
+
+	// no motor speed known yet so nothing is filtered (sampled peak of a 200hz sine at 2khz is 951)
+	EXPECT_GE(_gyro_sine_peak(&gyro, 200, 2000, 1000), 950);
+
+	// 12000 rpm is 200hz with the second harmonic at 400hz
+	ins_gyro_set_motor_rpm(&gyro, 0, 12000);
+	EXPECT_LT(_gyro_sine_peak(&gyro, 200, 2000, 1000), 20);
+	EXPECT_LT(_gyro_sine_peak(&gyro, 400, 2000, 1000), 20);
+	EXPECT_GT(_gyro_sine_peak(&gyro, 300, 2000, 1000), 900);
+
+	// filters follow the motor when it speeds up
+	ins_gyro_set_motor_rpm(&gyro, 0, 15000);
+	EXPECT_LT(_gyro_sine_peak(&gyro, 250, 2000, 1000), 20);
+
+	// motors below the minimum speed are not filtered
+	ins_gyro_set_motor_rpm(&gyro, 0, 3000);
+	EXPECT_GT(_gyro_sine_peak(&gyro, 50, 2000, 1000), 990);
+}
+
+//! deterministic noise in range -amplitude to amplitude
+static float _alt_noise(uint32_t *seed, float amplitude){
+	*seed = *seed * 1103515245 + 12345;
+	return (((*seed >> 16) & 0x7fff) / 16383.5f - 1.0f) * amplitude;
+}
+
+class InsAltitudeTest : public ::testing::Test {
+protected:
+	virtual void SetUp(){
+		config_reset(&config);
+		baro = &config_get_profile_rw(&config.data)->baro;
+		ins_altitude_init(&alt, baro);
+	}
+
+	//! runs the filter for ms milliseconds at 1khz with baro at 50hz while climbing with constant acceleration
+	void run(int ms, float acc, float bias, float noise){
+		for(int c = 0; c < ms; c++){
+			vel += acc * 0.001f;
+			pos += vel * 0.001f;
+			ins_altitude_predict(&alt, acc + bias, 0.001f);
+			if((c % 20) == 0)
+				ins_altitude_input_baro(&alt, pos + _alt_noise(&seed, noise));
+		}
+	}
+
+	struct barometer_config *baro;
+	struct ins_altitude alt;
+	float pos = 10000, vel = 0;
+	uint32_t seed = 1;
+};
+
+TEST_F(InsAltitudeTest, TestInitializesFromFirstSample){
+	EXPECT_FALSE(alt.initialized);
+	ins_altitude_predict(&alt, 100, 0.001f);
+	EXPECT_FLOAT_EQ(0, ins_altitude_get_cm(&alt));
+	ins_altitude_input_baro(&alt, 10000);
+	EXPECT_TRUE(alt.initialized);
+	EXPECT_FLOAT_EQ(10000, ins_altitude_get_cm(&alt));
+	EXPECT_FLOAT_EQ(0, ins_altitude_get_velocity_cms(&alt));
+}
+
+TEST_F(InsAltitudeTest, TestFiltersBaroNoise){
+	run(5000, 0, 0, 60);
+	float max_err = 0;
+	for(int c = 0; c < 10; c++){
+		run(100, 0, 0, 60);
+		max_err = MAX(max_err, fabsf(ins_altitude_get_cm(&alt) - pos));
+		EXPECT_NEAR(0, ins_altitude_get_velocity_cms(&alt), 15);
+	}
+	// much smaller than the baro noise
+	EXPECT_LT(max_err, 20);
+}
+
+TEST_F(InsAltitudeTest, TestFollowsClimbWithoutLag){
+	run(5000, 0, 0, 60);
+	// accelerate to 2m/s in one second and keep climbing
+	run(1000, 200, 0, 60);
+	run(500, 0, 0, 60);
+	EXPECT_NEAR(200, ins_altitude_get_velocity_cms(&alt), 20);
+	EXPECT_NEAR(pos, ins_altitude_get_cm(&alt), 25);
+}
+
+TEST_F(InsAltitudeTest, TestEstimatesAccelerometerBias){
+	run(30000, 0, 30, 60);
+	EXPECT_NEAR(30, alt.x[INS_ALT_BIAS], 5);
+	EXPECT_NEAR(0, ins_altitude_get_velocity_cms(&alt), 10);
+	EXPECT_NEAR(pos, ins_altitude_get_cm(&alt), 25);
+}
+
+TEST_F(InsAltitudeTest, TestSonarTakesOverFromBaro){
+	run(5000, 0, 0, 0);
+	float start = ins_altitude_get_cm(&alt);
+
+	// sonar reads height above ground while baro reads altitude above sea level.
+	// Sonar coming into range does not move the estimate.
+	for(int c = 0; c < 1000; c++){
+		ins_altitude_predict(&alt, 0, 0.001f);
+		if((c % 20) == 0) ins_altitude_input_baro(&alt, pos);
+		if((c % 40) == 0) ins_altitude_input_sonar(&alt, 100);
+	}
+	EXPECT_NEAR(start, ins_altitude_get_cm(&alt), 2);
+
+	// while in range sonar is trusted over a baro that drifts. Climb 50cm and stop.
+	for(int c = 0; c < 2000; c++){
+		float acc = (c < 1000)?50:-50;
+		vel += acc * 0.001f;
+		pos += vel * 0.001f;
+		ins_altitude_predict(&alt, acc, 0.001f);
+		if((c % 20) == 0) ins_altitude_input_baro(&alt, pos + 200);
+		if((c % 40) == 0) ins_altitude_input_sonar(&alt, 100 + pos - start);
+	}
+	EXPECT_NEAR(start + 50, ins_altitude_get_cm(&alt), 5);
+
+	// no jump when sonar goes out of range and baro takes over again
+	for(int c = 0; c < 2000; c++){
+		ins_altitude_predict(&alt, 0, 0.001f);
+		if((c % 20) == 0) ins_altitude_input_baro(&alt, pos + 200);
+	}
+	EXPECT_NEAR(start + 50, ins_altitude_get_cm(&alt), 10);
+}
+
+TEST(InsUnitTest, TestAltitudeBelowReferenceIsNegative){
+	struct instruments ins;
+	config_reset(&config);
+	reset_trims();
+	ins_init(&ins, &config.data);
+
+	ins_altitude_reset(&ins.alt, -250.4f);
+	EXPECT_EQ(-250, ins_get_altitude_cm(&ins));
+}
+
+TEST(InsUnitTest, TestGpsPositionIsFused){
+	struct instruments ins;
+	config_reset(&config);
+	reset_trims();
+	ins_init(&ins, &config.data);
+	EXPECT_FALSE(ins_has_position(&ins));
+
+	// level and still, the receiver first reports the origin and then a point 5m north of it
+	struct posest_gps_fix fix = { 450000000, 150000000, 10000, {0, 0, 0}, 0 };
+	sys_micros_t t = 0;
+	for(int c = 0; c < 3000; c++){
+		t += 1000;
+		ins_process_acc(&ins, 0, 0, SYSTEM_ACCEL_1G);
+		ins_process_gyro(&ins, 0, 0, 0);
+		ins_update(&ins, 0.001f);
+		if((c % 10) == 0)
+			ins_update_position(&ins, t);
+		if((c % 100) == 50){
+			fix.timestamp = t;
+			ins_process_gps(&ins, &fix);
+			fix.lat = 450000000 + lrintf(500 / 1.113195f);
+		}
+	}
+	EXPECT_TRUE(ins_has_position(&ins));
+	EXPECT_NEAR(500, ins_get_position_cm(&ins)[0], 5);
+	EXPECT_NEAR(0, ins_get_position_cm(&ins)[1], 5);
+	EXPECT_NEAR(0, ins_get_velocity_cms(&ins)[0], 5);
+}
@@ -414,3 +414,99 @@ uint16_t rssi;
 
 }
 #endif
+
+extern "C" {
+    #include "config/config.h"
+    #include "rx/rx.h"
+    #include "drivers/light_ws2811strip.h"
+    #include "io/ledstrip.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+#define LF(name) LED_FLAG_FUNCTION(LED_FUNCTION_ ## name)
+
+static hsvColor_t stripColors[WS2811_LED_STRIP_LENGTH];
+static uint32_t stripWrites = 0;
+static int stripUpdates = 0;
+
+class LedCompositorTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        mock_system_reset();
+        mock_system_clock_mode(MOCK_CLOCK_MANUAL);
+        mock_time_micros = 1000;
+
+        config_reset(&config);
+        struct ledstrip_config *lc = &config.data.ledstrip;
+        memset(lc->leds, 0, sizeof(lc->leds));
+        // two plain leds, two blinking leds and a ring of six
+        for (int i = 0; i < 10; i++) {
+            lc->leds[i].xy = i + 1;
+            lc->leds[i].color = 2;
+        }
+        lc->leds[0].flags = LF(COLOR);
+        lc->leds[1].flags = LF(COLOR);
+        lc->leds[2].flags = LF(BLINK);
+        lc->leds[3].flags = LF(BLINK);
+        for (int i = 4; i < 10; i++)
+            lc->leds[i].flags = LF(THRUST_RING);
+
+        rx_init(&rx, mock_syscalls(), &config.data);
+        ledstrip_init(&ledstrip, &config.data, mock_syscalls(), &rx, NULL);
+        ledstrip_enable(&ledstrip);
+        memset(stripColors, 0, sizeof(stripColors));
+        stripWrites = 0;
+        stripUpdates = 0;
+    }
+    void run(int32_t us) {
+        mock_time_micros += us;
+        ledstrip_update(&ledstrip);
+    }
+    struct ledstrip ledstrip;
+    struct config_store config;
+    struct rx rx;
+};
+
+TEST_F(LedCompositorTest, TestOnlyChangedLayersRepaint)
+{
+    // first frame paints every led
+    run(0);
+    EXPECT_EQ(1, stripUpdates);
+    EXPECT_EQ(0xFFFFFFFFu, stripWrites);
+    EXPECT_EQ(config.data.ledstrip.colors[2].h, stripColors[0].h);
+
+    // blink and ring timers fire again after 100ms. Plain leds are left alone.
+    stripWrites = 0;
+    run(100000);
+    EXPECT_EQ(0u, stripWrites & 0x3);
+    EXPECT_NE(0u, stripWrites & 0x3F0);
+
+    // once the blink cycle goes quiet only the ring keeps changing
+    for (int i = 0; i < 5; i++)
+        run(100000);
+    stripWrites = 0;
+    run(100000);
+    EXPECT_EQ(0u, stripWrites & 0xF);
+
+    // config changes are picked up on the next update once they are announced
+    config.data.ledstrip.leds[0].color = 3;
+    config_notify_changed();
+    stripWrites = 0;
+    run(100000);
+    EXPECT_NE(0u, stripWrites & 0x1);
+    EXPECT_EQ(config.data.ledstrip.colors[3].h, stripColors[0].h);
+}
+
+extern "C" {
+void ws2811LedStripInit(void) {}
+void ws2811UpdateStrip(void) { stripUpdates++; }
+void setLedHsv(int index, const hsvColor_t *color) {
+    stripColors[index] = *color;
+    stripWrites |= 1UL << index;
+}
+void setStripColor(const hsvColor_t *color) { UNUSED(color); }
+bool isWS2811LedStripReady(void) { return true; }
+void ws2811SetGamma(bool enabled) { UNUSED(enabled); }
+}
@@ -0,0 +1,231 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+extern "C" {
+	#include "common/crc.h"
+	#include "common/maths.h"
+	#include "common/streambuf.h"
+	#include "io/log_download.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+//! contents of the fake dataflash, the log is the first fake_flash_used bytes
+static uint8_t fake_flash[4096];
+static uint32_t fake_flash_used;
+
+struct chunk {
+	uint32_t offset;
+	uint16_t size;
+	uint8_t flags;
+	uint32_t crc;
+};
+
+class LogDownloadTest : public ::testing::Test {
+protected:
+	struct log_download dl;
+	sys_micros_t now;
+
+	virtual void SetUp(){
+		for(unsigned c = 0; c < sizeof(fake_flash); c++)
+			fake_flash[c] = (uint8_t)(c * 13 + (c >> 8));
+		fake_flash_used = 0;
+		now = 1000;
+		log_download_init(&dl);
+	}
+
+	//! starts a flash download and returns the size reported to the host
+	uint32_t begin(uint32_t offset, uint32_t length, uint16_t chunk_size, uint8_t window){
+		uint8_t req[16], reply[8];
+		sbuf_t src = { req, req + sizeof(req) };
+		sbufWriteU8(&src, LOG_DOWNLOAD_SOURCE_FLASH);
+		sbufWriteU8(&src, 0);
+		sbufWriteU32(&src, offset);
+		sbufWriteU32(&src, length);
+		sbufWriteU16(&src, chunk_size);
+		sbufWriteU8(&src, window);
+		src.end = src.ptr;
+		src.ptr = req;
+
+		sbuf_t dst = { reply, reply + sizeof(reply) };
+		log_download_begin(&dl, &src, &dst, now);
+		sbufSwitchToReader(&dst, reply);
+		EXPECT_EQ(1, sbufReadU8(&dst));
+		return sbufReadU32(&dst);
+	}
+
+	//! fetches the next chunk, returns false if nothing was sent
+	bool next(struct chunk *c, uint8_t *data = NULL){
+		uint8_t buf[LOG_DOWNLOAD_CHUNK_HEADER_SIZE + LOG_DOWNLOAD_MAX_CHUNK];
+		sbuf_t dst = { buf, buf + sizeof(buf) };
+		if(!log_download_next_chunk(&dl, &dst, now))
+			return false;
+		sbufSwitchToReader(&dst, buf);
+		c->offset = sbufReadU32(&dst);
+		c->size = sbufReadU16(&dst);
+		c->flags = sbufReadU8(&dst);
+		c->crc = sbufReadU32(&dst);
+		if(data)
+			memcpy(data, sbufPtr(&dst), c->size);
+		return true;
+	}
+};
+
+TEST_F(LogDownloadTest, TestEmptyLogSendsEndMarker){
+	struct chunk c;
+	EXPECT_EQ(0u, begin(0, 0, 100, 4));
+
+	ASSERT_TRUE(next(&c));
+	EXPECT_EQ(0u, c.offset);
+	EXPECT_EQ(0, c.size);
+	EXPECT_EQ(LOG_DOWNLOAD_CHUNK_LAST, c.flags);
+
+	// the transfer is over
+	EXPECT_FALSE(dl.active);
+	EXPECT_FALSE(next(&c));
+}
+
+TEST_F(LogDownloadTest, TestStartAtEndSendsEndMarker){
+	struct chunk c;
+	fake_flash_used = 1000;
+	EXPECT_EQ(0u, begin(1000, 0, 100, 4));
+
+	ASSERT_TRUE(next(&c));
+	EXPECT_EQ(1000u, c.offset);
+	EXPECT_EQ(0, c.size);
+	EXPECT_EQ(LOG_DOWNLOAD_CHUNK_LAST, c.flags);
+	EXPECT_FALSE(dl.active);
+}
+
+TEST_F(LogDownloadTest, TestChunksCarryDataAndCrc){
+	struct chunk c;
+	uint8_t data[LOG_DOWNLOAD_MAX_CHUNK];
+	fake_flash_used = 250;
+	EXPECT_EQ(250u, begin(0, 0, 100, 4));
+
+	for(uint32_t offset = 0; offset < 250; offset += 100){
+		ASSERT_TRUE(next(&c, data));
+		EXPECT_EQ(offset, c.offset);
+		EXPECT_EQ(MIN(100u, 250 - offset), c.size);
+		EXPECT_EQ(0, memcmp(fake_flash + offset, data, c.size));
+		EXPECT_EQ(crc32_ieee_buf(0, fake_flash + offset, c.size), c.crc);
+		EXPECT_EQ((offset + c.size == 250) ? LOG_DOWNLOAD_CHUNK_LAST : 0, c.flags);
+	}
+	EXPECT_FALSE(next(&c));
+
+	// acknowledging the last byte ends the transfer
+	log_download_ack(&dl, 250, false, now);
+	EXPECT_FALSE(dl.active);
+}
+
+TEST_F(LogDownloadTest, TestWindowLimitsUnacknowledgedData){
+	struct chunk c;
+	fake_flash_used = 4000;
+	begin(0, 0, 100, 3);
+
+	// only a window worth of chunks goes out before the host answers
+	for(int i = 0; i < 3; i++)
+		ASSERT_TRUE(next(&c));
+	EXPECT_FALSE(next(&c));
+
+	// each acknowledged chunk lets one more out
+	log_download_ack(&dl, 100, false, now);
+	ASSERT_TRUE(next(&c));
+	EXPECT_EQ(300u, c.offset);
+	EXPECT_FALSE(next(&c));
+
+	// acknowledging data that was never sent is ignored
+	log_download_ack(&dl, 1000, false, now);
+	EXPECT_FALSE(next(&c));
+	EXPECT_EQ(100u, dl.acked);
+}
+
+TEST_F(LogDownloadTest, TestResendOnRequest){
+	struct chunk c;
+	fake_flash_used = 4000;
+	begin(0, 0, 100, 4);
+	for(int i = 0; i < 4; i++)
+		ASSERT_TRUE(next(&c));
+
+	// the host lost the chunk at 200
+	log_download_ack(&dl, 200, true, now);
+
+	ASSERT_TRUE(next(&c));
+	EXPECT_EQ(200u, c.offset);
+	ASSERT_TRUE(next(&c));
+	EXPECT_EQ(300u, c.offset);
+}
+
+TEST_F(LogDownloadTest, TestResendAfterAckTimeout){
+	struct chunk c;
+	fake_flash_used = 4000;
+	begin(0, 0, 100, 2);
+	ASSERT_TRUE(next(&c));
+	ASSERT_TRUE(next(&c));
+	log_download_ack(&dl, 100, false, now);
+	ASSERT_TRUE(next(&c));
+	EXPECT_EQ(200u, c.offset);
+
+	// nothing happens before the timeout
+	now += LOG_DOWNLOAD_ACK_TIMEOUT;
+	EXPECT_FALSE(next(&c));
+
+	// after it everything that was not acknowledged is sent again
+	now += 1;
+	ASSERT_TRUE(next(&c));
+	EXPECT_EQ(100u, c.offset);
+	ASSERT_TRUE(next(&c));
+	EXPECT_EQ(200u, c.offset);
+	EXPECT_FALSE(next(&c));
+}
+
+TEST_F(LogDownloadTest, TestLengthLimitsTransfer){
+	struct chunk c;
+	fake_flash_used = 4000;
+	EXPECT_EQ(150u, begin(1000, 150, 100, 4));
+
+	ASSERT_TRUE(next(&c));
+	EXPECT_EQ(1000u, c.offset);
+	EXPECT_EQ(100, c.size);
+	ASSERT_TRUE(next(&c));
+	EXPECT_EQ(1100u, c.offset);
+	EXPECT_EQ(50, c.size);
+	EXPECT_EQ(LOG_DOWNLOAD_CHUNK_LAST, c.flags);
+	EXPECT_FALSE(next(&c));
+}
+
+// STUBS
+
+extern "C" {
+
+uint32_t flashfsGetOffset(void){
+	return fake_flash_used;
+}
+
+int flashfsReadAbs(uint32_t address, uint8_t *buffer, unsigned int len){
+	if(address + len > sizeof(fake_flash))
+		len = sizeof(fake_flash) - address;
+	memcpy(buffer, fake_flash + address, len);
+	return len;
+}
+
+}
@@ -0,0 +1,400 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <vector>
+
+extern "C" {
+    #include "drivers/serial.h"
+    #include "config/config.h"
+    #include "telemetry/telemetry.h"
+    #include "telemetry/mavlink.h"
+    #include "cli.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+#define MSG_HEARTBEAT 0
+#define MSG_PARAM_REQUEST_LIST 21
+#define MSG_PARAM_VALUE 22
+#define MSG_PARAM_SET 23
+#define MSG_GLOBAL_POSITION_INT 33
+#define MSG_SERVO_OUTPUT_RAW 36
+#define MSG_ATTITUDE_QUATERNION 31
+#define MSG_HIGHRES_IMU 105
+#define MSG_COMMAND_LONG 76
+#define MSG_COMMAND_ACK 77
+
+struct fake_serial {
+    serialPort_t dev;
+    uint8_t data[16384];
+    size_t len;
+    uint8_t rx[512];
+    size_t rx_len;
+    size_t rx_pos;
+};
+
+static void fakeWriteBuf(serialPort_t *port, void *data, int count)
+{
+    struct fake_serial *self = (struct fake_serial*)port;
+    ASSERT_LE(self->len + count, sizeof(self->data));
+    memcpy(self->data + self->len, data, count);
+    self->len += count;
+}
+
+static uint8_t fakeTxFree(serialPort_t *port)
+{
+    (void)port;
+    return 255;
+}
+
+static uint8_t fakeRxWaiting(serialPort_t *port)
+{
+    struct fake_serial *self = (struct fake_serial*)port;
+    return self->rx_len - self->rx_pos;
+}
+
+static uint8_t fakeRead(serialPort_t *port)
+{
+    struct fake_serial *self = (struct fake_serial*)port;
+    return self->rx[self->rx_pos++];
+}
+
+static struct serial_port_ops fakeOps;
+
+// independent x.25 crc so that the test does not share code with the encoder
+static uint16_t x25(const uint8_t *data, size_t len, uint8_t extra)
+{
+    uint16_t crc = 0xffff;
+    for (size_t c = 0; c <= len; c++) {
+        uint8_t tmp = ((c < len)?data[c]:extra) ^ (crc & 0xff);
+        tmp ^= (tmp << 4);
+        crc = (crc >> 8) ^ (tmp << 8) ^ (tmp << 3) ^ (tmp >> 4);
+    }
+    return crc;
+}
+
+struct frame {
+    uint32_t msgid;
+    uint8_t seq;
+    std::vector<uint8_t> payload;
+};
+
+class MavlinkTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        mock_system_reset();
+        mock_system_clock_mode(MOCK_CLOCK_MANUAL);
+        mock_time_micros = 1000;
+
+        memset(&fakeOps, 0, sizeof(fakeOps));
+        fakeOps.writeBuf = fakeWriteBuf;
+        fakeOps.serialTotalTxFree = fakeTxFree;
+        fakeOps.serialTotalRxWaiting = fakeRxWaiting;
+        fakeOps.serialRead = fakeRead;
+        memset(&serial, 0, sizeof(serial));
+        serial.dev.vTable = &fakeOps;
+
+        config_reset(&config);
+
+        memset(&state, 0, sizeof(state));
+        state.roll = 100;
+        state.motors[0] = 1100;
+        state.motors[3] = 1400;
+        state.has_gps = true;
+
+        telemetry_init(&telemetry, mock_syscalls(), &config.data);
+        ASSERT_EQ(0, telemetry_add_port(&telemetry, &telemetry_mavlink, &serial.dev, 115200));
+    }
+
+    void run(int32_t us) {
+        for (int32_t t = 0; t < us; t += 4000) {
+            mock_time_micros += 4000;
+            telemetry_update(&telemetry, &state);
+        }
+    }
+
+    // sends a frame from the gcs to the flight controller
+    void send(uint32_t msgid, uint8_t crc_extra, const void *payload, uint8_t size) {
+        uint8_t buf[MAVLINK_V2_FRAME_SIZE(255)];
+        int len = mavlink_pack_v2(buf, 0, 255, 190, msgid, crc_extra, payload, size);
+        memcpy(serial.rx + serial.rx_len, buf, len);
+        serial.rx_len += len;
+    }
+
+    // splits captured output into v2 frames. Returns false on a corrupt frame.
+    bool parse(std::vector<struct frame> &frames, uint8_t crc_extra_of(uint32_t)) {
+        size_t pos = 0;
+        while (pos < serial.len) {
+            if (serial.data[pos] != 0xfd)
+                return false;
+            uint8_t len = serial.data[pos + 1];
+            struct frame f;
+            f.msgid = serial.data[pos + 7] | (serial.data[pos + 8] << 8) | (serial.data[pos + 9] << 16);
+            f.seq = serial.data[pos + 4];
+            if (serial.data[pos + 5] != config.data.telemetry.mavlink_sysid)
+                return false;
+            uint16_t crc = x25(serial.data + pos + 1, 9 + len, crc_extra_of(f.msgid));
+            if ((serial.data[pos + 10 + len] | (serial.data[pos + 11 + len] << 8)) != crc)
+                return false;
+            f.payload.assign(serial.data + pos + 10, serial.data + pos + 10 + len);
+            // zero extend the way a receiver has to
+            f.payload.resize(255, 0);
+            frames.push_back(f);
+            pos += 12 + len;
+        }
+        bool complete = pos == serial.len;
+        serial.len = 0;
+        return complete;
+    }
+
+    static uint8_t crcExtra(uint32_t msgid) {
+        switch (msgid) {
+            case MSG_HEARTBEAT: return 50;
+            case MSG_PARAM_VALUE: return 220;
+            case MSG_ATTITUDE_QUATERNION: return 246;
+            case MSG_HIGHRES_IMU: return 93;
+            case MSG_SERVO_OUTPUT_RAW: return 222;
+            case MSG_GLOBAL_POSITION_INT: return 104;
+            case MSG_COMMAND_ACK: return 143;
+            default: return 0;
+        }
+    }
+
+    struct config_store config;
+    struct telemetry telemetry;
+    struct telemetry_state state;
+    struct fake_serial serial;
+};
+
+TEST_F(MavlinkTest, TestPayloadTruncation)
+{
+    uint8_t payload[8] = { 0x11, 0x22, 0, 0x33, 0, 0, 0, 0 };
+    uint8_t buf[MAVLINK_V2_FRAME_SIZE(8)];
+
+    int len = mavlink_pack_v2(buf, 7, 1, 1, 0x012345, 0x55, payload, sizeof(payload));
+    EXPECT_EQ(MAVLINK_V2_FRAME_SIZE(4), len);
+    EXPECT_EQ(0xfd, buf[0]);
+    EXPECT_EQ(4, buf[1]);
+    EXPECT_EQ(7, buf[4]);
+    EXPECT_EQ(0x45, buf[7]);
+    EXPECT_EQ(0x23, buf[8]);
+    EXPECT_EQ(0x01, buf[9]);
+    EXPECT_EQ(0, memcmp(buf + 10, payload, 4));
+    uint16_t crc = x25(buf + 1, 9 + 4, 0x55);
+    EXPECT_EQ(crc & 0xff, buf[14]);
+    EXPECT_EQ(crc >> 8, buf[15]);
+
+    // an all zero payload still keeps its first byte
+    memset(payload, 0, sizeof(payload));
+    EXPECT_EQ(MAVLINK_V2_FRAME_SIZE(1), mavlink_pack_v2(buf, 0, 1, 1, 0, 0, payload, sizeof(payload)));
+}
+
+TEST_F(MavlinkTest, TestStreamRates)
+{
+    std::vector<struct frame> frames;
+    int counts[256] = {0};
+
+    run(1000000 - 4000);
+    ASSERT_TRUE(parse(frames, crcExtra));
+    for (size_t c = 0; c < frames.size(); c++) {
+        counts[frames[c].msgid & 0xff]++;
+        EXPECT_EQ((uint8_t)c, frames[c].seq);
+    }
+
+    EXPECT_EQ(1, counts[MSG_HEARTBEAT]);
+    EXPECT_EQ(config.data.telemetry.mavlink_rate_att, counts[MSG_ATTITUDE_QUATERNION]);
+    EXPECT_EQ(config.data.telemetry.mavlink_rate_imu, counts[MSG_HIGHRES_IMU]);
+    EXPECT_EQ(config.data.telemetry.mavlink_rate_servo, counts[MSG_SERVO_OUTPUT_RAW]);
+    EXPECT_EQ(config.data.telemetry.mavlink_rate_pos, counts[MSG_GLOBAL_POSITION_INT]);
+    EXPECT_EQ(0, counts[MSG_PARAM_VALUE]);
+
+    // motor outputs show up in the servo message
+    for (size_t c = 0; c < frames.size(); c++) {
+        if (frames[c].msgid != MSG_SERVO_OUTPUT_RAW)
+            continue;
+        EXPECT_EQ(1100, frames[c].payload[4] | (frames[c].payload[5] << 8));
+        EXPECT_EQ(1400, frames[c].payload[10] | (frames[c].payload[11] << 8));
+    }
+
+    // a rate of zero turns the stream off
+    config.data.telemetry.mavlink_rate_att = 0;
+    frames.clear();
+    memset(counts, 0, sizeof(counts));
+    run(1000000);
+    ASSERT_TRUE(parse(frames, crcExtra));
+    for (size_t c = 0; c < frames.size(); c++)
+        counts[frames[c].msgid & 0xff]++;
+    EXPECT_EQ(0, counts[MSG_ATTITUDE_QUATERNION]);
+    EXPECT_EQ(config.data.telemetry.mavlink_rate_imu, counts[MSG_HIGHRES_IMU]);
+}
+
+TEST_F(MavlinkTest, TestParamSet)
+{
+    int index = cli_var_find("mavlink_rate_imu", strlen("mavlink_rate_imu"));
+    ASSERT_GE(index, 0);
+
+    // PARAM_SET with the trailing param_type left out as v2 allows
+    uint8_t set[23];
+    memset(set, 0, sizeof(set));
+    float value = 25;
+    memcpy(set, &value, sizeof(value));
+    set[4] = config.data.telemetry.mavlink_sysid;
+    set[5] = 1;
+    memcpy(set + 6, "mavlink_rate_imu", 16);
+    send(MSG_PARAM_SET, 168, set, sizeof(set));
+
+    // out of range values are refused
+    value = 200;
+    memcpy(set, &value, sizeof(value));
+    memcpy(set + 6, "mavlink_rate_att", 16);
+    send(MSG_PARAM_SET, 168, set, sizeof(set));
+
+    // a frame with a bad crc is ignored
+    value = 30;
+    memcpy(set, &value, sizeof(value));
+    memcpy(set + 6, "mavlink_rate_srv", 16);
+    send(MSG_PARAM_SET, 167, set, sizeof(set));
+
+    run(100000);
+    EXPECT_EQ(25, config.data.telemetry.mavlink_rate_imu);
+    EXPECT_EQ(10, config.data.telemetry.mavlink_rate_att);
+    EXPECT_EQ(5, config.data.telemetry.mavlink_rate_servo);
+
+    std::vector<struct frame> frames;
+    ASSERT_TRUE(parse(frames, crcExtra));
+    int replies = 0;
+    for (size_t c = 0; c < frames.size(); c++) {
+        if (frames[c].msgid != MSG_PARAM_VALUE)
+            continue;
+        const uint8_t *p = frames[c].payload.data();
+        float reply;
+        memcpy(&reply, p, sizeof(reply));
+        EXPECT_EQ(cli_var_count(), p[4] | (p[5] << 8));
+        if (replies == 0) {
+            EXPECT_EQ(index, p[6] | (p[7] << 8));
+            EXPECT_EQ(0, memcmp(p + 8, "mavlink_rate_imu", 16));
+            EXPECT_FLOAT_EQ(25, reply);
+            EXPECT_EQ(1, p[24]); // MAV_PARAM_TYPE_UINT8
+        } else {
+            // rejected value is answered with the value that was kept
+            EXPECT_EQ(0, memcmp(p + 8, "mavlink_rate_att", 16));
+            EXPECT_FLOAT_EQ(10, reply);
+        }
+        replies++;
+    }
+    EXPECT_EQ(2, replies);
+}
+
+TEST_F(MavlinkTest, TestParamSetRefusedWhileArmed)
+{
+    uint8_t set[23];
+    memset(set, 0, sizeof(set));
+    float value = 25;
+    memcpy(set, &value, sizeof(value));
+    set[4] = config.data.telemetry.mavlink_sysid;
+    set[5] = 1;
+    memcpy(set + 6, "mavlink_rate_imu", 16);
+    send(MSG_PARAM_SET, 168, set, sizeof(set));
+
+    state.armed = true;
+    run(100000);
+    EXPECT_EQ(10, config.data.telemetry.mavlink_rate_imu);
+
+    // the gcs is told the value that was kept
+    std::vector<struct frame> frames;
+    ASSERT_TRUE(parse(frames, crcExtra));
+    int replies = 0;
+    for (size_t c = 0; c < frames.size(); c++) {
+        if (frames[c].msgid != MSG_PARAM_VALUE)
+            continue;
+        float reply;
+        memcpy(&reply, frames[c].payload.data(), sizeof(reply));
+        EXPECT_FLOAT_EQ(10, reply);
+        replies++;
+    }
+    EXPECT_EQ(1, replies);
+}
+
+TEST_F(MavlinkTest, TestSaveCommand)
+{
+    uint8_t cmd[33];
+    memset(cmd, 0, sizeof(cmd));
+    float write = 1;
+    memcpy(cmd, &write, sizeof(write));
+    cmd[28] = 245; // MAV_CMD_PREFLIGHT_STORAGE
+    cmd[30] = config.data.telemetry.mavlink_sysid;
+    cmd[31] = 1;
+
+    for (int armed = 0; armed < 2; armed++) {
+        state.armed = armed;
+        send(MSG_COMMAND_LONG, 152, cmd, sizeof(cmd));
+        run(100000);
+
+        std::vector<struct frame> frames;
+        ASSERT_TRUE(parse(frames, crcExtra));
+        int acks = 0;
+        for (size_t c = 0; c < frames.size(); c++) {
+            if (frames[c].msgid != MSG_COMMAND_ACK)
+                continue;
+            const uint8_t *p = frames[c].payload.data();
+            EXPECT_EQ(245, p[0] | (p[1] << 8));
+            // MAV_RESULT_ACCEPTED on the ground, MAV_RESULT_TEMPORARILY_REJECTED in the air
+            EXPECT_EQ(armed ? 1 : 0, p[2]);
+            acks++;
+        }
+        EXPECT_EQ(1, acks);
+        EXPECT_EQ(!armed, telemetry_save_requested(&telemetry));
+        // the request is only reported once
+        EXPECT_FALSE(telemetry_save_requested(&telemetry));
+    }
+}
+
+TEST_F(MavlinkTest, TestParamList)
+{
+    uint8_t req[2] = { 0, 0 };
+    send(MSG_PARAM_REQUEST_LIST, 159, req, sizeof(req));
+
+    std::vector<bool> seen(cli_var_count(), false);
+    int received = 0;
+    for (int c = 0; c < 10; c++) {
+        std::vector<struct frame> frames;
+        run(500000);
+        ASSERT_TRUE(parse(frames, crcExtra));
+        for (size_t f = 0; f < frames.size(); f++) {
+            if (frames[f].msgid != MSG_PARAM_VALUE)
+                continue;
+            const uint8_t *p = frames[f].payload.data();
+            uint16_t idx = p[6] | (p[7] << 8);
+            ASSERT_LT(idx, cli_var_count());
+            EXPECT_FALSE(seen[idx]);
+            seen[idx] = true;
+            received++;
+
+            float reply, expected;
+            memcpy(&reply, p, sizeof(reply));
+            ASSERT_EQ(0, cli_var_get(&config.data, idx, &expected));
+            EXPECT_FLOAT_EQ(expected, reply);
+            EXPECT_EQ(0, strncmp((const char*)p + 8, cli_var_name(idx), 16));
+        }
+    }
+    EXPECT_EQ(cli_var_count(), received);
+}
@@ -0,0 +1,195 @@
+/*
+ * This file is part of Ninjaflight.
+ *
+ * Ninjaflight is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Ninjaflight is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Ninjaflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+extern "C" {
+    #include "drivers/serial.h"
+    #include "telemetry/telemetry.h"
+    #include "telemetry/ltm.h"
+}
+
+#include "unittest_macros.h"
+#include "gtest/gtest.h"
+
+struct fake_serial {
+    serialPort_t dev;
+    uint8_t data[8192];
+    size_t len;
+    uint8_t txFree;
+};
+
+static void fakeWriteBuf(serialPort_t *port, void *data, int count)
+{
+    struct fake_serial *self = (struct fake_serial*)port;
+    memcpy(self->data + self->len, data, count);
+    self->len += count;
+}
+
+static uint8_t fakeTxFree(serialPort_t *port)
+{
+    return ((struct fake_serial*)port)->txFree;
+}
+
+static struct serial_port_ops fakeOps;
+
+class TelemetryTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        mock_system_reset();
+        mock_system_clock_mode(MOCK_CLOCK_MANUAL);
+        mock_time_micros = 1000;
+
+        memset(&fakeOps, 0, sizeof(fakeOps));
+        fakeOps.writeBuf = fakeWriteBuf;
+        fakeOps.serialTotalTxFree = fakeTxFree;
+        memset(&serial, 0, sizeof(serial));
+        serial.dev.vTable = &fakeOps;
+        serial.txFree = 255;
+
+        memset(&state, 0, sizeof(state));
+        state.roll = 125;
+        state.pitch = -300;
+        state.yaw = 1800;
+        state.vbat = 126;
+        state.armed = true;
+        state.flight_mode = TELEMETRY_MODE_ANGLE;
+        state.has_gps = true;
+        state.gps_fix = true;
+        state.num_sat = 9;
+        state.lat = 590000000;
+        state.lon = 180000000;
+
+        telemetry_init(&telemetry, mock_syscalls(), NULL);
+    }
+
+    // runs the telemetry task at 250Hz for the given time
+    void run(int32_t us) {
+        for (int32_t t = 0; t < us; t += 4000) {
+            mock_time_micros += 4000;
+            telemetry_update(&telemetry, &state);
+        }
+    }
+
+    // splits captured data into ltm frames and counts them by type. Returns false on a corrupt frame.
+    bool countFrames(int counts[256]) {
+        memset(counts, 0, sizeof(int) * 256);
+        size_t pos = 0;
+        while (pos < serial.len) {
+            if (serial.data[pos] != '$' || serial.data[pos + 1] != 'T')
+                return false;
+            uint8_t id = serial.data[pos + 2];
+            size_t payload = 0;
+            switch (id) {
+                case 'A': payload = 6; break;
+                case 'S': payload = 7; break;
+                case 'G': payload = 14; break;
+                case 'O': payload = 14; break;
+                default: return false;
+            }
+            uint8_t crc = 0;
+            for (size_t c = 0; c < payload; c++)
+                crc ^= serial.data[pos + 3 + c];
+            if (crc != serial.data[pos + 3 + payload])
+                return false;
+            counts[id]++;
+            pos += 3 + payload + 1;
+        }
+        return pos == serial.len;
+    }
+
+    struct telemetry telemetry;
+    struct telemetry_state state;
+    struct fake_serial serial;
+};
+
+TEST_F(TelemetryTest, TestLtmFrames)
+{
+    EXPECT_FALSE(telemetry_is_active(&telemetry));
+    EXPECT_EQ(0, telemetry_add_port(&telemetry, &telemetry_ltm, &serial.dev, 19200));
+    EXPECT_TRUE(telemetry_is_active(&telemetry));
+
+    // everything is due right away so stop just short of a second to see one second worth of frames
+    run(1000000 - 4000);
+
+    int counts[256];
+    EXPECT_TRUE(countFrames(counts));
+    EXPECT_EQ(10, counts['A']);
+    EXPECT_EQ(5, counts['S']);
+    EXPECT_EQ(5, counts['G']);
+    EXPECT_EQ(1, counts['O']);
+    EXPECT_EQ(0u, telemetry.ports[0].deferred);
+
+    // attitude frame carries whole degrees, pitch first
+    EXPECT_EQ('A', serial.data[2]);
+    EXPECT_EQ(-30, (int16_t)(serial.data[3] | (serial.data[4] << 8)));
+    EXPECT_EQ(12, (int16_t)(serial.data[5] | (serial.data[6] << 8)));
+    EXPECT_EQ(180, (int16_t)(serial.data[7] | (serial.data[8] << 8)));
+
+    // no gps frames without a gps
+    state.has_gps = false;
+    serial.len = 0;
+    run(1000000);
+    EXPECT_TRUE(countFrames(counts));
+    EXPECT_EQ(0, counts['G']);
+    EXPECT_EQ(10, counts['A']);
+    EXPECT_EQ(5, counts['S']);
+}
+
+TEST_F(TelemetryTest, TestSlowLinkKeepsPriorities)
+{
+    // 2400 baud carries 240 bytes per second which is less than ltm wants to send
+    EXPECT_EQ(0, telemetry_add_port(&telemetry, &telemetry_ltm, &serial.dev, 2400));
+
+    run(10000000);
+
+    int counts[256];
+    EXPECT_TRUE(countFrames(counts));
+    // never more than the link can carry plus the initial burst
+    EXPECT_LE(serial.len, 2400u + telemetry.ports[0].burst);
+    // attitude keeps its full rate and the osd frame gives way
+    EXPECT_GE(counts['A'], 99);
+    EXPECT_LT(counts['O'], 10);
+    EXPECT_GT(telemetry.ports[0].deferred, 0u);
+}
+
+TEST_F(TelemetryTest, TestBackpressure)
+{
+    EXPECT_EQ(0, telemetry_add_port(&telemetry, &telemetry_ltm, &serial.dev, 115200));
+
+    // a full transmit buffer holds everything back
+    serial.txFree = 0;
+    run(100000);
+    EXPECT_EQ(0u, serial.len);
+
+    // and the backlog does not come out all at once
+    serial.txFree = 255;
+    mock_time_micros += 4000;
+    telemetry_update(&telemetry, &state);
+    EXPECT_GT(serial.len, 0u);
+    EXPECT_LE(serial.len, (size_t)TELEMETRY_MAX_BYTES_PER_CYCLE);
+}
+
+TEST_F(TelemetryTest, TestPorts)
+{
+    EXPECT_EQ(-EINVAL, telemetry_add_port(&telemetry, &telemetry_ltm, NULL, 19200));
+    for (int c = 0; c < TELEMETRY_MAX_PORTS; c++)
+        EXPECT_EQ(0, telemetry_add_port(&telemetry, &telemetry_ltm, &serial.dev, 19200));
+    EXPECT_EQ(-ENOMEM, telemetry_add_port(&telemetry, &telemetry_ltm, &serial.dev, 19200));
+}
@@ -117,3 +117,125 @@ TEST(UlinkTest, UlinkBasicTest){
 	}
 	EXPECT_EQ(1, valid_frames); 
 }
+
+static uint16_t crc16_bytewise(uint16_t crc, const uint8_t *p, size_t size){
+	while(size--){
+		crc ^= *p++;
+		for(int b = 0; b < 8; b++)
+			crc = (crc & 1)?((crc >> 1) ^ 0xA001):(crc >> 1);
+	}
+	return crc;
+}
+
+TEST(UlinkTest, UlinkCrcTest){
+	// standard check value for CRC-16/ARC
+	EXPECT_EQ(0xBB3D, ulink_crc16(0, "123456789", 9));
+
+	uint8_t data[64];
+	srand(1);
+	for(size_t c = 0; c < sizeof(data); c++) data[c] = rand();
+	// every length and alignment has to give the same result as the bit wise reference
+	for(size_t off = 0; off < 8; off++){
+		for(size_t len = 0; len + off <= sizeof(data); len++){
+			EXPECT_EQ(crc16_bytewise(0x1234, data + off, len), ulink_crc16(0x1234, data + off, len));
+		}
+	}
+}
+
+TEST(UlinkTest, UlinkRingTest){
+	uint8_t ring_buf[23];
+	struct ulink_ring ring;
+	ulink_ring_init(&ring, ring_buf, sizeof(ring_buf));
+
+	const char *data1 = "\x01\x00\x7d\x7e";
+	const char *data2 = "\x7e\x7e\x01\x02";
+	const uint8_t expected[] = { 0x01, 0x00, 0x7d, 0x5d, 0x7d, 0x5e, 0x8c, 0xa0, 0x7e, 0x7d, 0x5e, 0x7d, 0x5e, 0x01, 0x02, 0x61, 0xf8, 0x7e };
+
+	// same bytes as the frame based encoder
+	EXPECT_EQ(9, ulink_encode(&ring, data1, 4));
+	EXPECT_EQ(9, ulink_encode(&ring, data2, 4));
+	EXPECT_EQ(18u, ulink_ring_used(&ring));
+
+	uint8_t out[64];
+	size_t pos = 0;
+	const void *ptr;
+	size_t len;
+	while((len = ulink_ring_peek(&ring, &ptr)) > 0){
+		memcpy(out + pos, ptr, len);
+		pos += len;
+		ulink_ring_consume(&ring, len);
+	}
+	EXPECT_EQ(sizeof(expected), pos);
+	EXPECT_EQ(0, memcmp(expected, out, sizeof(expected)));
+
+	// third frame wraps around the end of the ring and still comes out in order
+	EXPECT_EQ(9, ulink_encode(&ring, data1, 4));
+	EXPECT_EQ(5u, ulink_ring_peek(&ring, &ptr));
+	memcpy(out, ptr, 5);
+	ulink_ring_consume(&ring, 5);
+	EXPECT_EQ(4u, ulink_ring_peek(&ring, &ptr));
+	memcpy(out + 5, ptr, 4);
+	ulink_ring_consume(&ring, 4);
+	EXPECT_EQ(0, memcmp(expected, out, 9));
+
+	// frames are never written partially
+	EXPECT_EQ(9, ulink_encode(&ring, data1, 4));
+	EXPECT_EQ(9, ulink_encode(&ring, data1, 4));
+	EXPECT_EQ(-ENOSPC, ulink_encode(&ring, data1, 4));
+	EXPECT_EQ(18u, ulink_ring_used(&ring));
+
+	uint8_t big[ULINK_MAX_PAYLOAD_SIZE + 1];
+	EXPECT_EQ(-EMSGSIZE, ulink_encode(&ring, big, sizeof(big)));
+}
+
+TEST(UlinkTest, UlinkStreamTest){
+	static uint8_t ring_buf[4096];
+	static uint8_t payload[8][300];
+	struct ulink_ring ring;
+	ulink_ring_init(&ring, ring_buf, sizeof(ring_buf));
+
+	// long frames with escapes scattered around
+	srand(2);
+	for(int f = 0; f < 8; f++){
+		for(size_t c = 0; c < sizeof(payload[f]); c++)
+			payload[f][c] = (rand() % 16 == 0)?(0x7d + (rand() & 1)):rand();
+		EXPECT_LT(0, ulink_encode(&ring, payload[f], sizeof(payload[f]) - f));
+	}
+
+	// an overlong frame is dropped without taking the following frames with it
+	uint8_t junk[600];
+	memset(junk, 0x55, sizeof(junk));
+	junk[sizeof(junk) - 1] = 0x7e;
+
+	uint8_t stream[sizeof(junk) + sizeof(ring_buf)];
+	memcpy(stream, junk, sizeof(junk));
+	size_t total = sizeof(junk);
+	const void *ptr;
+	size_t len;
+	while((len = ulink_ring_peek(&ring, &ptr)) > 0){
+		memcpy(stream + total, ptr, len);
+		total += len;
+		ulink_ring_consume(&ring, len);
+	}
+
+	// feed the stream in odd sized pieces
+	struct ulink_frame frame;
+	ulink_frame_init(&frame);
+	int f = 0;
+	size_t pos = 0;
+	while(pos < total){
+		size_t chunk = (total - pos < 77)?(total - pos):77;
+		size_t used = 0;
+		while(used < chunk){
+			used += ulink_parse_frame(stream + pos + used, chunk - used, &frame);
+			if(ulink_frame_valid(&frame)){
+				ASSERT_LT(f, 8);
+				EXPECT_EQ(sizeof(payload[f]) - f, ulink_frame_size(&frame));
+				EXPECT_EQ(0, memcmp(payload[f], ulink_frame_data(&frame), ulink_frame_size(&frame)));
+				f++;
+			}
+		}
+		pos += chunk;
+	}
+	EXPECT_EQ(8, f);
+}
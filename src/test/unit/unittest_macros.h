@@ -33,6 +33,7 @@
 #define MOCK_LOGGER_BUF_SIZE (1024 * 2000)
 
 extern uint16_t mock_motor_pwm[8];
+extern uint32_t mock_motor_erpm[8];
 extern uint16_t mock_servo_pwm[8];
 extern uint16_t mock_rc_pwm[RX_MAX_SUPPORTED_RC_CHANNELS];
 extern uint16_t mock_pwm_errors;
@@ -86,14 +86,99 @@ TEST(WS2812, updateDMABuffer) {
     byteIndex++;
 }
 
+static int hsvToRgbCalls = 0;
+static int gammaCalls = 0;
+static int dmaEnableCalls = 0;
+
+TEST(WS2812, updateOnlyChangedLeds) {
+    // given
+    ws2811LedStripInit();
+    ws2811LedDataTransferInProgress = 0;
+    int conversions = hsvToRgbCalls;
+    int transfers = dmaEnableCalls;
+
+    // when nothing changed
+    ws2811UpdateStrip();
+
+    // then no transfer is started
+    EXPECT_EQ(transfers, dmaEnableCalls);
+
+    // when two leds get the same new color
+    hsvColor_t green = { 120, 0, 255 };
+    setLedHsv(3, &green);
+    setLedHsv(4, &green);
+    ws2811UpdateStrip();
+
+    // then the color is converted once and only those leds are encoded
+    EXPECT_EQ(transfers + 1, dmaEnableCalls);
+    EXPECT_EQ(conversions + 1, hsvToRgbCalls);
+    // stub puts v into the green byte which is sent first
+    for (int bit = 0; bit < 8; bit++) {
+        EXPECT_EQ(BIT_COMPARE_0, ledStripDMABuffer[2 * WS2811_BITS_PER_LED + bit]);
+        EXPECT_EQ(BIT_COMPARE_1, ledStripDMABuffer[3 * WS2811_BITS_PER_LED + bit]);
+        EXPECT_EQ(BIT_COMPARE_1, ledStripDMABuffer[4 * WS2811_BITS_PER_LED + bit]);
+        EXPECT_EQ(BIT_COMPARE_0, ledStripDMABuffer[5 * WS2811_BITS_PER_LED + bit]);
+    }
+
+    // when a led is set to the color it already has
+    ws2811LedDataTransferInProgress = 0;
+    setLedHsv(3, &green);
+    ws2811UpdateStrip();
+
+    // then nothing is sent
+    EXPECT_EQ(transfers + 1, dmaEnableCalls);
+    ws2811LedDataTransferInProgress = 0;
+}
+
+TEST(WS2812, gammaIsOptional) {
+    // given
+    ws2811LedStripInit();
+    ws2811LedDataTransferInProgress = 0;
+    int conversions = hsvToRgbCalls;
+    int transfers = dmaEnableCalls;
+
+    // when a led is set with gamma left at its default
+    hsvColor_t blue = { 240, 0, 100 };
+    setLedHsv(0, &blue);
+    ws2811UpdateStrip();
+
+    // then the color is converted without gamma
+    EXPECT_EQ(conversions + 1, hsvToRgbCalls);
+    EXPECT_EQ(0, gammaCalls);
+
+    // when gamma is enabled
+    ws2811LedDataTransferInProgress = 0;
+    ws2811SetGamma(true);
+    ws2811UpdateStrip();
+
+    // then the unchanged leds are converted again with gamma and sent
+    EXPECT_EQ(transfers + 2, dmaEnableCalls);
+    EXPECT_LT(0, gammaCalls);
+    ws2811SetGamma(false);
+    ws2811LedDataTransferInProgress = 0;
+}
+
 extern "C" {
-rgbColor24bpp_t hsvToRgb24(const hsvColor_t *c) {
-    UNUSED(c);
-    return (rgbColor24bpp_t){.raw = {0,0,0}};
+rgbColor24bpp_t hsvToRgb24Gamma(const hsvColor_t *c) {
+    gammaCalls++;
+    rgbColor24bpp_t rgb;
+    rgb.rgb.r = c->h;
+    rgb.rgb.g = c->v;
+    rgb.rgb.b = c->s;
+    return rgb;
+}
+
+rgbColor24bpp_t hsvToRgb24Lut(const hsvColor_t *c) {
+    rgbColor24bpp_t rgb;
+    rgb.rgb.r = c->h;
+    rgb.rgb.g = c->v;
+    rgb.rgb.b = c->s;
+    hsvToRgbCalls++;
+    return rgb;
 }
 
 void ws2811LedStripHardwareInit(void) {}
-void ws2811LedStripDMAEnable(void) {}
+void ws2811LedStripDMAEnable(void) { dmaEnableCalls++; }
 
 void dmaSetHandler(dmaHandlerIdentifier_e, dmaCallbackHandlerFuncPtr ) {}
 